@@ -1,4 +1,6 @@
 ﻿#include "audiooutput.h"
+#include "log.h"
+#include "trace.h"
 
 /**
  * @brief 构造函数，初始化音频输出对象
@@ -10,6 +12,7 @@
 AudioOutput::AudioOutput(AVSync *avsync, const AudioParams &aduio_params, AVFrameQueue *frame_queue, AVRational time_base)
     : avsync_(avsync), src_tgt_(aduio_params), frame_queue_(frame_queue), time_base_(time_base)
 {
+    thread_options_.name = "sdl-audio";
     swr_ctx_ = nullptr;           // 初始化重采样上下文为空
     audio_buf1_ = nullptr;        // 初始化音频缓冲区为空
     audio_buf1_size = 0;          // 初始化音频缓冲区大小为0
@@ -23,11 +26,15 @@ AudioOutput::AudioOutput(AVSync *avsync, const AudioParams &aduio_params, AVFram
  */
 AudioOutput::~AudioOutput()
 {
+    // 先关闭设备，保证回调不再访问下面释放的资源
+    DeInit();
+    
     // 释放重采样上下文
     if (swr_ctx_) {
         swr_free(&swr_ctx_);
         swr_ctx_ = nullptr;
     }
+    av_channel_layout_uninit(&in_tgt_.ch_layout);
     
     // 释放音频缓冲区
     if (audio_buf1_) {
@@ -35,9 +42,58 @@ AudioOutput::~AudioOutput()
         audio_buf1_ = nullptr;
         audio_buf1_size = 0;
     }
-    
-    // 确保调用了DeInit
-    DeInit();
+}
+
+/**
+ * @brief 按帧的格式准备重采样器，格式和上一帧相同时直接返回；
+ * 变化时(码流中途切换采样率、声道布局或采样格式)释放旧的重采样器，
+ * 和SDL需要的格式不同时按新格式重建，相同时不再重采样
+ * @param frame 将要输出的音频帧
+ * @return 成功返回0，失败返回负值
+ */
+int AudioOutput::OpenResampler(const AVFrame *frame)
+{
+    if(in_tgt_.freq == frame->sample_rate && in_tgt_.fmt == frame->format
+       && av_channel_layout_compare(&in_tgt_.ch_layout, &frame->ch_layout) == 0) {
+        return 0;
+    }
+    if(in_tgt_.freq > 0) {
+        LOG_INFO("audio format changed %s %dHz %dch -> %s %dHz %dch\n",
+                 av_get_sample_fmt_name(in_tgt_.fmt), in_tgt_.freq, in_tgt_.ch_layout.nb_channels,
+                 av_get_sample_fmt_name((enum AVSampleFormat)frame->format), frame->sample_rate,
+                 frame->ch_layout.nb_channels);
+        if(stats_) {
+            stats_->audio_format_changes.Add(1);
+        }
+    }
+    // 旧重采样器内部缓存的少量样本随之丢弃
+    swr_free(&swr_ctx_);
+    in_tgt_.freq = frame->sample_rate;
+    in_tgt_.fmt = (enum AVSampleFormat)frame->format;
+    av_channel_layout_uninit(&in_tgt_.ch_layout);
+    av_channel_layout_copy(&in_tgt_.ch_layout, &frame->ch_layout);
+    if(frame->format == dst_tgt_.fmt      // 采样格式相同
+       && frame->sample_rate == dst_tgt_.freq // 采样率相同
+       && av_channel_layout_compare(&frame->ch_layout, &dst_tgt_.ch_layout) == 0) { // 通道布局相同
+        return 0;
+    }
+    // 配置并分配重采样器
+    swr_alloc_set_opts2(&swr_ctx_,
+                        &dst_tgt_.ch_layout,                // 输出通道布局
+                        dst_tgt_.fmt,                       // 输出采样格式
+                        dst_tgt_.freq,                      // 输出采样率
+                        &frame->ch_layout,                  // 输入通道布局
+                        (enum AVSampleFormat)frame->format, // 输入采样格式
+                        frame->sample_rate,                 // 输入采样率
+                        0, NULL);
+    // 初始化重采样器
+    if(!swr_ctx_ || swr_init(swr_ctx_) < 0) {
+        LOG_ERROR("swr_init failed\n");
+        swr_free(&swr_ctx_);
+        in_tgt_.freq = 0;   // 下一帧重试
+        return -1;
+    }
+    return 0;
 }
 
 /**
@@ -49,41 +105,34 @@ AudioOutput::~AudioOutput()
 void sdl_audio_callback(void *userdata, Uint8 * stream, int len)
 {
     AudioOutput *audio_output = (AudioOutput *)userdata;
-//    printf("sdl_audio_callback len: %d\n", len);
+    TRACE_SCOPE("sdl_audio_callback", "audio", 0);
+    if(!audio_output->callback_tid_) {
+        audio_output->callback_tid_ = CurrentThreadId();
+        ApplyThreadOptions(audio_output->thread_options_);
+    }
+    int64_t callback_start_us = audio_output->stats_ ? PipelineStats::NowMicroseconds() : 0;
+    StageHeartbeat *heartbeat = audio_output->stats_ ? &audio_output->stats_->heartbeats[STAGE_AUDIO_OUTPUT] : NULL;
+    if(heartbeat) {
+        heartbeat->Beat();
+    }
+//    LOG_TRACE("sdl_audio_callback len: %d\n", len);
     while(len > 0) {
         // 如果当前缓冲区已用完，需要获取新的音频帧
         if(audio_output->audio_buf_index == audio_output->audio_buf_size) {
             // 1. 读取pcm的数据
             audio_output->audio_buf_index = 0;
-            AVFrame *frame = audio_output->frame_queue_->Pop(2);  // 从队列获取音频帧，最多等待2ms
-            
-            // 如果获取到了帧，设置播放时间戳
+            // 获取下一帧，同时更新播放时间戳
+            AVFrame *frame = audio_output->ReadFrame();
             if(frame) {
-                audio_output->pts = frame->pts * av_q2d(audio_output->time_base_);
+                if(heartbeat) {
+                    heartbeat->Progress((int64_t)(audio_output->pts * 1000000));
+                }
                 
                 // 2. 执行音频重采样
-                // 2.1 初始化重采样器(如果需要)
-                if(( (frame->format != audio_output->dst_tgt_.fmt)      // 采样格式不同
-                     || (frame->sample_rate != audio_output->dst_tgt_.freq) // 采样率不同
-                     || av_channel_layout_compare(&frame->ch_layout, &audio_output->dst_tgt_.ch_layout) != 0) // 通道布局不同
-                   && (!audio_output->swr_ctx_)) {
-                    // 配置并分配重采样器
-                    swr_alloc_set_opts2(&audio_output->swr_ctx_,
-                                        &audio_output->dst_tgt_.ch_layout,  // 输出通道布局
-                                        audio_output->dst_tgt_.fmt,         // 输出采样格式
-                                        audio_output->dst_tgt_.freq,        // 输出采样率
-                                        &frame->ch_layout,                  // 输入通道布局
-                                        (enum AVSampleFormat)frame->format, // 输入采样格式
-                                        frame->sample_rate,                 // 输入采样率
-                                        0, NULL);
-                    // 初始化重采样器
-                    if(!audio_output->swr_ctx_ || swr_init(audio_output->swr_ctx_) < 0) {
-                        printf("swr_init failed");
-                        if(audio_output->swr_ctx_) {
-                            swr_free(&audio_output->swr_ctx_);
-                        }
-                        return;
-                    }
+                // 2.1 初始化重采样器(如果需要)，帧的格式变化时重建
+                if(audio_output->OpenResampler(frame) < 0) {
+                    av_frame_free(&frame);
+                    return;
                 }
                 
                 // 如果需要重采样，执行重采样操作
@@ -98,7 +147,7 @@ void sdl_audio_callback(void *userdata, Uint8 * stream, int len)
                                     out_samples,
                                     audio_output->dst_tgt_.fmt, 0);
                     if(out_bytes < 0) {
-                        printf("av_samples_get_buffer_size failed");
+                        LOG_ERROR("av_samples_get_buffer_size failed");
                         return;
                     }
                     
@@ -106,9 +155,13 @@ void sdl_audio_callback(void *userdata, Uint8 * stream, int len)
                     av_fast_malloc(&audio_output->audio_buf1_, &audio_output->audio_buf1_size, out_bytes);
                     
                     // 执行重采样
-                    int len2 = swr_convert(audio_output->swr_ctx_, out, out_samples, in, frame->nb_samples);
+                    int len2 = 0;
+                    {
+                        TRACE_SCOPE("swr_convert", "audio", frame->pts);
+                        len2 = swr_convert(audio_output->swr_ctx_, out, out_samples, in, frame->nb_samples);
+                    }
                     if(len2 < 0) {
-                        printf("swr_convert failed\n");
+                        LOG_ERROR("swr_convert failed\n");
                         return;
                     }
                     
@@ -136,6 +189,15 @@ void sdl_audio_callback(void *userdata, Uint8 * stream, int len)
                 // 没有获取到帧，设置静音数据
                 audio_output->audio_buf_ = NULL;
                 audio_output->audio_buf_size = 512;
+                if(audio_output->stats_) {
+                    audio_output->stats_->audio_underruns.Add(1);
+                    audio_output->stats_->recorder.Record(FLIGHT_AUDIO_UNDERRUN, FLIGHT_STREAM_AUDIO,
+                                                          (int64_t)(audio_output->pts / av_q2d(audio_output->time_base_)));
+                    // 开播前和读到文件结尾后队列本来就是空的，只有播放中的欠载才导出
+                    if(heartbeat->ProgressCount() > 0 && !audio_output->stats_->heartbeats[STAGE_DEMUX].Eof()) {
+                        audio_output->stats_->recorder.Trigger("audio_underrun");
+                    }
+                }
             }
         } // end of if(audio_output->audio_buf_index < audio_output->audio_buf_size)
         
@@ -159,13 +221,60 @@ void sdl_audio_callback(void *userdata, Uint8 * stream, int len)
         len -= len3;
         audio_output->audio_buf_index += len3;
         stream += len3;
-//        printf("len:%d, audio_buf_index:%d, %d\n", len, audio_output->audio_buf_index,
+//        LOG_TRACE("len:%d, audio_buf_index:%d, %d\n", len, audio_output->audio_buf_index,
 //               audio_output->audio_buf_size);
     }
     
     // 更新音频时钟作为主时钟
-    printf("audio pts: %0.3lf\n", audio_output->pts);
+    LOG_TRACE("audio pts: %0.3lf\n", audio_output->pts);
+    if(audio_output->stats_) {
+        audio_output->stats_->recorder.Record(FLIGHT_CLOCK_UPDATE, FLIGHT_STREAM_AUDIO,
+                                              (int64_t)(audio_output->pts / av_q2d(audio_output->time_base_)),
+                                              audio_output->pts, audio_output->avsync_->GetClock());
+    }
     audio_output->avsync_->SetClock(audio_output->pts);
+    if(audio_output->stats_) {
+        audio_output->stats_->audio_callback.Record(PipelineStats::NowMicroseconds() - callback_start_us);
+    }
+}
+
+/**
+ * @brief 取下一帧要播放的数据，在音频回调中调用；变速时经过atempo，拉伸后的帧时间戳不是媒体时间，
+ *        播放时间戳取最后送入atempo的帧
+ * @return 帧，调用方负责释放，队列为空时返回NULL
+ */
+AVFrame *AudioOutput::ReadFrame()
+{
+    if(!tempo_.Active()) {
+        // 从变速切回原速时丢掉滤镜里缓存的几十毫秒
+        tempo_.Reset();
+    }
+    AVFrame *out = tempo_.Active() ? av_frame_alloc() : NULL;
+    while(!out || tempo_.Receive(out) != 0) {
+        AVFrame *frame = NULL;
+        {
+            TraceScope trace_pop("frame_queue_pop", "audio");
+            frame = frame_queue_->Pop(2);  // 从队列获取音频帧，最多等待2ms
+            if(frame) {
+                trace_pop.SetPts(frame->pts);
+            }
+        }
+        if(!frame) {
+            av_frame_free(&out);
+            return NULL;
+        }
+        pts = frame->pts * av_q2d(time_base_);
+        if(!out) {
+            return frame;
+        }
+        int ret = tempo_.Send(frame);
+        av_frame_free(&frame);
+        if(ret < 0) {
+            av_frame_free(&out);
+            return NULL;
+        }
+    }
+    return out;
 }
 
 /**
@@ -174,9 +283,9 @@ void sdl_audio_callback(void *userdata, Uint8 * stream, int len)
  */
 int AudioOutput::Init()
 {
-    // 初始化SDL音频子系统
-    if(SDL_Init(SDL_INIT_AUDIO) != 0) {
-        printf("SDL_Init failed\n");
+    // 初始化SDL音频子系统，SDL内部有引用计数，多个实例各自初始化、各自退出
+    if(SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+        LOG_ERROR("SDL_InitSubSystem failed:%s\n", SDL_GetError());
         return -1;
     }
     
@@ -190,10 +299,11 @@ int AudioOutput::Init()
     wanted_spec.userdata = this;                 // 回调函数的用户数据
     wanted_spec.samples = 1024;                 // 每次回调的采样数 2*2*1024 = 4096字节
     
-    // 打开音频设备
-    int ret = SDL_OpenAudio(&wanted_spec, NULL);
-    if(ret != 0) {
-        printf("SDL_OpenAudio failed\n");
+    // 打开音频设备，SDL_OpenAudio只能打开一个设备，多实例时要用SDL_OpenAudioDevice
+    audio_dev_ = SDL_OpenAudioDevice(NULL, 0, &wanted_spec, NULL, 0);
+    if(audio_dev_ == 0) {
+        LOG_ERROR("SDL_OpenAudioDevice failed:%s\n", SDL_GetError());
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
         return -1;
     }
     
@@ -202,9 +312,8 @@ int AudioOutput::Init()
     dst_tgt_.fmt = AV_SAMPLE_FMT_S16;      // 设置为SDL要求的16位有符号格式
     dst_tgt_.freq = wanted_spec.freq;      // 保持与SDL一致的采样率
     
-    // 开始播放音频
-    SDL_PauseAudio(0);
-    printf("AudioOutput::Init() finish\n");
+    // 设备打开后处于暂停状态，由SetPause(false)开始播放
+    LOG_INFO("AudioOutput::Init() finish\n");
     return 0;
 }
 
@@ -214,10 +323,82 @@ int AudioOutput::Init()
  */
 int AudioOutput::DeInit()
 {
+    if(audio_dev_ == 0) {
+        return 0;
+    }
     // 暂停音频播放
-    SDL_PauseAudio(1);
-    // 关闭音频设备
-    SDL_CloseAudio();
-    printf("AudioOutput::DeInit() finish\n");
+    SDL_PauseAudioDevice(audio_dev_, 1);
+    // 关闭音频设备，返回后回调不会再被调用
+    SDL_CloseAudioDevice(audio_dev_);
+    audio_dev_ = 0;
+    if(callback_tid_) {
+        UnregisterThread(callback_tid_);
+        callback_tid_ = 0;
+    }
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    LOG_INFO("AudioOutput::DeInit() finish\n");
     return 0;
 }
+
+/**
+ * @brief 暂停或恢复音频设备，暂停时不再调用回调
+ * @param pause true暂停，false播放
+ */
+void AudioOutput::SetPause(bool pause)
+{
+    if(audio_dev_ != 0) {
+        SDL_PauseAudioDevice(audio_dev_, pause ? 1 : 0);
+    }
+}
+
+/**
+ * @brief 丢弃帧队列和已重采样但还没播放的数据，用于seek
+ * @param pts 新的播放位置，单位秒
+ *
+ * 持有设备锁，保证和回调互斥
+ */
+void AudioOutput::Flush(double pts)
+{
+    if(audio_dev_ != 0) {
+        SDL_LockAudioDevice(audio_dev_);
+    }
+    frame_queue_->Flush();
+    audio_buf_ = NULL;
+    audio_buf_size = 0;
+    audio_buf_index = 0;
+    tempo_.Reset();
+    this->pts = pts;
+    if(audio_dev_ != 0) {
+        SDL_UnlockAudioDevice(audio_dev_);
+    }
+}
+
+/**
+ * @brief 设置统计对象，在Init之前调用
+ * @param stats 统计对象指针，可以为NULL
+ */
+void AudioOutput::SetStats(PipelineStats *stats)
+{
+    stats_ = stats;
+}
+
+/**
+ * @brief 设置播放速率，变速不变调，可以在任意线程调用，下一帧生效
+ * @param rate 1.0为原速，范围AUDIO_TEMPO_MIN_RATE到AUDIO_TEMPO_MAX_RATE
+ */
+void AudioOutput::SetRate(double rate)
+{
+    tempo_.SetRate(rate);
+}
+
+/**
+ * @brief 设置音频线程的名字、CPU亲和性和调度类别，在Init之前调用
+ * @param options 线程属性，名字为空时使用sdl-audio
+ */
+void AudioOutput::SetThreadOptions(const ThreadOptions &options)
+{
+    thread_options_ = options;
+    if(thread_options_.name.empty()) {
+        thread_options_.name = "sdl-audio";
+    }
+}
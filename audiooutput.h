@@ -2,6 +2,7 @@
 #define AUDIOOUTPUT_H
 #include "avframequeue.h"
 #include "avsync.h"
+#include "audiotempo.h"
 #ifdef __cplusplus  ///
 extern "C"
 {
@@ -24,11 +25,19 @@ public:
     ~AudioOutput();
     int Init();
     int DeInit();
+    void SetPause(bool pause);
+    void Flush(double pts);
+    void SetStats(PipelineStats *stats);
+    void SetThreadOptions(const ThreadOptions &options);
+    void SetRate(double rate);
+    AVFrame *ReadFrame();
+    int OpenResampler(const AVFrame *frame);
 
 public:
     AVFrameQueue *frame_queue_ = NULL;
     AudioParams src_tgt_; // 解码后的源pcm格式
     AudioParams dst_tgt_; // SDL需要的格式
+    AudioParams in_tgt_ = {};   // 上一帧的格式，码流中途变化时重建重采样器，freq为0表示还没有帧
 
     struct SwrContext *swr_ctx_ = NULL;
 
@@ -41,6 +50,11 @@ public:
     AVRational time_base_ ;
     AVSync *avsync_ = NULL;
     double pts = 0;
+    PipelineStats *stats_ = NULL;
+    SDL_AudioDeviceID audio_dev_ = 0;   // 每个实例单独打开设备，支持多个播放器同时播放
+    ThreadOptions thread_options_;      // 第一次回调时设置到SDL的音频线程
+    int64_t callback_tid_ = 0;          // 音频线程号，0表示还没回调过
+    AudioTempo tempo_;                  // 变速时在重采样之前拉伸，原速时不经过
 };
 
 #endif // AUDIOOUTPUT_H
@@ -0,0 +1,134 @@
+﻿#include "audiotempo.h"
+#include "log.h"
+#include "trace.h"
+#include <stdio.h>
+extern "C" {
+#include "libavfilter/buffersrc.h"
+#include "libavfilter/buffersink.h"
+}
+
+AudioTempo::AudioTempo()
+{
+    memset(&ch_layout_, 0, sizeof(ch_layout_));
+}
+
+AudioTempo::~AudioTempo()
+{
+    Reset();
+}
+
+/**
+ * @brief 设置播放速率，超出范围时截断
+ * @param rate 1.0为原速
+ */
+void AudioTempo::SetRate(double rate)
+{
+    if(rate < AUDIO_TEMPO_MIN_RATE) {
+        rate = AUDIO_TEMPO_MIN_RATE;
+    }
+    if(rate > AUDIO_TEMPO_MAX_RATE) {
+        rate = AUDIO_TEMPO_MAX_RATE;
+    }
+    rate_ = rate;
+}
+
+double AudioTempo::Rate()
+{
+    return rate_.load();
+}
+
+/**
+ * @brief 是否需要拉伸，只看设置的速率；原速时直接使用解码出的帧，调用方据此Reset释放变速时留下的滤镜图
+ */
+bool AudioTempo::Active()
+{
+    return rate_.load() != 1.0;
+}
+
+/**
+ * @brief 送入一帧，速率或格式变化时先重建滤镜图(丢弃旧图中缓存的几十毫秒数据)
+ * @param frame 解码出的音频帧，不转移所有权
+ * @return 成功返回0，失败返回负值
+ */
+int AudioTempo::Send(const AVFrame *frame)
+{
+    double rate = rate_.load();
+    if(!graph_ || rate != graph_rate_ || frame->format != format_ || frame->sample_rate != sample_rate_
+            || av_channel_layout_compare(&frame->ch_layout, &ch_layout_) != 0) {
+        if(rebuild(frame, rate) < 0) {
+            return -1;
+        }
+    }
+    TRACE_SCOPE("atempo", "audio", frame->pts);
+    int ret = av_buffersrc_add_frame_flags(src_, (AVFrame *)frame, AV_BUFFERSRC_FLAG_KEEP_REF);
+    if(ret < 0) {
+        LOG_ERROR("%s(%d) av_buffersrc_add_frame_flags failed:%d\n", __FUNCTION__, __LINE__, ret);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 取出一帧拉伸后的数据
+ * @param frame 输出帧，格式、采样率和通道布局与输入相同，调用方负责unref
+ * @return 成功返回0，需要更多输入返回AVERROR(EAGAIN)，其他负值为错误
+ */
+int AudioTempo::Receive(AVFrame *frame)
+{
+    if(!graph_) {
+        return AVERROR(EAGAIN);
+    }
+    return av_buffersink_get_frame(sink_, frame);
+}
+
+/**
+ * @brief 释放滤镜图和其中缓存的数据，用于seek，下一次Send时重建
+ */
+void AudioTempo::Reset()
+{
+    if(graph_) {
+        avfilter_graph_free(&graph_);
+    }
+    src_ = NULL;
+    sink_ = NULL;
+    graph_rate_ = 0;
+    format_ = -1;
+    sample_rate_ = 0;
+    av_channel_layout_uninit(&ch_layout_);
+}
+
+/**
+ * @brief 按输入帧的格式创建 abuffer -> atempo -> abuffersink
+ * @return 成功返回0，失败返回负值
+ */
+int AudioTempo::rebuild(const AVFrame *frame, double rate)
+{
+    Reset();
+    char layout[64] = {0};
+    av_channel_layout_describe(&frame->ch_layout, layout, sizeof(layout));
+    char args[256];
+    snprintf(args, sizeof(args), "time_base=1/%d:sample_rate=%d:sample_fmt=%s:channel_layout=%s",
+             frame->sample_rate, frame->sample_rate, av_get_sample_fmt_name((enum AVSampleFormat)frame->format), layout);
+    char tempo[32];
+    snprintf(tempo, sizeof(tempo), "tempo=%f", rate);
+
+    graph_ = avfilter_graph_alloc();
+    AVFilterContext *atempo = NULL;
+    if(!graph_
+            || avfilter_graph_create_filter(&src_, avfilter_get_by_name("abuffer"), "in", args, NULL, graph_) < 0
+            || avfilter_graph_create_filter(&atempo, avfilter_get_by_name("atempo"), "atempo", tempo, NULL, graph_) < 0
+            || avfilter_graph_create_filter(&sink_, avfilter_get_by_name("abuffersink"), "out", NULL, NULL, graph_) < 0
+            || avfilter_link(src_, 0, atempo, 0) < 0
+            || avfilter_link(atempo, 0, sink_, 0) < 0
+            || avfilter_graph_config(graph_, NULL) < 0) {
+        LOG_ERROR("%s(%d) create atempo graph failed, %s, %s\n", __FUNCTION__, __LINE__, args, tempo);
+        Reset();
+        return -1;
+    }
+    graph_rate_ = rate;
+    format_ = frame->format;
+    sample_rate_ = frame->sample_rate;
+    av_channel_layout_copy(&ch_layout_, &frame->ch_layout);
+    LOG_INFO("atempo graph created, %s, %s\n", args, tempo);
+    return 0;
+}
@@ -0,0 +1,46 @@
+﻿#ifndef AUDIOTEMPO_H
+#define AUDIOTEMPO_H
+#include <atomic>
+#ifdef __cplusplus
+extern "C" {
+#include "libavfilter/avfilter.h"
+#include "libavutil/frame.h"
+}
+#endif
+
+// 支持的播放速率范围，atempo单级即可覆盖
+#define AUDIO_TEMPO_MIN_RATE 0.5
+#define AUDIO_TEMPO_MAX_RATE 4.0
+
+/**
+ * 变速不变调：用libavfilter的atempo(WSOLA)拉伸音频，
+ * 用法和解码器一样，Send一帧后反复Receive直到返回AVERROR(EAGAIN)
+ *
+ * Send/Receive/Reset只能在一个线程(或互斥的多个线程，如音频回调和持有设备锁的Flush)调用，
+ * SetRate可以在任意线程调用，下一次Send时重建滤镜图生效
+ */
+class AudioTempo
+{
+public:
+    AudioTempo();
+    ~AudioTempo();
+    void SetRate(double rate);
+    double Rate();
+    bool Active();
+    int Send(const AVFrame *frame);
+    int Receive(AVFrame *frame);
+    void Reset();
+private:
+    int rebuild(const AVFrame *frame, double rate);
+
+    std::atomic<double> rate_{1.0};
+    AVFilterGraph *graph_ = NULL;
+    AVFilterContext *src_ = NULL;
+    AVFilterContext *sink_ = NULL;
+    double graph_rate_ = 0;          // 当前滤镜图的速率，0表示还没有创建
+    int format_ = -1;                // 当前滤镜图的输入格式，变化时重建
+    int sample_rate_ = 0;
+    AVChannelLayout ch_layout_;
+};
+
+#endif // AUDIOTEMPO_H
@@ -1,4 +1,5 @@
 ﻿#include "avframequeue.h"
+#include "log.h"
 
 /**
  * @brief 构造函数，初始化AVFrameQueue对象
@@ -23,10 +24,20 @@ AVFrameQueue::~AVFrameQueue()
  */
 void AVFrameQueue::Abort()
 {
-    // 先释放队列中的所有帧资源
-    release();
-    // 终止内部队列，唤醒所有等待的线程
+    // 先终止内部队列，唤醒所有等待的线程，之后的Push会失败
     queue_.Abort();
+    // 再一次性释放队列里剩余的资源
+    release();
+}
+
+/**
+ * @brief 清空队列中的所有帧，队列仍然可用
+ *
+ * 用于seek，调用时上游不能再往队列里放旧位置的帧
+ */
+void AVFrameQueue::Flush()
+{
+    release();
 }
 
 /**
@@ -53,7 +64,20 @@ int AVFrameQueue::Push(AVFrame *val)
     // 移动引用，将val的内容移动到tmp_frame，val的引用计数会被重置为0
     av_frame_move_ref(tmp_frame, val);
     // 将新帧放入队列
-    return queue_.Push(tmp_frame);
+    FrameItem item = {tmp_frame, residency_ ? PipelineStats::NowMicroseconds() : 0};
+    int ret = queue_.Push(item);
+    if(ret < 0) {
+        av_frame_free(&tmp_frame);
+        return ret;
+    }
+    if(depth_) {
+        depth_->Set(queue_.Size());
+    }
+    Task *consumer = consumer_.load();
+    if(consumer) {
+        consumer->Wake();
+    }
+    return 0;
 }
 
 /**
@@ -65,18 +89,28 @@ int AVFrameQueue::Push(AVFrame *val)
  */
 AVFrame *AVFrameQueue::Pop(const int timeout)
 {
-    AVFrame *tmp_frame = NULL;
+    FrameItem item = {NULL, 0};
     // 从队列中获取一个帧
-    int ret = queue_.Pop(tmp_frame, timeout);
+    int ret = queue_.Pop(item, timeout);
     if(ret < 0) {
         if(ret == -1) {
-            printf("queue_ abort\n ");
+            LOG_DEBUG("queue_ abort\n ");
         }
         // 队列已终止或出错，返回NULL
         return NULL;
     }
+    if(residency_) {
+        residency_->Record(PipelineStats::NowMicroseconds() - item.push_us);
+    }
+    if(depth_) {
+        depth_->Set(queue_.Size());
+    }
+    Task *producer = producer_.load();
+    if(producer) {
+        producer->Wake();
+    }
     // 返回队列中的帧
-    return tmp_frame;
+    return item.frame;
 }
 
 /**
@@ -87,18 +121,40 @@ AVFrame *AVFrameQueue::Pop(const int timeout)
  */
 AVFrame *AVFrameQueue::Front()
 {
-    AVFrame *tmp_frame = NULL;
+    FrameItem item = {NULL, 0};
     // 获取队列首部的帧但不移除
-    int ret = queue_.Front(tmp_frame);
+    int ret = queue_.Front(item);
     if(ret < 0) {
         if(ret == -1) {
-            printf("queue_ abort\n ");
+            LOG_DEBUG("queue_ abort\n ");
         }
         // 队列已终止或出错，返回NULL
         return NULL;
     }
     // 返回队列中的帧
-    return tmp_frame;
+    return item.frame;
+}
+
+/**
+ * @brief 设置统计项，在开始入队之前调用
+ * @param residency 帧在队列中停留时间的直方图，可以为NULL
+ * @param depth 队列深度，可以为NULL
+ */
+void AVFrameQueue::SetStats(LatencyHistogram *residency, Gauge *depth)
+{
+    residency_ = residency;
+    depth_ = depth;
+}
+
+/**
+ * @brief 设置队列两端的任务，在Submit之前调用，停止任务之后设为NULL
+ * @param producer 往队列里放的任务，Pop之后唤醒，可以为NULL
+ * @param consumer 从队列里取的任务，Push之后唤醒，可以为NULL
+ */
+void AVFrameQueue::SetTasks(Task *producer, Task *consumer)
+{
+    producer_ = producer;
+    consumer_ = consumer;
 }
 
 /**
@@ -107,17 +163,14 @@ AVFrame *AVFrameQueue::Front()
  */
 void AVFrameQueue::release()
 {
-    while(true) {
-        AVFrame *tmp_frame = NULL;
-        // 尝试从队列中获取一个帧，等待1ms
-        int ret = queue_.Pop(tmp_frame, 1);
-        if(ret < 0) {
-            // 队列为空或已终止，退出循环
-            break;
-        } else {
-            // 释放帧资源
-            av_frame_free(&tmp_frame);
-            continue;
-        }
+    // 在锁内整体取走，锁外逐个释放，不再逐个Pop等待超时
+    std::queue<FrameItem> items;
+    queue_.Drain(items);
+    while(!items.empty()) {
+        av_frame_free(&items.front().frame);
+        items.pop();
+    }
+    if(depth_) {
+        depth_->Set(0);
     }
 }
@@ -1,6 +1,8 @@
 ﻿#ifndef AVFRAMEQUEUE_H
 #define AVFRAMEQUEUE_H
 #include "queue.h"
+#include "stats.h"
+#include "taskexecutor.h"
 #ifdef __cplusplus
 extern "C" { // 大写的C
 #include "libavcodec/avcodec.h"
@@ -14,13 +16,24 @@ public:
     AVFrameQueue();
     ~AVFrameQueue();
     void Abort();
+    void Flush();
     int Size();
     int Push(AVFrame *val);
     AVFrame *Pop(const int timeout);
     AVFrame *Front();
+    void SetStats(LatencyHistogram *residency, Gauge *depth);
+    void SetTasks(Task *producer, Task *consumer);
 private:
+    struct FrameItem {
+        AVFrame *frame;
+        int64_t push_us;   // 入队时间，用于统计排队耗时
+    };
     void release();
-    Queue<AVFrame *> queue_;
+    Queue<FrameItem> queue_;
+    LatencyHistogram *residency_ = NULL;
+    Gauge *depth_ = NULL;
+    std::atomic<Task *> producer_{nullptr};   // Pop出空位后唤醒
+    std::atomic<Task *> consumer_{nullptr};   // Push进数据后唤醒
 };
 
 #endif // AVFRAMEQUEUE_H
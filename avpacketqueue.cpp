@@ -1,4 +1,5 @@
 ﻿#include "avpacketqueue.h"
+#include "log.h"
 
 /**
  * @brief 构造函数，初始化AVPacketQueue对象
@@ -23,10 +24,20 @@ AVPacketQueue::~AVPacketQueue()
  */
 void AVPacketQueue::Abort()
 {
-    // 先释放队列里的资源
-    release();
-    // 终止内部队列，唤醒所有等待的线程
+    // 先终止内部队列，唤醒所有等待的线程，之后的Push会失败
     queue_.Abort();
+    // 再一次性释放队列里剩余的资源
+    release();
+}
+
+/**
+ * @brief 清空队列中的所有数据包，队列仍然可用
+ *
+ * 用于seek，调用时上游不能再往队列里放旧位置的数据包
+ */
+void AVPacketQueue::Flush()
+{
+    release();
 }
 
 /**
@@ -53,7 +64,20 @@ int AVPacketQueue::Push(AVPacket *val)
     // 移动引用，将val的内容移动到tmp_pkt，val的引用计数会被重置为0
     av_packet_move_ref(tmp_pkt, val);
     // 将新数据包放入队列
-    return queue_.Push(tmp_pkt);
+    PacketItem item = {tmp_pkt, residency_ ? PipelineStats::NowMicroseconds() : 0};
+    int ret = queue_.Push(item);
+    if(ret < 0) {
+        av_packet_free(&tmp_pkt);
+        return ret;
+    }
+    if(depth_) {
+        depth_->Set(queue_.Size());
+    }
+    Task *consumer = consumer_.load();
+    if(consumer) {
+        consumer->Wake();
+    }
+    return 0;
 }
 
 /**
@@ -65,18 +89,65 @@ int AVPacketQueue::Push(AVPacket *val)
  */
 AVPacket *AVPacketQueue::Pop(const int timeout)
 {
-    AVPacket *tmp_pkt = NULL;
+    PacketItem item = {NULL, 0};
     // 从队列中获取一个数据包
-    int ret = queue_.Pop(tmp_pkt, timeout);
+    int ret = queue_.Pop(item, timeout);
     if(ret < 0) {
         if(ret == -1) {
-            printf("queue_ abort\n ");
+            LOG_DEBUG("queue_ abort\n ");
         }
         // 队列已终止或出错，返回NULL
         return NULL;
     }
+    if(residency_) {
+        residency_->Record(PipelineStats::NowMicroseconds() - item.push_us);
+    }
+    if(depth_) {
+        depth_->Set(queue_.Size());
+    }
+    Task *producer = producer_.load();
+    if(producer) {
+        producer->Wake();
+    }
     // 返回队列中的数据包
-    return tmp_pkt;
+    return item.pkt;
+}
+
+/**
+ * @brief 查看队列中的第一个AVPacket，但不移除它
+ * @return 成功返回AVPacket指针，失败返回NULL
+ *
+ * 注意：返回的是队列中的数据包，不要释放这个指针，只有唯一的消费者可以调用
+ */
+AVPacket *AVPacketQueue::Front()
+{
+    PacketItem item = {NULL, 0};
+    if(queue_.Front(item) < 0) {
+        return NULL;
+    }
+    return item.pkt;
+}
+
+/**
+ * @brief 设置统计项，在开始入队之前调用
+ * @param residency 数据包在队列中停留时间的直方图，可以为NULL
+ * @param depth 队列深度，可以为NULL
+ */
+void AVPacketQueue::SetStats(LatencyHistogram *residency, Gauge *depth)
+{
+    residency_ = residency;
+    depth_ = depth;
+}
+
+/**
+ * @brief 设置队列两端的任务，在Submit之前调用，停止任务之后设为NULL
+ * @param producer 往队列里放的任务，Pop之后唤醒，可以为NULL
+ * @param consumer 从队列里取的任务，Push之后唤醒，可以为NULL
+ */
+void AVPacketQueue::SetTasks(Task *producer, Task *consumer)
+{
+    producer_ = producer;
+    consumer_ = consumer;
 }
 
 /**
@@ -85,17 +156,14 @@ AVPacket *AVPacketQueue::Pop(const int timeout)
  */
 void AVPacketQueue::release()
 {
-    while(true) {
-        AVPacket *tmp_pkt = NULL;
-        // 尝试从队列中获取一个数据包，等待1ms
-        int ret = queue_.Pop(tmp_pkt, 1);
-        if(ret < 0) {
-            // 队列为空或已终止，退出循环
-            break;
-        } else {
-            // 释放数据包资源
-            av_packet_free(&tmp_pkt);
-            continue;
-        }
+    // 在锁内整体取走，锁外逐个释放，不再逐个Pop等待超时
+    std::queue<PacketItem> items;
+    queue_.Drain(items);
+    while(!items.empty()) {
+        av_packet_free(&items.front().pkt);
+        items.pop();
+    }
+    if(depth_) {
+        depth_->Set(0);
     }
 }
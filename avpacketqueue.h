@@ -1,6 +1,8 @@
 ﻿#ifndef AVPACKETQUEUE_H
 #define AVPACKETQUEUE_H
 #include "queue.h"
+#include "stats.h"
+#include "taskexecutor.h"
 #ifdef __cplusplus
 extern "C" { // 大写的C
 #include "libavcodec/avcodec.h"
@@ -13,12 +15,24 @@ public:
     AVPacketQueue();
     ~AVPacketQueue();
     void Abort();
+    void Flush();
     int Size();
     int Push(AVPacket *val);
     AVPacket *Pop(const int timeout);
+    AVPacket *Front();
+    void SetStats(LatencyHistogram *residency, Gauge *depth);
+    void SetTasks(Task *producer, Task *consumer);
 private:
+    struct PacketItem {
+        AVPacket *pkt;
+        int64_t push_us;   // 入队时间，用于统计排队耗时
+    };
     void release();
-    Queue<AVPacket *> queue_;
+    Queue<PacketItem> queue_;
+    LatencyHistogram *residency_ = NULL;
+    Gauge *depth_ = NULL;
+    std::atomic<Task *> producer_{nullptr};   // Pop出空位后唤醒
+    std::atomic<Task *> consumer_{nullptr};   // Push进数据后唤醒
 };
 
 #endif // AVPACKETQUEUE_H
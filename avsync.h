@@ -1,5 +1,6 @@
 ﻿#ifndef AVSYNC_H
 #define AVSYNC_H
+#include <atomic>
 #include <chrono>
 #include <ctime>
 #include <math.h>
@@ -30,8 +31,12 @@ public:
      */
     void SetClock(double pts)
     {
+        if(paused_ || held_) {
+            paused_clock_ = pts;
+            return;
+        }
         double time = GetMicroseconds() / 1000000.0; //秒
-        pts_drift_ = pts - time;
+        pts_drift_ = pts - time * rate_;
     }
     /**
      * @brief 获取当前时钟值
@@ -41,8 +46,73 @@ public:
      */
     double GetClock()
     {
+        if(paused_ || held_) {
+            return paused_clock_;
+        }
         double time = GetMicroseconds() / 1000000.0;
-        return pts_drift_ + time;
+        return pts_drift_ + time * rate_;
+    }
+
+    /**
+     * @brief 设置播放速率，时钟从当前值开始按新速率走
+     * @param rate 1.0为原速
+     */
+    void SetRate(double rate)
+    {
+        double clock = GetClock();
+        rate_ = rate;
+        SetClock(clock);
+    }
+    double Rate()
+    {
+        return rate_;
+    }
+
+    /**
+     * @brief 暂停时钟，之后GetClock一直返回暂停时的值
+     */
+    void Pause()
+    {
+        if(!paused_) {
+            freeze();
+            paused_ = true;
+        }
+    }
+    /**
+     * @brief 恢复时钟，从暂停时的值继续走
+     */
+    void Resume()
+    {
+        if(paused_) {
+            paused_ = false;
+            thaw();
+        }
+    }
+    bool IsPaused()
+    {
+        return paused_;
+    }
+
+    /**
+     * @brief 缓冲时冻结时钟，和Pause互相独立，两者都解除后时钟才从冻结的值继续走
+     * @param hold true冻结，false解除
+     */
+    void Hold(bool hold)
+    {
+        if(hold == held_) {
+            return;
+        }
+        if(hold) {
+            freeze();
+            held_ = true;
+        } else {
+            held_ = false;
+            thaw();
+        }
+    }
+    bool IsHeld()
+    {
+        return held_;
     }
 
     // 微妙的单位
@@ -53,7 +123,27 @@ public:
         time_t us = duration_cast<microseconds>(duration).count();
         return us;
     }
-    double pts_drift_ = 0;
+    // 音频回调写、刷新循环和控制线程读
+    std::atomic<double> pts_drift_{0};
+    std::atomic<bool> paused_{false};
+    std::atomic<double> paused_clock_{0};
+    std::atomic<double> rate_{1.0};   // 媒体时间每秒前进的秒数
+    std::atomic<bool> held_{false};   // 缓冲中，由BufferingController设置
+private:
+    // 还在走时记下当前值
+    void freeze()
+    {
+        if(!paused_ && !held_) {
+            paused_clock_ = GetClock();
+        }
+    }
+    // 暂停和缓冲都解除后从记下的值继续走
+    void thaw()
+    {
+        if(!paused_ && !held_) {
+            SetClock(paused_clock_);
+        }
+    }
 };
 
 #endif // AVSYNC_H
@@ -0,0 +1,655 @@
+﻿#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+#include "playerhost.h"
+#include "log.h"
+#undef main               // 解决SDL重定义main的问题
+
+// 统计窗口内迟到帧占比低于该值视为能持续播放
+#define SUSTAIN_LATE_RATIO 0.01
+// 开始统计前的预热时间，跳过启动阶段的迟到帧
+#define WARMUP_SECONDS 2
+// churn模式下每隔该时间替换一路播放器，单位毫秒
+#define CHURN_INTERVAL_MS 200
+// exact模式下等目标帧解出的最长时间，单位毫秒
+#define EXACT_TIMEOUT_MS 5000
+
+/**
+ * @brief 进程累计占用的CPU时间，单位秒
+ */
+static double process_cpu_seconds()
+{
+#ifdef _WIN32
+    FILETIME create_time, exit_time, kernel_time, user_time;
+    if(!GetProcessTimes(GetCurrentProcess(), &create_time, &exit_time, &kernel_time, &user_time)) {
+        return 0;
+    }
+    ULARGE_INTEGER kernel, user;
+    kernel.LowPart = kernel_time.dwLowDateTime;
+    kernel.HighPart = kernel_time.dwHighDateTime;
+    user.LowPart = user_time.dwLowDateTime;
+    user.HighPart = user_time.dwHighDateTime;
+    return (kernel.QuadPart + user.QuadPart) / 10000000.0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+           + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+#endif
+}
+
+static double wall_seconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count() / 1000000.0;
+}
+
+struct BenchResult
+{
+    int streams = 0;
+    double cores = 0;          // 平均占用的CPU核数
+    double fps = 0;            // 每路每秒显示的帧数
+    double late_ratio = 0;     // 迟到帧占比
+    int64_t stalls = 0;
+    bool sustained = false;
+};
+
+/**
+ * @brief 同时播放streams路，统计预热之后seconds秒内的CPU和迟到帧
+ * @param workers 线程池大小，负数表示每个播放器自己的线程池(每个阶段一个工作线程)
+ */
+static BenchResult run_once(const char *url, int streams, int workers, int seconds)
+{
+    BenchResult result;
+    result.streams = streams;
+    PlayerHost host;
+    if(host.Init(workers, true) < 0) {
+        return result;
+    }
+    std::vector<Player *> players;
+    for(int i = 0; i < streams; i++) {
+        Player *player = host.AddPlayer(url);
+        if(!player) {
+            return result;
+        }
+        players.push_back(player);
+    }
+    host.Start();
+    std::this_thread::sleep_for(std::chrono::seconds(WARMUP_SECONDS));
+
+    int64_t presented0 = 0, late0 = 0, stalls0 = 0;
+    for(Player *player : players) {
+        presented0 += player->Stats()->frames_presented.Get();
+        late0 += player->Stats()->frames_late.Get();
+        stalls0 += player->Stats()->stalls.Get();
+    }
+    double cpu0 = process_cpu_seconds();
+    double wall0 = wall_seconds();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    double cpu1 = process_cpu_seconds();
+    double wall1 = wall_seconds();
+    int64_t presented1 = 0, late1 = 0, stalls1 = 0;
+    for(Player *player : players) {
+        presented1 += player->Stats()->frames_presented.Get();
+        late1 += player->Stats()->frames_late.Get();
+        stalls1 += player->Stats()->stalls.Get();
+    }
+    host.Stop();
+
+    int64_t presented = presented1 - presented0;
+    int64_t late = late1 - late0;
+    result.cores = (cpu1 - cpu0) / (wall1 - wall0);
+    result.fps = presented / (wall1 - wall0) / streams;
+    result.late_ratio = presented > 0 ? (double)late / presented : 1.0;
+    result.stalls = stalls1 - stalls0;
+    result.sustained = presented > 0 && result.late_ratio < SUSTAIN_LATE_RATIO && result.stalls == 0;
+    return result;
+}
+
+/**
+ * @brief 从1路开始逐路增加，直到连续两次不能持续播放
+ * @return 能持续播放的最大路数
+ */
+static int run_mode(const char *mode, const char *url, int max_streams, int workers, int seconds)
+{
+    printf("\n[%s] workers:%d\n", mode, workers);
+    printf("%8s %8s %10s %10s %8s %10s\n", "streams", "cores", "fps/stream", "late%", "stalls", "sustained");
+    int best = 0;
+    int failures = 0;
+    for(int streams = 1; streams <= max_streams && failures < 2; streams++) {
+        BenchResult r = run_once(url, streams, workers, seconds);
+        printf("%8d %8.2f %10.1f %10.2f %8lld %10s\n", r.streams, r.cores, r.fps, r.late_ratio * 100,
+               (long long)r.stalls, r.sustained ? "yes" : "no");
+        fflush(stdout);
+        if(r.sustained) {
+            best = streams;
+            failures = 0;
+        } else {
+            failures++;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief 反复销毁和创建播放器：保持streams路同时播放，每隔CHURN_INTERVAL_MS停止最早的一路再新建一路，
+ *        统计RemovePlayer(停止加释放)的耗时分布
+ */
+static void run_churn(const char *url, int streams, int workers, int seconds)
+{
+    printf("\n[churn] workers:%d streams:%d interval:%dms\n", workers, streams, CHURN_INTERVAL_MS);
+    PlayerHost host;
+    if(host.Init(workers, true) < 0) {
+        return;
+    }
+    std::vector<Player *> players;
+    for(int i = 0; i < streams; i++) {
+        Player *player = host.AddPlayer(url);
+        if(!player) {
+            return;
+        }
+        players.push_back(player);
+    }
+    host.Start();
+    LatencyHistogram stop_latency("remove_player_us");
+    double end = wall_seconds() + seconds;
+    while(wall_seconds() < end) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(CHURN_INTERVAL_MS));
+        double start = wall_seconds();
+        host.RemovePlayer(players.front());
+        stop_latency.Record((int64_t)((wall_seconds() - start) * 1000000));
+        players.erase(players.begin());
+        Player *player = host.AddPlayer(url);
+        if(!player) {
+            break;
+        }
+        players.push_back(player);
+    }
+    host.Stop();
+    HistogramSnapshot s = stop_latency.Snapshot();
+    printf("%8s %10s %10s %10s %10s %10s\n", "removed", "p50_us", "p90_us", "p99_us", "max_us", "mean_us");
+    printf("%8llu %10lld %10lld %10lld %10lld %10.0f\n", (unsigned long long)s.count, (long long)s.p50,
+           (long long)s.p90, (long long)s.p99, (long long)s.max, s.mean);
+}
+
+struct PhaseResult
+{
+    double cores = 0;
+    int64_t presented = 0;
+    int64_t late = 0;
+    uint64_t steps = 0;        // 线程池执行的Step次数
+};
+
+/**
+ * @brief 统计接下来seconds秒内的CPU、显示帧数和线程池调度次数
+ */
+static PhaseResult measure_phase(PlayerHost &host, std::vector<Player *> &players, int seconds)
+{
+    PhaseResult result;
+    int64_t presented0 = 0, late0 = 0;
+    for(Player *player : players) {
+        presented0 += player->Stats()->frames_presented.Get();
+        late0 += player->Stats()->frames_late.Get();
+    }
+    uint64_t steps0 = host.Executor()->Steps();
+    double cpu0 = process_cpu_seconds();
+    double wall0 = wall_seconds();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    result.cores = (process_cpu_seconds() - cpu0) / (wall_seconds() - wall0);
+    result.steps = host.Executor()->Steps() - steps0;
+    for(Player *player : players) {
+        result.presented += player->Stats()->frames_presented.Get();
+        result.late += player->Stats()->frames_late.Get();
+    }
+    result.presented -= presented0;
+    result.late -= late0;
+    return result;
+}
+
+/**
+ * @brief 暂停时的CPU占用：streams路播放一段时间后全部暂停，等队列填满、任务挂起后统计，再全部恢复
+ */
+static void run_pause(const char *url, int streams, int workers, int seconds)
+{
+    printf("\n[pause] workers:%d streams:%d\n", workers, streams);
+    PlayerHost host;
+    if(host.Init(workers, true) < 0) {
+        return;
+    }
+    std::vector<Player *> players;
+    for(int i = 0; i < streams; i++) {
+        Player *player = host.AddPlayer(url);
+        if(!player) {
+            return;
+        }
+        players.push_back(player);
+    }
+    host.Start();
+    std::this_thread::sleep_for(std::chrono::seconds(WARMUP_SECONDS));
+    PhaseResult playing = measure_phase(host, players, seconds);
+    for(Player *player : players) {
+        player->Pause();
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    PhaseResult paused = measure_phase(host, players, seconds);
+    for(Player *player : players) {
+        player->Play();
+    }
+    PhaseResult resumed = measure_phase(host, players, WARMUP_SECONDS);
+    host.Stop();
+    printf("%8s %8s %10s %8s %10s\n", "phase", "cores", "presented", "late", "steps");
+    PhaseResult *phases[3] = {&playing, &paused, &resumed};
+    const char *names[3] = {"playing", "paused", "resumed"};
+    for(int i = 0; i < 3; i++) {
+        printf("%8s %8.4f %10lld %8lld %10llu\n", names[i], phases[i]->cores, (long long)phases[i]->presented,
+               (long long)phases[i]->late, (unsigned long long)phases[i]->steps);
+    }
+}
+
+/**
+ * @brief 各播放速率下的CPU：streams路同时播放，依次切换到各个速率，每档预热后统计
+ *        (无声卡时音频同样经过atempo再丢弃)
+ */
+static void run_rate(const char *url, int streams, int workers, int seconds)
+{
+    printf("\n[rate] workers:%d streams:%d\n", workers, streams);
+    PlayerHost host;
+    if(host.Init(workers, true) < 0) {
+        return;
+    }
+    std::vector<Player *> players;
+    for(int i = 0; i < streams; i++) {
+        Player *player = host.AddPlayer(url);
+        if(!player) {
+            return;
+        }
+        players.push_back(player);
+    }
+    host.Start();
+    const double rates[] = {0.5, 1.0, 1.5, 2.0, 3.0, 4.0};
+    printf("%8s %8s %10s %10s %8s %10s\n", "rate", "cores", "fps/stream", "dropped", "late", "steps");
+    for(double rate : rates) {
+        int64_t dropped0 = 0;
+        for(Player *player : players) {
+            player->SetRate(rate);
+            dropped0 += player->Stats()->frames_dropped.Get();
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(WARMUP_SECONDS));
+        PhaseResult r = measure_phase(host, players, seconds);
+        int64_t dropped = 0;
+        for(Player *player : players) {
+            dropped += player->Stats()->frames_dropped.Get();
+        }
+        printf("%8.2f %8.3f %10.1f %10lld %8lld %10llu\n", rate, r.cores, (double)r.presented / seconds / streams,
+               (long long)(dropped - dropped0), (long long)r.late, (unsigned long long)r.steps);
+        fflush(stdout);
+    }
+    host.Stop();
+}
+
+/**
+ * @brief 按模拟的vblank显示：streams路分别在60Hz和50Hz下播放，统计每路每秒的vblank、换帧、重复和跳过，
+ *        以及第一路最近8帧的节奏(24p在60Hz上应为32323232，25p在50Hz上为22222222)
+ */
+static void run_vsync(const char *url, int streams, int workers, int seconds)
+{
+    printf("\n[vsync] workers:%d streams:%d\n", workers, streams);
+    printf("%8s %10s %10s %10s %8s %8s %10s\n", "hz", "vblanks/s", "frames/s", "repeats/s", "skips", "late", "cadence");
+    const int rates[] = {60, 50};
+    for(int hz : rates) {
+        PlayerHost host;
+        if(host.Init(workers, true) < 0) {
+            return;
+        }
+        host.SetVsync(true, hz);
+        std::vector<Player *> players;
+        for(int i = 0; i < streams; i++) {
+            Player *player = host.AddPlayer(url);
+            if(!player) {
+                return;
+            }
+            players.push_back(player);
+        }
+        host.Start();
+        std::this_thread::sleep_for(std::chrono::seconds(WARMUP_SECONDS));
+        int64_t vblanks0 = 0, repeats0 = 0, skips0 = 0;
+        for(Player *player : players) {
+            vblanks0 += player->Stats()->vsync_vblanks.Get();
+            repeats0 += player->Stats()->vsync_repeats.Get();
+            skips0 += player->Stats()->vsync_skips.Get();
+        }
+        PhaseResult r = measure_phase(host, players, seconds);
+        int64_t vblanks = 0, repeats = 0, skips = 0;
+        for(Player *player : players) {
+            vblanks += player->Stats()->vsync_vblanks.Get();
+            repeats += player->Stats()->vsync_repeats.Get();
+            skips += player->Stats()->vsync_skips.Get();
+        }
+        long long cadence = (long long)players[0]->Stats()->vsync_cadence.Get();
+        host.Stop();
+        double per_stream = (double)seconds * streams;
+        printf("%8d %10.1f %10.1f %10.1f %8lld %8lld %10lld\n", hz, (vblanks - vblanks0) / per_stream,
+               r.presented / per_stream, (repeats - repeats0) / per_stream, (long long)(skips - skips0),
+               (long long)r.late, cadence);
+        fflush(stdout);
+    }
+}
+
+/**
+ * @brief 拼接输出：streams路显示在同一个窗口的网格里，统计预热之后每路的CPU(其中上传的部分)、
+ *        共用的清屏和呈现的CPU，以及各项之和和进程CPU的对比；没有显示器时用SDL的dummy视频驱动
+ */
+static void run_mosaic(const char *url, int streams, int workers, int seconds)
+{
+    printf("\n[mosaic] workers:%d streams:%d\n", workers, streams);
+    if(!getenv("SDL_VIDEODRIVER")) {
+        SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+    }
+    PlayerHost host;
+    if(host.Init(workers, false) < 0 || host.EnableMosaic(1280, 720) < 0) {
+        return;
+    }
+    std::vector<Player *> players;
+    for(int i = 0; i < streams; i++) {
+        Player *player = host.AddPlayer(url);
+        if(!player) {
+            return;
+        }
+        players.push_back(player);
+    }
+    // 刷新循环在主线程，渲染器只能在创建它的线程使用
+    host.MainLoop(WARMUP_SECONDS);
+    std::vector<int64_t> cpu0, render0, presented0;
+    for(Player *player : players) {
+        cpu0.push_back(player->CpuMicroseconds());
+        render0.push_back(player->Stats()->video_render_cpu.Get());
+        presented0.push_back(player->Stats()->frames_presented.Get());
+    }
+    int64_t composite0 = host.Mosaic()->CpuMicroseconds();
+    double cpu_start = process_cpu_seconds();
+    double wall_start = wall_seconds();
+    host.MainLoop(seconds);
+    double wall = wall_seconds() - wall_start;
+    double process_cores = (process_cpu_seconds() - cpu_start) / wall;
+    printf("%8s %10s %10s %8s\n", "stream", "cores", "render", "fps");
+    double total_cores = 0;
+    for(size_t i = 0; i < players.size(); i++) {
+        double cores = (players[i]->CpuMicroseconds() - cpu0[i]) / (wall * 1000000);
+        double render = (players[i]->Stats()->video_render_cpu.Get() - render0[i]) / (wall * 1000000);
+        total_cores += cores;
+        printf("%8d %10.3f %10.3f %8.1f\n", (int)i, cores, render,
+               (players[i]->Stats()->frames_presented.Get() - presented0[i]) / wall);
+    }
+    double composite_cores = (host.Mosaic()->CpuMicroseconds() - composite0) / (wall * 1000000);
+    total_cores += composite_cores;
+    printf("composite cores:%.3f, total cores:%.3f, process cores:%.3f\n", composite_cores, total_cores, process_cores);
+    fflush(stdout);
+    host.Stop();
+}
+
+/**
+ * @brief 倒放：streams路从接近结尾处开始倒放，分别在1x和2x下统计每路每秒显示的帧、解码端倒序送出的帧、
+ *        解完的GOP、GOP超过预算重解的次数和重新缓冲次数；长GOP的码流用它看倒放能否持续
+ */
+static void run_reverse(const char *url, int streams, int workers, int seconds)
+{
+    printf("\n[reverse] workers:%d streams:%d\n", workers, streams);
+    PlayerHost host;
+    if(host.Init(workers, true) < 0) {
+        return;
+    }
+    std::vector<Player *> players;
+    for(int i = 0; i < streams; i++) {
+        Player *player = host.AddPlayer(url);
+        if(!player) {
+            return;
+        }
+        players.push_back(player);
+    }
+    host.Start();
+    const double rates[] = {1.0, 2.0};
+    printf("%8s %8s %10s %12s %8s %10s %10s %8s %12s\n", "rate", "cores", "fps/stream", "reverse fps", "gops",
+           "redecodes", "rebuffers", "late", "buffered MB");
+    for(double rate : rates) {
+        int64_t frames0 = 0, gops0 = 0, redecodes0 = 0, rebuffers0 = 0;
+        for(Player *player : players) {
+            // 每档都从接近结尾处开始，统计窗口内不会倒放到开头
+            player->SetRate(rate);
+            player->Seek(player->StartTime() + player->Duration() * 0.9);
+            player->SetReverse(true);
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(WARMUP_SECONDS));
+        for(Player *player : players) {
+            PipelineStats *stats = player->Stats();
+            frames0 += stats->reverse_frames.Get();
+            gops0 += stats->reverse_gops.Get();
+            redecodes0 += stats->reverse_redecodes.Get();
+            rebuffers0 += stats->rebuffers.Get();
+        }
+        PhaseResult r = measure_phase(host, players, seconds);
+        int64_t frames = 0, gops = 0, redecodes = 0, rebuffers = 0, buffered = 0;
+        for(Player *player : players) {
+            PipelineStats *stats = player->Stats();
+            frames += stats->reverse_frames.Get();
+            gops += stats->reverse_gops.Get();
+            redecodes += stats->reverse_redecodes.Get();
+            rebuffers += stats->rebuffers.Get();
+            buffered += stats->reverse_buffered_bytes.Get();
+        }
+        printf("%8.2f %8.3f %10.1f %12.1f %8lld %10lld %10lld %8lld %12.1f\n", rate, r.cores,
+               (double)r.presented / seconds / streams, (double)(frames - frames0) / seconds / streams,
+               (long long)(gops - gops0), (long long)(redecodes - redecodes0), (long long)(rebuffers - rebuffers0),
+               (long long)r.late, buffered / 1048576.0);
+        fflush(stdout);
+    }
+    host.Stop();
+}
+
+/**
+ * @brief 等一路精确seek解出目标帧
+ * @return 解出返回true，超时返回false
+ */
+static bool wait_exact(PipelineStats *stats, int64_t seeks0)
+{
+    double deadline = wall_seconds() + EXACT_TIMEOUT_MS / 1000.0;
+    while(stats->exact_seeks.Get() == seeks0 && wall_seconds() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return stats->exact_seeks.Get() != seeks0;
+}
+
+/**
+ * @brief 精确seek：streams路暂停后反复精确seek到随机位置，等目标帧解出，
+ *        按关键帧到目标解出的帧数(GOP内的距离)分组统计到目标帧的耗时；
+ *        目标按Position的时间轴(从StartTime开始)，用MPEG-TS等起始时间不为0的文件时misses应为0，
+ *        最后seek到结尾，目标在最后一帧之后时也要解出
+ */
+static void run_exact(const char *url, int streams, int workers, int seconds)
+{
+    printf("\n[exact] workers:%d streams:%d\n", workers, streams);
+    PlayerHost host;
+    if(host.Init(workers, true) < 0) {
+        return;
+    }
+    std::vector<Player *> players;
+    for(int i = 0; i < streams; i++) {
+        Player *player = host.AddPlayer(url);
+        if(!player) {
+            return;
+        }
+        players.push_back(player);
+    }
+    host.Start();
+    std::this_thread::sleep_for(std::chrono::seconds(WARMUP_SECONDS));
+    for(Player *player : players) {
+        player->Pause();
+    }
+    // 各组的帧数上限(不含)，最后一组不限
+    const int bounds[] = {1, 8, 32, 128, 512};
+    const int groups = sizeof(bounds) / sizeof(bounds[0]) + 1;
+    int64_t count[groups] = {0}, total_us[groups] = {0}, max_us[groups] = {0}, distance_ms[groups] = {0};
+    int64_t timeouts = 0;
+    int64_t misses0 = 0;
+    for(Player *player : players) {
+        misses0 += player->Stats()->exact_misses.Get();
+    }
+    double start = players[0]->StartTime();
+    srand(1);
+    double end = wall_seconds() + seconds;
+    std::vector<int64_t> seeks0(players.size());
+    while(wall_seconds() < end) {
+        for(size_t i = 0; i < players.size(); i++) {
+            seeks0[i] = players[i]->Stats()->exact_seeks.Get();
+            // 不取开头，音频比视频早开始时第一帧之前的目标不算seek错
+            players[i]->SeekExact(start + (0.02 + rand() / (double)RAND_MAX * 0.93) * players[i]->Duration());
+        }
+        for(size_t i = 0; i < players.size(); i++) {
+            PipelineStats *stats = players[i]->Stats();
+            if(!wait_exact(stats, seeks0[i])) {
+                timeouts++;
+                continue;
+            }
+            int64_t frames = stats->exact_seek_frames.Get();
+            int group = 0;
+            while(group < groups - 1 && frames >= bounds[group]) {
+                group++;
+            }
+            int64_t elapsed_us = stats->exact_seek_last_us.Get();
+            count[group]++;
+            total_us[group] += elapsed_us;
+            distance_ms[group] += stats->exact_seek_distance_ms.Get();
+            if(elapsed_us > max_us[group]) {
+                max_us[group] = elapsed_us;
+            }
+        }
+    }
+    // 结尾：目标在最后一帧之后，读到结尾后送出最后一帧
+    int64_t end_timeouts = 0;
+    for(size_t i = 0; i < players.size(); i++) {
+        seeks0[i] = players[i]->Stats()->exact_seeks.Get();
+        players[i]->SeekExact(start + players[i]->Duration());
+    }
+    for(size_t i = 0; i < players.size(); i++) {
+        if(!wait_exact(players[i]->Stats(), seeks0[i])) {
+            end_timeouts++;
+        }
+    }
+    int64_t misses = 0;
+    for(Player *player : players) {
+        misses += player->Stats()->exact_misses.Get();
+    }
+    host.Stop();
+    printf("start:%.3f s\n", start);
+    printf("%12s %8s %12s %10s %10s\n", "frames", "seeks", "distance ms", "avg ms", "max ms");
+    for(int i = 0; i < groups; i++) {
+        if(count[i] == 0) {
+            continue;
+        }
+        char range[32];
+        if(i == groups - 1) {
+            snprintf(range, sizeof(range), ">=%d", bounds[i - 1]);
+        } else {
+            snprintf(range, sizeof(range), "%d-%d", i > 0 ? bounds[i - 1] : 0, bounds[i] - 1);
+        }
+        printf("%12s %8lld %12.1f %10.2f %10.2f\n", range, (long long)count[i], (double)distance_ms[i] / count[i],
+               total_us[i] / 1000.0 / count[i], max_us[i] / 1000.0);
+    }
+    printf("timeouts:%lld misses:%lld end timeouts:%lld\n", (long long)timeouts, (long long)(misses - misses0),
+           (long long)end_timeouts);
+    fflush(stdout);
+}
+
+/**
+ * @brief 多实例压测：比较共享线程池和每个播放器自己的线程池(每个阶段一个工作线程)两种模式下能持续播放的路数
+ *
+ * 用法: hostbench <url> [max_streams=16] [mode=both|pool|threads|churn|pause|rate|vsync|mosaic|reverse|exact] [workers=0] [seconds=10]
+ * 无窗口、无声卡，时钟按墙上时间走，统计窗口内迟到帧低于1%且没有卡顿视为能持续播放；
+ * churn模式保持max_streams路，反复替换播放器并统计停止耗时；pause模式统计max_streams路全部暂停时的CPU；
+ * rate模式统计max_streams路在0.5x到4x各速率下的CPU和丢帧；
+ * vsync模式按模拟的vblank显示，统计60Hz和50Hz下的节奏；
+ * mosaic模式把max_streams路拼接到同一个窗口，统计每路和拼接的CPU；
+ * reverse模式统计max_streams路在1x和2x倒放时持续的帧率、GOP解码和重新缓冲；
+ * exact模式反复精确seek到随机位置，按关键帧到目标的距离统计到目标帧的耗时，并检查落在目标之后(misses)和seek到结尾的情况
+ */
+int main(int argc, char *argv[])
+{
+    if(argc < 2) {
+        printf("usage: %s <url> [max_streams=16] [mode=both|pool|threads|churn|pause|rate|vsync|mosaic|reverse|exact] [workers=0] [seconds=10]\n", argv[0]);
+        return -1;
+    }
+    const char *url = argv[1];
+    int max_streams = argc > 2 ? atoi(argv[2]) : 16;
+    const char *mode = argc > 3 ? argv[3] : "both";
+    int workers = argc > 4 ? atoi(argv[4]) : 0;
+    int seconds = argc > 5 ? atoi(argv[5]) : 10;
+    if(workers <= 0) {
+        workers = (int)std::thread::hardware_concurrency();
+    }
+
+    Logger::Instance()->Init();
+    Logger::Instance()->SetLevel(LOG_LEVEL_WARN);
+    printf("url:%s, cpus:%u, max_streams:%d, seconds:%d\n", url, std::thread::hardware_concurrency(), max_streams, seconds);
+
+    if(strcmp(mode, "churn") == 0) {
+        run_churn(url, max_streams, workers, seconds);
+        Logger::Instance()->DeInit();
+        return 0;
+    }
+    if(strcmp(mode, "pause") == 0) {
+        run_pause(url, max_streams, workers, seconds);
+        Logger::Instance()->DeInit();
+        return 0;
+    }
+    if(strcmp(mode, "rate") == 0) {
+        run_rate(url, max_streams, workers, seconds);
+        Logger::Instance()->DeInit();
+        return 0;
+    }
+    if(strcmp(mode, "vsync") == 0) {
+        run_vsync(url, max_streams, workers, seconds);
+        Logger::Instance()->DeInit();
+        return 0;
+    }
+    if(strcmp(mode, "exact") == 0) {
+        run_exact(url, max_streams, workers, seconds);
+        Logger::Instance()->DeInit();
+        return 0;
+    }
+    if(strcmp(mode, "reverse") == 0) {
+        run_reverse(url, max_streams, workers, seconds);
+        Logger::Instance()->DeInit();
+        return 0;
+    }
+    if(strcmp(mode, "mosaic") == 0) {
+        run_mosaic(url, max_streams, workers, seconds);
+        SDL_Quit();
+        Logger::Instance()->DeInit();
+        return 0;
+    }
+    int pool_best = -1, threads_best = -1;
+    if(strcmp(mode, "threads") != 0) {
+        pool_best = run_mode("pool", url, max_streams, workers, seconds);
+    }
+    if(strcmp(mode, "pool") != 0) {
+        threads_best = run_mode("threads", url, max_streams, -1, seconds);
+    }
+    printf("\nmax sustained streams:");
+    if(pool_best >= 0) {
+        printf(" pool(%d workers)=%d", workers, pool_best);
+    }
+    if(threads_best >= 0) {
+        printf(" thread-per-stage=%d", threads_best);
+    }
+    printf("\n");
+    Logger::Instance()->DeInit();
+    return 0;
+}
@@ -0,0 +1,18 @@
+# 多实例压测，链接播放器库，用上层的sparkplayer.pro一起编译
+TEMPLATE = app
+CONFIG += console c++17
+CONFIG -= app_bundle
+CONFIG -= qt
+
+INCLUDEPATH += $$PWD/..
+
+SOURCES += \
+        hostbench.cpp
+
+LIBS += -L$$OUT_PWD/../lib -lsparkplayer
+!sparkplayer_shared {
+    win32-g++: PRE_TARGETDEPS += $$OUT_PWD/../lib/libsparkplayer.a
+    else:win32: PRE_TARGETDEPS += $$OUT_PWD/../lib/sparkplayer.lib
+}
+
+include(../sparkplayer.pri)
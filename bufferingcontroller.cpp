@@ -0,0 +1,169 @@
+﻿#include "bufferingcontroller.h"
+#include "log.h"
+
+/**
+ * @brief 构造函数
+ * @param stats 管线统计对象，读取解复用的状态，写入缓冲指标
+ * @param avsync 播放时钟
+ * @param demux 解复用，读取两路最近读到的时间戳
+ */
+BufferingController::BufferingController(PipelineStats *stats, AVSync *avsync, DemuxThread *demux):
+    stats_(stats), avsync_(avsync), demux_(demux)
+{
+    SetOptions(ThreadOptions("buffering"));
+}
+
+BufferingController::~BufferingController()
+{
+    Stop();
+}
+
+/**
+ * @brief 初始化水位
+ * @param low_ms 低水位，单位毫秒，播放中低于它时重新缓冲
+ * @param high_ms 高水位，单位毫秒，缓冲到它时开始播放，必须大于低水位
+ * @return 成功返回0，失败返回负值
+ */
+int BufferingController::Init(int low_ms, int high_ms)
+{
+    if(!stats_ || !avsync_ || !demux_ || low_ms < 0 || high_ms <= low_ms) {
+        LOG_ERROR("%s(%d) invalid param, low_ms:%d, high_ms:%d\n", __FUNCTION__, __LINE__, low_ms, high_ms);
+        return -1;
+    }
+    low_us_ = low_ms * 1000LL;
+    high_us_ = high_ms * 1000LL;
+    return 0;
+}
+
+/**
+ * @brief 设置停住/放开时钟和音频的回调，在控制线程中调用，播放器正忙(如seek)时返回false，下次再试
+ */
+void BufferingController::SetHoldCallback(std::function<bool(bool hold)> callback)
+{
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    hold_callback_ = callback;
+}
+
+/**
+ * @brief 用户暂停时不检查，恢复时马上检查一次
+ */
+void BufferingController::SetPaused(bool paused)
+{
+    paused_ = paused;
+    if(!paused) {
+        wakeUp();
+    }
+}
+
+/**
+ * @brief 切换倒放，之后由调用方Preroll重新预缓冲
+ */
+void BufferingController::SetReverse(bool reverse)
+{
+    reverse_ = reverse;
+}
+
+/**
+ * @brief 开播、seek或丢弃缓冲后重新预缓冲，调用方已经停住时钟和音频
+ */
+void BufferingController::Preroll()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now_us = PipelineStats::NowMicroseconds();
+    if(buffering_ && rebuffering_) {
+        // 重新缓冲中seek，到这里为止算一次卡顿
+        stats_->rebuffer.Record(now_us - buffering_since_us_);
+    }
+    buffering_ = true;
+    rebuffering_ = false;
+    buffering_since_us_ = now_us;
+    preroll_base_us_ = INT64_MIN;
+    stats_->buffering.Set(1);
+}
+
+/**
+ * @brief 控制线程主函数，每BUFFERING_CHECK_MS检查一次，暂停时不定时唤醒
+ */
+void BufferingController::Run()
+{
+    while(waitFor(paused_ ? -1 : BUFFERING_CHECK_MS)) {
+        if(!paused_) {
+            check();
+        }
+    }
+}
+
+/**
+ * @brief 采样两路缓冲时长，按水位切换缓冲和播放状态
+ */
+void BufferingController::check()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t audio_pts_us = demux_->AudioPtsUs();
+    int64_t video_pts_us = demux_->VideoPtsUs();
+    int64_t clock_us = (int64_t)(avsync_->GetClock() * 1000000);
+    StageHeartbeat &demux = stats_->heartbeats[STAGE_DEMUX];
+    bool full = demux.Throttled();
+    if(reverse_) {
+        // 倒放时时间轴取负，解码端送出的帧和时钟都按递增比较
+        StageHeartbeat &decode = stats_->heartbeats[STAGE_VIDEO_DECODE];
+        video_pts_us = decode.PtsUs();
+        audio_pts_us = video_pts_us;
+        full = decode.Throttled();
+    }
+    if(buffering_ && !rebuffering_ && !reverse_ && audio_pts_us != INT64_MIN && video_pts_us != INT64_MIN) {
+        if(preroll_base_us_ == INT64_MIN) {
+            preroll_base_us_ = audio_pts_us < video_pts_us ? audio_pts_us : video_pts_us;
+        }
+        if(preroll_base_us_ > clock_us) {
+            clock_us = preroll_base_us_;
+        }
+    }
+    // 换算成墙上时间，倍速时同样的缓冲撑不了那么久
+    int64_t audio_us = stats_->MediaToWallUs(LeadUs(audio_pts_us, clock_us));
+    int64_t video_us = stats_->MediaToWallUs(LeadUs(video_pts_us, clock_us));
+    stats_->audio_buffered_ms.Set(audio_us / 1000);
+    stats_->video_buffered_ms.Set(video_us / 1000);
+    int64_t buffered_us = audio_us < video_us ? audio_us : video_us;
+
+    bool eof = demux.Eof();
+    int64_t now_us = PipelineStats::NowMicroseconds();
+    if(buffering_) {
+        if(buffered_us < high_us_ && !full && !eof) {
+            return;
+        }
+        if(!hold(false)) {
+            return;
+        }
+        int64_t elapsed_us = now_us - buffering_since_us_;
+        (rebuffering_ ? stats_->rebuffer : stats_->preroll).Record(elapsed_us);
+        LOG_INFO("%s done in %lld ms, audio %lld ms, video %lld ms\n", rebuffering_ ? "rebuffer" : "preroll",
+                 (long long)(elapsed_us / 1000), (long long)(audio_us / 1000), (long long)(video_us / 1000));
+        buffering_ = false;
+        stats_->buffering.Set(0);
+        return;
+    }
+    // 队列满时解码和输出端还有数据，停住也不会读到更多
+    if(buffered_us > low_us_ || full || eof) {
+        return;
+    }
+    if(!hold(true)) {
+        return;
+    }
+    LOG_WARN("rebuffer, audio %lld ms, video %lld ms\n", (long long)(audio_us / 1000), (long long)(video_us / 1000));
+    buffering_ = true;
+    rebuffering_ = true;
+    buffering_since_us_ = now_us;
+    stats_->rebuffers.Add(1);
+    stats_->buffering.Set(1);
+}
+
+bool BufferingController::hold(bool hold)
+{
+    std::function<bool(bool)> callback;
+    {
+        std::lock_guard<std::mutex> lock(callback_mutex_);
+        callback = hold_callback_;
+    }
+    return callback && callback(hold);
+}
@@ -0,0 +1,55 @@
+﻿#ifndef BUFFERINGCONTROLLER_H
+#define BUFFERINGCONTROLLER_H
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include "thread.h"
+#include "stats.h"
+#include "avsync.h"
+#include "demuxthread.h"
+
+// 检查间隔，单位毫秒
+#define BUFFERING_CHECK_MS 20
+// 默认水位，单位毫秒：播放中任一路缓冲降到低水位以下时停住，两路都缓冲到高水位后再走
+#define BUFFERING_LOW_WATERMARK_MS 100
+#define BUFFERING_HIGH_WATERMARK_MS 1000
+
+/**
+ * 缓冲控制线程：按音视频两路已读到的时间戳减去播放时钟得到各自缓冲的时长，
+ * 开播和seek后先预缓冲到高水位再让时钟和音频走，播放中降到低水位以下时重新缓冲
+ *
+ * 读到结尾或解复用因队列满在等待时不再缓冲，此时再等也不会有更多数据；
+ * 倒放时只有视频，按解码端已倒序送出的帧计算，解码端领先已到上限时不再缓冲
+ */
+class BufferingController : public Thread
+{
+public:
+    BufferingController(PipelineStats *stats, AVSync *avsync, DemuxThread *demux);
+    ~BufferingController();
+    int Init(int low_ms, int high_ms);
+    virtual void Run();
+    void SetHoldCallback(std::function<bool(bool hold)> callback);
+    void SetPaused(bool paused);
+    void SetReverse(bool reverse);
+    void Preroll();
+private:
+    void check();
+    bool hold(bool hold);
+
+    PipelineStats *stats_ = NULL;
+    AVSync *avsync_ = NULL;
+    DemuxThread *demux_ = NULL;
+    int64_t low_us_ = BUFFERING_LOW_WATERMARK_MS * 1000LL;
+    int64_t high_us_ = BUFFERING_HIGH_WATERMARK_MS * 1000LL;
+    std::mutex mutex_;                   // check和Preroll互斥
+    bool buffering_ = true;              // 时钟和音频是否被停住
+    bool rebuffering_ = false;           // false表示开播或seek后的预缓冲，不算卡顿
+    int64_t buffering_since_us_ = 0;
+    int64_t preroll_base_us_ = INT64_MIN;   // 预缓冲期间最早采到的时间戳，时钟还没对齐到流的起始时间时用它做起点
+    std::atomic<bool> paused_{false};
+    std::atomic<bool> reverse_{false};
+    std::mutex callback_mutex_;
+    std::function<bool(bool)> hold_callback_;
+};
+
+#endif // BUFFERINGCONTROLLER_H
@@ -0,0 +1,291 @@
+﻿#include "convertthread.h"
+#include "log.h"
+#include "trace.h"
+#ifdef __cplusplus
+extern "C" {
+#include "libavutil/opt.h"
+#include "libavutil/pixdesc.h"
+#include "libavutil/imgutils.h"
+}
+#endif
+
+/**
+ * @brief 构造函数
+ * @param in_queue 解码帧队列，作为输入
+ * @param out_queue 显示帧队列，作为输出
+ */
+ConvertThread::ConvertThread(AVFrameQueue *in_queue, AVFrameQueue *out_queue):
+    in_queue_(in_queue), out_queue_(out_queue)
+{
+}
+
+ConvertThread::~ConvertThread()
+{
+    if(sws_ctx_) {
+        sws_freeContext(sws_ctx_);
+        sws_ctx_ = NULL;
+    }
+}
+
+/**
+ * @brief 初始化，swscale在第一帧需要转换时按帧的尺寸和格式创建
+ * @param time_base 视频流时间基准
+ * @param threads swscale按片并行的线程数，0表示CPU核数，1表示不并行
+ * @return 成功返回0，失败返回负值
+ */
+int ConvertThread::Init(AVRational time_base, int threads)
+{
+    if(!in_queue_ || !out_queue_ || threads < 0) {
+        LOG_ERROR("%s(%d) invalid param, threads:%d\n", __FUNCTION__, __LINE__, threads);
+        return -1;
+    }
+    time_base_ = time_base;
+    threads_ = threads;
+    return 0;
+}
+
+/**
+ * @brief 纹理是否能直接显示该格式，不需要转换
+ * @param format AVPixelFormat
+ */
+bool ConvertThread::Passthrough(int format)
+{
+    switch(format) {
+        case AV_PIX_FMT_YUV420P:    // IYUV纹理，YV12纹理也是同样的三个平面，只是U、V顺序不同
+        case AV_PIX_FMT_YUVJ420P:
+        case AV_PIX_FMT_NV12:       // NV12/NV21纹理
+        case AV_PIX_FMT_NV21:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief 截止时间：已转换的帧领先输出端播放位置的时间用完的时刻
+ * @return 单调时钟微秒，不知道播放位置时返回当前时间
+ */
+int64_t ConvertThread::Deadline()
+{
+    int64_t now = PipelineStats::NowMicroseconds();
+    if(!stats_) {
+        return now;
+    }
+    return now + stats_->MediaToWallUs(LeadUs(frame_pts_us_, stats_->heartbeats[STAGE_VIDEO_OUTPUT].PtsUs()));
+}
+
+/**
+ * @brief 取一帧转换后放入显示帧队列，由TaskExecutor调度，不等待
+ * @return TASK_PROGRESS处理了一帧，TASK_IDLE显示帧队列已满或没有解码帧(队列另一端唤醒)
+ */
+int ConvertThread::Step()
+{
+    if(out_queue_->Size() >= max_frames_) {
+        return TASK_IDLE;
+    }
+    AVFrame *frame = in_queue_->Pop(0);
+    if(!frame) {
+        return TASK_IDLE;
+    }
+    if(frame->pts != AV_NOPTS_VALUE && time_base_.den > 0) {
+        frame_pts_us_ = av_rescale_q(frame->pts, time_base_, AV_TIME_BASE_Q);
+    }
+    // 只缩小不放大，放大由渲染器做
+    int width = frame->width;
+    int height = frame->height;
+    int output_width = output_width_;
+    int output_height = output_height_;
+    if(output_width > 0 && output_height > 0 && (output_width < width || output_height < height)) {
+        FitSize(frame->width, frame->height, output_width, output_height, width, height);
+    }
+    bool scaled = width != frame->width || height != frame->height;
+    if(!scaled && Passthrough(frame->format)) {
+        if(stats_) {
+            stats_->video_passthrough.Add(1);
+        }
+    } else {
+        int64_t start_us = stats_ ? PipelineStats::NowMicroseconds() : 0;
+        AVFrame *converted = convert(frame, width, height);
+        av_frame_free(&frame);
+        if(!converted) {
+            // 转换失败只丢这一帧
+            return TASK_PROGRESS;
+        }
+        frame = converted;
+        if(stats_) {
+            stats_->video_convert.Record(PipelineStats::NowMicroseconds() - start_us);
+            stats_->video_copies.Add(1);
+            stats_->video_copy_bytes.Add(av_image_get_buffer_size((enum AVPixelFormat)frame->format,
+                                                                  frame->width, frame->height, 1));
+            if(scaled) {
+                stats_->video_downscaled.Add(1);
+            }
+        }
+    }
+    // Push会移走引用，先让缓存引用同一块缓冲
+    if(cache_) {
+        cache_->Insert(frame);
+    }
+    {
+        TRACE_SCOPE("frame_queue_push", "video", frame->pts);
+        out_queue_->Push(frame);
+    }
+    av_frame_free(&frame);
+    return TASK_PROGRESS;
+}
+
+/**
+ * @brief 转成YUV420P并缩放到指定大小
+ * @param width 输出宽度
+ * @param height 输出高度
+ * @return 新的帧，失败返回NULL
+ */
+AVFrame *ConvertThread::convert(AVFrame *frame, int width, int height)
+{
+    if(openScaler(frame, width, height) < 0) {
+        return NULL;
+    }
+    AVFrame *out = av_frame_alloc();
+    if(!out) {
+        return NULL;
+    }
+    // 不分配缓冲，由swscale分配
+    out->format = AV_PIX_FMT_YUV420P;
+    out->width = width;
+    out->height = height;
+    int ret = 0;
+    {
+        TRACE_SCOPE("sws_scale_frame", "video", frame->pts);
+        ret = sws_scale_frame(sws_ctx_, out, frame);
+    }
+    if(ret < 0) {
+        char err2str[256] = {0};
+        av_strerror(ret, err2str, sizeof(err2str));
+        LOG_RATELIMIT(LOG_LEVEL_ERROR, 1000, "sws_scale_frame failed, ret:%d, err2str:%s\n", ret, err2str);
+        av_frame_free(&out);
+        return NULL;
+    }
+    av_frame_copy_props(out, frame);
+    return out;
+}
+
+/**
+ * @brief 按帧的尺寸、格式和输出大小创建swscale，和上次相同时复用
+ * @return 成功返回0，失败返回负值
+ */
+int ConvertThread::openScaler(const AVFrame *frame, int width, int height)
+{
+    if(sws_ctx_ && frame->width == src_width_ && frame->height == src_height_ && frame->format == src_format_
+            && width == dst_width_ && height == dst_height_) {
+        return 0;
+    }
+    if(sws_ctx_) {
+        sws_freeContext(sws_ctx_);
+    }
+    sws_ctx_ = sws_alloc_context();
+    if(!sws_ctx_) {
+        LOG_ERROR("%s(%d) sws_alloc_context failed\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    av_opt_set_int(sws_ctx_, "srcw", frame->width, 0);
+    av_opt_set_int(sws_ctx_, "srch", frame->height, 0);
+    av_opt_set_int(sws_ctx_, "src_format", frame->format, 0);
+    av_opt_set_int(sws_ctx_, "dstw", width, 0);
+    av_opt_set_int(sws_ctx_, "dsth", height, 0);
+    av_opt_set_int(sws_ctx_, "dst_format", AV_PIX_FMT_YUV420P, 0);
+    av_opt_set_int(sws_ctx_, "sws_flags", SWS_BILINEAR, 0);
+    // 一帧按行切片，由swscale自己的线程并行转换
+    av_opt_set_int(sws_ctx_, "threads", threads_, 0);
+    int ret = sws_init_context(sws_ctx_, NULL, NULL);
+    if(ret < 0) {
+        LOG_ERROR("%s(%d) sws_init_context failed, %dx%d %s\n", __FUNCTION__, __LINE__, frame->width, frame->height,
+                  av_get_pix_fmt_name((enum AVPixelFormat)frame->format));
+        sws_freeContext(sws_ctx_);
+        sws_ctx_ = NULL;
+        return -1;
+    }
+    src_width_ = frame->width;
+    src_height_ = frame->height;
+    src_format_ = frame->format;
+    dst_width_ = width;
+    dst_height_ = height;
+    LOG_INFO("convert %dx%d %s to %dx%d yuv420p, threads:%d\n", frame->width, frame->height,
+             av_get_pix_fmt_name((enum AVPixelFormat)frame->format), width, height, threads_);
+    return 0;
+}
+
+/**
+ * @brief 设置显示区域的像素大小，比视频小时缩小到该大小，可以在任意线程调用，下一帧生效
+ * @param width 宽度，0表示不缩小
+ * @param height 高度，0表示不缩小
+ */
+void ConvertThread::SetOutputSize(int width, int height)
+{
+    output_width_ = width;
+    output_height_ = height;
+}
+
+/**
+ * @brief 保持宽高比放进指定区域的最大尺寸，宽高取偶数，YUV420P的色度平面是一半大小
+ * @param width 视频宽度
+ * @param height 视频高度
+ * @param box_width 区域宽度
+ * @param box_height 区域高度
+ * @param fit_width 返回宽度
+ * @param fit_height 返回高度
+ */
+void ConvertThread::FitSize(int width, int height, int box_width, int box_height, int &fit_width, int &fit_height)
+{
+    if(width <= 0 || height <= 0 || box_width <= 0 || box_height <= 0) {
+        fit_width = width;
+        fit_height = height;
+        return;
+    }
+    if((int64_t)box_width * height <= (int64_t)box_height * width) {
+        fit_width = box_width;
+        fit_height = (int)((int64_t)box_width * height / width);
+    } else {
+        fit_height = box_height;
+        fit_width = (int)((int64_t)box_height * width / height);
+    }
+    fit_width = fit_width < 2 ? 2 : fit_width & ~1;
+    fit_height = fit_height < 2 ? 2 : fit_height & ~1;
+}
+
+/**
+ * @brief seek时调用，必须在任务从TaskExecutor移除后调用
+ */
+void ConvertThread::Flush()
+{
+    frame_pts_us_ = INT64_MIN;
+    if(cache_) {
+        cache_->Discontinuity();
+    }
+}
+
+/**
+ * @brief 设置统计对象，在Submit之前调用
+ * @param stats 统计对象指针，可以为NULL
+ */
+void ConvertThread::SetStats(PipelineStats *stats)
+{
+    stats_ = stats;
+}
+
+/**
+ * @brief 设置已解码帧缓存，在Submit之前调用
+ * @param cache 缓存指针，可以为NULL
+ */
+void ConvertThread::SetCache(FrameCache *cache)
+{
+    cache_ = cache;
+}
+
+/**
+ * @brief 设置低延时模式，在Submit之前调用
+ * @param low_delay true时显示帧队列上限减为CONVERT_LOW_DELAY_FRAMES
+ */
+void ConvertThread::SetLowDelay(bool low_delay)
+{
+    max_frames_ = low_delay ? CONVERT_LOW_DELAY_FRAMES : CONVERT_MAX_FRAMES;
+}
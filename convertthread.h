@@ -0,0 +1,63 @@
+﻿#ifndef CONVERTTHREAD_H
+#define CONVERTTHREAD_H
+
+#include <atomic>
+#include "taskexecutor.h"
+#include "avframequeue.h"
+#include "framecache.h"
+#ifdef __cplusplus
+extern "C" {
+#include "libswscale/swscale.h"
+}
+#endif
+
+// 显示帧队列超过该数量时暂停转换
+#define CONVERT_MAX_FRAMES 3
+// 低延时模式下的显示帧队列上限
+#define CONVERT_LOW_DELAY_FRAMES 1
+
+/**
+ * 像素格式转换任务：从解码帧队列取帧，纹理能直接显示的格式(YUV420P、NV12、NV21)原样放入显示帧队列，
+ * 其他格式(10bit、4:2:2/4:4:4、RGB等)用swscale按片多线程转成YUV420P；
+ * 窗口比视频小时同时缩小到窗口大小，上传和纹理只按窗口大小占用带宽和显存；
+ * 解码帧队列为空时挂起等解码Push，显示帧队列满时挂起等输出端Pop
+ */
+class ConvertThread : public Task
+{
+public:
+    ConvertThread(AVFrameQueue *in_queue, AVFrameQueue *out_queue);
+    ~ConvertThread();
+    int Init(AVRational time_base, int threads);
+    int Step();
+    int64_t Deadline();
+    void Flush();
+    void SetStats(PipelineStats *stats);
+    void SetCache(FrameCache *cache);
+    void SetLowDelay(bool low_delay);
+    void SetOutputSize(int width, int height);
+
+    static bool Passthrough(int format);
+    static void FitSize(int width, int height, int box_width, int box_height, int &fit_width, int &fit_height);
+private:
+    AVFrame *convert(AVFrame *frame, int width, int height);
+    int openScaler(const AVFrame *frame, int width, int height);
+
+    AVFrameQueue *in_queue_ = NULL;
+    AVFrameQueue *out_queue_ = NULL;
+    PipelineStats *stats_ = NULL;
+    FrameCache *cache_ = NULL;           // 放入显示帧队列的帧同时放入缓存
+    struct SwsContext *sws_ctx_ = NULL;
+    int threads_ = 0;                    // swscale按片并行的线程数，0表示CPU核数
+    int src_width_ = 0;                  // sws_ctx_对应的输入，变化时重建
+    int src_height_ = 0;
+    int src_format_ = AV_PIX_FMT_NONE;
+    int dst_width_ = 0;
+    int dst_height_ = 0;
+    std::atomic<int> output_width_{0};    // 显示区域大小，0表示不缩小，由刷新循环设置
+    std::atomic<int> output_height_{0};
+    int64_t frame_pts_us_ = INT64_MIN;   // 最近放入显示帧队列的时间戳，用于计算截止时间
+    int max_frames_ = CONVERT_MAX_FRAMES;
+    AVRational time_base_ = {0, 1};
+};
+
+#endif // CONVERTTHREAD_H
@@ -0,0 +1,61 @@
+﻿#include "costage.h"
+#ifdef SPARK_COROUTINE
+
+CoStage::CoStage(std::coroutine_handle<promise_type> handle):
+    handle_(handle)
+{
+}
+
+CoStage::CoStage(CoStage &&other) noexcept:
+    handle_(other.handle_)
+{
+    other.handle_ = nullptr;
+}
+
+/**
+ * @brief 替换协程，原来的协程在挂起点直接销毁，用于seek后从头开始
+ */
+CoStage &CoStage::operator=(CoStage &&other) noexcept
+{
+    if(this != &other) {
+        if(handle_) {
+            handle_.destroy();
+        }
+        handle_ = other.handle_;
+        other.handle_ = nullptr;
+    }
+    return *this;
+}
+
+CoStage::~CoStage()
+{
+    if(handle_) {
+        handle_.destroy();
+    }
+}
+
+/**
+ * @brief 驱动协程执行到下一个挂起点，由Task::Step调用
+ * @return TASK_PROGRESS在CoYield处让出，TASK_IDLE等待的队列条件不满足，TASK_DONE协程已结束
+ */
+int CoStage::Resume()
+{
+    if(!handle_ || handle_.done()) {
+        return TASK_DONE;
+    }
+    promise_type &promise = handle_.promise();
+    // 被Wake时先重试等待的条件，不满足就继续挂起，不恢复协程
+    if(promise.waiting) {
+        if(!promise.waiting->TryComplete()) {
+            return TASK_IDLE;
+        }
+        promise.waiting = nullptr;
+    }
+    handle_.resume();
+    if(handle_.done()) {
+        return TASK_DONE;
+    }
+    return promise.waiting ? TASK_IDLE : TASK_PROGRESS;
+}
+
+#endif // SPARK_COROUTINE
@@ -0,0 +1,100 @@
+﻿#ifndef COSTAGE_H
+#define COSTAGE_H
+// C++20协程实现的管线阶段，qmake CONFIG+=sparkplayer_coroutine 时定义SPARK_COROUTINE
+#ifdef SPARK_COROUTINE
+#include <coroutine>
+#include "taskexecutor.h"
+#include "avpacketqueue.h"
+#include "avframequeue.h"
+
+/**
+ * 协程挂起时等待的条件，TaskExecutor调度到任务时先重试，条件满足才恢复协程
+ */
+class CoAwaiter
+{
+public:
+    virtual ~CoAwaiter() {}
+    virtual bool TryComplete() = 0;
+};
+
+/**
+ * 协程形式的阶段：阶段逻辑写成普通循环，co_await队列时挂起而不是阻塞线程；
+ * 由所在Task的Step调用Resume驱动，挂起等待队列时返回TASK_IDLE，队列另一端Wake后重试
+ */
+class CoStage
+{
+public:
+    struct promise_type {
+        CoAwaiter *waiting = nullptr;   // 正在等待的条件，CoYield挂起时为空
+        CoStage get_return_object()
+        {
+            return CoStage(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        // 创建后先挂起，第一次Step时才开始执行
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    CoStage() {}
+    explicit CoStage(std::coroutine_handle<promise_type> handle);
+    CoStage(CoStage &&other) noexcept;
+    CoStage &operator=(CoStage &&other) noexcept;
+    CoStage(const CoStage &) = delete;
+    CoStage &operator=(const CoStage &) = delete;
+    ~CoStage();
+    int Resume();
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+/**
+ * 做完一个单位的工作后让出，Step返回TASK_PROGRESS，按新的截止时间重新排队
+ */
+struct CoYield
+{
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<CoStage::promise_type>) {}
+    void await_resume() {}
+};
+
+/**
+ * 等待队列中的数量不超过max_size，即下游取走了数据，Pop时队列唤醒生产者
+ */
+template <typename Q>
+class QueueRoom : public CoAwaiter
+{
+public:
+    QueueRoom(Q *queue, int max_size): queue_(queue), max_size_(max_size) {}
+    bool TryComplete() { return queue_->Size() <= max_size_; }
+    bool await_ready() { return TryComplete(); }
+    void await_suspend(std::coroutine_handle<CoStage::promise_type> handle) { handle.promise().waiting = this; }
+    void await_resume() {}
+private:
+    Q *queue_;
+    int max_size_;
+};
+
+/**
+ * 等待并取出一个数据包，Push时队列唤醒消费者
+ */
+class PacketPop : public CoAwaiter
+{
+public:
+    explicit PacketPop(AVPacketQueue *queue): queue_(queue) {}
+    bool TryComplete()
+    {
+        packet_ = queue_->Pop(0);
+        return packet_ != NULL;
+    }
+    bool await_ready() { return TryComplete(); }
+    void await_suspend(std::coroutine_handle<CoStage::promise_type> handle) { handle.promise().waiting = this; }
+    AVPacket *await_resume() { return packet_; }
+private:
+    AVPacketQueue *queue_;
+    AVPacket *packet_ = NULL;
+};
+
+#endif // SPARK_COROUTINE
+#endif // COSTAGE_H
@@ -1,4 +1,17 @@
-﻿#include "decodethread.h"
+﻿#include <algorithm>
+#include "decodethread.h"
+#include "log.h"
+#include "trace.h"
+
+// 帧引用的缓冲大小之和
+static int64_t frame_bytes(const AVFrame *frame)
+{
+    int64_t bytes = 0;
+    for(int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++) {
+        bytes += frame->buf[i]->size;
+    }
+    return bytes;
+}
 
 /**
  * @brief 构造函数，初始化解码线程
@@ -16,26 +29,36 @@ DecodeThread::DecodeThread(AVPacketQueue *packet_queue, AVFrameQueue  *frame_que
  */
 DecodeThread::~DecodeThread()
 {
-    // 确保停止线程
-    Stop();
+    reverseClear();
+    if(exact_frame_) {
+        av_frame_free(&exact_frame_);
+    }
+    if (frame_) {
+        av_frame_free(&frame_);
+    }
     
     // 释放编解码器上下文
     if (codec_ctx_) {
         avcodec_free_context(&codec_ctx_);
         codec_ctx_ = nullptr;
     }
+    // 还在队列里的帧持有缓冲，池在它们都释放后才真正释放
+    if(pool_) {
+        av_buffer_pool_uninit(&pool_);
+    }
 }
 
 /**
  * @brief 初始化解码器
  * @param par 编解码器参数
+ * @param time_base 流的时间基准，解码出的帧的pts使用该时间基准
  * @return 成功返回0，失败返回负值
  */
-int DecodeThread::Init(AVCodecParameters *par)
+int DecodeThread::Init(AVCodecParameters *par, AVRational time_base)
 {
     // 检查参数有效性
     if(!par) {
-        printf("DecodeThread::Init par is NULL\n");
+        LOG_ERROR("DecodeThread::Init par is NULL\n");
         return -1;
     }
     
@@ -47,126 +70,650 @@ int DecodeThread::Init(AVCodecParameters *par)
     // avcodec_parameters_from_context // 合成复用的时候用
     if(ret < 0) {
         av_strerror(ret, err2str, sizeof(err2str));
-        printf("avcodec_parameters_to_context failed, ret:%d, err2str:%s", ret, err2str);
+        LOG_ERROR("avcodec_parameters_to_context failed, ret:%d, err2str:%s", ret, err2str);
         return -1;
     }
     
+    codec_ctx_->pkt_timebase = time_base;
+    // 低延时模式：不为重排缓存帧，按片多线程，避免帧级多线程带来的几帧延时
+    if(low_delay_) {
+        codec_ctx_->flags |= AV_CODEC_FLAG_LOW_DELAY;
+        codec_ctx_->thread_type = FF_THREAD_SLICE;
+    }
+    
     // 根据编解码器ID查找解码器
     const AVCodec *codec = avcodec_find_decoder(codec_ctx_->codec_id);
     if(!codec) {
-        printf("avcodec_find_decoder failed\n");
+        LOG_ERROR("avcodec_find_decoder failed\n");
         return -1;
     }
     
+    // 视频帧直接解码到纹理布局的缓冲，VideoOutput一次SDL_UpdateTexture上传，不再逐平面拷贝；
+    // 不支持自定义缓冲(DR1)的解码器仍用FFmpeg自己的
+    if(codec_ctx_->codec_type == AVMEDIA_TYPE_VIDEO && (codec->capabilities & AV_CODEC_CAP_DR1)) {
+        codec_ctx_->opaque = this;
+        codec_ctx_->get_buffer2 = getBuffer;
+    }
+
     // 打开解码器
     ret = avcodec_open2(codec_ctx_, codec, NULL);
     if(ret < 0) {
         av_strerror(ret, err2str, sizeof(err2str));
-        printf("avcodec_open2 failed, ret:%d, err2str:%s", ret, err2str);
+        LOG_ERROR("avcodec_open2 failed, ret:%d, err2str:%s", ret, err2str);
+        return -1;
+    }
+    
+    // 存放解码结果的帧，Push时引用被移走，可以反复使用
+    frame_ = av_frame_alloc();
+    if(!frame_) {
+        LOG_ERROR("av_frame_alloc failed\n");
         return -1;
     }
     
-    printf("Init decode finish\n");
+#ifdef SPARK_COROUTINE
+    coroutine_ = run();
+#endif
+    LOG_INFO("Init decode finish\n");
     return 0;
 }
 
 /**
- * @brief 启动解码线程
- * @return 成功返回0，失败返回负值
+ * @brief 截止时间：已解码的帧领先输出端播放位置的时间用完的时刻
+ * @return 单调时钟微秒，不知道播放位置时返回当前时间
  */
-int DecodeThread::Start()
+int64_t DecodeThread::Deadline()
 {
-    // 创建新线程执行Run方法
-    thread_ = new std::thread(&DecodeThread::Run, this);
-    if(!thread_) {
-        printf("new DecodeThread failed\n");
-        return -1;
+    int64_t now = PipelineStats::NowMicroseconds();
+    if(!stats_ || !codec_ctx_) {
+        return now;
     }
-    return 0;
+    int stage = codec_ctx_->codec_type == AVMEDIA_TYPE_AUDIO ? STAGE_AUDIO_OUTPUT : STAGE_VIDEO_OUTPUT;
+    return now + stats_->MediaToWallUs(LeadUs(frame_pts_us_, stats_->heartbeats[stage].PtsUs()));
 }
 
 /**
- * @brief 停止解码线程
- * @return 成功返回0
+ * @brief 取一个数据包送给解码器，并把能取出的帧都放入帧队列，由TaskExecutor调度，不等待数据包
+ * @return TASK_PROGRESS送入了一个包，TASK_IDLE帧队列已满或没有数据包(队列另一端唤醒)，TASK_DONE解码出错或读到结尾已取空
  */
-int DecodeThread::Stop()
+int DecodeThread::Step()
 {
-    printf("%s(%d)\n", __FUNCTION__, __LINE__);
-    // 调用基类的Stop方法，设置abort_标志并等待线程结束
-    Thread::Stop();
-    return 0;
+    if(stats_) {
+        bool audio = codec_ctx_->codec_type == AVMEDIA_TYPE_AUDIO;
+        stats_->heartbeats[audio ? STAGE_AUDIO_DECODE : STAGE_VIDEO_DECODE].Beat();
+    }
+    if(replay_cache_) {
+        return replayStep();
+    }
+    if(reverse_) {
+        return reverseStep();
+    }
+#ifdef SPARK_COROUTINE
+    return coroutine_.Resume();
+#else
+    // 如果帧队列已满，等输出端取走一些再解码
+    // 1920*1080*1.5*100 (一帧YUV占用大小约为宽*高*1.5字节)
+    if(frame_queue_->Size() > max_frames_) {
+        return TASK_IDLE;
+    }
+    
+    // 从packet_queue读取数据包
+    AVPacket *packet = NULL;
+    {
+        TraceScope trace_pop("packet_queue_pop", av_get_media_type_string(codec_ctx_->codec_type));
+        packet = packet_queue_->Pop(0);
+        if(packet) {
+            trace_pop.SetPts(packet->pts);
+        }
+    }
+    if(!packet) {
+        LOG_RATELIMIT(LOG_LEVEL_DEBUG, 1000, "no packet\n");
+        return TASK_IDLE;
+    }
+    if(skipPacket(packet)) {
+        return TASK_PROGRESS;
+    }
+    if(sendPacket(packet) < 0) {
+        return TASK_DONE;
+    }
+    
+    // 从解码器读取解码后的帧
+    int ret = 0;
+    while((ret = receiveFrame()) == 0) {
+        if(!holdExact()) {
+            pushFrame();
+        }
+    }
+    // 精确seek的目标在最后一帧之后，解码器取空时送出留下的最后一帧
+    if(ret == AVERROR_EOF && exact_pts_ != AV_NOPTS_VALUE) {
+        finishExact();
+    }
+    // EAGAIN表示需要更多数据包才能产生下一帧，其他错误结束解码
+    return ret == AVERROR(EAGAIN) ? TASK_PROGRESS : TASK_DONE;
+#endif
 }
 
+#ifdef SPARK_COROUTINE
 /**
- * @brief 解码线程主函数
- * 
- * 从packet_queue获取数据包，解码成帧，然后放入frame_queue
+ * @brief 协程形式的解码循环，没有数据包时挂起；每解出一帧都检查帧队列，满了就挂起，不会一次塞入一个包的所有帧
  */
-void DecodeThread::Run()
+CoStage DecodeThread::run()
 {
-    int ret = 0;
-    // 分配一个用于存放解码结果的帧
-    AVFrame *frame = av_frame_alloc();
-    
-    // 主解码循环
-    while(1) {
-        // 检查是否需要退出
-        if(abort_ == 1) {
-            break;
-        }
-        
-        // 如果帧队列已满，等待一段时间再继续
-        // 1920*1080*1.5*100 (一帧YUV占用大小约为宽*高*1.5字节)
-        if(frame_queue_->Size() > 10) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    while(true) {
+        AVPacket *packet = co_await PacketPop(packet_queue_);
+        if(skipPacket(packet)) {
             continue;
         }
-        
-        // 从packet_queue读取数据包
-        AVPacket *packet = packet_queue_->Pop(10);  // 最多等待10ms
+        if(sendPacket(packet) < 0) {
+            co_return;
+        }
+        int ret = 0;
+        while((ret = receiveFrame()) == 0) {
+            if(holdExact()) {
+                continue;
+            }
+            co_await QueueRoom<AVFrameQueue>(frame_queue_, max_frames_);
+            pushFrame();
+        }
+        if(ret == AVERROR_EOF && exact_pts_ != AV_NOPTS_VALUE) {
+            finishExact();
+        }
+        if(ret != AVERROR(EAGAIN)) {
+            co_return;
+        }
+        co_await CoYield();
+    }
+}
+#endif
+
+/**
+ * @brief 从缓存重放一帧，已缓存范围内的数据包直接丢弃，重放完后回到解码
+ * @return TASK_PROGRESS放入了一帧或重放结束，TASK_IDLE帧队列已满
+ */
+int DecodeThread::replayStep()
+{
+    if(frame_queue_->Size() > max_frames_) {
+        return TASK_IDLE;
+    }
+    // 只有这个任务取数据包，Front返回的包在Pop之前一直有效
+    AVPacket *packet = NULL;
+    while((packet = packet_queue_->Front())
+            && (packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts) < replay_to_) {
+        packet = packet_queue_->Pop(0);
+        av_packet_free(&packet);
+    }
+    AVFrame *frame = replay_pts_ == AV_NOPTS_VALUE ? replay_cache_->Find(replay_from_) : replay_cache_->Next(replay_pts_);
+    if(!frame || frame->pts >= replay_to_) {
+        av_frame_free(&frame);
+        LOG_INFO("replay finish at %lld\n", (long long)replay_pts_);
+        replay_cache_ = NULL;
+        wait_keyframe_ = true;
+        return TASK_PROGRESS;
+    }
+    replay_pts_ = frame->pts;
+    if(codec_ctx_->pkt_timebase.num) {
+        frame_pts_us_ = av_rescale_q(frame->pts, codec_ctx_->pkt_timebase, AV_TIME_BASE_Q);
+    }
+    if(stats_) {
+        stats_->heartbeats[STAGE_VIDEO_DECODE].Progress();
+    }
+    {
+        TRACE_SCOPE("frame_queue_push", "video", frame->pts);
+        frame_queue_->Push(frame);
+    }
+    av_frame_free(&frame);
+    return TASK_PROGRESS;
+}
+
+/**
+ * @brief 倒放的一步：先把解完的GOP倒序送出，帧队列满时继续解更早的GOP，解码和显示重叠
+ * @return TASK_PROGRESS做了一步，TASK_IDLE帧队列已满并且没有能解的，或者在等数据包，TASK_DONE解码出错
+ */
+int DecodeThread::reverseStep()
+{
+    StageHeartbeat *heartbeat = stats_ ? &stats_->heartbeats[STAGE_VIDEO_DECODE] : NULL;
+    if(!reverse_ready_.empty() && frame_queue_->Size() <= max_frames_) {
+        reverseEmit();
+        return TASK_PROGRESS;
+    }
+    if(!reverse_gop_.empty() && !reverse_pass_done_) {
+        return reverseDecode();
+    }
+    if(reverse_pass_done_ && reverse_ready_.empty()) {
+        reverseHandOff();
+        return TASK_PROGRESS;
+    }
+    if(reverse_gop_.empty() && reverse_next_done_) {
+        reverse_gop_.swap(reverse_next_);
+        reverse_next_done_ = false;
+        reverse_sent_ = 0;
+        reverse_limit_ = reverse_from_ != AV_NOPTS_VALUE ? reverse_from_ + 1 : INT64_MAX;
+        reverse_from_ = AV_NOPTS_VALUE;
+        return TASK_PROGRESS;
+    }
+    if(!reverse_next_done_) {
+        AVPacket *packet = packet_queue_->Pop(0);
         if(packet) {
-            // 送给解码器
-            ret = avcodec_send_packet(codec_ctx_, packet);
-            // 释放数据包(已经送入解码器)
-            av_packet_free(&packet);
-            
-            if(ret < 0) {
-                av_strerror(ret, err2str, sizeof(err2str));
-                printf("avcodec_send_packet failed, ret:%d, err2str:%s", ret, err2str);
-                break;
+            // 空包是解复用放的GOP结尾
+            if(!packet->data && packet->size == 0) {
+                av_packet_free(&packet);
+                reverse_next_done_ = !reverse_next_.empty();
+            } else {
+                reverse_next_.push_back(packet);
             }
-            
-            // 从解码器读取解码后的帧
-            while (true) {
-                ret = avcodec_receive_frame(codec_ctx_, frame);  // 存在B帧的场景  B3-2  P2-3   I1-1 --> P3  B2  I1
-                if(ret == 0) {
-                    // 成功解码到一帧，放入帧队列
-                    frame_queue_->Push(frame);
-//                    printf("%s frame_queue size:%d\n ", codec_ctx_->codec->name, frame_queue_->Size());
-                    continue;
-                } else if(ret == AVERROR(EAGAIN)) {
-                    // 需要更多数据包才能产生下一帧，跳出内层循环
-                    break;
-                } else {
-                    // 其他错误，设置终止标志并跳出循环
-                    abort_  = 1;
-                    av_strerror(ret, err2str, sizeof(err2str));
-                    printf("avcodec_receive_frame failed, ret:%d, err2str:%s", ret, err2str);
-                    break;
-                }
+            return TASK_PROGRESS;
+        }
+    }
+    // 两个GOP都已解完、帧队列满，解码领先已到上限，缓冲控制据此不再等
+    if(heartbeat) {
+        heartbeat->SetThrottled(!reverse_ready_.empty());
+    }
+    return TASK_IDLE;
+}
+
+/**
+ * @brief 送当前GOP的下一个包，全部送完后取出解码器里剩下的帧，本遍结束
+ */
+int DecodeThread::reverseDecode()
+{
+    if(reverse_sent_ < reverse_gop_.size()) {
+        // 超过预算时还要再送一遍，送的是引用
+        AVPacket *packet = av_packet_clone(reverse_gop_[reverse_sent_++]);
+        if(!packet || sendPacket(packet) < 0) {
+            return TASK_DONE;
+        }
+    } else {
+        avcodec_send_packet(codec_ctx_, NULL);
+    }
+    int ret = 0;
+    while((ret = receiveFrame()) == 0) {
+        reverseKeep();
+    }
+    if(ret == AVERROR_EOF) {
+        avcodec_flush_buffers(codec_ctx_);
+        reverse_pass_done_ = true;
+        return TASK_PROGRESS;
+    }
+    return ret == AVERROR(EAGAIN) ? TASK_PROGRESS : TASK_DONE;
+}
+
+/**
+ * @brief 保留frame_，超过一半预算时丢掉最早的帧，这一段送出后再解一遍取回来
+ */
+void DecodeThread::reverseKeep()
+{
+    if(frame_->pts == AV_NOPTS_VALUE || frame_->pts >= reverse_limit_) {
+        av_frame_unref(frame_);
+        return;
+    }
+    AVFrame *frame = av_frame_alloc();
+    if(!frame) {
+        av_frame_unref(frame_);
+        return;
+    }
+    av_frame_move_ref(frame, frame_);
+    reverse_decoded_.push_back(frame);
+    reverse_decoded_bytes_ += frame_bytes(frame);
+    while(reverse_decoded_bytes_ > reverse_budget_ / 2 && reverse_decoded_.size() > 1) {
+        AVFrame *oldest = reverse_decoded_.front();
+        reverse_decoded_.erase(reverse_decoded_.begin());
+        reverse_decoded_bytes_ -= frame_bytes(oldest);
+        av_frame_free(&oldest);
+        reverse_truncated_ = true;
+    }
+    if(stats_) {
+        stats_->reverse_buffered_bytes.Set(reverse_decoded_bytes_ + reverse_ready_bytes_);
+    }
+}
+
+/**
+ * @brief 上一个GOP送完后把本遍解出的帧交给送出；丢过帧时同一个GOP再解一遍，只保留还没送出的帧
+ */
+void DecodeThread::reverseHandOff()
+{
+    std::sort(reverse_decoded_.begin(), reverse_decoded_.end(), [](const AVFrame *a, const AVFrame *b) {
+        return a->pts < b->pts;
+    });
+    reverse_ready_.swap(reverse_decoded_);
+    reverse_ready_bytes_ = reverse_decoded_bytes_;
+    reverse_decoded_bytes_ = 0;
+    reverse_pass_done_ = false;
+    reverse_sent_ = 0;
+    if(reverse_truncated_ && !reverse_ready_.empty()) {
+        reverse_limit_ = reverse_ready_.front()->pts;
+        reverse_truncated_ = false;
+        if(stats_) {
+            stats_->reverse_redecodes.Add(1);
+        }
+        LOG_DEBUG("reverse gop over budget, decode again before %lld\n", (long long)reverse_limit_);
+        return;
+    }
+    for(AVPacket *packet : reverse_gop_) {
+        av_packet_free(&packet);
+    }
+    reverse_gop_.clear();
+    reverse_truncated_ = false;
+    if(stats_) {
+        stats_->reverse_gops.Add(1);
+    }
+}
+
+/**
+ * @brief 送出待送出的最后一帧，时间轴取负，倒序的帧时间戳递增，输出端和时钟按正常播放处理
+ */
+void DecodeThread::reverseEmit()
+{
+    AVFrame *frame = reverse_ready_.back();
+    reverse_ready_.pop_back();
+    reverse_ready_bytes_ -= frame_bytes(frame);
+    frame->pts = -frame->pts;
+    frame->best_effort_timestamp = frame->pts;
+    frame->pkt_dts = AV_NOPTS_VALUE;
+    if(codec_ctx_->pkt_timebase.num) {
+        frame_pts_us_ = av_rescale_q(frame->pts, codec_ctx_->pkt_timebase, AV_TIME_BASE_Q);
+    }
+    int64_t now_us = PipelineStats::NowMicroseconds();
+    if(reverse_frames_++ == 0) {
+        reverse_start_us_ = now_us;
+    }
+    if(stats_) {
+        StageHeartbeat &heartbeat = stats_->heartbeats[STAGE_VIDEO_DECODE];
+        heartbeat.SetThrottled(false);
+        heartbeat.Progress(frame_pts_us_);
+        stats_->reverse_frames.Add(1);
+        stats_->reverse_buffered_bytes.Set(reverse_decoded_bytes_ + reverse_ready_bytes_);
+        if(now_us > reverse_start_us_) {
+            stats_->reverse_fps.Set((reverse_frames_ - 1) * 1000000 / (now_us - reverse_start_us_));
+        }
+    }
+    {
+        TRACE_SCOPE("frame_queue_push", "video", frame->pts);
+        frame_queue_->Push(frame);
+    }
+    av_frame_free(&frame);
+}
+
+/**
+ * @brief 释放倒放缓冲的数据包和帧
+ */
+void DecodeThread::reverseClear()
+{
+    for(AVPacket *packet : reverse_next_) {
+        av_packet_free(&packet);
+    }
+    for(AVPacket *packet : reverse_gop_) {
+        av_packet_free(&packet);
+    }
+    for(AVFrame *frame : reverse_decoded_) {
+        av_frame_free(&frame);
+    }
+    for(AVFrame *frame : reverse_ready_) {
+        av_frame_free(&frame);
+    }
+    reverse_next_.clear();
+    reverse_gop_.clear();
+    reverse_decoded_.clear();
+    reverse_ready_.clear();
+    reverse_next_done_ = false;
+    reverse_sent_ = 0;
+    reverse_truncated_ = false;
+    reverse_pass_done_ = false;
+    reverse_decoded_bytes_ = 0;
+    reverse_ready_bytes_ = 0;
+    if(stats_) {
+        stats_->reverse_buffered_bytes.Set(0);
+    }
+}
+
+/**
+ * @brief 精确seek时处理刚解出的frame_：目标之前的帧不送出，只留下最近的一帧；
+ *        解到目标之后先送出留下的帧(目标位置显示的帧)，frame_再照常送出
+ * @return frame_被留下或丢弃时返回true，调用方不再送出
+ */
+bool DecodeThread::holdExact()
+{
+    if(exact_pts_ == AV_NOPTS_VALUE) {
+        return false;
+    }
+    if(frame_->pts == AV_NOPTS_VALUE) {
+        av_frame_unref(frame_);
+        return true;
+    }
+    if(exact_first_pts_ == AV_NOPTS_VALUE) {
+        exact_first_pts_ = frame_->pts;
+    }
+    if(frame_->pts > exact_pts_) {
+        finishExact();
+        return false;
+    }
+    exact_frames_++;
+    if(exact_frame_->buf[0] && stats_ && codec_ctx_->codec_type == AVMEDIA_TYPE_VIDEO) {
+        stats_->exact_discarded_frames.Add(1);
+    }
+    av_frame_unref(exact_frame_);
+    av_frame_move_ref(exact_frame_, frame_);
+    // 正好解到目标，不用等下一帧
+    if(exact_frame_->pts == exact_pts_) {
+        finishExact();
+    }
+    return true;
+}
+
+/**
+ * @brief 送出留下的帧，结束精确seek并记录耗时和关键帧到目标的距离
+ */
+void DecodeThread::finishExact()
+{
+    bool video = codec_ctx_->codec_type == AVMEDIA_TYPE_VIDEO;
+    // 没有留下的帧时目标位置显示的是frame_，它在目标之后说明seek的时间轴和帧的时间戳不一致
+    bool missed = !exact_frame_->buf[0] && frame_->buf[0];
+    if(exact_frame_->buf[0]) {
+        TRACE_SCOPE("frame_queue_push", av_get_media_type_string(codec_ctx_->codec_type), exact_frame_->pts);
+        frame_queue_->Push(exact_frame_);
+    }
+    if(video) {
+        int64_t elapsed_us = PipelineStats::NowMicroseconds() - exact_since_us_;
+        int64_t distance_ms = exact_first_pts_ != AV_NOPTS_VALUE && codec_ctx_->pkt_timebase.num ?
+                              av_rescale_q(exact_pts_ - exact_first_pts_, codec_ctx_->pkt_timebase, {1, 1000}) : 0;
+        if(stats_) {
+            stats_->exact_seek.Record(elapsed_us);
+            stats_->exact_seek_last_us.Set(elapsed_us);
+            stats_->exact_seek_frames.Set(exact_frames_);
+            stats_->exact_seek_distance_ms.Set(distance_ms);
+            stats_->exact_seeks.Add(1);
+            if(missed) {
+                stats_->exact_misses.Add(1);
             }
-            // 把frame发送给framequeue
-        } else {
-            printf("no packet\n");
         }
+        if(missed) {
+            LOG_WARN("exact target %lld before first decoded frame %lld\n", (long long)exact_pts_, (long long)frame_->pts);
+        }
+        LOG_INFO("exact frame %lld after %d frames (%lld ms from keyframe) in %lld us\n", (long long)exact_pts_,
+                 exact_frames_, (long long)distance_ms, (long long)elapsed_us);
     }
+    exact_pts_ = AV_NOPTS_VALUE;
+}
+
+/**
+ * @brief 重放时丢弃过数据包，解码器的参考帧已经不完整，丢到下一个关键帧再送给解码器
+ * @param packet 数据包，丢弃时释放
+ * @return 丢弃返回true
+ */
+bool DecodeThread::skipPacket(AVPacket *packet)
+{
+    if(!wait_keyframe_) {
+        return false;
+    }
+    if(packet->flags & AV_PKT_FLAG_KEY) {
+        wait_keyframe_ = false;
+        avcodec_flush_buffers(codec_ctx_);
+        return false;
+    }
+    av_packet_free(&packet);
+    return true;
+}
+
+/**
+ * @brief 把数据包送给解码器并释放数据包
+ * @param packet 数据包，data为NULL、size为0时是解复用读到结尾放的空包
+ * @return 成功返回0，失败返回负值
+ */
+int DecodeThread::sendPacket(AVPacket *packet)
+{
+    // 静态字符串"audio"/"video"，用于trace标记
+    const char *stream = av_get_media_type_string(codec_ctx_->codec_type);
+    StageHeartbeat *heartbeat = NULL;
+    if(stats_) {
+        heartbeat = &stats_->heartbeats[codec_ctx_->codec_type == AVMEDIA_TYPE_AUDIO ? STAGE_AUDIO_DECODE : STAGE_VIDEO_DECODE];
+    }
+    // 每帧解码耗时：从送包(或上一帧入队之后)到receive_frame拿到该帧，不含排队等待
+    decode_start_us_ = stats_ ? PipelineStats::NowMicroseconds() : 0;
+    int ret = 0;
+    {
+        TRACE_SCOPE("avcodec_send_packet", stream, packet->pts);
+        if(heartbeat) {
+            heartbeat->Enter("avcodec_send_packet");
+        }
+        // 倍速时由控制线程设置，在解码线程里生效
+        int skip_frame = skip_frame_.load();
+        // 精确seek时在目标之前就结束的帧不会显示，是非参考帧时不用解
+        if(exact_pts_ != AV_NOPTS_VALUE && codec_ctx_->codec_type == AVMEDIA_TYPE_VIDEO && skip_frame < AVDISCARD_NONREF
+                && packet->pts != AV_NOPTS_VALUE && packet->duration > 0 && packet->pts + packet->duration <= exact_pts_) {
+            skip_frame = AVDISCARD_NONREF;
+        }
+        codec_ctx_->skip_frame = (enum AVDiscard)skip_frame;
+        // 解复用在结尾放的空包：不再有数据，取出解码器中剩余的帧
+        ret = avcodec_send_packet(codec_ctx_, packet->data || packet->size ? packet : NULL);
+        if(heartbeat) {
+            heartbeat->Leave();
+        }
+    }
+    // 释放数据包(已经送入解码器)
+    av_packet_free(&packet);
     
-    // 退出前释放frame资源
-    if (frame) {
-        av_frame_free(&frame);
+    if(ret < 0) {
+        av_strerror(ret, err2str, sizeof(err2str));
+        LOG_ERROR("avcodec_send_packet failed, ret:%d, err2str:%s", ret, err2str);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 从解码器取一帧到frame_，记录解码耗时
+ * @return 成功返回0，需要更多数据包返回AVERROR(EAGAIN)，其他错误返回对应的负值
+ */
+int DecodeThread::receiveFrame()
+{
+    const char *stream = av_get_media_type_string(codec_ctx_->codec_type);
+    bool audio = codec_ctx_->codec_type == AVMEDIA_TYPE_AUDIO;
+    StageHeartbeat *heartbeat = NULL;
+    if(stats_) {
+        heartbeat = &stats_->heartbeats[audio ? STAGE_AUDIO_DECODE : STAGE_VIDEO_DECODE];
+    }
+    int ret = 0;
+    {
+        TraceScope trace_receive("avcodec_receive_frame", stream);
+        if(heartbeat) {
+            heartbeat->Enter("avcodec_receive_frame");
+        }
+        ret = avcodec_receive_frame(codec_ctx_, frame_);  // 存在B帧的场景  B3-2  P2-3   I1-1 --> P3  B2  I1
+        if(heartbeat) {
+            heartbeat->Leave();
+        }
+        if(ret == 0) {
+            trace_receive.SetPts(frame_->pts);
+        }
+    }
+    if(ret == 0) {
+        if(stats_) {
+            (audio ? stats_->audio_decode : stats_->video_decode).Record(PipelineStats::NowMicroseconds() - decode_start_us_);
+            heartbeat->Progress();
+            stats_->recorder.Record(FLIGHT_FRAME_DECODED, audio ? FLIGHT_STREAM_AUDIO : FLIGHT_STREAM_VIDEO, frame_->pts);
+        }
+        // 倒放时按送出的帧计算，解出的帧还要等整个GOP解完
+        if(!reverse_ && frame_->pts != AV_NOPTS_VALUE && codec_ctx_->pkt_timebase.num) {
+            frame_pts_us_ = av_rescale_q(frame_->pts, codec_ctx_->pkt_timebase, AV_TIME_BASE_Q);
+        }
+    } else if(ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
+        av_strerror(ret, err2str, sizeof(err2str));
+        LOG_ERROR("avcodec_receive_frame failed, ret:%d, err2str:%s", ret, err2str);
+    }
+    return ret;
+}
+
+/**
+ * @brief 把frame_放入帧队列，frame_的引用被移走，可以继续接收下一帧
+ */
+void DecodeThread::pushFrame()
+{
+    {
+        TRACE_SCOPE("frame_queue_push", av_get_media_type_string(codec_ctx_->codec_type), frame_->pts);
+        frame_queue_->Push(frame_);
+    }
+    if(stats_) {
+        decode_start_us_ = PipelineStats::NowMicroseconds();
     }
 }
 
+/**
+ * @brief 解码器分配帧缓冲的回调：纹理能直接显示的格式(YUV420P、NV12、NV21)分配一整块，
+ *        各平面按SDL_UpdateTexture要求的布局连续存放(亮度之后紧跟色度，色度行宽为亮度的一半或相同)，
+ *        行数按解码器要求对齐，多出的行显示时裁掉；其他格式用FFmpeg默认的分配
+ */
+int DecodeThread::getBuffer(AVCodecContext *ctx, AVFrame *frame, int flags)
+{
+    DecodeThread *decode = (DecodeThread *)ctx->opaque;
+    bool planar = frame->format == AV_PIX_FMT_YUV420P || frame->format == AV_PIX_FMT_YUVJ420P;
+    bool semi_planar = frame->format == AV_PIX_FMT_NV12 || frame->format == AV_PIX_FMT_NV21;
+    if(!planar && !semi_planar) {
+        return avcodec_default_get_buffer2(ctx, frame, flags);
+    }
+    int width = frame->width;
+    int height = frame->height;
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    avcodec_align_dimensions2(ctx, &width, &height, linesize_align);
+    height = FFALIGN(height, 2);
+    int pitch = FFALIGN(width, DECODE_TEXTURE_PITCH_ALIGN);
+    size_t luma_size = (size_t)pitch * height;
+    AVBufferRef *buf = decode->poolBuffer(luma_size + luma_size / 2 + DECODE_TEXTURE_PADDING);
+    if(!buf) {
+        return AVERROR(ENOMEM);
+    }
+    frame->buf[0] = buf;
+    frame->data[0] = buf->data;
+    frame->linesize[0] = pitch;
+    frame->data[1] = buf->data + luma_size;
+    if(planar) {
+        frame->linesize[1] = pitch / 2;
+        frame->data[2] = frame->data[1] + (size_t)(pitch / 2) * (height / 2);
+        frame->linesize[2] = pitch / 2;
+    } else {
+        frame->linesize[1] = pitch;
+    }
+    frame->extended_data = frame->data;
+    return 0;
+}
+
+/**
+ * @brief 从缓冲池取一块，大小变化(分辨率变化)时重建池
+ */
+AVBufferRef *DecodeThread::poolBuffer(size_t size)
+{
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    if(!pool_ || pool_size_ != size) {
+        if(pool_) {
+            av_buffer_pool_uninit(&pool_);
+        }
+        pool_ = av_buffer_pool_init(size, NULL);
+        if(!pool_) {
+            LOG_ERROR("%s(%d) av_buffer_pool_init failed, size:%zu\n", __FUNCTION__, __LINE__, size);
+            return NULL;
+        }
+        pool_size_ = size;
+    }
+    return av_buffer_pool_get(pool_);
+}
+
 /**
  * @brief 获取解码器上下文
  * @return 解码器上下文指针
@@ -175,3 +722,115 @@ AVCodecContext *DecodeThread::GetAVCodecContext()
 {
     return codec_ctx_;
 }
+
+/**
+ * @brief 清空解码器内部缓存的数据，用于seek，必须在任务从TaskExecutor移除后调用
+ */
+void DecodeThread::Flush()
+{
+    if(codec_ctx_) {
+        avcodec_flush_buffers(codec_ctx_);
+    }
+    frame_pts_us_ = INT64_MIN;
+    replay_cache_ = NULL;
+    wait_keyframe_ = false;
+    reverseClear();
+    exact_pts_ = AV_NOPTS_VALUE;
+    if(exact_frame_) {
+        av_frame_unref(exact_frame_);
+    }
+#ifdef SPARK_COROUTINE
+    // 协程可能拿着旧位置的帧挂起在等待帧队列空位处，从头开始
+    coroutine_ = run();
+#endif
+}
+
+/**
+ * @brief 设置跳过哪些帧不解码，倍速时跳过非参考帧以降低解码开销，可以在任意线程调用，下一个数据包生效
+ * @param discard AVDiscard，AVDISCARD_DEFAULT表示全部解码
+ */
+void DecodeThread::SetSkipFrame(int discard)
+{
+    skip_frame_ = discard;
+}
+
+/**
+ * @brief 设置低延时模式，在Init之前调用
+ * @param low_delay true时解码器不缓存帧，帧队列上限减为DECODE_LOW_DELAY_FRAMES
+ */
+void DecodeThread::SetLowDelay(bool low_delay)
+{
+    low_delay_ = low_delay;
+    max_frames_ = low_delay ? DECODE_LOW_DELAY_FRAMES : DECODE_MAX_FRAMES;
+}
+
+/**
+ * @brief 从缓存重放[from_pts, to_pts)之间的帧代替解码，用于A/B循环，在Flush之后、任务提交之前调用
+ * @param cache 已确认整段缓存并且前后相连(FrameCache::Covers)
+ * @param from_pts 起点，从不早于它的第一帧开始
+ * @param to_pts 终点，不含；之后的数据包从下一个关键帧开始解码
+ */
+void DecodeThread::Replay(FrameCache *cache, int64_t from_pts, int64_t to_pts)
+{
+    replay_cache_ = cache;
+    replay_pts_ = AV_NOPTS_VALUE;
+    replay_from_ = cache->Ceil(from_pts);
+    replay_to_ = to_pts;
+}
+
+/**
+ * @brief 切换倒放，在Flush之后、任务提交之前调用
+ * @param reverse true时数据包按DemuxThread::SeekReverse的GOP分段，每个GOP整段解完后倒序送出，
+ *                时间戳取负；false时恢复正常解码
+ * @param from_pts 倒放的起点，第一个GOP只送出不晚于它的帧
+ * @param budget_bytes 已解码还没送出的帧的缓冲上限，GOP超过一半时分几遍解，每遍只保留放得下的最后一段
+ */
+void DecodeThread::SetReverse(bool reverse, int64_t from_pts, int64_t budget_bytes)
+{
+    reverseClear();
+    reverse_ = reverse;
+    reverse_from_ = from_pts;
+    reverse_budget_ = budget_bytes;
+    reverse_frames_ = 0;
+    if(stats_) {
+        // 倒放时缓冲控制按送出的帧算缓冲时长，不能用上一次倒放留下的位置
+        stats_->heartbeats[STAGE_VIDEO_DECODE].ResetPts();
+        stats_->heartbeats[STAGE_VIDEO_DECODE].SetThrottled(false);
+        if(reverse) {
+            stats_->reverse_fps.Set(0);
+        }
+    }
+}
+
+/**
+ * @brief 精确seek：解复用已seek到目标之前的关键帧，之后解出的帧只送出目标位置显示的那一帧及其之后的帧，
+ *        在Flush之后、任务提交之前调用
+ * @param pts 目标时间戳，送出不晚于它的最后一帧
+ * @param since_us 精确seek开始的时间(PipelineStats::NowMicroseconds)，用于统计到目标帧解出的耗时
+ * @return 成功返回0，失败返回负值
+ */
+int DecodeThread::SetExactTarget(int64_t pts, int64_t since_us)
+{
+    if(!exact_frame_) {
+        exact_frame_ = av_frame_alloc();
+        if(!exact_frame_) {
+            LOG_ERROR("%s(%d) av_frame_alloc failed\n", __FUNCTION__, __LINE__);
+            return -1;
+        }
+    }
+    av_frame_unref(exact_frame_);
+    exact_pts_ = pts;
+    exact_since_us_ = since_us;
+    exact_first_pts_ = AV_NOPTS_VALUE;
+    exact_frames_ = 0;
+    return 0;
+}
+
+/**
+ * @brief 设置统计对象，在Submit之前调用
+ * @param stats 统计对象指针，可以为NULL
+ */
+void DecodeThread::SetStats(PipelineStats *stats)
+{
+    stats_ = stats;
+}
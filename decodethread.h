@@ -1,25 +1,106 @@
 ﻿#ifndef DECODETHREAD_H
 #define DECODETHREAD_H
 
-#include "thread.h"
+#include <mutex>
+#include <vector>
+#include "taskexecutor.h"
 #include "avpacketqueue.h"
 #include "avframequeue.h"
+#include "framecache.h"
+#include "costage.h"
 
-class DecodeThread : public Thread
+// 帧队列超过该数量时暂停解码
+#define DECODE_MAX_FRAMES 10
+// 低延时模式下的帧队列上限
+#define DECODE_LOW_DELAY_FRAMES 2
+// 纹理布局缓冲的亮度行宽对齐(字节)，YUV420P的色度行宽是亮度的一半，仍按64字节对齐，满足解码器SIMD和纹理上传的要求
+#define DECODE_TEXTURE_PITCH_ALIGN 128
+// 纹理布局缓冲末尾留出的字节数，SIMD读越界时不越过缓冲
+#define DECODE_TEXTURE_PADDING 64
+// 倒放时已解码还没送出的帧的默认缓冲上限，单位MB
+#define DECODE_REVERSE_BUDGET_MB 256
+
+/**
+ * 解码任务：每次Step送一个数据包给解码器，取出的帧放入帧队列；
+ * 没有数据包时挂起等解复用Push，帧队列满时挂起等输出端Pop
+ */
+class DecodeThread : public Task
 {
 public:
     DecodeThread(AVPacketQueue *packet_queue, AVFrameQueue  *frame_queue);
     ~DecodeThread();
-    int Init(AVCodecParameters *par); //解码器初始化
-    int Start();
-    int Stop();
-    void Run();
+    int Init(AVCodecParameters *par, AVRational time_base); //解码器初始化
+    int Step();
+    int64_t Deadline();
     AVCodecContext *GetAVCodecContext();
+    void Flush();
+    void SetStats(PipelineStats *stats);
+    void SetSkipFrame(int discard);
+    void SetLowDelay(bool low_delay);
+    void Replay(FrameCache *cache, int64_t from_pts, int64_t to_pts);
+    void SetReverse(bool reverse, int64_t from_pts, int64_t budget_bytes);
+    int SetExactTarget(int64_t pts, int64_t since_us);
 private:
+    static int getBuffer(AVCodecContext *ctx, AVFrame *frame, int flags);
+    AVBufferRef *poolBuffer(size_t size);
+    int sendPacket(AVPacket *packet);
+    int receiveFrame();
+    void pushFrame();
+    int replayStep();
+    bool skipPacket(AVPacket *packet);
+    int reverseStep();
+    int reverseDecode();
+    void reverseKeep();
+    void reverseHandOff();
+    void reverseEmit();
+    void reverseClear();
+    bool holdExact();
+    void finishExact();
+#ifdef SPARK_COROUTINE
+    CoStage run();
+    CoStage coroutine_;
+#endif
+
     char err2str[256] = {0};
     AVCodecContext *codec_ctx_ = NULL;
     AVPacketQueue *packet_queue_ = NULL;
     AVFrameQueue  *frame_queue_ = NULL;
+    PipelineStats *stats_ = NULL;
+    AVFrame *frame_ = NULL;
+    int64_t frame_pts_us_ = INT64_MIN;   // 最近解码出的帧时间戳，用于计算截止时间
+    int64_t decode_start_us_ = 0;        // 送包或上一帧入队的时间，用于统计每帧解码耗时
+    std::atomic<int> skip_frame_{AVDISCARD_DEFAULT};
+    bool low_delay_ = false;
+    int max_frames_ = DECODE_MAX_FRAMES;
+    std::mutex pool_mutex_;           // 帧级多线程时getBuffer可能在解码器的线程中调用
+    AVBufferPool *pool_ = NULL;       // 纹理布局的帧缓冲，大小变化时重建
+    size_t pool_size_ = 0;
+    FrameCache *replay_cache_ = NULL;          // 不为NULL时从缓存重放，不解码
+    int64_t replay_pts_ = AV_NOPTS_VALUE;      // 上一个重放的帧，AV_NOPTS_VALUE表示还没开始
+    int64_t replay_from_ = AV_NOPTS_VALUE;
+    int64_t replay_to_ = AV_NOPTS_VALUE;
+    bool wait_keyframe_ = false;               // 重放时丢弃了数据包，解码器要从关键帧重新开始
+    bool reverse_ = false;                     // 倒放：按GOP整段解码，倒序送出，时间戳取负
+    int64_t reverse_budget_ = 0;               // 已解码还没送出的帧的缓冲上限，正在解的GOP和正在送出的GOP各占一半
+    int64_t reverse_from_ = AV_NOPTS_VALUE;    // 第一个GOP只送出不晚于它的帧
+    std::vector<AVPacket *> reverse_next_;     // 正在从队列收的GOP(更早的一个)
+    bool reverse_next_done_ = false;           // 已收到GOP结尾的空包
+    std::vector<AVPacket *> reverse_gop_;      // 正在解码的GOP
+    size_t reverse_sent_ = 0;                  // 本遍已送给解码器的包数
+    int64_t reverse_limit_ = INT64_MAX;        // 本遍只保留早于它的帧，之后的帧上一遍已经送出
+    bool reverse_truncated_ = false;           // 本遍超过预算丢掉了最早的帧，送出后要再解一遍
+    bool reverse_pass_done_ = false;           // 本遍已解完，等上一个GOP送完再交接
+    std::vector<AVFrame *> reverse_decoded_;   // 本遍解出的帧，按pts从小到大
+    int64_t reverse_decoded_bytes_ = 0;
+    std::vector<AVFrame *> reverse_ready_;     // 待送出的帧，从后往前送
+    int64_t reverse_ready_bytes_ = 0;
+    int64_t reverse_start_us_ = 0;             // 本次倒放第一帧送出的时间，用于统计平均帧率
+    int64_t reverse_frames_ = 0;
+    int64_t exact_pts_ = AV_NOPTS_VALUE;       // 精确seek的目标，目标之前的帧不送出
+    AVFrame *exact_frame_ = NULL;              // 目标之前最近解出的帧，解到目标之后才知道它就是目标位置显示的帧
+    int64_t exact_since_us_ = 0;               // 精确seek开始的时间
+    int64_t exact_first_pts_ = AV_NOPTS_VALUE; // seek后解出的第一帧(关键帧)
+    int exact_frames_ = 0;                     // seek后到目标为止解出的帧数
 };
 
 #endif // DECODETHREAD_H
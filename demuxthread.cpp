@@ -1,4 +1,6 @@
 ﻿#include "demuxthread.h"
+#include "log.h"
+#include "trace.h"
 
 /**
  * @brief 构造函数，初始化解复用线程
@@ -8,7 +10,7 @@
 DemuxThread::DemuxThread(AVPacketQueue *audio_queue, AVPacketQueue *video_queue):
     audio_queue_(audio_queue), video_queue_(video_queue)
 {
-    printf("DemuxThread\n");
+    LOG_DEBUG("DemuxThread\n");
     ifmt_ctx_ = nullptr;  // 初始化格式上下文为空
 }
 
@@ -17,10 +19,7 @@ DemuxThread::DemuxThread(AVPacketQueue *audio_queue, AVPacketQueue *video_queue)
  */
 DemuxThread::~DemuxThread()
 {
-    printf("~DemuxThread\n");
-    
-    // 确保停止线程
-    Stop();
+    LOG_DEBUG("~DemuxThread\n");
     
     // 关闭并释放格式上下文
     if (ifmt_ctx_) {
@@ -37,27 +36,35 @@ int DemuxThread::Init(const char *url)
 {
     // 检查参数有效性
     if(!url) {
-        printf("%s(%d) url is null\n", __FUNCTION__, __LINE__);
+        LOG_ERROR("%s(%d) url is null\n", __FUNCTION__, __LINE__);
         return -1;
     }
     
     // 检查队列是否有效
     if(!audio_queue_ || !video_queue_) {
-        printf("%s(%d) audio_queue_ or video_queue_  null\n", __FUNCTION__, __LINE__);
+        LOG_ERROR("%s(%d) audio_queue_ or video_queue_  null\n", __FUNCTION__, __LINE__);
         return -1;
     }
     
     // 保存URL
     url_ = url;
     
-    // 分配格式上下文
+    // 分配格式上下文，设置中断回调，停止时网络流的打开和读取不会一直阻塞
     ifmt_ctx_ = avformat_alloc_context();
+    ifmt_ctx_->interrupt_callback.callback = interruptCallback;
+    ifmt_ctx_->interrupt_callback.opaque = this;
+    // 低延时模式：少量探测，探测时读到的包不缓存，直接从最新的数据开始
+    if(low_latency_) {
+        ifmt_ctx_->flags |= AVFMT_FLAG_NOBUFFER;
+        ifmt_ctx_->probesize = DEMUX_LOW_LATENCY_PROBESIZE;
+        ifmt_ctx_->max_analyze_duration = DEMUX_LOW_LATENCY_ANALYZE_US;
+    }
     
     // 打开输入文件
     int ret = avformat_open_input(&ifmt_ctx_, url_.c_str(), NULL, NULL);
     if(ret < 0) {
         av_strerror(ret, err2str, sizeof(err2str));
-        printf("%s(%d) avformat_open_input failed:%d, %s\n", __FUNCTION__, __LINE__, ret, err2str);
+        LOG_ERROR("%s(%d) avformat_open_input failed:%d, %s\n", __FUNCTION__, __LINE__, ret, err2str);
         return -1;
     }
     
@@ -65,7 +72,7 @@ int DemuxThread::Init(const char *url)
     ret = avformat_find_stream_info(ifmt_ctx_, NULL);
     if(ret < 0) {
         av_strerror(ret, err2str, sizeof(err2str));
-        printf("%s(%d) avformat_find_stream_info failed:%d, %s\n", __FUNCTION__, __LINE__, ret, err2str);
+        LOG_ERROR("%s(%d) avformat_find_stream_info failed:%d, %s\n", __FUNCTION__, __LINE__, ret, err2str);
         return -1;
     }
     
@@ -78,92 +85,317 @@ int DemuxThread::Init(const char *url)
     // 查找最佳视频流
     video_stream_ = av_find_best_stream(ifmt_ctx_, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
     
-    printf("%s(%d) audio_stream_:%d, video_stream_:%d\n", __FUNCTION__, __LINE__, audio_stream_, video_stream_);
+    LOG_INFO("%s(%d) audio_stream_:%d, video_stream_:%d\n", __FUNCTION__, __LINE__, audio_stream_, video_stream_);
     
     // 检查是否找到音频或视频流
     if(audio_stream_ < 0 || video_stream_ < 0) {
-        printf("no audio or no video\n");
+        LOG_ERROR("no audio or no video\n");
         return -1;
     }
     
+#ifdef SPARK_COROUTINE
+    coroutine_ = run();
+#endif
     return 0;
 }
 
 /**
- * @brief 启动解复用线程
- * @return 成功返回0，失败返回负值
+ * @brief 读取并分发一个数据包，由TaskExecutor调度
+ * @return TASK_PROGRESS读到一个包，TASK_IDLE队列已满(下游Pop后唤醒)，TASK_DONE读到结尾或出错
+ */
+int DemuxThread::Step()
+{
+    StageHeartbeat *heartbeat = stats_ ? &stats_->heartbeats[STAGE_DEMUX] : NULL;
+    if(heartbeat) {
+        heartbeat->Beat();
+    }
+    if(reverse_) {
+        return reverseStep();
+    }
+#ifdef SPARK_COROUTINE
+    return coroutine_.Resume();
+#else
+    // 如果队列已满，等下游取走一些再读
+    if(queueFull()) {
+        if(heartbeat) {
+            heartbeat->SetThrottled(true);
+        }
+        return TASK_IDLE;
+    }
+    if(heartbeat) {
+        heartbeat->SetThrottled(false);
+    }
+    AVPacket packet;
+    if(readPacket(&packet) < 0) {
+        endOfStream();
+        return TASK_DONE;
+    }
+    dispatch(&packet);
+    return TASK_PROGRESS;
+#endif
+}
+
+#ifdef SPARK_COROUTINE
+/**
+ * @brief 协程形式的解复用循环，和Step的逻辑相同，队列满时挂起
+ */
+CoStage DemuxThread::run()
+{
+    StageHeartbeat *heartbeat = stats_ ? &stats_->heartbeats[STAGE_DEMUX] : NULL;
+    AVPacket packet;
+    while(true) {
+        if(queueFull()) {
+            if(heartbeat) {
+                heartbeat->SetThrottled(true);
+            }
+            co_await QueueRoom<AVPacketQueue>(audio_queue_, DEMUX_MAX_PACKETS);
+            co_await QueueRoom<AVPacketQueue>(video_queue_, DEMUX_MAX_PACKETS);
+            if(heartbeat) {
+                heartbeat->SetThrottled(false);
+            }
+        }
+        if(readPacket(&packet) < 0) {
+            endOfStream();
+            co_return;
+        }
+        dispatch(&packet);
+        co_await CoYield();
+    }
+}
+#endif
+
+/**
+ * @brief 音频或视频数据包队列已满
  */
-int DemuxThread::Start()
+bool DemuxThread::queueFull()
 {
-    // 创建新线程执行Run方法
-    thread_ = new std::thread(&DemuxThread::Run, this);
-    if(!thread_) {
-        printf("new DemuxThread failed\n");
+    return audio_queue_->Size() > DEMUX_MAX_PACKETS || video_queue_->Size() > DEMUX_MAX_PACKETS;
+}
+
+/**
+ * @brief 读取一个数据包，记录耗时和心跳
+ * @param packet 读到的数据包
+ * @return 成功返回0，读到结尾或出错返回负值
+ */
+int DemuxThread::readPacket(AVPacket *packet)
+{
+    StageHeartbeat *heartbeat = stats_ ? &stats_->heartbeats[STAGE_DEMUX] : NULL;
+    int ret = 0;
+    {
+        TraceScope trace_read("av_read_frame", "demux");
+        int64_t read_start_us = stats_ ? PipelineStats::NowMicroseconds() : 0;
+        if(heartbeat) {
+            heartbeat->Enter("av_read_frame");
+        }
+        ret = av_read_frame(ifmt_ctx_, packet);
+        if(heartbeat) {
+            heartbeat->Leave();
+        }
+        if(stats_) {
+            stats_->demux_read.Record(PipelineStats::NowMicroseconds() - read_start_us);
+        }
+        if(ret == 0) {
+            trace_read.SetStream(packet->stream_index == audio_stream_ ? "audio" :
+                                 packet->stream_index == video_stream_ ? "video" : "other");
+            trace_read.SetPts(packet->pts);
+        }
+    }
+    if(ret == AVERROR_EXIT) {
+        // 被Stop/Seek中断，不是读到结尾
+        LOG_DEBUG("%s(%d) av_read_frame interrupted\n", __FUNCTION__, __LINE__);
         return -1;
     }
+    if(ret < 0) {
+        av_strerror(ret, err2str, sizeof(err2str));
+        LOG_ERROR("%s(%d) av_read_frame failed:%d, %s\n", __FUNCTION__, __LINE__, ret, err2str);
+        if(heartbeat) {
+            heartbeat->SetEof(true);
+        }
+        return -1;
+    }
+    if(heartbeat) {
+        // 记下最新读到的时间戳，低延时控制用它和播放时钟算缓冲时长
+        int64_t pts_us = INT64_MIN;
+        if(packet->pts != AV_NOPTS_VALUE && (packet->stream_index == audio_stream_ || packet->stream_index == video_stream_)) {
+            pts_us = av_rescale_q(packet->pts, ifmt_ctx_->streams[packet->stream_index]->time_base, AV_TIME_BASE_Q);
+        }
+        heartbeat->Progress(pts_us);
+    }
     return 0;
 }
 
 /**
- * @brief 停止解复用线程
- * @return 成功返回0
+ * @brief 根据数据包所属的流类型，分发到相应的队列，其他流的数据包直接释放
+ * @param packet 数据包，分发后引用被移走
  */
-int DemuxThread::Stop()
+void DemuxThread::dispatch(AVPacket *packet)
 {
-    printf("%s(%d)\n", __FUNCTION__, __LINE__);
-    // 调用基类的Stop方法，设置abort_标志并等待线程结束
-    Thread::Stop();
-    return 0;
+    if(skip_to_key_) {
+        // 音频也一起丢，和视频从同一位置开始
+        if(packet->stream_index != video_stream_ || !(packet->flags & AV_PKT_FLAG_KEY)) {
+            av_packet_unref(packet);
+            return;
+        }
+        skip_to_key_ = false;
+    }
+    if(packet->stream_index == audio_stream_) {  // 音频包队列
+        TRACE_SCOPE("packet_queue_push", "audio", packet->pts);
+        if(stats_) {
+            stats_->recorder.Record(FLIGHT_PACKET_READ, FLIGHT_STREAM_AUDIO, packet->pts, packet->size);
+        }
+        if(packet->pts != AV_NOPTS_VALUE) {
+            audio_pts_us_ = av_rescale_q(packet->pts, AudioStreamTimebase(), AV_TIME_BASE_Q);
+        }
+        audio_queue_->Push(packet);
+    } else if(packet->stream_index == video_stream_) {  // 视频包队列
+        TRACE_SCOPE("packet_queue_push", "video", packet->pts);
+        if(stats_) {
+            stats_->recorder.Record(FLIGHT_PACKET_READ, FLIGHT_STREAM_VIDEO, packet->pts, packet->size);
+        }
+        if(packet->pts != AV_NOPTS_VALUE) {
+            video_pts_us_ = av_rescale_q(packet->pts, VideoStreamTimebase(), AV_TIME_BASE_Q);
+        }
+        video_queue_->Push(packet);
+    } else {
+        // 其他类型的流，直接释放数据包
+        av_packet_unref(packet);
+    }
 }
 
 /**
- * @brief 解复用线程主函数
- * 
- * 从媒体文件读取数据包，根据流类型分发到音频或视频队列
+ * @brief 倒放时读一个视频包：每个GOP先seek到它的关键帧，读到下一个GOP的关键帧为止，
+ *        之后放一个空包作为GOP的结尾，再seek到更早的关键帧
+ * @return TASK_PROGRESS读到一个包，TASK_IDLE队列已满，TASK_DONE已读完文件开头的GOP或出错
  */
-void DemuxThread::Run()
+int DemuxThread::reverseStep()
 {
-    printf("DemuxThread::Run() into\n");
-    
-    AVPacket packet;
-    int ret = 0;
-    
-    // 主解复用循环
-    while(1) {
-        // 检查是否需要退出
-        if(abort_ == 1) {
-            break;
-        }
-        
-        // 如果队列已满，等待一段时间再继续
-        if(audio_queue_->Size() > 100 || video_queue_->Size() > 100) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            continue;
-        }
-        
-        // 读取一个数据包
-        ret = av_read_frame(ifmt_ctx_, &packet);
+    StageHeartbeat *heartbeat = stats_ ? &stats_->heartbeats[STAGE_DEMUX] : NULL;
+    if(video_queue_->Size() > DEMUX_MAX_PACKETS) {
+        if(heartbeat) {
+            heartbeat->SetThrottled(true);
+        }
+        return TASK_IDLE;
+    }
+    if(heartbeat) {
+        heartbeat->SetThrottled(false);
+    }
+    AVStream *stream = ifmt_ctx_->streams[video_stream_];
+    int64_t first_pts = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    if(!reverse_reading_) {
+        if(reverse_end_ <= first_pts) {
+            return reverseDone();
+        }
+        reverse_target_ = reverse_end_ - reverse_back_ < first_pts ? first_pts : reverse_end_ - reverse_back_;
+        int ret = av_seek_frame(ifmt_ctx_, video_stream_, reverse_target_, AVSEEK_FLAG_BACKWARD);
         if(ret < 0) {
             av_strerror(ret, err2str, sizeof(err2str));
-            printf("%s(%d) av_read_frame failed:%d, %s\n", __FUNCTION__, __LINE__, ret, err2str);
-            break;
-        }
-        
-        // 根据数据包所属的流类型，分发到相应的队列
-        if(packet.stream_index == audio_stream_) {  // 音频包队列
-            audio_queue_->Push(&packet);
-//            printf("audio pkt size:%d\n", audio_queue_->Size());
-        } else if(packet.stream_index == video_stream_) {  // 视频包队列
-            video_queue_->Push(&packet);
-//            printf("video pkt size:%d\n", video_queue_->Size());
-        } else {
-            // 其他类型的流，直接释放数据包
+            LOG_ERROR("%s(%d) av_seek_frame failed:%d, %s\n", __FUNCTION__, __LINE__, ret, err2str);
+            return TASK_DONE;
+        }
+        reverse_reading_ = true;
+        reverse_key_ = AV_NOPTS_VALUE;
+    }
+    AVPacket packet;
+    if(readPacket(&packet) < 0) {
+        if(interrupt_ && interrupt_->load()) {
+            return TASK_DONE;
+        }
+        // 从文件最后一个GOP开始倒放时读到结尾，这个GOP到此为止
+        if(heartbeat) {
+            heartbeat->SetEof(false);
+        }
+        if(reverse_key_ == AV_NOPTS_VALUE) {
+            return TASK_DONE;
+        }
+        endSegment();
+        return TASK_PROGRESS;
+    }
+    int64_t pts = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+    bool key = (packet.flags & AV_PKT_FLAG_KEY) != 0;
+    if(packet.stream_index != video_stream_ || pts == AV_NOPTS_VALUE) {
+        av_packet_unref(&packet);
+        return TASK_PROGRESS;
+    }
+    if(reverse_key_ == AV_NOPTS_VALUE) {
+        // seek到关键帧之前时先丢到关键帧
+        if(!key) {
+            av_packet_unref(&packet);
+            return TASK_PROGRESS;
+        }
+        if(pts >= reverse_end_) {
+            // 索引不精确落回了上一个GOP，往前多退一些再seek；已经从开头seek过说明前面没有GOP了
             av_packet_unref(&packet);
+            if(reverse_target_ <= first_pts) {
+                return reverseDone();
+            }
+            reverse_back_ = reverse_back_ > 1 ? reverse_back_ * 2 : av_rescale_q(1000000, AV_TIME_BASE_Q, stream->time_base);
+            reverse_reading_ = false;
+            return TASK_PROGRESS;
         }
+        reverse_key_ = pts;
+    } else if(key && pts >= reverse_end_) {
+        av_packet_unref(&packet);
+        endSegment();
+        return TASK_PROGRESS;
     }
-    
-    // 资源释放移到析构函数中，避免重复关闭
-    printf("DemuxThread::Run() leave\n");
+    dispatch(&packet);
+    return TASK_PROGRESS;
+}
+
+/**
+ * @brief 已经读完文件开头的GOP，和正常播放读到结尾一样标记EOF
+ */
+int DemuxThread::reverseDone()
+{
+    LOG_INFO("reverse reached start at %lld\n", (long long)reverse_end_);
+    if(stats_) {
+        stats_->heartbeats[STAGE_DEMUX].SetEof(true);
+    }
+    return TASK_DONE;
+}
+
+/**
+ * @brief 当前GOP读完，放一个空包告诉解码端，下一次从这个GOP的关键帧之前找
+ */
+void DemuxThread::endSegment()
+{
+    AVPacket *marker = av_packet_alloc();
+    video_queue_->Push(marker);
+    av_packet_free(&marker);
+    reverse_end_ = reverse_key_;
+    reverse_back_ = 1;
+    reverse_reading_ = false;
+}
+
+/**
+ * @brief 正常读到结尾(不是被中断)时给两个队列各放一个空包，解码端据此取出解码器中剩余的帧
+ */
+void DemuxThread::endOfStream()
+{
+    if(interrupt_ && interrupt_->load()) {
+        return;
+    }
+    AVPacketQueue *queues[2] = {audio_queue_, video_queue_};
+    for(AVPacketQueue *queue : queues) {
+        AVPacket *marker = av_packet_alloc();
+        queue->Push(marker);
+        av_packet_free(&marker);
+    }
+}
+
+/**
+ * @brief 截止时间：音视频两路中已读数据领先播放位置最少的那一路即将被取空的时间
+ * @return 单调时钟微秒，不知道播放位置时返回当前时间
+ */
+int64_t DemuxThread::Deadline()
+{
+    int64_t now = PipelineStats::NowMicroseconds();
+    if(!stats_) {
+        return now;
+    }
+    int64_t audio_lead = LeadUs(audio_pts_us_.load(), stats_->heartbeats[STAGE_AUDIO_OUTPUT].PtsUs());
+    int64_t video_lead = LeadUs(video_pts_us_.load(), stats_->heartbeats[STAGE_VIDEO_OUTPUT].PtsUs());
+    return now + stats_->MediaToWallUs(audio_lead < video_lead ? audio_lead : video_lead);
 }
 
 /**
@@ -219,3 +451,158 @@ AVRational DemuxThread::VideoStreamTimebase()
         return tb;
     }
 }
+
+/**
+ * @brief 获取视频帧率，按容器和码流信息推测
+ * @return 视频帧率，未知时分子为0
+ */
+AVRational DemuxThread::VideoFrameRate()
+{
+    if(video_stream_ != -1) {
+        return av_guess_frame_rate(ifmt_ctx_, ifmt_ctx_->streams[video_stream_], NULL);
+    } else {
+        AVRational rate = {0, 1};
+        return rate;
+    }
+}
+
+/**
+ * @brief 获取媒体时长
+ * @return 时长，单位微秒，未知时返回0
+ */
+int64_t DemuxThread::Duration()
+{
+    if(!ifmt_ctx_ || ifmt_ctx_->duration == AV_NOPTS_VALUE) {
+        return 0;
+    }
+    return ifmt_ctx_->duration;
+}
+
+/**
+ * @brief 获取第一个包的时间戳，MPEG-TS、带编辑列表的MP4等不从0开始
+ * @return 单位微秒，未知时返回0
+ */
+int64_t DemuxThread::StartTime()
+{
+    if(!ifmt_ctx_ || ifmt_ctx_->start_time == AV_NOPTS_VALUE) {
+        return 0;
+    }
+    return ifmt_ctx_->start_time;
+}
+
+/**
+ * @brief 跳转到指定位置之前最近的关键帧，必须在任务从TaskExecutor移除后调用
+ * @param position_us 目标位置，单位微秒，和流的时间戳在同一时间轴上(包含StartTime)
+ * @return 成功返回0，失败返回负值
+ */
+int DemuxThread::Seek(int64_t position_us)
+{
+    if(!ifmt_ctx_) {
+        return -1;
+    }
+    reverse_ = false;
+    int ret = avformat_seek_file(ifmt_ctx_, -1, INT64_MIN, position_us, position_us, 0);
+    if(ret < 0) {
+        av_strerror(ret, err2str, sizeof(err2str));
+        LOG_ERROR("%s(%d) avformat_seek_file failed:%d, %s\n", __FUNCTION__, __LINE__, ret, err2str);
+        return -1;
+    }
+    if(stats_) {
+        stats_->heartbeats[STAGE_DEMUX].SetEof(false);
+    }
+    audio_pts_us_ = INT64_MIN;
+    video_pts_us_ = INT64_MIN;
+#ifdef SPARK_COROUTINE
+    // 协程可能挂起在等待队列空位处，从头开始
+    coroutine_ = run();
+#endif
+    return 0;
+}
+
+/**
+ * @brief 从指定位置开始倒放，只读视频包，按GOP从后往前读；之后调用Seek回到正常读取，必须在任务从TaskExecutor移除后调用
+ * @param position_us 开始位置，单位微秒，从包含它的GOP开始
+ * @return 成功返回0，失败返回负值
+ *
+ * 每个GOP的数据包之后跟一个空包(data为NULL，size为0)作为结尾，解码端据此把整个GOP解完再倒序送出
+ */
+int DemuxThread::SeekReverse(int64_t position_us)
+{
+    if(!ifmt_ctx_) {
+        return -1;
+    }
+    reverse_ = true;
+    reverse_reading_ = false;
+    // 开始位置正好是关键帧时，从这个GOP开始
+    reverse_end_ = av_rescale_q(position_us, AV_TIME_BASE_Q, VideoStreamTimebase()) + 1;
+    reverse_key_ = AV_NOPTS_VALUE;
+    reverse_back_ = 0;
+    if(stats_) {
+        stats_->heartbeats[STAGE_DEMUX].SetEof(false);
+    }
+    audio_pts_us_ = INT64_MIN;
+    video_pts_us_ = INT64_MIN;
+    return 0;
+}
+
+/**
+ * @brief 设置统计对象，在Submit之前调用
+ * @param stats 统计对象指针，可以为NULL
+ */
+void DemuxThread::SetStats(PipelineStats *stats)
+{
+    stats_ = stats;
+}
+
+/**
+ * @brief 设置中断标志，在Init之前调用
+ * @param interrupt 由调用方持有，置为true时正在阻塞的avformat_open_input/av_read_frame等尽快返回，可以为NULL
+ */
+void DemuxThread::SetInterrupt(const std::atomic<bool> *interrupt)
+{
+    interrupt_ = interrupt;
+}
+
+/**
+ * @brief 设置低延时模式，在Init之前调用
+ * @param low_latency true时少量探测、不缓存探测的数据包，用于直播源
+ */
+void DemuxThread::SetLowLatency(bool low_latency)
+{
+    low_latency_ = low_latency;
+}
+
+/**
+ * @brief 丢弃之后读到的数据包，直到下一个视频关键帧，必须在任务从TaskExecutor移除后调用
+ */
+void DemuxThread::SkipToKeyframe()
+{
+    skip_to_key_ = true;
+}
+
+/**
+ * @brief 最近读到的音频包时间戳，可以在任意线程调用
+ * @return 单位微秒，还没读到或seek之后返回INT64_MIN
+ */
+int64_t DemuxThread::AudioPtsUs()
+{
+    return audio_pts_us_;
+}
+
+/**
+ * @brief 最近读到的视频包时间戳，可以在任意线程调用
+ * @return 单位微秒，还没读到或seek之后返回INT64_MIN
+ */
+int64_t DemuxThread::VideoPtsUs()
+{
+    return video_pts_us_;
+}
+
+/**
+ * @brief FFmpeg在阻塞IO中周期性调用，返回非0时中止当前调用
+ */
+int DemuxThread::interruptCallback(void *opaque)
+{
+    DemuxThread *demux = (DemuxThread *)opaque;
+    return demux->interrupt_ && demux->interrupt_->load() ? 1 : 0;
+}
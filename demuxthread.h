@@ -1,8 +1,10 @@
 ﻿#ifndef DEMUXTHREAD_H
 #define DEMUXTHREAD_H
+#include <atomic>
 #include <iostream>
-#include "thread.h"
+#include "taskexecutor.h"
 #include "avpacketqueue.h"
+#include "costage.h"
 #ifdef __cplusplus
 extern "C" { // 大写的C
 #include "libavutil/avutil.h"
@@ -10,15 +12,23 @@ extern "C" { // 大写的C
 }
 #endif
 
-class DemuxThread : public Thread
+// 任意一个数据包队列超过该数量时暂停读取
+#define DEMUX_MAX_PACKETS 100
+// 低延时模式下探测码流信息最多读取的字节数和时长
+#define DEMUX_LOW_LATENCY_PROBESIZE 32768
+#define DEMUX_LOW_LATENCY_ANALYZE_US 100000
+
+/**
+ * 解复用任务：每次Step读一个数据包放入音频或视频队列，队列满时挂起，下游取走数据包后被唤醒
+ */
+class DemuxThread : public Task
 {
 public:
     DemuxThread(AVPacketQueue *audio_queue, AVPacketQueue *video_queue);
     virtual ~DemuxThread();
     int Init(const char *url);
-    virtual int Start();
-    virtual int Stop();
-    virtual void Run();
+    virtual int Step();
+    virtual int64_t Deadline();
 
     AVCodecParameters *AudioCodecParameters();
     AVCodecParameters *VideoCodecParameters();
@@ -26,7 +36,31 @@ public:
     AVRational AudioStreamTimebase();
 
     AVRational VideoStreamTimebase();
+    AVRational VideoFrameRate();
+    int64_t Duration();
+    int64_t StartTime();
+    int Seek(int64_t position_us);
+    int SeekReverse(int64_t position_us);
+    void SetStats(PipelineStats *stats);
+    void SetInterrupt(const std::atomic<bool> *interrupt);
+    void SetLowLatency(bool low_latency);
+    void SkipToKeyframe();
+    int64_t AudioPtsUs();
+    int64_t VideoPtsUs();
 private:
+    static int interruptCallback(void *opaque);
+    bool queueFull();
+    int readPacket(AVPacket *packet);
+    void dispatch(AVPacket *packet);
+    int reverseStep();
+    void endSegment();
+    void endOfStream();
+    int reverseDone();
+#ifdef SPARK_COROUTINE
+    CoStage run();
+    CoStage coroutine_;
+#endif
+
     std::string url_;
     AVFormatContext *ifmt_ctx_ = NULL;
     char err2str[256] = {0};
@@ -34,6 +68,18 @@ private:
     int video_stream_ = -1;
     AVPacketQueue *audio_queue_ = NULL;
     AVPacketQueue *video_queue_ = NULL;
+    PipelineStats *stats_ = NULL;
+    const std::atomic<bool> *interrupt_ = NULL;   // 为true时阻塞中的打开/读取立即返回AVERROR_EXIT
+    bool low_latency_ = false;
+    bool skip_to_key_ = false;           // 丢弃数据包直到下一个视频关键帧
+    bool reverse_ = false;               // 倒放：从后往前逐个GOP读视频包，丢弃音频
+    bool reverse_reading_ = false;       // 已seek到当前GOP，正在读它的数据包
+    int64_t reverse_end_ = AV_NOPTS_VALUE;    // 当前GOP读到这个时间戳的关键帧为止(视频流时间基准)，即上一个GOP的起点
+    int64_t reverse_key_ = AV_NOPTS_VALUE;    // 当前GOP的关键帧，还没读到时为AV_NOPTS_VALUE
+    int64_t reverse_back_ = 0;                // seek目标比reverse_end_提前的量，落回同一个关键帧时加倍
+    int64_t reverse_target_ = AV_NOPTS_VALUE; // 当前GOP的seek目标
+    std::atomic<int64_t> audio_pts_us_{INT64_MIN};   // 最近读到的音频包时间戳，用于计算截止时间和缓冲时长
+    std::atomic<int64_t> video_pts_us_{INT64_MIN};
 };
 
 #endif // DEMUXTHREAD_H
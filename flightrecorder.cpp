@@ -0,0 +1,178 @@
+﻿#include "flightrecorder.h"
+#include "log.h"
+#include <stdio.h>
+#include <signal.h>
+#include <chrono>
+
+// SIGUSR1计数，所有FlightRecorder实例的后台线程各自比较，不需要在信号处理函数里加锁
+static std::atomic<uint64_t> g_flight_signal_count{0};
+
+#ifdef SIGUSR1
+typedef void (*SignalHandler)(int);
+static SignalHandler g_prev_handler = SIG_DFL;
+
+/**
+ * @brief SIGUSR1处理函数，只做计数，并转给之前注册的处理函数(如Tracer)
+ */
+static void flight_signal_handler(int sig)
+{
+    g_flight_signal_count.fetch_add(1);
+    if(g_prev_handler != SIG_DFL && g_prev_handler != SIG_IGN && g_prev_handler != SIG_ERR) {
+        g_prev_handler(sig);
+    }
+}
+#endif
+
+static const char *flight_event_name(int type)
+{
+    static const char *names[FLIGHT_EVENT_TYPES] = {
+        "packet_read", "frame_decoded", "frame_presented", "frame_dropped",
+        "audio_underrun", "clock_update", "stall", "vblank"
+    };
+    if(type < 0 || type >= FLIGHT_EVENT_TYPES) {
+        return "unknown";
+    }
+    return names[type];
+}
+
+static int64_t flight_now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+FlightRecorder::FlightRecorder()
+{
+    SetOptions(ThreadOptions("flight"));
+}
+
+FlightRecorder::~FlightRecorder()
+{
+    Stop();
+}
+
+/**
+ * @brief 初始化导出参数，不调用也可以记录，只是不会写文件
+ * @param path_prefix 导出文件前缀，文件名为 前缀-序号-原因.jsonl
+ * @param min_dump_interval_ms 两次自动导出的最小间隔，避免连续欠载时反复写盘
+ * @return 成功返回0，失败返回负值
+ */
+int FlightRecorder::Init(const char *path_prefix, int min_dump_interval_ms)
+{
+    if(!path_prefix) {
+        LOG_ERROR("%s(%d) path_prefix is null\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    path_prefix_ = path_prefix;
+    if(min_dump_interval_ms >= 0) {
+        min_dump_interval_us_ = min_dump_interval_ms * 1000LL;
+    }
+#ifdef SIGUSR1
+    static std::atomic<bool> installed{false};
+    if(!installed.exchange(true)) {
+        g_prev_handler = signal(SIGUSR1, flight_signal_handler);
+    }
+#endif
+    signal_seen_ = g_flight_signal_count.load();
+    return 0;
+}
+
+/**
+ * @brief 后台线程主函数，处理触发请求和信号
+ */
+void FlightRecorder::Run()
+{
+    do {
+        uint64_t signal_count = g_flight_signal_count.load();
+        if(signal_count != signal_seen_) {
+            signal_seen_ = signal_count;
+            Dump("signal");     // 手动请求不受最小间隔限制
+        }
+        const char *reason = trigger_reason_.exchange(nullptr);
+        if(reason) {
+            int64_t now = flight_now_us();
+            if(last_dump_us_ == 0 || now - last_dump_us_ >= min_dump_interval_us_) {
+                Dump(reason);
+            } else {
+                LOG_DEBUG("flight recorder skip dump %s\n", reason);
+            }
+        }
+    } while(waitFor(50));
+}
+
+/**
+ * @brief 记录一个事件，无锁，可以在音频回调中调用
+ * @param type 事件类型FlightEventType
+ * @param stream 所属流FLIGHT_STREAM_XXX
+ * @param pts 时间戳，使用流的time_base
+ * @param value 附加值，含义见FlightEventType
+ * @param value2 附加值，含义见FlightEventType
+ */
+void FlightRecorder::Record(int type, int stream, int64_t pts, double value, double value2)
+{
+    uint64_t index = head_.fetch_add(1, std::memory_order_relaxed);
+    FlightEvent &event = events_[index & (FLIGHT_RECORDER_CAPACITY - 1)];
+    event.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    event.time_us.store(flight_now_us(), std::memory_order_relaxed);
+    event.type.store(type, std::memory_order_relaxed);
+    event.stream.store(stream, std::memory_order_relaxed);
+    event.pts.store(pts, std::memory_order_relaxed);
+    event.value.store(value, std::memory_order_relaxed);
+    event.value2.store(value2, std::memory_order_relaxed);
+    event.seq.store(index + 1, std::memory_order_release);
+}
+
+/**
+ * @brief 请求导出，只置标志，可以在音频回调中调用
+ * @param reason 原因，必须是静态字符串
+ */
+void FlightRecorder::Trigger(const char *reason)
+{
+    trigger_reason_.store(reason);
+}
+
+/**
+ * @brief 把环形缓冲区里的事件按时间顺序写到文件，每行一个json
+ * @param reason 导出原因，写在第一行并作为文件名的一部分
+ * @return 成功返回0，失败返回负值
+ */
+int FlightRecorder::Dump(const char *reason)
+{
+    if(path_prefix_.empty()) {
+        return -1;
+    }
+    last_dump_us_ = flight_now_us();
+    char path[512];
+    snprintf(path, sizeof(path), "%s-%d-%s.jsonl", path_prefix_.c_str(), ++dump_count_, reason);
+    FILE *fp = fopen(path, "w");
+    if(!fp) {
+        LOG_ERROR("%s(%d) open %s failed\n", __FUNCTION__, __LINE__, path);
+        return -1;
+    }
+    uint64_t head = head_.load(std::memory_order_acquire);
+    uint64_t begin = head > FLIGHT_RECORDER_CAPACITY ? head - FLIGHT_RECORDER_CAPACITY : 0;
+    fprintf(fp, "{\"reason\":\"%s\",\"time_us\":%lld,\"events\":%llu}\n",
+            reason, (long long)last_dump_us_, (unsigned long long)(head - begin));
+    for(uint64_t i = begin; i < head; i++) {
+        FlightEvent &event = events_[i & (FLIGHT_RECORDER_CAPACITY - 1)];
+        if(event.seq.load(std::memory_order_acquire) != i + 1) {
+            continue;   // 正在写或已被覆盖
+        }
+        int64_t time_us = event.time_us.load(std::memory_order_relaxed);
+        int type = event.type.load(std::memory_order_relaxed);
+        int stream = event.stream.load(std::memory_order_relaxed);
+        int64_t pts = event.pts.load(std::memory_order_relaxed);
+        double value = event.value.load(std::memory_order_relaxed);
+        double value2 = event.value2.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(event.seq.load(std::memory_order_relaxed) != i + 1) {
+            continue;
+        }
+        fprintf(fp, "{\"time_us\":%lld,\"type\":\"%s\",\"stream\":%d,\"pts\":%lld,\"value\":%.6f,\"value2\":%.6f}\n",
+                (long long)time_us, flight_event_name(type), stream, (long long)pts, value, value2);
+    }
+    fclose(fp);
+    LOG_WARN("flight recorder dump(%s) to %s\n", reason, path);
+    return 0;
+}
@@ -0,0 +1,65 @@
+﻿#ifndef FLIGHTRECORDER_H
+#define FLIGHTRECORDER_H
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include "thread.h"
+
+#define FLIGHT_RECORDER_CAPACITY 4096   // 保留最近的事件条数，必须是2的幂
+
+enum FlightEventType {
+    FLIGHT_PACKET_READ = 0,   // value:包大小
+    FLIGHT_FRAME_DECODED,
+    FLIGHT_FRAME_PRESENTED,   // value:与音频时钟的差值(秒)
+    FLIGHT_FRAME_DROPPED,     // value:与音频时钟的差值(秒)
+    FLIGHT_AUDIO_UNDERRUN,
+    FLIGHT_CLOCK_UPDATE,      // value:新的时钟值(秒)，value2:更新前的时钟值(秒)
+    FLIGHT_STALL,             // value:卡顿原因StallCause
+    FLIGHT_VBLANK,            // 按vblank显示时每个vblank的选择，value:1换新帧/0重复上一帧，value2:跳过的帧数
+    FLIGHT_EVENT_TYPES
+};
+
+// 事件所属的流
+#define FLIGHT_STREAM_NONE  -1
+#define FLIGHT_STREAM_AUDIO 0
+#define FLIGHT_STREAM_VIDEO 1
+
+// 各字段都是relaxed原子变量，读者靠seq判断读到的是否是完整的一条
+struct FlightEvent
+{
+    std::atomic<uint64_t> seq{0};   // 写入序号+1，0表示正在写
+    std::atomic<int64_t> time_us{0};
+    std::atomic<int> type{0};
+    std::atomic<int> stream{0};
+    std::atomic<int64_t> pts{0};
+    std::atomic<double> value{0};
+    std::atomic<double> value2{0};
+};
+
+/**
+ * 飞行记录仪：固定大小的无锁环形缓冲区，常开记录管线事件，
+ * 出现欠载、音画差过大、卡顿或收到SIGUSR1时由后台线程把最近的事件写到磁盘
+ */
+class FlightRecorder : public Thread
+{
+public:
+    FlightRecorder();
+    ~FlightRecorder();
+    int Init(const char *path_prefix, int min_dump_interval_ms);
+    virtual void Run();
+
+    void Record(int type, int stream, int64_t pts, double value = 0, double value2 = 0);
+    void Trigger(const char *reason);
+    int Dump(const char *reason);
+private:
+    std::atomic<uint64_t> head_{0};
+    FlightEvent events_[FLIGHT_RECORDER_CAPACITY];
+    std::atomic<const char *> trigger_reason_{nullptr};   // 非空表示有待处理的导出请求
+    std::string path_prefix_;
+    int64_t min_dump_interval_us_ = 10000000;
+    int64_t last_dump_us_ = 0;
+    int dump_count_ = 0;
+    uint64_t signal_seen_ = 0;
+};
+
+#endif // FLIGHTRECORDER_H
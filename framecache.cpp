@@ -0,0 +1,263 @@
+﻿#include "framecache.h"
+#include "log.h"
+
+FrameCache::FrameCache()
+{
+}
+
+FrameCache::~FrameCache()
+{
+    Clear();
+}
+
+/**
+ * @brief 初始化
+ * @param budget_bytes 内存预算，所有缓存帧的缓冲大小之和超过它时淘汰
+ * @param stats 统计对象，可以为NULL
+ * @return 成功返回0，失败返回负值
+ */
+int FrameCache::Init(int64_t budget_bytes, PipelineStats *stats)
+{
+    if(budget_bytes <= 0) {
+        LOG_ERROR("%s(%d) invalid budget:%lld\n", __FUNCTION__, __LINE__, (long long)budget_bytes);
+        return -1;
+    }
+    budget_bytes_ = budget_bytes;
+    stats_ = stats;
+    return 0;
+}
+
+/**
+ * @brief 插入一帧，已有同一pts的帧时只更新使用时间，和上一次插入的帧相邻时记为相连
+ * @param frame 可以直接显示的帧，只增加缓冲的引用
+ */
+void FrameCache::Insert(const AVFrame *frame)
+{
+    if(frame->pts == AV_NOPTS_VALUE) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<int64_t, Entry>::iterator it = entries_.find(frame->pts);
+    if(it == entries_.end()) {
+        AVFrame *ref = av_frame_clone(frame);
+        if(!ref) {
+            return;
+        }
+        Entry entry;
+        entry.frame = ref;
+        entry.bytes = 0;
+        for(int i = 0; i < AV_NUM_DATA_POINTERS && ref->buf[i]; i++) {
+            entry.bytes += ref->buf[i]->size;
+        }
+        entry.prev = AV_NOPTS_VALUE;
+        entry.next = AV_NOPTS_VALUE;
+        lru_.push_front(frame->pts);
+        entry.lru = lru_.begin();
+        it = entries_.insert(std::make_pair(frame->pts, entry)).first;
+        bytes_ += entry.bytes;
+    } else {
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+    }
+    // 按时长判断中间有没有跳过的帧，不知道时长时认为相邻
+    if(last_pts_ != AV_NOPTS_VALUE && last_pts_ < frame->pts
+            && (last_duration_ <= 0 || frame->pts - last_pts_ <= last_duration_ * 3 / 2)) {
+        std::map<int64_t, Entry>::iterator last = entries_.find(last_pts_);
+        if(last != entries_.end()) {
+            link(last, it);
+        }
+    }
+    last_pts_ = frame->pts;
+    last_duration_ = frame->duration;
+    evict();
+    updateStats();
+}
+
+/**
+ * @brief 之后插入的帧和之前的不相连，seek时调用，已缓存的帧保留
+ */
+void FrameCache::Discontinuity()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    last_pts_ = AV_NOPTS_VALUE;
+    last_duration_ = 0;
+}
+
+/**
+ * @brief 释放所有缓存帧
+ */
+void FrameCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(std::map<int64_t, Entry>::iterator it = entries_.begin(); it != entries_.end(); ++it) {
+        av_frame_free(&it->second.frame);
+    }
+    entries_.clear();
+    lru_.clear();
+    bytes_ = 0;
+    last_pts_ = AV_NOPTS_VALUE;
+    updateStats();
+}
+
+/**
+ * @brief 取pts对应的帧
+ * @return 帧的新引用，调用方释放；没有缓存时返回NULL
+ */
+AVFrame *FrameCache::Find(int64_t pts)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lookup(pts);
+}
+
+/**
+ * @brief 取和pts相连的下一帧
+ * @return 帧的新引用，调用方释放；pts不在缓存中或下一帧不相连时返回NULL
+ */
+AVFrame *FrameCache::Next(int64_t pts)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<int64_t, Entry>::iterator it = entries_.find(pts);
+    return lookup(it == entries_.end() ? AV_NOPTS_VALUE : it->second.next);
+}
+
+/**
+ * @brief 取和pts相连的上一帧
+ * @return 帧的新引用，调用方释放；pts不在缓存中或上一帧不相连时返回NULL
+ */
+AVFrame *FrameCache::Prev(int64_t pts)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<int64_t, Entry>::iterator it = entries_.find(pts);
+    return lookup(it == entries_.end() ? AV_NOPTS_VALUE : it->second.prev);
+}
+
+/**
+ * @brief 不晚于pts的最后一个缓存帧，即时钟在pts时正在显示的帧
+ * @return 帧的pts，没有时返回AV_NOPTS_VALUE
+ */
+int64_t FrameCache::Floor(int64_t pts)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<int64_t, Entry>::iterator it = entries_.upper_bound(pts);
+    if(it == entries_.begin()) {
+        return AV_NOPTS_VALUE;
+    }
+    return (--it)->first;
+}
+
+/**
+ * @brief 不早于pts的第一个缓存帧
+ * @return 帧的pts，没有时返回AV_NOPTS_VALUE
+ */
+int64_t FrameCache::Ceil(int64_t pts)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<int64_t, Entry>::iterator it = entries_.lower_bound(pts);
+    return it == entries_.end() ? AV_NOPTS_VALUE : it->first;
+}
+
+/**
+ * @brief [from, to)之间要显示的帧是否都已缓存并且前后相连，A/B循环据此决定能否不解码直接重放；
+ *        不计入按帧统计的命中和未命中，整段命中的次数见loops_cached_total
+ */
+bool FrameCache::Covers(int64_t from, int64_t to)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<int64_t, Entry>::iterator it = entries_.lower_bound(from);
+    // 第一帧正好在from，或者和from之前的一帧相连，中间没有漏掉的帧
+    bool covered = it != entries_.end() && (it->first == from || it->second.prev != AV_NOPTS_VALUE);
+    while(covered && it->first < to) {
+        if(it->second.next == AV_NOPTS_VALUE) {
+            covered = false;
+            break;
+        }
+        it = entries_.find(it->second.next);
+        covered = it != entries_.end();
+    }
+    return covered;
+}
+
+/**
+ * @brief 当前缓存帧的缓冲大小之和
+ */
+int64_t FrameCache::Bytes()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+}
+
+/**
+ * @brief 取一帧并记为最近使用，统计命中和未命中，调用前已加锁
+ */
+AVFrame *FrameCache::lookup(int64_t pts)
+{
+    std::map<int64_t, Entry>::iterator it = pts == AV_NOPTS_VALUE ? entries_.end() : entries_.find(pts);
+    if(it == entries_.end()) {
+        if(stats_) {
+            stats_->frame_cache_misses.Add(1);
+        }
+        return NULL;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+    if(stats_) {
+        stats_->frame_cache_hits.Add(1);
+    }
+    return av_frame_clone(it->second.frame);
+}
+
+/**
+ * @brief 记为前后相连，两帧原来各自相连的帧不再和它们相连，调用前已加锁
+ */
+void FrameCache::link(std::map<int64_t, Entry>::iterator prev, std::map<int64_t, Entry>::iterator next)
+{
+    std::map<int64_t, Entry>::iterator old = entries_.end();
+    if(prev->second.next != next->first && (old = entries_.find(prev->second.next)) != entries_.end()
+            && old->second.prev == prev->first) {
+        old->second.prev = AV_NOPTS_VALUE;
+    }
+    if(next->second.prev != prev->first && (old = entries_.find(next->second.prev)) != entries_.end()
+            && old->second.next == next->first) {
+        old->second.next = AV_NOPTS_VALUE;
+    }
+    prev->second.next = next->first;
+    next->second.prev = prev->first;
+}
+
+/**
+ * @brief 超过预算时从最久没用的开始淘汰，至少保留刚插入的一帧，调用前已加锁
+ */
+void FrameCache::evict()
+{
+    while(bytes_ > budget_bytes_ && lru_.size() > 1) {
+        release(entries_.find(lru_.back()));
+        if(stats_) {
+            stats_->frame_cache_evictions.Add(1);
+        }
+    }
+}
+
+/**
+ * @brief 释放一帧，前后帧不再和它相连，调用前已加锁
+ */
+void FrameCache::release(std::map<int64_t, Entry>::iterator it)
+{
+    Entry &entry = it->second;
+    std::map<int64_t, Entry>::iterator neighbor = entries_.end();
+    if(entry.prev != AV_NOPTS_VALUE && (neighbor = entries_.find(entry.prev)) != entries_.end()) {
+        neighbor->second.next = AV_NOPTS_VALUE;
+    }
+    if(entry.next != AV_NOPTS_VALUE && (neighbor = entries_.find(entry.next)) != entries_.end()) {
+        neighbor->second.prev = AV_NOPTS_VALUE;
+    }
+    bytes_ -= entry.bytes;
+    lru_.erase(entry.lru);
+    av_frame_free(&entry.frame);
+    entries_.erase(it);
+}
+
+void FrameCache::updateStats()
+{
+    if(stats_) {
+        stats_->frame_cache_bytes.Set(bytes_);
+        stats_->frame_cache_frames.Set((int64_t)entries_.size());
+    }
+}
@@ -0,0 +1,64 @@
+﻿#ifndef FRAMECACHE_H
+#define FRAMECACHE_H
+#include <list>
+#include <map>
+#include <mutex>
+#include "stats.h"
+#ifdef __cplusplus
+extern "C" {
+#include "libavutil/frame.h"
+}
+#endif
+
+// 默认的内存预算，单位MB
+#define FRAME_CACHE_DEFAULT_MB 256
+
+/**
+ * 已解码视频帧的缓存：按pts保存可以直接显示的帧(引用解码或转换后的缓冲，不拷贝)，
+ * 总大小超过预算时淘汰最久没用的帧，用于逐帧步进和A/B循环
+ *
+ * 按解码顺序相邻插入的两帧记为前后相连，只有相连的帧才能直接前后步进，
+ * seek之后或者两帧之间隔了不止一帧(倍速跳过非参考帧)时不相连；可以在任意线程调用
+ */
+class FrameCache
+{
+public:
+    FrameCache();
+    ~FrameCache();
+    int Init(int64_t budget_bytes, PipelineStats *stats);
+    void Insert(const AVFrame *frame);
+    void Discontinuity();
+    void Clear();
+    AVFrame *Find(int64_t pts);
+    AVFrame *Next(int64_t pts);
+    AVFrame *Prev(int64_t pts);
+    int64_t Floor(int64_t pts);
+    int64_t Ceil(int64_t pts);
+    bool Covers(int64_t from, int64_t to);
+    int64_t Bytes();
+private:
+    // 一帧缓存，prev/next为相连的前后帧的pts，不相连时为AV_NOPTS_VALUE
+    struct Entry {
+        AVFrame *frame;
+        int64_t bytes;
+        int64_t prev;
+        int64_t next;
+        std::list<int64_t>::iterator lru;
+    };
+    AVFrame *lookup(int64_t pts);
+    void link(std::map<int64_t, Entry>::iterator prev, std::map<int64_t, Entry>::iterator next);
+    void evict();
+    void release(std::map<int64_t, Entry>::iterator it);
+    void updateStats();
+
+    std::mutex mutex_;
+    std::map<int64_t, Entry> entries_;
+    std::list<int64_t> lru_;             // 最近用过的在前面
+    int64_t budget_bytes_ = (int64_t)FRAME_CACHE_DEFAULT_MB << 20;
+    int64_t bytes_ = 0;
+    int64_t last_pts_ = AV_NOPTS_VALUE;  // 上一次插入的帧，下一帧和它相连
+    int64_t last_duration_ = 0;
+    PipelineStats *stats_ = NULL;
+};
+
+#endif // FRAMECACHE_H
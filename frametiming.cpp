@@ -0,0 +1,63 @@
+﻿#include "frametiming.h"
+
+/**
+ * @brief 计算帧的显示时间和与时钟的差
+ * @param frame 视频帧
+ * @param time_base 视频流时间基准
+ * @param clock 播放时钟，按vblank显示时为该vblank对应的时钟，单位秒
+ */
+FrameTiming::FrameTiming(const AVFrame *frame, AVRational time_base, double clock)
+{
+    pts = frame->pts * av_q2d(time_base);
+    diff = pts - clock;
+    duration = frame->duration > 0 ? frame->duration * av_q2d(time_base) : FRAME_DEFAULT_DURATION;
+}
+
+/**
+ * @brief 决定等待、丢弃还是显示
+ * @param rate 播放速率
+ * @return FrameAction
+ */
+int FrameTiming::Action(double rate) const
+{
+    if(diff > 0) {
+        return FRAME_WAIT;
+    }
+    // 倍速时显示跟不上，下一帧也已经到时间了，当前帧不上传直接丢弃
+    if(rate > 1.0 && diff < -duration) {
+        return FRAME_DROP;
+    }
+    return FRAME_SHOW;
+}
+
+/**
+ * @brief 记录一帧被丢弃
+ * @param stats 统计对象，可以为NULL
+ */
+void RecordFrameDropped(PipelineStats *stats, const AVFrame *frame, const FrameTiming &timing)
+{
+    if(!stats) {
+        return;
+    }
+    stats->frames_dropped.Add(1);
+    stats->recorder.Record(FLIGHT_FRAME_DROPPED, FLIGHT_STREAM_VIDEO, frame->pts, timing.diff);
+    stats->heartbeats[STAGE_VIDEO_OUTPUT].Progress((int64_t)(timing.pts * 1000000));
+}
+
+/**
+ * @brief 记录一帧已显示，显示时已经落后时钟超过一帧的时长记为迟到帧
+ * @param stats 统计对象，可以为NULL
+ */
+void RecordFrameShown(PipelineStats *stats, const AVFrame *frame, const FrameTiming &timing)
+{
+    if(!stats) {
+        return;
+    }
+    if(timing.diff < -timing.duration) {
+        stats->frames_late.Add(1);
+    }
+    stats->recorder.Record(FLIGHT_FRAME_PRESENTED, FLIGHT_STREAM_VIDEO, frame->pts, timing.diff);
+    stats->frames_presented.Add(1);
+    stats->MarkFirstFrame();
+    stats->heartbeats[STAGE_VIDEO_OUTPUT].Progress((int64_t)(timing.pts * 1000000));
+}
@@ -0,0 +1,33 @@
+﻿#ifndef FRAMETIMING_H
+#define FRAMETIMING_H
+#include "avframequeue.h"
+#include "stats.h"
+
+// 帧没有时长时按25fps处理
+#define FRAME_DEFAULT_DURATION 0.04
+
+// 输出端对队首视频帧的处理
+enum FrameAction {
+    FRAME_WAIT = 0,   // 还没到显示时间
+    FRAME_DROP,       // 倍速时来不及显示，不上传直接丢弃
+    FRAME_SHOW        // 到达或超过显示时间，显示
+};
+
+/**
+ * 视频帧相对播放时钟的时间，VideoOutput、MosaicOutput和HeadlessOutput按同一规则决定等待、丢弃还是显示，
+ * 并按同一方式记录统计、飞行记录和心跳
+ */
+struct FrameTiming
+{
+    FrameTiming(const AVFrame *frame, AVRational time_base, double clock);
+    int Action(double rate) const;
+
+    double pts;        // 帧的显示时间，单位秒
+    double diff;       // 与时钟的差，单位秒，大于0表示还没到时间
+    double duration;   // 帧时长，单位秒
+};
+
+void RecordFrameDropped(PipelineStats *stats, const AVFrame *frame, const FrameTiming &timing);
+void RecordFrameShown(PipelineStats *stats, const AVFrame *frame, const FrameTiming &timing);
+
+#endif // FRAMETIMING_H
@@ -0,0 +1,207 @@
+﻿#include "headlessoutput.h"
+#include "frametiming.h"
+#include "log.h"
+#include "trace.h"
+
+// 最长等待时间，和VideoOutput的刷新间隔一致
+#define HEADLESS_REFRESH_RATE 0.01
+
+/**
+ * @brief 构造函数
+ * @param avsync 音视频同步器指针
+ * @param audio_queue 音频帧队列
+ * @param video_queue 视频帧队列，为NULL时只取走音频
+ * @param audio_time_base 音频流时间基准
+ * @param video_time_base 视频流时间基准
+ */
+HeadlessOutput::HeadlessOutput(AVSync *avsync, AVFrameQueue *audio_queue, AVFrameQueue *video_queue,
+                               AVRational audio_time_base, AVRational video_time_base):
+    avsync_(avsync), audio_queue_(audio_queue), video_queue_(video_queue),
+    audio_time_base_(audio_time_base), video_time_base_(video_time_base)
+{
+}
+
+HeadlessOutput::~HeadlessOutput()
+{
+}
+
+/**
+ * @brief 取走到期的帧，可以被多个播放器共用的刷新线程调用
+ * @param remain_time 返回下一帧应该等待的时间，单位秒
+ */
+void HeadlessOutput::Refresh(double &remain_time)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    remain_time = HEADLESS_REFRESH_RATE;
+    double clock = avsync_->GetClock();
+    consumeAudio(clock);
+    consumeVideo(clock, remain_time);
+}
+
+/**
+ * @brief 丢弃两个帧队列中的所有帧，用于seek
+ */
+void HeadlessOutput::Flush()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    audio_queue_->Flush();
+    if(video_queue_) {
+        video_queue_->Flush();
+    }
+    tempo_.Reset();
+    pacer_.Reset();
+}
+
+/**
+ * @brief 逐帧步进：记为显示到该帧，队列里不晚于它的帧丢弃
+ * @param frame 要显示的帧
+ */
+void HeadlessOutput::ShowFrame(const AVFrame *frame)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    AVFrame *front = NULL;
+    while(video_queue_ && (front = video_queue_->Front()) && front->pts <= frame->pts) {
+        front = video_queue_->Pop(0);
+        av_frame_free(&front);
+    }
+    if(stats_) {
+        stats_->heartbeats[STAGE_VIDEO_OUTPUT].Progress((int64_t)(frame->pts * av_q2d(video_time_base_) * 1000000));
+    }
+}
+
+/**
+ * @brief 设置播放速率，可以在任意线程调用
+ * @param rate 1.0为原速
+ */
+void HeadlessOutput::SetRate(double rate)
+{
+    tempo_.SetRate(rate);
+}
+
+/**
+ * @brief 按模拟的vblank取走视频帧，用于在无窗口时验证按vblank显示的节奏，在SetStats之后、Refresh之前调用
+ * @param refresh_hz 模拟的刷新率
+ */
+void HeadlessOutput::SetVsync(double refresh_hz)
+{
+    pacer_.Init(refresh_hz, true, stats_);
+}
+
+/**
+ * @brief 设置统计对象，在Refresh之前调用
+ * @param stats 统计对象指针，可以为NULL
+ */
+void HeadlessOutput::SetStats(PipelineStats *stats)
+{
+    stats_ = stats;
+}
+
+/**
+ * @brief 取走所有pts不晚于时钟的音频帧，相当于声卡已经播放完
+ */
+void HeadlessOutput::consumeAudio(double clock)
+{
+    StageHeartbeat *heartbeat = stats_ ? &stats_->heartbeats[STAGE_AUDIO_OUTPUT] : NULL;
+    if(heartbeat) {
+        heartbeat->Beat();
+    }
+    while(true) {
+        AVFrame *frame = audio_queue_->Front();
+        if(!frame || frame->pts * av_q2d(audio_time_base_) > clock) {
+            break;
+        }
+        double pts = frame->pts * av_q2d(audio_time_base_);
+        frame = audio_queue_->Pop(0);
+        stretch(frame);
+        av_frame_free(&frame);
+        if(heartbeat) {
+            heartbeat->Progress((int64_t)(pts * 1000000));
+        }
+    }
+}
+
+/**
+ * @brief 倍速时和AudioOutput一样经过atempo再丢弃，使压测的CPU占用包含变速的开销
+ */
+void HeadlessOutput::stretch(AVFrame *frame)
+{
+    if(!tempo_.Active()) {
+        tempo_.Reset();
+        return;
+    }
+    if(tempo_.Send(frame) < 0) {
+        return;
+    }
+    AVFrame *out = av_frame_alloc();
+    while(tempo_.Receive(out) == 0) {
+        av_frame_unref(out);
+    }
+    av_frame_free(&out);
+}
+
+/**
+ * @brief 和VideoOutput::videoRefresh相同的显示判断，只是不上传纹理
+ */
+void HeadlessOutput::consumeVideo(double clock, double &remain_time)
+{
+    // 视频交给MosaicOutput显示时没有视频队列
+    if(!video_queue_) {
+        return;
+    }
+    if(stats_) {
+        stats_->heartbeats[STAGE_VIDEO_OUTPUT].Beat();
+    }
+    if(pacer_.Enabled()) {
+        consumeVsync(clock, remain_time);
+        return;
+    }
+    AVFrame *frame = video_queue_->Front();
+    if(!frame) {
+        return;
+    }
+    FrameTiming timing(frame, video_time_base_, clock);
+    int action = timing.Action(avsync_->Rate());
+    if(action == FRAME_WAIT) {
+        if(timing.diff < remain_time) {
+            remain_time = timing.diff;
+        }
+        return;
+    }
+    if(action == FRAME_DROP) {
+        RecordFrameDropped(stats_, frame, timing);
+        frame = video_queue_->Pop(0);
+        av_frame_free(&frame);
+        remain_time = 0;
+        return;
+    }
+    RecordFrameShown(stats_, frame, timing);
+    {
+        TRACE_SCOPE("frame_queue_pop", "video", frame->pts);
+        frame = video_queue_->Pop(0);
+    }
+    av_frame_free(&frame);
+    // 落后时不等待，下一帧马上判断
+    remain_time = 0;
+}
+
+/**
+ * @brief 和VideoOutput按vblank显示时相同的选帧，到了模拟的vblank才决定，没到时返回等待时间
+ */
+void HeadlessOutput::consumeVsync(double clock, double &remain_time)
+{
+    int64_t now_us = PipelineStats::NowMicroseconds();
+    double wait = pacer_.UntilVblank(now_us);
+    if(wait <= 0) {
+        double vblank_clock = pacer_.VblankClock(clock, avsync_->Rate(), now_us);
+        AVFrame *frame = pacer_.Select(video_queue_, video_time_base_, vblank_clock, avsync_->Rate());
+        if(frame) {
+            RecordFrameShown(stats_, frame, FrameTiming(frame, video_time_base_, vblank_clock));
+            av_frame_free(&frame);
+        }
+        pacer_.OnVblank(now_us);
+        wait = pacer_.UntilVblank(now_us);
+    }
+    if(wait < remain_time) {
+        remain_time = wait;
+    }
+}
@@ -0,0 +1,42 @@
+﻿#ifndef HEADLESSOUTPUT_H
+#define HEADLESSOUTPUT_H
+#include <mutex>
+#include "avframequeue.h"
+#include "avsync.h"
+#include "audiotempo.h"
+#include "vsyncpacer.h"
+
+/**
+ * 无窗口、无声卡的输出：按时钟把到期的音频帧和视频帧取走并计数，
+ * 用于多实例压测，时钟按墙上时间走
+ */
+class HeadlessOutput
+{
+public:
+    HeadlessOutput(AVSync *avsync, AVFrameQueue *audio_queue, AVFrameQueue *video_queue,
+                   AVRational audio_time_base, AVRational video_time_base);
+    ~HeadlessOutput();
+    void Refresh(double &remain_time);
+    void Flush();
+    void ShowFrame(const AVFrame *frame);
+    void SetStats(PipelineStats *stats);
+    void SetRate(double rate);
+    void SetVsync(double refresh_hz);
+private:
+    void consumeAudio(double clock);
+    void stretch(AVFrame *frame);
+    void consumeVideo(double clock, double &remain_time);
+    void consumeVsync(double clock, double &remain_time);
+
+    AVSync *avsync_ = NULL;
+    AVFrameQueue *audio_queue_ = NULL;
+    AVFrameQueue *video_queue_ = NULL;
+    AVRational audio_time_base_;
+    AVRational video_time_base_;
+    PipelineStats *stats_ = NULL;
+    AudioTempo tempo_;
+    VsyncPacer pacer_;   // 开启时按模拟的vblank取帧
+    std::mutex mutex_;   // Refresh持有队首帧的指针，Flush要和它互斥
+};
+
+#endif // HEADLESSOUTPUT_H
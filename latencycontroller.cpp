@@ -0,0 +1,164 @@
+﻿#include "latencycontroller.h"
+#include "log.h"
+#include <math.h>
+
+/**
+ * @brief 构造函数
+ * @param stats 管线统计对象，读取解复用的最新时间戳，写入缓冲时长和端到端延时
+ * @param avsync 播放时钟
+ */
+LatencyController::LatencyController(PipelineStats *stats, AVSync *avsync):
+    stats_(stats), avsync_(avsync)
+{
+    SetOptions(ThreadOptions("latency"));
+}
+
+LatencyController::~LatencyController()
+{
+    Stop();
+}
+
+/**
+ * @brief 初始化
+ * @param target_ms 目标延时，播放器内缓冲超过它时开始追赶
+ * @param wallclock_pts 发送端用墙上时间(秒)打时间戳，可以算出端到端延时
+ * @return 成功返回0，失败返回负值
+ */
+int LatencyController::Init(int target_ms, bool wallclock_pts)
+{
+    if(!stats_ || !avsync_ || target_ms <= 0) {
+        LOG_ERROR("%s(%d) invalid param, target_ms:%d\n", __FUNCTION__, __LINE__, target_ms);
+        return -1;
+    }
+    target_us_ = target_ms * 1000LL;
+    wallclock_pts_ = wallclock_pts;
+    return 0;
+}
+
+/**
+ * @brief 设置调整速率的回调，在控制线程中调用，回调里不能等待Player的控制锁
+ */
+void LatencyController::SetRateCallback(std::function<void(double rate)> callback)
+{
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    rate_callback_ = callback;
+}
+
+/**
+ * @brief 设置丢弃缓冲的回调，在控制线程中调用，播放器正忙(如seek)时返回false，下次再试
+ * @param callback 参数为丢弃后时钟应该跳到的位置，单位秒
+ */
+void LatencyController::SetDropCallback(std::function<bool(double position)> callback)
+{
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    drop_callback_ = callback;
+}
+
+/**
+ * @brief 暂停期间缓冲必然增长，不追赶
+ */
+void LatencyController::SetPaused(bool paused)
+{
+    paused_ = paused;
+    if(!paused) {
+        wakeUp();
+    }
+}
+
+/**
+ * @brief 控制线程主函数，每100ms检查一次，暂停时不定时唤醒
+ */
+void LatencyController::Run()
+{
+    while(waitFor(paused_ ? -1 : 100)) {
+        if(!paused_) {
+            check();
+        }
+    }
+}
+
+/**
+ * @brief 采样缓冲时长和端到端延时，决定加速、恢复原速或丢弃
+ */
+void LatencyController::check()
+{
+    double clock = avsync_->GetClock();
+    if(wallclock_pts_) {
+        // 发送端的时间戳就是它采集时的墙上时间，按TS时间戳的周期回绕
+        double now = std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::system_clock::now().time_since_epoch()).count() / 1000000.0;
+        double latency = fmod(now - clock, LIVE_WALLCLOCK_WRAP_SECONDS);
+        if(latency < 0) {
+            latency += LIVE_WALLCLOCK_WRAP_SECONDS;
+        }
+        if(latency > LIVE_WALLCLOCK_WRAP_SECONDS / 2) {
+            latency -= LIVE_WALLCLOCK_WRAP_SECONDS;
+        }
+        if(latency >= 0) {
+            stats_->glass_to_glass.Record((int64_t)(latency * 1000000));
+        }
+    }
+
+    int64_t newest_us = stats_->heartbeats[STAGE_DEMUX].PtsUs();
+    if(newest_us == INT64_MIN || stats_->heartbeats[STAGE_VIDEO_OUTPUT].ProgressCount() == 0) {
+        return;
+    }
+    double sample = newest_us - clock * 1000000;
+    if(sample < 0) {
+        sample = 0;
+    }
+    // 平滑，避免关键帧、突发包让速率来回跳
+    buffered_us_ = buffered_us_ < 0 ? sample : buffered_us_ * 0.7 + sample * 0.3;
+    stats_->live_buffer_ms.Set((int64_t)(buffered_us_ / 1000));
+
+    double excess_us = buffered_us_ - target_us_;
+    int64_t now_us = PipelineStats::NowMicroseconds();
+    if(excess_us > LIVE_DROP_EXCESS_MS * 1000.0 && now_us - last_drop_us_ > LIVE_DROP_INTERVAL_MS * 1000LL) {
+        std::function<bool(double)> drop;
+        {
+            std::lock_guard<std::mutex> lock(callback_mutex_);
+            drop = drop_callback_;
+        }
+        double position = (newest_us - target_us_) / 1000000.0;
+        if(drop && drop(position)) {
+            LOG_INFO("live drop, buffered %lld ms, jump to %0.3lf\n", (long long)(buffered_us_ / 1000), position);
+            stats_->live_drops.Add(1);
+            last_drop_us_ = now_us;
+            buffered_us_ = -1;
+            setRate(1.0);
+        }
+        return;
+    }
+    if(rate_ == 1.0 && excess_us <= LIVE_CATCHUP_MARGIN_MS * 1000.0) {
+        return;
+    }
+    if(excess_us <= 0) {
+        setRate(1.0);
+        return;
+    }
+    // 每多缓冲1秒加速10%，按5%一档取整，避免频繁重建atempo
+    double rate = 1.0 + ceil(excess_us / 1000000.0 * 0.1 / 0.05) * 0.05;
+    if(rate > LIVE_CATCHUP_MAX_RATE) {
+        rate = LIVE_CATCHUP_MAX_RATE;
+    }
+    if(rate != rate_ && rate_ == 1.0) {
+        stats_->live_catchups.Add(1);
+    }
+    setRate(rate);
+}
+
+void LatencyController::setRate(double rate)
+{
+    if(rate == rate_) {
+        return;
+    }
+    rate_ = rate;
+    std::function<void(double)> callback;
+    {
+        std::lock_guard<std::mutex> lock(callback_mutex_);
+        callback = rate_callback_;
+    }
+    if(callback) {
+        callback(rate);
+    }
+}
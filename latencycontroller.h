@@ -0,0 +1,54 @@
+﻿#ifndef LATENCYCONTROLLER_H
+#define LATENCYCONTROLLER_H
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include "thread.h"
+#include "stats.h"
+#include "avsync.h"
+
+// 缓冲超过目标延时多少时开始加速
+#define LIVE_CATCHUP_MARGIN_MS 50
+// 加速追赶的最大速率，atempo在这个范围内听不出变调
+#define LIVE_CATCHUP_MAX_RATE 1.25
+// 缓冲超过目标延时这么多时不再追赶，直接丢到最新的关键帧
+#define LIVE_DROP_EXCESS_MS 1500
+// 两次丢弃之间的最小间隔
+#define LIVE_DROP_INTERVAL_MS 2000
+// MPEG-TS时间戳33位、90kHz，用墙上时间打时间戳时按这个周期回绕
+#define LIVE_WALLCLOCK_WRAP_SECONDS (8589934592.0 / 90000.0)
+
+/**
+ * 直播低延时控制线程：每100ms比较已读到的最新时间戳和播放时钟，得到播放器内缓冲的时长，
+ * 超过目标延时时小幅加速追赶，超过太多时丢到最新的关键帧；同时统计端到端延时
+ *
+ * 端到端延时需要发送端用墙上时间打时间戳(见README中的ffmpeg命令)，否则只统计缓冲时长
+ */
+class LatencyController : public Thread
+{
+public:
+    LatencyController(PipelineStats *stats, AVSync *avsync);
+    ~LatencyController();
+    int Init(int target_ms, bool wallclock_pts);
+    virtual void Run();
+    void SetRateCallback(std::function<void(double rate)> callback);
+    void SetDropCallback(std::function<bool(double position)> callback);
+    void SetPaused(bool paused);
+private:
+    void check();
+    void setRate(double rate);
+
+    PipelineStats *stats_ = NULL;
+    AVSync *avsync_ = NULL;
+    int64_t target_us_ = 500000;
+    bool wallclock_pts_ = false;
+    double buffered_us_ = -1;        // 平滑后的缓冲时长，负数表示还没有采样
+    double rate_ = 1.0;              // 当前设置的速率
+    int64_t last_drop_us_ = 0;
+    std::atomic<bool> paused_{false};
+    std::mutex callback_mutex_;
+    std::function<void(double)> rate_callback_;
+    std::function<bool(double)> drop_callback_;
+};
+
+#endif // LATENCYCONTROLLER_H
@@ -0,0 +1,74 @@
+# 播放器库，默认编译静态库，qmake CONFIG+=sparkplayer_shared 编译动态库
+TEMPLATE = lib
+TARGET = sparkplayer
+CONFIG += c++17
+CONFIG -= qt
+
+sparkplayer_shared {
+    CONFIG += shared
+} else {
+    CONFIG += staticlib
+}
+DESTDIR = $$OUT_PWD/lib
+
+SOURCES += \
+        audiooutput.cpp \
+        audiotempo.cpp \
+        avframequeue.cpp \
+        avpacketqueue.cpp \
+        bufferingcontroller.cpp \
+        convertthread.cpp \
+        costage.cpp \
+        decodethread.cpp \
+        demuxthread.cpp \
+        flightrecorder.cpp \
+        framecache.cpp \
+        frametiming.cpp \
+        headlessoutput.cpp \
+        latencycontroller.cpp \
+        log.cpp \
+        loopcontroller.cpp \
+        mosaicoutput.cpp \
+        player.cpp \
+        playerhost.cpp \
+        renderthread.cpp \
+        stats.cpp \
+        taskexecutor.cpp \
+        thread.cpp \
+        trace.cpp \
+        videooutput.cpp \
+        vsyncpacer.cpp \
+        watchdog.cpp
+
+include(sparkplayer.pri)
+
+HEADERS += \
+    audiooutput.h \
+    audiotempo.h \
+    avframequeue.h \
+    avpacketqueue.h \
+    avsync.h \
+    bufferingcontroller.h \
+    convertthread.h \
+    costage.h \
+    decodethread.h \
+    demuxthread.h \
+    flightrecorder.h \
+    framecache.h \
+    frametiming.h \
+    headlessoutput.h \
+    latencycontroller.h \
+    log.h \
+    loopcontroller.h \
+    mosaicoutput.h \
+    player.h \
+    playerhost.h \
+    queue.h \
+    renderthread.h \
+    stats.h \
+    taskexecutor.h \
+    thread.h \
+    trace.h \
+    videooutput.h \
+    vsyncpacer.h \
+    watchdog.h
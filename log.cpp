@@ -0,0 +1,296 @@
+﻿#include "log.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <chrono>
+
+/**
+ * @brief 构造函数
+ * @param id 环形缓冲区编号，输出时用来区分线程
+ */
+LogRing::LogRing(int id):
+    id_(id)
+{
+}
+
+/**
+ * @brief 生产者获取一个可写的槽位
+ * @return 成功返回槽位指针，缓冲区满返回NULL(该条日志被丢弃)
+ */
+LogRecord *LogRing::Reserve()
+{
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    uint32_t tail = tail_.load(std::memory_order_acquire);
+    if(head - tail >= LOG_RING_CAPACITY) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+    }
+    return &records_[head & (LOG_RING_CAPACITY - 1)];
+}
+
+/**
+ * @brief 生产者提交Reserve得到的槽位，对消费者可见
+ */
+void LogRing::Commit()
+{
+    head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+/**
+ * @brief 消费者查看最早的一条日志
+ * @return 没有日志返回NULL
+ */
+LogRecord *LogRing::Peek()
+{
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if(tail == head_.load(std::memory_order_acquire)) {
+        return NULL;
+    }
+    return &records_[tail & (LOG_RING_CAPACITY - 1)];
+}
+
+/**
+ * @brief 消费者释放Peek得到的槽位
+ */
+void LogRing::Consume()
+{
+    tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+bool LogRing::Empty()
+{
+    return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_acquire);
+}
+
+/**
+ * @brief 判断本次调用是否允许输出
+ * @param interval_ms 限流间隔，单位毫秒
+ * @param suppressed 允许输出时返回上次输出以来被抑制的条数
+ * @return 允许输出返回true
+ */
+bool LogRateLimiter::Allow(int interval_ms, int *suppressed)
+{
+    int64_t now = Logger::NowMicroseconds();
+    int64_t last = last_us_.load(std::memory_order_relaxed);
+    if(now - last < (int64_t)interval_ms * 1000
+            || !last_us_.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+        suppressed_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    *suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+    return true;
+}
+
+// 线程退出时把自己的ring标记为可回收，由后台线程在取空后释放
+struct LogRingHolder
+{
+    LogRing *ring = NULL;
+    ~LogRingHolder()
+    {
+        if(ring) {
+            ring->released_.store(true, std::memory_order_release);
+        }
+    }
+};
+static thread_local LogRingHolder t_ring_holder;
+
+Logger::Logger()
+{
+    SetOptions(ThreadOptions("logger"));
+}
+
+Logger::~Logger()
+{
+    DeInit();
+    for(LogRing *ring : rings_) {
+        delete ring;
+    }
+    rings_.clear();
+}
+
+/**
+ * @brief 获取全局日志对象
+ */
+Logger *Logger::Instance()
+{
+    static Logger logger;
+    return &logger;
+}
+
+/**
+ * @brief 启动后台输出线程，之前写的日志会同步输出
+ * @return 成功返回0，失败返回负值
+ */
+int Logger::Init()
+{
+    if(running_) {
+        return 0;
+    }
+    return Start();
+}
+
+/**
+ * @brief 停止后台线程，并把缓冲区内剩余的日志全部输出
+ * @return 成功返回0
+ */
+int Logger::DeInit()
+{
+    if(!running_) {
+        return 0;
+    }
+    Stop();
+    return 0;
+}
+
+int Logger::Start()
+{
+    if(Thread::Start() < 0) {
+        return -1;
+    }
+    running_ = true;
+    return 0;
+}
+
+int Logger::Stop()
+{
+    Thread::Stop();
+    running_ = false;
+    // 线程退出后再取一次，保证不丢最后的日志
+    drain();
+    fflush(stdout);
+    return 0;
+}
+
+/**
+ * @brief 后台线程主函数，定期把各线程ring中的日志写到stdout
+ */
+void Logger::Run()
+{
+    do {
+        drain();
+    } while(waitFor(10));
+}
+
+/**
+ * @brief 写一条日志，只做格式化和入队，不做任何IO，可以在音频回调中调用
+ * @param level 日志级别
+ * @param suppressed 限流抑制掉的条数
+ * @param fmt printf风格的格式串
+ */
+void Logger::Write(int level, int suppressed, const char *fmt, ...)
+{
+    va_list args;
+    if(!running_) {
+        // 后台线程未启动(初始化之前或退出之后)，直接同步输出
+        LogRecord record;
+        record.time_us = NowMicroseconds();
+        record.level = level;
+        record.suppressed = suppressed;
+        va_start(args, fmt);
+        vsnprintf(record.text, sizeof(record.text), fmt, args);
+        va_end(args);
+        output(0, &record);
+        return;
+    }
+    LogRing *ring = threadRing();
+    if(!ring) {
+        return;
+    }
+    LogRecord *record = ring->Reserve();
+    if(!record) {
+        return;
+    }
+    record->time_us = NowMicroseconds();
+    record->level = level;
+    record->suppressed = suppressed;
+    va_start(args, fmt);
+    vsnprintf(record->text, sizeof(record->text), fmt, args);
+    va_end(args);
+    ring->Commit();
+}
+
+/**
+ * @brief 获取所有线程因缓冲区满而丢弃的日志条数
+ */
+uint64_t Logger::Dropped()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t dropped = dropped_released_;
+    for(LogRing *ring : rings_) {
+        dropped += ring->dropped_.load(std::memory_order_relaxed);
+    }
+    return dropped;
+}
+
+/**
+ * @brief 单调时钟，单位为微秒
+ */
+int64_t Logger::NowMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief 获取当前线程的ring，第一次调用时创建并注册
+ */
+LogRing *Logger::threadRing()
+{
+    if(t_ring_holder.ring) {
+        return t_ring_holder.ring;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    LogRing *ring = new LogRing(++next_ring_id_);
+    rings_.push_back(ring);
+    t_ring_holder.ring = ring;
+    return ring;
+}
+
+/**
+ * @brief 取空所有ring，并回收所属线程已退出的ring
+ */
+void Logger::drain()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(auto it = rings_.begin(); it != rings_.end(); ) {
+        LogRing *ring = *it;
+        // 先读released_，保证退出线程最后写入的日志在下面能被取到
+        bool released = ring->released_.load(std::memory_order_acquire);
+        LogRecord *record = NULL;
+        while((record = ring->Peek()) != NULL) {
+            output(ring->id_, record);
+            ring->Consume();
+        }
+        if(released) {
+            dropped_released_ += ring->dropped_.load(std::memory_order_relaxed);
+            delete ring;
+            it = rings_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    fflush(stdout);
+}
+
+/**
+ * @brief 把一条日志写到stdout
+ */
+void Logger::output(int ring_id, const LogRecord *record)
+{
+    static const char levels[] = {'T', 'D', 'I', 'W', 'E'};
+    char level = record->level >= 0 && record->level < (int)sizeof(levels) ? levels[record->level] : '?';
+    size_t len = strnlen(record->text, sizeof(record->text));
+    // 原有的输出大多以换行结尾，这里统一去掉再补上
+    while(len > 0 && (record->text[len - 1] == '\n' || record->text[len - 1] == ' ')) {
+        len--;
+    }
+    if(record->suppressed > 0) {
+        fprintf(stdout, "[%lld.%06lld][%c][%d] %.*s (suppressed %d)\n",
+                (long long)(record->time_us / 1000000), (long long)(record->time_us % 1000000),
+                level, ring_id, (int)len, record->text, record->suppressed);
+    } else {
+        fprintf(stdout, "[%lld.%06lld][%c][%d] %.*s\n",
+                (long long)(record->time_us / 1000000), (long long)(record->time_us % 1000000),
+                level, ring_id, (int)len, record->text);
+    }
+}
@@ -0,0 +1,127 @@
+﻿#ifndef LOG_H
+#define LOG_H
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+#include "thread.h"
+
+// 日志级别，数值越大越重要
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_WARN  3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_OFF   5
+
+// 编译期日志级别，低于该级别的日志语句会被编译器整体消除(参数也不会求值)
+// 可以在.pro中通过 DEFINES += LOG_COMPILE_LEVEL=0 打开TRACE级别
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_RECORD_SIZE   256   // 单条日志最大长度(含结尾0)
+#define LOG_RING_CAPACITY 256   // 每个线程环形缓冲区的日志条数，必须是2的幂
+
+struct LogRecord
+{
+    int64_t time_us;
+    int level;
+    int suppressed;    // 被限流丢弃的重复条数
+    char text[LOG_RECORD_SIZE];
+};
+
+/**
+ * 单生产者单消费者的无锁环形缓冲区，每个写日志的线程独占一个，
+ * 由Logger的后台线程负责消费
+ */
+class LogRing
+{
+public:
+    LogRing(int id);
+    LogRecord *Reserve();
+    void Commit();
+    LogRecord *Peek();
+    void Consume();
+    bool Empty();
+
+    int id_ = 0;
+    std::atomic<bool> released_{false};   // 所属线程已经退出
+    std::atomic<uint64_t> dropped_{0};    // 缓冲区满时丢弃的条数
+private:
+    std::atomic<uint32_t> head_{0};       // 写位置，只有生产者修改
+    std::atomic<uint32_t> tail_{0};       // 读位置，只有消费者修改
+    LogRecord records_[LOG_RING_CAPACITY];
+};
+
+/**
+ * 按调用点的限流器，interval_ms内只放行一条，其余计数
+ */
+class LogRateLimiter
+{
+public:
+    bool Allow(int interval_ms, int *suppressed);
+private:
+    std::atomic<int64_t> last_us_{INT64_MIN / 2};
+    std::atomic<int> suppressed_{0};
+};
+
+class Logger : public Thread
+{
+public:
+    static Logger *Instance();
+    int Init();
+    int DeInit();
+    virtual int Start();
+    virtual int Stop();
+    virtual void Run();
+
+    void SetLevel(int level) { level_ = level; }
+    int Level() { return level_; }
+    void Write(int level, int suppressed, const char *fmt, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 4, 5)))
+#endif
+    ;
+    uint64_t Dropped();
+
+    static int64_t NowMicroseconds();
+private:
+    Logger();
+    ~Logger();
+    LogRing *threadRing();
+    void drain();
+    void output(int ring_id, const LogRecord *record);
+
+    std::atomic<int> level_{LOG_COMPILE_LEVEL};
+    std::atomic<bool> running_{false};
+    std::mutex mutex_;                    // 只保护rings_的注册和遍历，不在写日志路径上
+    std::vector<LogRing *> rings_;
+    int next_ring_id_ = 0;
+    uint64_t dropped_released_ = 0;       // 已回收的ring累计丢弃数
+};
+
+#define LOG_WRITE(level, suppressed, fmt, ...) do { \
+        if((level) >= LOG_COMPILE_LEVEL && (level) >= Logger::Instance()->Level()) { \
+            Logger::Instance()->Write(level, suppressed, fmt, ##__VA_ARGS__); \
+        } \
+    } while(0)
+
+// interval_ms内同一调用点只输出一次，被抑制的条数附在下一次输出里
+#define LOG_RATELIMIT(level, interval_ms, fmt, ...) do { \
+        if((level) >= LOG_COMPILE_LEVEL && (level) >= Logger::Instance()->Level()) { \
+            static LogRateLimiter log_limiter_; \
+            int log_suppressed_ = 0; \
+            if(log_limiter_.Allow(interval_ms, &log_suppressed_)) { \
+                Logger::Instance()->Write(level, log_suppressed_, fmt, ##__VA_ARGS__); \
+            } \
+        } \
+    } while(0)
+
+#define LOG_TRACE(fmt, ...) LOG_WRITE(LOG_LEVEL_TRACE, 0, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...) LOG_WRITE(LOG_LEVEL_DEBUG, 0, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...)  LOG_WRITE(LOG_LEVEL_INFO, 0, fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...)  LOG_WRITE(LOG_LEVEL_WARN, 0, fmt, ##__VA_ARGS__)
+#define LOG_ERROR(fmt, ...) LOG_WRITE(LOG_LEVEL_ERROR, 0, fmt, ##__VA_ARGS__)
+
+#endif // LOG_H
@@ -0,0 +1,86 @@
+﻿#include "loopcontroller.h"
+#include "log.h"
+
+/**
+ * @brief 构造函数
+ * @param avsync 播放时钟
+ */
+LoopController::LoopController(AVSync *avsync):
+    avsync_(avsync)
+{
+    SetOptions(ThreadOptions("loop"));
+}
+
+LoopController::~LoopController()
+{
+    Stop();
+}
+
+/**
+ * @brief 设置循环范围，可以在任意线程调用
+ * @param start 起点，单位秒
+ * @param end 终点，单位秒，不大于start时取消循环
+ */
+void LoopController::SetRange(double start, double end)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        start_ = start;
+        end_ = end;
+    }
+    active_ = end > start;
+    wakeUp();
+}
+
+/**
+ * @brief 设置回到起点的回调，在控制线程中调用，播放器正忙(如seek)时返回false，下次再试
+ */
+void LoopController::SetLoopCallback(std::function<bool(double start, double end)> callback)
+{
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    loop_callback_ = callback;
+}
+
+/**
+ * @brief 暂停时时钟不走，不检查
+ */
+void LoopController::SetPaused(bool paused)
+{
+    paused_ = paused;
+    if(!paused) {
+        wakeUp();
+    }
+}
+
+/**
+ * @brief 控制线程主函数，循环中每LOOP_CHECK_MS检查一次
+ */
+void LoopController::Run()
+{
+    while(waitFor(paused_ || !active_ ? -1 : LOOP_CHECK_MS)) {
+        if(!paused_ && active_) {
+            check();
+        }
+    }
+}
+
+/**
+ * @brief 时钟到达终点时回到起点
+ */
+void LoopController::check()
+{
+    double start = 0;
+    double end = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        start = start_;
+        end = end_;
+    }
+    if(avsync_->GetClock() < end) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    if(loop_callback_ && !loop_callback_(start, end)) {
+        LOG_DEBUG("loop busy, retry\n");
+    }
+}
@@ -0,0 +1,38 @@
+﻿#ifndef LOOPCONTROLLER_H
+#define LOOPCONTROLLER_H
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include "thread.h"
+#include "avsync.h"
+
+// 检查间隔，单位毫秒，也是循环终点最多多播放的时间
+#define LOOP_CHECK_MS 10
+
+/**
+ * A/B循环控制线程：播放时钟到达终点时通知播放器回到起点；
+ * 没有设置循环或暂停时不定时唤醒
+ */
+class LoopController : public Thread
+{
+public:
+    LoopController(AVSync *avsync);
+    ~LoopController();
+    virtual void Run();
+    void SetRange(double start, double end);
+    void SetLoopCallback(std::function<bool(double start, double end)> callback);
+    void SetPaused(bool paused);
+private:
+    void check();
+
+    AVSync *avsync_ = NULL;
+    std::mutex mutex_;
+    double start_ = 0;       // 单位秒，end_不大于start_时不循环
+    double end_ = 0;
+    std::atomic<bool> active_{false};
+    std::atomic<bool> paused_{false};
+    std::mutex callback_mutex_;
+    std::function<bool(double, double)> loop_callback_;
+};
+
+#endif // LOOPCONTROLLER_H
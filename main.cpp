@@ -1,132 +1,169 @@
 ﻿#include <iostream>
-#include "demuxthread.h"    // 解复用线程，负责从媒体文件读取数据包
-#include "decodethread.h"   // 解码线程，负责解码音频和视频数据包
-#include "audiooutput.h"    // 音频输出，负责播放音频数据
-#include "videooutput.h"    // 视频输出，负责显示视频帧
-#include "avsync.h"         // 音视频同步，维护统一的时钟基准
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "player.h"         // 播放器，持有解复用、解码、输出和同步时钟
+#include "playerhost.h"     // 多实例宿主，多个url时拼接到同一个窗口
+#include "log.h"            // 异步日志，避免在实时路径上做阻塞IO
+#include "trace.h"          // 可选的Chrome trace埋点
 using namespace std;
 #undef main               // 解决SDL重定义main的问题
 
+// 拼接窗口的默认大小
+#define MOSAIC_WIDTH 1280
+#define MOSAIC_HEIGHT 720
+
+/**
+ * @brief 多路拼接播放：各路共享线程池解复用和解码，视频显示在同一个窗口的网格里，不出声
+ * @param count url个数
+ * @param urls url数组
+ * @return 成功返回0，失败返回负值
+ */
+static int play_mosaic(int count, char *urls[])
+{
+    PlayerHost host;
+    if(host.Init(0, false) < 0 || host.EnableMosaic(MOSAIC_WIDTH, MOSAIC_HEIGHT) < 0) {
+        return -1;
+    }
+    int64_t start_us = PipelineStats::NowMicroseconds();
+    for(int i = 0; i < count; i++) {
+        if(!host.AddPlayer(urls[i])) {
+            LOG_ERROR("%s(%d) play %s failed\n", __FUNCTION__, __LINE__, urls[i]);
+        }
+    }
+    if(host.PlayerCount() == 0) {
+        return -1;
+    }
+    // 阻塞直到用户退出，之后打印每路和总的CPU占用
+    host.MainLoop();
+    host.ReportCpu((PipelineStats::NowMicroseconds() - start_us) / 1000000.0);
+    host.Stop();
+    return 0;
+}
+
 /**
  * @brief 程序入口
  * @param argc 命令行参数数量
- * @param argv 命令行参数数组，argv[1]为要播放的媒体文件路径
+ * @param argv 命令行参数数组，argv[1]为要播放的媒体文件路径，有多个时拼接到同一个窗口播放
  * @return 成功返回0，失败返回负值
  */
 int main(int argc, char *argv[])
 {
-    cout << "Hello World!" << endl;
-    printf("url :%s\n", argv[1]);  // 打印要播放的媒体文件路径
-    int ret = 0;
-    
-    // 创建音视频数据包队列和帧队列，用于线程间数据传递
-    AVPacketQueue audio_packet_queue;  // 音频数据包队列
-    AVPacketQueue video_packet_queue;  // 视频数据包队列
-    AVFrameQueue audio_frame_queue;    // 音频帧队列
-    AVFrameQueue video_frame_queue;    // 视频帧队列
-    
-    AVSync avsync;                     // 音视频同步器
-    
-    // 创建并初始化解复用线程，负责读取媒体文件并分离音视频流
-    DemuxThread *demux_thread = new DemuxThread(&audio_packet_queue, &video_packet_queue);
-    ret = demux_thread->Init(argv[1]);  // 初始化解复用线程，打开媒体文件
-    if(ret < 0) {
-        printf("%s(%d) demux_thread Init\n", __FUNCTION__, __LINE__);
-        return -1;
+    // 启动日志后台线程，之后所有日志都只在调用线程格式化入队
+    Logger::Instance()->Init();
+    LOG_INFO("Hello World!\n");
+    LOG_INFO("url :%s\n", argv[1]);  // 打印要播放的媒体文件路径
+    // 设置了SPARK_TRACE环境变量时打开埋点，退出或收到SIGUSR1时导出到该文件
+    const char *trace_path = getenv("SPARK_TRACE");
+    if(trace_path) {
+        Tracer::Instance()->Init(trace_path);
+        Tracer::Instance()->SetThreadName("main");
     }
-    ret = demux_thread->Start();        // 启动解复用线程
-    if(ret < 0) {
-        printf("%s(%d) demux_thread Start\n", __FUNCTION__, __LINE__);
-        return -1;
+
+    // 多个url时拼接到同一个窗口播放(电视墙)
+    if(argc > 2) {
+        int ret = play_mosaic(argc - 1, argv + 1);
+        SDL_Quit();
+        LOG_INFO("main finish\n");
+        Tracer::Instance()->DeInit();
+        Logger::Instance()->DeInit();
+        return ret == 0 ? 0 : -1;
     }
-    
-    // 创建并初始化音频解码线程，负责解码音频数据包
-    DecodeThread *audio_decode_thread = new DecodeThread(&audio_packet_queue, &audio_frame_queue);
-    ret = audio_decode_thread->Init(demux_thread->AudioCodecParameters());  // 使用音频流参数初始化解码器
-    if(ret < 0) {
-        printf("%s(%d) audio_decode_thread Init\n", __FUNCTION__, __LINE__);
-        return -1;
+
+    Player player;
+    // 播放器事件在内部线程回调，这里只打日志
+    player.SetEventCallback([](int event, const std::string &) {
+        if(event == PLAYER_EVENT_END_OF_STREAM) {
+            LOG_INFO("player end of stream\n");
+        }
+    });
+    // SPARK_THREAD_DEMUX/AUDIO_DECODE/VIDEO_DECODE/AUDIO_OUTPUT/VIDEO_OUTPUT设置各阶段线程的调度，
+    // 格式为 类别[:优先级][@CPU掩码]，如 SPARK_THREAD_AUDIO_OUTPUT=fifo:20、SPARK_THREAD_DEMUX=nice:10@0x1
+    for(int stage = 0; stage < STAGE_COUNT; stage++) {
+        std::string env = "SPARK_THREAD_";
+        for(const char *p = PipelineStageName(stage); *p; p++) {
+            env += (char)toupper(*p);
+        }
+        const char *spec = getenv(env.c_str());
+        ThreadOptions options;
+        if(spec && ParseThreadOptions(spec, options) == 0) {
+            player.SetStageThreadOptions(stage, options);
+        } else if(spec) {
+            LOG_WARN("invalid %s=%s\n", env.c_str(), spec);
+        }
     }
-    ret = audio_decode_thread->Start();  // 启动音频解码线程
-    if(ret < 0) {
-        printf("%s(%d) audio_decode_thread Start\n", __FUNCTION__, __LINE__);
-        return -1;
+    // 设置了SPARK_LIVE_LATENCY_MS时按直播低延时模式播放，发送端用墙上时间打时间戳时设置SPARK_LIVE_WALLCLOCK=1统计端到端延时
+    const char *live_latency = getenv("SPARK_LIVE_LATENCY_MS");
+    if(live_latency) {
+        const char *wallclock = getenv("SPARK_LIVE_WALLCLOCK");
+        player.SetLowLatency(atoi(live_latency), wallclock && atoi(wallclock) == 1);
     }
-    
-    // 创建并初始化视频解码线程，负责解码视频数据包
-    DecodeThread *video_decode_thread = new DecodeThread(&video_packet_queue, &video_frame_queue);
-    ret = video_decode_thread->Init(demux_thread->VideoCodecParameters());  // 使用视频流参数初始化解码器
-    if(ret < 0) {
-        printf("%s(%d) video_decode_thread Init\n", __FUNCTION__, __LINE__);
-        return -1;
+    // SPARK_BUFFER_MS=低水位,高水位 设置缓冲水位，单位毫秒
+    const char *buffer_ms = getenv("SPARK_BUFFER_MS");
+    if(buffer_ms) {
+        int low_ms = 0;
+        int high_ms = 0;
+        if(sscanf(buffer_ms, "%d,%d", &low_ms, &high_ms) == 2) {
+            player.SetBufferWatermarks(low_ms, high_ms);
+        } else {
+            LOG_WARN("invalid SPARK_BUFFER_MS=%s\n", buffer_ms);
+        }
     }
-    ret = video_decode_thread->Start();  // 启动视频解码线程
-    if(ret < 0) {
-        printf("%s(%d) video_decode_thread Start\n", __FUNCTION__, __LINE__);
-        return -1;
+    // SPARK_RENDER_THREAD=0时在主线程渲染，SPARK_RENDER_BUFFERS=2/3设置双缓冲或三缓冲
+    const char *render_thread = getenv("SPARK_RENDER_THREAD");
+    const char *render_buffers = getenv("SPARK_RENDER_BUFFERS");
+    if(render_thread || render_buffers) {
+        player.SetRenderThread(!render_thread || atoi(render_thread) != 0,
+                               render_buffers ? atoi(render_buffers) : VIDEO_TEXTURE_BUFFERS);
     }
-    
-    // 初始化音视频同步时钟
-    avsync.InitClock();
-    
-    // 设置音频参数，用于后续音频输出
-    AudioParams audio_params;
-    memset(&audio_params, 0, sizeof(audio_params));
-    audio_params.ch_layout = audio_decode_thread->GetAVCodecContext()->ch_layout;   // 音频通道布局
-    audio_params.fmt = audio_decode_thread->GetAVCodecContext()->sample_fmt;        // 音频采样格式
-    audio_params.freq = audio_decode_thread->GetAVCodecContext()->sample_rate;      // 音频采样率
-    
-    // 创建并初始化音频输出，负责播放音频
-    AudioOutput *audio_output = new AudioOutput(&avsync, audio_params, &audio_frame_queue, demux_thread->AudioStreamTimebase());
-    ret = audio_output->Init();  // 初始化音频输出，设置SDL音频
-    if(ret < 0) {
-        printf("%s(%d) audio_output Init\n", __FUNCTION__, __LINE__);
-        return -1;
+    // SPARK_VSYNC=1时按显示器的vblank显示，SPARK_VSYNC_HZ=60时按该刷新率模拟vblank
+    const char *vsync = getenv("SPARK_VSYNC");
+    const char *vsync_hz = getenv("SPARK_VSYNC_HZ");
+    if((vsync && atoi(vsync) != 0) || vsync_hz) {
+        player.SetVsync(true, vsync_hz ? atoi(vsync_hz) : 0);
     }
-    
-    // 创建并初始化视频输出，负责显示视频
-    VideoOutput *video_output_ = new VideoOutput(&avsync, &video_frame_queue, video_decode_thread->GetAVCodecContext()->width,
-            video_decode_thread->GetAVCodecContext()->height, demux_thread->VideoStreamTimebase());
-    ret = video_output_->Init();  // 初始化视频输出，创建SDL窗口和渲染器
-    if(ret < 0) {
-        printf("%s(%d) video_output_ Init\n", __FUNCTION__, __LINE__);
-        return -1;
+    // SPARK_FRAME_CACHE_MB设置已解码帧缓存的预算，用于逐帧步进和A/B循环，0表示不缓存
+    const char *frame_cache_mb = getenv("SPARK_FRAME_CACHE_MB");
+    player.SetFrameCache(frame_cache_mb ? atoi(frame_cache_mb) : FRAME_CACHE_DEFAULT_MB);
+    // SPARK_REVERSE_BUDGET_MB设置倒放时已解码帧的内存预算
+    const char *reverse_budget_mb = getenv("SPARK_REVERSE_BUDGET_MB");
+    if(reverse_budget_mb) {
+        player.SetReverseBudget(atoi(reverse_budget_mb));
+    }
+    // 设置了SPARK_STATS环境变量时定期把快照写到该文件，SPARK_STATS_FORMAT=prometheus时输出Prometheus文本
+    StatsReporter stats_reporter(player.Stats());
+    const char *stats_path = getenv("SPARK_STATS");
+    if(stats_path) {
+        const char *interval = getenv("SPARK_STATS_INTERVAL_MS");
+        if(stats_reporter.Init(stats_path, getenv("SPARK_STATS_FORMAT"), interval ? atoi(interval) : 1000) == 0) {
+            stats_reporter.Start();
+        }
     }
-    
-    // 进入视频主循环，此函数会阻塞直到用户退出
-    video_output_->MainLoop();
 
-    // 优化资源释放顺序，先停止所有线程，然后再清理资源
-    printf("%s(%d) stopping threads\n", __FUNCTION__, __LINE__);
-    // 先停止解码线程，因为它们依赖解复用线程提供数据
-    video_decode_thread->Stop();
-    audio_decode_thread->Stop();
-    // 再停止解复用线程
-    demux_thread->Stop();
+    // 打开媒体文件并开始播放，失败时已创建的线程和资源由Player析构释放
+    int ret = player.Open(argv[1]);
+    if(ret == 0) {
+        ret = player.Play();
+    }
+    if(ret == 0) {
+        // 进入视频主循环，此函数会阻塞直到用户退出
+        player.MainLoop();
+    } else {
+        LOG_ERROR("%s(%d) play %s failed\n", __FUNCTION__, __LINE__, argv[1]);
+    }
 
-    // 释放音频输出
-    printf("%s(%d) cleaning audio output\n", __FUNCTION__, __LINE__);
-    delete audio_output;
-    
-    // 释放视频输出
-    printf("%s(%d) cleaning video output\n", __FUNCTION__, __LINE__);
-    delete video_output_;    // 释放SDL视频资源
-    
-    // 显式调用队列的Abort方法释放队列中的资源
-    printf("%s(%d) cleaning frame queues\n", __FUNCTION__, __LINE__);
-    audio_frame_queue.Abort();  // 终止音频帧队列并释放内部资源
-    video_frame_queue.Abort();  // 终止视频帧队列并释放内部资源
-    
-    printf("%s(%d) cleaning packet queues\n", __FUNCTION__, __LINE__);
-    audio_packet_queue.Abort();  // 终止音频包队列并释放内部资源
-    video_packet_queue.Abort();  // 终止视频包队列并释放内部资源
-    
-    // 删除线程对象
-    printf("%s(%d) deleting thread objects\n", __FUNCTION__, __LINE__);
-    delete audio_decode_thread;
-    delete video_decode_thread;
-    delete demux_thread;
-    
-    printf("main finish\n");
-    return 0;
+    // 退出前输出一次关键指标
+    stats_reporter.Stop();
+    PipelineStats *stats = player.Stats();
+    LOG_INFO("startup_us:%lld, frames_presented:%lld, frames_late:%lld, audio_underruns:%lld\n",
+             (long long)stats->startup_us.Get(), (long long)stats->frames_presented.Get(),
+             (long long)stats->frames_late.Get(), (long long)stats->audio_underruns.Get());
+    player.Stop();
+    SDL_Quit();
+
+    LOG_INFO("main finish\n");
+    Tracer::Instance()->DeInit();
+    // 输出剩余日志并停止后台线程
+    Logger::Instance()->DeInit();
+    return ret == 0 ? 0 : -1;
 }
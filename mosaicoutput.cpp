@@ -0,0 +1,351 @@
+﻿#include "mosaicoutput.h"
+#include <math.h>
+#include "log.h"
+#include "trace.h"
+#include "thread.h"
+#include "convertthread.h"
+#include "frametiming.h"
+#include "videooutput.h"
+
+// 刷新循环最长等待时间，和VideoOutput的刷新间隔一致
+#define MOSAIC_REFRESH_RATE 0.01
+
+MosaicOutput::MosaicOutput()
+{
+}
+
+MosaicOutput::~MosaicOutput()
+{
+    DeInit();
+}
+
+/**
+ * @brief 创建窗口和渲染器，之后Refresh必须在调用线程调用
+ * @param width 窗口宽度
+ * @param height 窗口高度
+ * @return 成功返回0，失败返回负值
+ */
+int MosaicOutput::Init(int width, int height)
+{
+    if(SDL_InitSubSystem(SDL_INIT_VIDEO)) {
+        LOG_ERROR("SDL_InitSubSystem failed:%s\n", SDL_GetError());
+        return -1;
+    }
+    sdl_inited_ = true;
+    win_ = SDL_CreateWindow("mosaic", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                            width, height, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
+    if(!win_) {
+        LOG_ERROR("SDL_CreateWindow failed:%s\n", SDL_GetError());
+        return -1;
+    }
+    renderer_ = SDL_CreateRenderer(win_, -1, 0);
+    if(!renderer_) {
+        LOG_ERROR("SDL_CreateRenderer failed:%s\n", SDL_GetError());
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 释放纹理、渲染器和窗口，在Init的线程调用，之前要移除所有画面
+ */
+void MosaicOutput::DeInit()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(Tile &tile : tiles_) {
+        if(tile.texture) {
+            retired_.push_back(tile.texture);
+        }
+        av_frame_free(&tile.still);
+    }
+    tiles_.clear();
+    for(SDL_Texture *texture : retired_) {
+        SDL_DestroyTexture(texture);
+    }
+    retired_.clear();
+    if(renderer_) {
+        SDL_DestroyRenderer(renderer_);
+        renderer_ = NULL;
+    }
+    if(win_) {
+        SDL_DestroyWindow(win_);
+        win_ = NULL;
+    }
+    if(sdl_inited_) {
+        SDL_QuitSubSystem(SDL_INIT_VIDEO);
+        sdl_inited_ = false;
+    }
+}
+
+/**
+ * @brief 添加一路画面，可以在任意线程调用，下次刷新时重新排列
+ * @param avsync 该路的同步时钟
+ * @param frame_queue 该路可以直接显示的帧
+ * @param time_base 视频流时间基准
+ * @param stats 该路的统计对象，可以为NULL
+ * @param resize_callback 该路区域的像素大小变化时调用，在Refresh的线程
+ * @return 画面id，用于RemoveTile和FlushTile
+ */
+int MosaicOutput::AddTile(AVSync *avsync, AVFrameQueue *frame_queue, AVRational time_base, PipelineStats *stats,
+                          std::function<void(int width, int height)> resize_callback)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Tile tile = {};
+    tile.id = next_id_++;
+    tile.avsync = avsync;
+    tile.frame_queue = frame_queue;
+    tile.time_base = time_base;
+    tile.stats = stats;
+    tile.resize_callback = resize_callback;
+    tiles_.push_back(tile);
+    layout_changed_ = true;
+    return tile.id;
+}
+
+/**
+ * @brief 移除一路画面，返回后不再访问它的队列和统计对象，可以在任意线程调用
+ * @param id AddTile的返回值
+ */
+void MosaicOutput::RemoveTile(int id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(size_t i = 0; i < tiles_.size(); i++) {
+        if(tiles_[i].id == id) {
+            if(tiles_[i].texture) {
+                retired_.push_back(tiles_[i].texture);
+            }
+            av_frame_free(&tiles_[i].still);
+            tiles_.erase(tiles_.begin() + i);
+            layout_changed_ = true;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief 丢弃一路画面队列中的所有帧，用于seek，正在显示的帧保留到新位置的第一帧
+ * @param id AddTile的返回值
+ */
+void MosaicOutput::FlushTile(int id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(Tile &tile : tiles_) {
+        if(tile.id == id) {
+            tile.frame_queue->Flush();
+            av_frame_free(&tile.still);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief 逐帧步进：下次刷新时不看时钟显示指定的帧，队列里不晚于它的帧丢弃
+ * @param id AddTile的返回值
+ * @param frame 要显示的帧，增加一个引用
+ */
+void MosaicOutput::ShowTile(int id, const AVFrame *frame)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(Tile &tile : tiles_) {
+        if(tile.id != id) {
+            continue;
+        }
+        av_frame_free(&tile.still);
+        tile.still = av_frame_clone(frame);
+        AVFrame *front = NULL;
+        while((front = tile.frame_queue->Front()) && front->pts <= frame->pts) {
+            front = tile.frame_queue->Pop(0);
+            av_frame_free(&front);
+        }
+        return;
+    }
+}
+
+int MosaicOutput::TileCount()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return (int)tiles_.size();
+}
+
+/**
+ * @brief 清屏、拷贝和呈现累计占用的CPU时间，不含各路的上传
+ * @return 单位微秒
+ */
+int64_t MosaicOutput::CpuMicroseconds()
+{
+    return cpu_us_.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief 刷新一次：先上传各路到时间的帧，有画面变化时再一次拷贝所有区域并呈现
+ * @param remain_time 返回所有画面中最短的等待时间，单位秒
+ */
+void MosaicOutput::Refresh(double &remain_time)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(!renderer_) {
+        return;
+    }
+    int64_t start_us = ThreadCpuMicroseconds();
+    for(SDL_Texture *texture : retired_) {
+        SDL_DestroyTexture(texture);
+    }
+    bool changed = !retired_.empty();
+    retired_.clear();
+    int width = 0;
+    int height = 0;
+    if(SDL_GetRendererOutputSize(renderer_, &width, &height) == 0
+            && (width != output_width_ || height != output_height_)) {
+        output_width_ = width;
+        output_height_ = height;
+        LOG_INFO("mosaic output %dx%d\n", width, height);
+        layout_changed_ = true;
+    }
+    if(layout_changed_) {
+        layout();
+        changed = true;
+    }
+    int64_t tiles_us = 0;
+    for(Tile &tile : tiles_) {
+        int64_t tile_start_us = ThreadCpuMicroseconds();
+        if(refreshTile(tile, remain_time)) {
+            changed = true;
+        }
+        int64_t tile_us = ThreadCpuMicroseconds() - tile_start_us;
+        if(tile.stats) {
+            tile.stats->video_render_cpu.Add(tile_us);
+        }
+        tiles_us += tile_us;
+    }
+    if(changed) {
+        composite();
+    }
+    cpu_us_.fetch_add(ThreadCpuMicroseconds() - start_us - tiles_us, std::memory_order_relaxed);
+}
+
+/**
+ * @brief 按画面数排成接近正方形的网格，各路按区域大小缩小后上传
+ */
+void MosaicOutput::layout()
+{
+    layout_changed_ = false;
+    int count = (int)tiles_.size();
+    if(count == 0 || output_width_ <= 0 || output_height_ <= 0) {
+        return;
+    }
+    int cols = (int)ceil(sqrt((double)count));
+    int rows = (count + cols - 1) / cols;
+    for(int i = 0; i < count; i++) {
+        Tile &tile = tiles_[i];
+        int col = i % cols;
+        int row = i / cols;
+        tile.rect.x = output_width_ * col / cols;
+        tile.rect.y = output_height_ * row / rows;
+        tile.rect.w = output_width_ * (col + 1) / cols - tile.rect.x;
+        tile.rect.h = output_height_ * (row + 1) / rows - tile.rect.y;
+        if(tile.resize_callback) {
+            tile.resize_callback(tile.rect.w, tile.rect.h);
+        }
+    }
+    LOG_INFO("mosaic layout %d tiles %dx%d\n", count, cols, rows);
+}
+
+/**
+ * @brief 和VideoOutput::videoRefresh相同的显示判断，到时间的帧上传到该路的纹理
+ * @return 上传了新的帧返回true
+ */
+bool MosaicOutput::refreshTile(Tile &tile, double &remain_time)
+{
+    PipelineStats *stats = tile.stats;
+    if(stats) {
+        stats->heartbeats[STAGE_VIDEO_OUTPUT].Beat();
+    }
+    if(tile.still) {
+        upload(tile, tile.still);
+        av_frame_free(&tile.still);
+        return true;
+    }
+    AVFrame *frame = tile.frame_queue->Front();
+    if(!frame) {
+        return false;
+    }
+    FrameTiming timing(frame, tile.time_base, tile.avsync->GetClock());
+    int action = timing.Action(tile.avsync->Rate());
+    if(action == FRAME_WAIT) {
+        if(timing.diff < remain_time) {
+            remain_time = timing.diff;
+        }
+        return false;
+    }
+    if(action == FRAME_DROP) {
+        RecordFrameDropped(stats, frame, timing);
+        frame = tile.frame_queue->Pop(0);
+        av_frame_free(&frame);
+        remain_time = 0;
+        return false;
+    }
+    int64_t upload_start_us = stats ? PipelineStats::NowMicroseconds() : 0;
+    upload(tile, frame);
+    if(stats) {
+        stats->video_upload.Record(PipelineStats::NowMicroseconds() - upload_start_us);
+    }
+    RecordFrameShown(stats, frame, timing);
+    {
+        TRACE_SCOPE("frame_queue_pop", "video", frame->pts);
+        frame = tile.frame_queue->Pop(0);
+    }
+    av_frame_free(&frame);
+    // 下一帧马上判断
+    remain_time = 0;
+    return true;
+}
+
+/**
+ * @brief 上传到该路的纹理，帧的大小或格式变化时重建纹理
+ * @return 成功返回0，失败返回负值，保留上一帧的画面
+ */
+int MosaicOutput::upload(Tile &tile, AVFrame *frame)
+{
+    Uint32 format = VideoOutput::TextureFormat(frame->format);
+    int rows = frame->height;
+    bool direct = VideoOutput::TextureLayout(frame, rows);
+    if(!tile.texture || tile.format != format || tile.width != frame->width || tile.height != rows) {
+        if(tile.texture) {
+            SDL_DestroyTexture(tile.texture);
+        }
+        tile.texture = SDL_CreateTexture(renderer_, format, SDL_TEXTUREACCESS_STREAMING, frame->width, rows);
+        if(!tile.texture) {
+            LOG_ERROR("%s(%d) SDL_CreateTexture failed:%s\n", __FUNCTION__, __LINE__, SDL_GetError());
+            return -1;
+        }
+        tile.format = format;
+        tile.width = frame->width;
+        tile.height = rows;
+        if(tile.stats) {
+            tile.stats->video_texture_creates.Add(1);
+            tile.stats->video_texture_pixels.Set((int64_t)frame->width * frame->height);
+        }
+    }
+    tile.src = {0, 0, frame->width, frame->height};
+    return VideoOutput::UpdateTexture(tile.texture, frame, direct, tile.stats);
+}
+
+/**
+ * @brief 清屏后把各路的纹理按宽高比画到各自区域的中间，只呈现一次
+ */
+void MosaicOutput::composite()
+{
+    SDL_RenderClear(renderer_);
+    for(Tile &tile : tiles_) {
+        if(!tile.texture) {
+            continue;
+        }
+        SDL_Rect rect;
+        ConvertThread::FitSize(tile.src.w, tile.src.h, tile.rect.w, tile.rect.h, rect.w, rect.h);
+        rect.x = tile.rect.x + (tile.rect.w - rect.w) / 2;
+        rect.y = tile.rect.y + (tile.rect.h - rect.h) / 2;
+        SDL_RenderCopy(renderer_, tile.texture, &tile.src, &rect);
+    }
+    TRACE_SCOPE("SDL_RenderPresent", "video", 0);
+    SDL_RenderPresent(renderer_);
+}
@@ -0,0 +1,75 @@
+﻿#ifndef MOSAICOUTPUT_H
+#define MOSAICOUTPUT_H
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "avframequeue.h"
+#include "avsync.h"
+#ifdef __cplusplus  ///
+extern "C"
+{
+#include "SDL.h"
+}
+#endif
+
+/**
+ * 多路画面拼接输出(电视墙)：多个Player各自解复用、解码，视频帧送到同一个窗口的不同区域，
+ * 共用一个渲染器；一次刷新先上传所有到时间的帧，再一次清屏、拷贝各区域、呈现
+ *
+ * 每路的上传耗时按线程CPU时间记到该路的video_render_cpu_us_total，
+ * 清屏、拷贝和呈现是各路共同的开销，单独由CpuMicroseconds返回
+ */
+class MosaicOutput
+{
+public:
+    MosaicOutput();
+    ~MosaicOutput();
+    int Init(int width, int height);
+    void DeInit();
+    int AddTile(AVSync *avsync, AVFrameQueue *frame_queue, AVRational time_base, PipelineStats *stats,
+                std::function<void(int width, int height)> resize_callback);
+    void RemoveTile(int id);
+    void FlushTile(int id);
+    void ShowTile(int id, const AVFrame *frame);
+    void Refresh(double &remain_time);
+    int TileCount();
+    int64_t CpuMicroseconds();
+private:
+    // 一路画面
+    struct Tile {
+        int id;
+        AVSync *avsync;
+        AVFrameQueue *frame_queue;
+        AVRational time_base;
+        PipelineStats *stats;
+        std::function<void(int, int)> resize_callback;   // 区域变化时通知格式转换缩小到该大小
+        SDL_Rect rect;            // 在窗口中的区域
+        SDL_Texture *texture;     // 正在显示的帧，帧的大小或格式变化时重建
+        Uint32 format;
+        int width;
+        int height;               // 直接上传时包含解码器对齐多出的行
+        SDL_Rect src;             // 纹理中有效的画面
+        AVFrame *still;           // 逐帧步进时要显示的帧，不看时钟
+    };
+
+    void layout();
+    bool refreshTile(Tile &tile, double &remain_time);
+    int upload(Tile &tile, AVFrame *frame);
+    void composite();
+
+    SDL_Window *win_ = NULL;
+    SDL_Renderer *renderer_ = NULL;
+    bool sdl_inited_ = false;
+    int output_width_ = 0;    // 渲染区域的像素大小，窗口缩放时变化
+    int output_height_ = 0;
+    bool layout_changed_ = false;    // 增减画面或窗口缩放后重新排列
+    int next_id_ = 1;
+    std::vector<Tile> tiles_;
+    std::vector<SDL_Texture *> retired_;   // 移除的画面的纹理，RemoveTile可能不在渲染线程，下次刷新时释放
+    std::atomic<int64_t> cpu_us_{0};
+    std::mutex mutex_;   // refreshTile持有队首帧的指针，RemoveTile和FlushTile要和它互斥
+};
+
+#endif // MOSAICOUTPUT_H
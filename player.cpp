@@ -0,0 +1,1219 @@
+﻿#include "player.h"
+#include "log.h"
+#include <stdio.h>
+
+// 进程内播放器计数，用于区分各实例的飞行记录文件
+static std::atomic<int> g_player_count{0};
+
+// 窗口中上下方向键切换的速率档位
+static const double g_rate_steps[] = {0.5, 0.75, 1.0, 1.25, 1.5, 2.0, 3.0, 4.0};
+
+/**
+ * @brief 从当前速率向上或向下切换一档
+ * @param direction 1加速，-1减速
+ */
+static double next_rate(double rate, int direction)
+{
+    int count = sizeof(g_rate_steps) / sizeof(g_rate_steps[0]);
+    if(direction > 0) {
+        for(int i = 0; i < count; i++) {
+            if(g_rate_steps[i] > rate + 0.001) {
+                return g_rate_steps[i];
+            }
+        }
+        return g_rate_steps[count - 1];
+    }
+    for(int i = count - 1; i >= 0; i--) {
+        if(g_rate_steps[i] < rate - 0.001) {
+            return g_rate_steps[i];
+        }
+    }
+    return g_rate_steps[0];
+}
+
+/**
+ * @brief 构造函数，把队列的统计项接到本实例的统计对象上
+ */
+Player::Player()
+{
+    id_ = ++g_player_count;
+    // 线程名带上播放器编号，多个实例时在top/perf中可以区分；解复用是预读，优先级调低
+    const char *names[STAGE_COUNT] = {"demux", "adec", "vdec", "audio", ""};
+    for(int i = 0; i < STAGE_COUNT; i++) {
+        if(names[i][0]) {
+            char name[32];
+            snprintf(name, sizeof(name), "%s-p%d", names[i], id_);
+            stage_options_[i].name = name;
+        }
+    }
+    stage_options_[STAGE_DEMUX].policy = THREAD_POLICY_NICE;
+    stage_options_[STAGE_DEMUX].priority = 5;
+    audio_packet_queue_.SetStats(&stats_.audio_packet_residency, &stats_.audio_packet_depth);
+    video_packet_queue_.SetStats(&stats_.video_packet_residency, &stats_.video_packet_depth);
+    audio_frame_queue_.SetStats(&stats_.audio_frame_residency, &stats_.audio_frame_depth);
+    video_decoded_queue_.SetStats(NULL, &stats_.video_decoded_depth);
+    video_frame_queue_.SetStats(&stats_.video_frame_residency, &stats_.video_frame_depth);
+}
+
+/**
+ * @brief 析构函数，停止所有线程并释放资源
+ */
+Player::~Player()
+{
+    Stop();
+}
+
+/**
+ * @brief 打开媒体文件，创建并初始化解复用、解码和输出，不开始播放
+ * @param url 媒体文件路径或URL
+ * @return 成功返回0，失败返回负值，失败时已创建的对象在Stop或析构时释放
+ */
+int Player::Open(const char *url)
+{
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    // 之前Stop或失败的Open留下的中断标志，不清除时打开和读取马上返回AVERROR_EXIT
+    interrupt_ = false;
+    if(!url) {
+        LOG_ERROR("%s(%d) url is null\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    if(demux_thread_) {
+        LOG_ERROR("%s(%d) player already opened\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    url_ = url;
+
+    // 解复用，打开媒体文件并分离音视频流
+    demux_thread_.reset(new DemuxThread(&audio_packet_queue_, &video_packet_queue_));
+    demux_thread_->SetStats(&stats_);
+    demux_thread_->SetInterrupt(&interrupt_);
+    demux_thread_->SetLowLatency(live_target_ms_ > 0);
+    if(demux_thread_->Init(url) < 0) {
+        LOG_ERROR("%s(%d) demux_thread Init\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+
+    // 音频、视频解码器
+    audio_decode_thread_.reset(new DecodeThread(&audio_packet_queue_, &audio_frame_queue_));
+    audio_decode_thread_->SetStats(&stats_);
+    audio_decode_thread_->SetLowDelay(live_target_ms_ > 0);
+    if(audio_decode_thread_->Init(demux_thread_->AudioCodecParameters(), demux_thread_->AudioStreamTimebase()) < 0) {
+        LOG_ERROR("%s(%d) audio_decode_thread Init\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    video_decode_thread_.reset(new DecodeThread(&video_packet_queue_, &video_decoded_queue_));
+    video_decode_thread_->SetStats(&stats_);
+    video_decode_thread_->SetLowDelay(live_target_ms_ > 0);
+    if(video_decode_thread_->Init(demux_thread_->VideoCodecParameters(), demux_thread_->VideoStreamTimebase()) < 0) {
+        LOG_ERROR("%s(%d) video_decode_thread Init\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    // 像素格式转换，纹理不能直接显示的格式转成YUV420P；共享线程池时多路之间已经并行，每路不再按片多线程
+    video_convert_thread_.reset(new ConvertThread(&video_decoded_queue_, &video_frame_queue_));
+    video_convert_thread_->SetStats(&stats_);
+    video_convert_thread_->SetLowDelay(live_target_ms_ > 0);
+    if(frame_cache_mb_ > 0) {
+        frame_cache_.reset(new FrameCache());
+        if(frame_cache_->Init((int64_t)frame_cache_mb_ << 20, &stats_) < 0) {
+            LOG_ERROR("%s(%d) frame cache Init\n", __FUNCTION__, __LINE__);
+            return -1;
+        }
+        video_convert_thread_->SetCache(frame_cache_.get());
+    }
+    if(video_convert_thread_->Init(demux_thread_->VideoStreamTimebase(), executor_ ? 1 : 0) < 0) {
+        LOG_ERROR("%s(%d) video_convert_thread Init\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+
+    // 队列两端的任务互相唤醒：有数据唤醒下游，有空位唤醒上游，输出端不是任务
+    audio_packet_queue_.SetTasks(demux_thread_.get(), audio_decode_thread_.get());
+    video_packet_queue_.SetTasks(demux_thread_.get(), video_decode_thread_.get());
+    audio_frame_queue_.SetTasks(audio_decode_thread_.get(), NULL);
+    video_decoded_queue_.SetTasks(video_decode_thread_.get(), video_convert_thread_.get());
+    video_frame_queue_.SetTasks(video_convert_thread_.get(), NULL);
+
+    // 无窗口模式下只按时钟取走帧，用于多实例压测
+    if(headless_ && !mosaic_) {
+        headless_output_.reset(new HeadlessOutput(&avsync_, &audio_frame_queue_, &video_frame_queue_,
+                               demux_thread_->AudioStreamTimebase(), demux_thread_->VideoStreamTimebase()));
+        headless_output_->SetStats(&stats_);
+        // 无窗口时只能模拟vblank
+        if(vsync_) {
+            headless_output_->SetVsync(vsync_hz_ > 0 ? vsync_hz_ : VSYNC_DEFAULT_REFRESH_HZ);
+        }
+        return openMonitors();
+    }
+
+    // 拼接输出：视频显示在共用窗口的一个区域，音频按墙上时钟取走不出声，多路同时出声没有意义
+    if(mosaic_) {
+        headless_output_.reset(new HeadlessOutput(&avsync_, &audio_frame_queue_, NULL,
+                               demux_thread_->AudioStreamTimebase(), demux_thread_->VideoStreamTimebase()));
+        headless_output_->SetStats(&stats_);
+        // 区域比视频小时在格式转换时缩小
+        mosaic_tile_ = mosaic_->AddTile(&avsync_, &video_frame_queue_, demux_thread_->VideoStreamTimebase(), &stats_,
+                                        [this](int width, int height) {
+            video_convert_thread_->SetOutputSize(width, height);
+        });
+        return openMonitors();
+    }
+
+    // 音频输出，设备打开后先暂停，Play时再开始
+    AudioParams audio_params;
+    memset(&audio_params, 0, sizeof(audio_params));
+    AVCodecContext *audio_codec_ctx = audio_decode_thread_->GetAVCodecContext();
+    audio_params.ch_layout = audio_codec_ctx->ch_layout;
+    audio_params.fmt = audio_codec_ctx->sample_fmt;
+    audio_params.freq = audio_codec_ctx->sample_rate;
+    audio_output_.reset(new AudioOutput(&avsync_, audio_params, &audio_frame_queue_, demux_thread_->AudioStreamTimebase()));
+    audio_output_->SetStats(&stats_);
+    audio_output_->SetThreadOptions(stage_options_[STAGE_AUDIO_OUTPUT]);
+    if(audio_output_->Init() < 0) {
+        LOG_ERROR("%s(%d) audio_output Init\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+
+    // 视频输出，创建窗口和渲染器
+    AVCodecContext *video_codec_ctx = video_decode_thread_->GetAVCodecContext();
+    video_output_.reset(new VideoOutput(&avsync_, &video_frame_queue_, video_codec_ctx->width,
+                                        video_codec_ctx->height, demux_thread_->VideoStreamTimebase()));
+    video_output_->SetStats(&stats_);
+    video_output_->SetRenderThread(render_thread_, texture_buffers_);
+    video_output_->SetVsync(vsync_, vsync_hz_);
+    // 窗口比视频小时在格式转换时缩小，纹理和上传带宽按窗口大小
+    video_output_->SetResizeCallback([this](int width, int height) {
+        video_convert_thread_->SetOutputSize(width, height);
+    });
+    if(video_output_->Init() < 0) {
+        LOG_ERROR("%s(%d) video_output Init\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    return openMonitors();
+}
+
+/**
+ * @brief 创建飞行记录仪和卡顿检测，Open的最后一步
+ * @return 成功返回0，失败返回负值
+ */
+int Player::openMonitors()
+{
+    // 飞行记录仪常开，欠载/音画差过大/卡顿/SIGUSR1时把最近的事件写到当前目录
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "sparkplayer-flight-p%d", id_);
+    if(stats_.recorder.Init(prefix, 10000) == 0) {
+        stats_.recorder.Start();
+    }
+
+    // 卡顿检测，播放位置超过1秒不前进时上报卡在哪个阶段
+    watchdog_.reset(new Watchdog(&stats_));
+    watchdog_->SetStallCallback([this](const StallEvent &event) {
+        notify(PLAYER_EVENT_STALL, event.ToJson());
+    });
+    watchdog_->SetEndCallback([this]() {
+        notify(PLAYER_EVENT_END_OF_STREAM, "");
+    });
+    if(watchdog_->Init(1000) < 0) {
+        LOG_ERROR("%s(%d) watchdog Init\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+
+    // 按水位预缓冲和重新缓冲，低延时模式下高水位不超过目标延时
+    int high_ms = buffer_high_ms_;
+    int low_ms = buffer_low_ms_;
+    if(live_target_ms_ > 0 && high_ms > live_target_ms_) {
+        high_ms = live_target_ms_;
+        if(low_ms >= high_ms) {
+            low_ms = high_ms / 2;
+        }
+    }
+    buffering_controller_.reset(new BufferingController(&stats_, &avsync_, demux_thread_.get()));
+    buffering_controller_->SetHoldCallback([this](bool hold) {
+        return onBufferingHold(hold);
+    });
+    if(buffering_controller_->Init(low_ms, high_ms) < 0) {
+        LOG_ERROR("%s(%d) buffering controller Init\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+
+    // 低延时直播：缓冲超过目标时加速或丢到最新关键帧
+    if(live_target_ms_ > 0) {
+        latency_controller_.reset(new LatencyController(&stats_, &avsync_));
+        latency_controller_->SetRateCallback([this](double rate) {
+            applyRate(rate);
+        });
+        latency_controller_->SetDropCallback([this](double position) {
+            return dropToLive(position);
+        });
+        if(latency_controller_->Init(live_target_ms_, live_wallclock_pts_) < 0) {
+            LOG_ERROR("%s(%d) latency controller Init\n", __FUNCTION__, __LINE__);
+            return -1;
+        }
+    }
+    LOG_INFO("player %d open %s\n", id_, url_.c_str());
+    return 0;
+}
+
+/**
+ * @brief 开始播放，暂停时调用则恢复播放
+ * @return 成功返回0，失败返回负值
+ */
+int Player::Play()
+{
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    if(!watchdog_) {
+        LOG_ERROR("%s(%d) player not opened\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    if(started_) {
+        if(avsync_.IsPaused()) {
+            // 逐帧步进过，音频和解码还在步进之前的位置，从显示的帧精确地重新开始
+            if(step_pts_ != AV_NOPTS_VALUE) {
+                seek(avsync_.GetClock(), true);
+            }
+            if(loop_controller_) {
+                loop_controller_->SetPaused(false);
+            }
+            // 时钟从暂停时的值继续走，音频回调再用下一帧的pts校准，不产生音画偏差
+            avsync_.Resume();
+            watchdog_->SetPaused(false);
+            if(latency_controller_) {
+                latency_controller_->SetPaused(false);
+            }
+            buffering_controller_->SetPaused(false);
+            // 暂停前正在缓冲时音频继续停着，缓冲够了再由BufferingController放开；倒放时不出声
+            if(audio_output_) {
+                audio_output_->SetPause(avsync_.IsHeld() || reverse_);
+            }
+            if(video_output_) {
+                video_output_->SetPaused(false);
+            }
+            wake();
+        }
+        return 0;
+    }
+    if(startStages() < 0) {
+        return -1;
+    }
+    watchdog_->Start();
+    if(latency_controller_) {
+        latency_controller_->Start();
+    }
+    // 初始化音视频同步时钟，先停住时钟和音频，预缓冲到高水位后再开始走
+    holdForBuffering(true);
+    avsync_.InitClock();
+    buffering_controller_->Preroll();
+    buffering_controller_->Start();
+    started_ = true;
+    return 0;
+}
+
+/**
+ * @brief 暂停播放，时钟停止，音频设备不再回调，刷新循环只等事件，
+ *        解复用和解码在队列满后挂起，整条管线不再定时唤醒
+ * @return 成功返回0，失败返回负值
+ */
+int Player::Pause()
+{
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    if(!started_) {
+        return -1;
+    }
+    if(avsync_.IsPaused()) {
+        return 0;
+    }
+    // 先停音频回调，避免暂停后回调又把时钟往前推
+    if(audio_output_) {
+        audio_output_->SetPause(true);
+    }
+    avsync_.Pause();
+    watchdog_->SetPaused(true);
+    if(latency_controller_) {
+        latency_controller_->SetPaused(true);
+    }
+    if(loop_controller_) {
+        loop_controller_->SetPaused(true);
+    }
+    buffering_controller_->SetPaused(true);
+    if(video_output_) {
+        video_output_->SetPaused(true);
+    }
+    return 0;
+}
+
+/**
+ * @brief 跳转到指定位置之前最近的关键帧，暂停状态下跳转后仍保持暂停
+ * @param position 目标位置，单位秒，和Position在同一时间轴上，媒体不从0开始时包含StartTime
+ * @return 成功返回0，失败返回负值
+ *
+ * 停止解复用和解码后清空队列和解码器缓存，再重新启动
+ */
+int Player::Seek(double position)
+{
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    if(!started_) {
+        return -1;
+    }
+    return seek(position);
+}
+
+/**
+ * @brief Seek的实现，调用前已持有控制锁
+ * @param exact true时音视频都只送出目标位置及之后的帧，倒放时忽略
+ */
+int Player::seek(double position, bool exact)
+{
+    int64_t start_us = PipelineStats::NowMicroseconds();
+    double start = demux_thread_->StartTime() / 1000000.0;
+    double duration = demux_thread_->Duration() / 1000000.0;
+    if(duration > 0 && position > start + duration) {
+        position = start + duration;
+    }
+    if(position < start) {
+        position = start;
+    }
+    LOG_INFO("player %d seek to %0.3lf%s\n", id_, position, reverse_ ? " reverse" : "");
+
+    stopStages();
+    interrupt_ = false;
+
+    int64_t position_us = (int64_t)(position * 1000000);
+    int ret = reverse_ ? demux_thread_->SeekReverse(position_us) : demux_thread_->Seek(position_us);
+    flushPipeline(reverse_ ? -position : position);
+    video_decode_thread_->SetReverse(reverse_, av_rescale_q(position_us, AV_TIME_BASE_Q, demux_thread_->VideoStreamTimebase()),
+                                     (int64_t)reverse_budget_mb_ << 20);
+    if(exact && !reverse_) {
+        video_decode_thread_->SetExactTarget(av_rescale_q(position_us, AV_TIME_BASE_Q, demux_thread_->VideoStreamTimebase()), start_us);
+        audio_decode_thread_->SetExactTarget(av_rescale_q(position_us, AV_TIME_BASE_Q, demux_thread_->AudioStreamTimebase()), start_us);
+    }
+
+    if(startStages() < 0) {
+        return -1;
+    }
+    // 暂停中seek，刷新到新位置的画面后再停下
+    if(avsync_.IsPaused()) {
+        if(video_output_) {
+            video_output_->RequestRefresh();
+        }
+        wake();
+    }
+    return ret;
+}
+
+/**
+ * @brief 精确seek：seek到目标之前的关键帧，解码但不显示目标之前的帧，只显示目标位置的那一帧，暂停状态下seek后仍保持暂停
+ * @param position 目标位置，单位秒，和Seek相同，按Position的时间轴
+ * @return 成功返回0，失败返回负值
+ *
+ * 目标之前就结束的非参考帧不解码；耗时和关键帧到目标的距离记录在exact_seek_us、exact_seek_frames和exact_seek_distance_ms
+ */
+int Player::SeekExact(double position)
+{
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    if(!started_) {
+        return -1;
+    }
+    return seek(position, true);
+}
+
+/**
+ * @brief 暂停中逐帧前进或后退一帧，暂停后时钟不走，显示的帧就是步进到的帧
+ * @param direction 大于0前进，否则后退
+ * @return 马上显示了返回0，需要精确seek、解到后再显示返回1，没有暂停返回-1
+ *
+ * 先找已解码帧缓存；前进时不在缓存里就取帧队列中的下一帧，解码器已经解到后面，不用重新解；
+ * 都没有时精确seek到相邻的帧。恢复播放时从步进到的帧重新开始
+ */
+int Player::StepFrame(int direction)
+{
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    if(!started_ || !avsync_.IsPaused() || reverse_) {
+        LOG_ERROR("%s(%d) step needs a paused forward player\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    AVRational time_base = demux_thread_->VideoStreamTimebase();
+    AVRational frame_rate = demux_thread_->VideoFrameRate();
+    int64_t duration = av_rescale_q(frame_rate.num > 0 ? av_rescale(1000000, frame_rate.den, frame_rate.num) : 40000,
+                                    AV_TIME_BASE_Q, time_base);
+    // 第一次步进从正在显示的帧开始，输出端的进度是微秒，换回时间基准后对齐到缓存中的帧
+    if(step_pts_ == AV_NOPTS_VALUE) {
+        int64_t shown_us = stats_.heartbeats[STAGE_VIDEO_OUTPUT].PtsUs();
+        if(shown_us == INT64_MIN) {
+            shown_us = (int64_t)(avsync_.GetClock() * 1000000);
+        }
+        step_pts_ = av_rescale_q(shown_us, AV_TIME_BASE_Q, time_base);
+        int64_t cached = frame_cache_ ? frame_cache_->Floor(step_pts_ + duration / 2) : AV_NOPTS_VALUE;
+        if(cached != AV_NOPTS_VALUE && cached >= step_pts_ - duration / 2) {
+            step_pts_ = cached;
+        }
+    }
+    AVFrame *frame = NULL;
+    if(frame_cache_) {
+        frame = direction > 0 ? frame_cache_->Next(step_pts_) : frame_cache_->Prev(step_pts_);
+    }
+    if(!frame && direction > 0) {
+        frame = queuedFrame(step_pts_);
+    }
+    if(!frame) {
+        // 前进到下一帧的时间，后退到上一帧的中间，时间戳换算有误差时也不会落回当前帧
+        int64_t target = direction > 0 ? step_pts_ + duration : step_pts_ - duration / 2;
+        LOG_INFO("player %d step %s from %lld by exact seek\n", id_, direction > 0 ? "forward" : "back", (long long)step_pts_);
+        if(seek(target > 0 ? target * av_q2d(time_base) : 0, true) < 0) {
+            return -1;
+        }
+        return 1;
+    }
+    showFrame(frame);
+    step_pts_ = frame->pts;
+    avsync_.SetClock(frame->pts * av_q2d(time_base));
+    av_frame_free(&frame);
+    wake();
+    return 0;
+}
+
+/**
+ * @brief 设置A/B循环，播放到终点时回到起点；整段在已解码帧缓存中时视频不解码，直接从缓存重放
+ * @param start 起点，单位秒
+ * @param end 终点，单位秒，不大于start时取消循环
+ * @return 成功返回0，失败返回负值
+ *
+ * 视频正在从缓存重放时改变或取消循环，从当前位置精确seek，之后照常解码
+ */
+int Player::SetLoop(double start, double end)
+{
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    if(!started_ || (reverse_ && end > start)) {
+        return -1;
+    }
+    if(!loop_controller_) {
+        if(end <= start) {
+            return 0;
+        }
+        loop_controller_.reset(new LoopController(&avsync_));
+        loop_controller_->SetLoopCallback([this](double loop_start, double loop_end) {
+            return loopBack(loop_start, loop_end);
+        });
+        loop_controller_->SetPaused(avsync_.IsPaused());
+        if(loop_controller_->Start() < 0) {
+            LOG_ERROR("%s(%d) loop controller Start\n", __FUNCTION__, __LINE__);
+            loop_controller_.reset();
+            return -1;
+        }
+    }
+    LOG_INFO("player %d loop %0.3lf - %0.3lf\n", id_, start, end);
+    loop_controller_->SetRange(start, end);
+    // 从缓存重放到旧的终点后视频解码要等下一个关键帧，不再回到起点时会停住最多一个GOP，
+    // 从当前位置精确seek，视频解码接上
+    if(loop_replay_) {
+        return seek(avsync_.GetClock(), true);
+    }
+    return 0;
+}
+
+/**
+ * @brief 切换倒放，从当前位置开始
+ * @param reverse true倒放，false恢复正常播放
+ * @return 成功返回0，失败返回负值
+ *
+ * 倒放只有视频：DemuxThread从当前位置所在的GOP开始逐个往前seek到关键帧，读出整个GOP；
+ * DecodeThread把GOP整段解完后倒序送出，同时解下一个(更早的)GOP，已解码的帧按SetReverseBudget的预算分几遍解；
+ * 时钟和送出的帧时间戳都取负，输出端和缓冲控制仍按时间戳递增处理，Position返回正常的位置
+ */
+int Player::SetReverse(bool reverse)
+{
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    if(!started_ || live_target_ms_ > 0) {
+        LOG_ERROR("%s(%d) reverse needs a started non-live player\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    if(reverse == reverse_) {
+        return 0;
+    }
+    double position = Position();
+    reverse_ = reverse;
+    if(loop_controller_) {
+        loop_controller_->SetRange(0, 0);
+    }
+    buffering_controller_->SetReverse(reverse);
+    // 倒放的帧时间戳取负，不放进缓存
+    video_convert_thread_->SetCache(reverse ? NULL : frame_cache_.get());
+    if(audio_output_ && reverse) {
+        audio_output_->SetPause(true);
+    }
+    // 倒放时音频输出的位置不再前进，看门狗只看视频
+    stats_.heartbeats[STAGE_AUDIO_OUTPUT].ResetPts();
+    return seek(position);
+}
+
+/**
+ * @brief 设置播放速率，变速不变调，Open之后任意时刻调用，暂停时恢复后按新速率播放
+ * @param rate 1.0为原速，范围AUDIO_TEMPO_MIN_RATE到AUDIO_TEMPO_MAX_RATE
+ * @return 成功返回0，失败返回负值
+ *
+ * 时钟按速率缩放，音频经过atempo拉伸；视频来不及显示的帧直接丢弃，
+ * 速率超过PLAYER_SKIP_NONREF_RATE时解码跳过非参考帧
+ */
+int Player::SetRate(double rate)
+{
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    if(!demux_thread_) {
+        LOG_ERROR("%s(%d) player not opened\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    if(rate < AUDIO_TEMPO_MIN_RATE || rate > AUDIO_TEMPO_MAX_RATE) {
+        LOG_ERROR("%s(%d) rate %0.2lf out of range\n", __FUNCTION__, __LINE__, rate);
+        return -1;
+    }
+    applyRate(rate);
+    return 0;
+}
+
+/**
+ * @brief 把速率设置到时钟、音频输出和视频解码，不加控制锁，低延时控制线程追赶时也调用
+ */
+void Player::applyRate(double rate)
+{
+    LOG_INFO("player %d rate %0.2lf\n", id_, rate);
+    avsync_.SetRate(rate);
+    if(audio_output_) {
+        audio_output_->SetRate(rate);
+    }
+    if(headless_output_) {
+        headless_output_->SetRate(rate);
+    }
+    video_decode_thread_->SetSkipFrame(rate > PLAYER_SKIP_NONREF_RATE ? AVDISCARD_NONREF : AVDISCARD_DEFAULT);
+    stats_.playback_rate.Set((int64_t)(rate * 100 + 0.5));
+}
+
+/**
+ * @brief 停止播放并释放所有资源，可以重复调用，也可以在其他线程调用以中断正在进行的Open
+ * @return 成功返回0
+ *
+ * 各等待都会被立即唤醒，解复用的阻塞IO通过中断回调返回，耗时记录在player_stop_us
+ */
+int Player::Stop()
+{
+    // 先于加锁设置，Open/Seek正卡在网络IO时也能尽快返回并释放锁
+    interrupt_ = true;
+    int64_t start_us = PipelineStats::NowMicroseconds();
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    // 加锁前正在进行的seek等可能已经在stopStages之后清除了中断标志，拿到锁后再设置一次
+    interrupt_ = true;
+    bool opened = demux_thread_ != nullptr;
+    int64_t locked_us = PipelineStats::NowMicroseconds();
+    // 先停低延时控制，它的回调会访问下面释放的对象
+    latency_controller_.reset();
+    buffering_controller_.reset();
+    loop_controller_.reset();
+    if(watchdog_) {
+        watchdog_->Stop();
+    }
+    stats_.recorder.Stop();
+    // 先关闭音频设备，之后回调不会再访问帧队列
+    audio_output_.reset();
+    int64_t audio_us = PipelineStats::NowMicroseconds();
+    stopStages();
+    int64_t stages_us = PipelineStats::NowMicroseconds();
+    // 各阶段释放之前记下累计的CPU时间
+    updateCpu();
+    if(mosaic_tile_ > 0) {
+        mosaic_->RemoveTile(mosaic_tile_);
+        mosaic_tile_ = 0;
+    }
+    video_output_.reset();
+    headless_output_.reset();
+    audio_packet_queue_.SetTasks(NULL, NULL);
+    video_packet_queue_.SetTasks(NULL, NULL);
+    audio_frame_queue_.SetTasks(NULL, NULL);
+    video_decoded_queue_.SetTasks(NULL, NULL);
+    video_frame_queue_.SetTasks(NULL, NULL);
+
+    // 释放队列中剩余的帧和数据包
+    audio_frame_queue_.Abort();
+    video_frame_queue_.Abort();
+    video_decoded_queue_.Abort();
+    audio_packet_queue_.Abort();
+    video_packet_queue_.Abort();
+
+    audio_decode_thread_.reset();
+    video_decode_thread_.reset();
+    video_convert_thread_.reset();
+    demux_thread_.reset();
+    frame_cache_.reset();
+    watchdog_.reset();
+    if(own_executor_) {
+        own_executor_.reset();
+        executor_ = NULL;
+    }
+    started_ = false;
+    if(!opened) {
+        return 0;
+    }
+    int64_t end_us = PipelineStats::NowMicroseconds();
+    stats_.player_stop.Record(end_us - start_us);
+    if(end_us - start_us > PLAYER_STOP_BUDGET_US) {
+        LOG_WARN("player %d stop took %lld us (lock:%lld, monitors+audio:%lld, stages:%lld, release:%lld)\n", id_,
+                 (long long)(end_us - start_us), (long long)(locked_us - start_us), (long long)(audio_us - locked_us),
+                 (long long)(stages_us - audio_us), (long long)(end_us - stages_us));
+    } else {
+        LOG_INFO("player %d stop took %lld us\n", id_, (long long)(end_us - start_us));
+    }
+    return 0;
+}
+
+/**
+ * @brief 事件和刷新主循环，必须在创建窗口的线程(一般是主线程)调用，阻塞直到用户退出
+ * @return 成功返回0，失败返回负值
+ *
+ * ESC/关闭窗口退出，空格暂停/恢复，左右方向键后退/前进10秒，上下方向键加速/减速，
+ * 逗号/句号暂停并后退/前进一帧，L依次设置循环起点、终点和取消循环，R切换倒放
+ */
+int Player::MainLoop()
+{
+    if(!video_output_) {
+        LOG_ERROR("%s(%d) player not opened\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    ThreadOptions &video_options = stage_options_[STAGE_VIDEO_OUTPUT];
+    if(render_thread_) {
+        // 视频输出在渲染线程，调用线程只处理事件，上传慢时不耽误响应按键
+        ThreadOptions options = video_options;
+        if(options.name.empty()) {
+            options.name = "render";
+        }
+        if(video_output_->StartRenderThread(options) < 0) {
+            LOG_ERROR("%s(%d) start render thread failed\n", __FUNCTION__, __LINE__);
+            return -1;
+        }
+    } else if(!video_options.name.empty() || video_options.policy != THREAD_POLICY_DEFAULT || video_options.affinity) {
+        // 视频输出就在调用线程，只在设置过时修改它的属性
+        ApplyThreadOptions(video_options);
+    }
+    SDL_Event event;
+    bool quit = false;
+    double loop_start = -1;   // 已设置循环起点时不小于0
+    bool looping = false;
+    while(!quit) {
+        video_output_->RefreshLoopWaitEvent(&event);
+        switch (event.type) {
+            case SDL_KEYDOWN:
+                switch (event.key.keysym.sym) {
+                    case SDLK_ESCAPE:
+                        LOG_INFO("esc key down\n");
+                        quit = true;
+                        break;
+                    case SDLK_SPACE:
+                        if(IsPaused()) {
+                            Play();
+                        } else {
+                            Pause();
+                        }
+                        break;
+                    case SDLK_LEFT:
+                        Seek(Position() - 10);
+                        break;
+                    case SDLK_RIGHT:
+                        Seek(Position() + 10);
+                        break;
+                    case SDLK_UP:
+                        SetRate(next_rate(Rate(), 1));
+                        break;
+                    case SDLK_DOWN:
+                        SetRate(next_rate(Rate(), -1));
+                        break;
+                    case SDLK_COMMA:
+                    case SDLK_PERIOD:
+                        if(!IsPaused()) {
+                            Pause();
+                        }
+                        StepFrame(event.key.keysym.sym == SDLK_PERIOD ? 1 : -1);
+                        break;
+                    case SDLK_r:
+                        SetReverse(!IsReverse());
+                        break;
+                    case SDLK_l:
+                        if(looping) {
+                            SetLoop(0, 0);
+                            looping = false;
+                            loop_start = -1;
+                        } else if(loop_start < 0 || Position() <= loop_start) {
+                            loop_start = Position();
+                            LOG_INFO("loop start %0.3lf\n", loop_start);
+                        } else {
+                            looping = SetLoop(loop_start, Position()) == 0;
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                break;
+            case SDL_QUIT:
+                LOG_INFO("SDL_QUIT\n");
+                quit = true;
+                break;
+            default:
+                break;
+        }
+    }
+    video_output_->StopRenderThread();
+    return 0;
+}
+
+/**
+ * @brief 刷新一次输出，不处理事件，由PlayerHost的刷新循环调用
+ * @param remain_time 返回下一帧应该等待的时间，单位秒
+ * @return 成功返回0，没有输出时返回负值
+ */
+int Player::Refresh(double &remain_time)
+{
+    if(headless_output_) {
+        int64_t start_us = ThreadCpuMicroseconds();
+        headless_output_->Refresh(remain_time);
+        output_cpu_us_.fetch_add(ThreadCpuMicroseconds() - start_us, std::memory_order_relaxed);
+        return 0;
+    }
+    if(video_output_) {
+        video_output_->Refresh(remain_time);
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief 设置低延时直播模式，在Open之前调用
+ * @param target_ms 目标延时，单位毫秒，0表示关闭；播放器内缓冲超过它时小幅加速，超过太多时丢到最新的关键帧
+ * @param wallclock_pts 发送端用墙上时间打时间戳，用于统计端到端延时glass_to_glass_us
+ */
+void Player::SetLowLatency(int target_ms, bool wallclock_pts)
+{
+    live_target_ms_ = target_ms > 0 ? target_ms : 0;
+    live_wallclock_pts_ = wallclock_pts;
+}
+
+/**
+ * @brief 设置缓冲水位，在Open之前调用
+ * @param low_ms 播放中任一路缓冲低于它时停住时钟和音频重新缓冲，单位毫秒
+ * @param high_ms 开播、seek和重新缓冲时两路都缓冲到它才开始走，单位毫秒，必须大于low_ms
+ */
+void Player::SetBufferWatermarks(int low_ms, int high_ms)
+{
+    buffer_low_ms_ = low_ms;
+    buffer_high_ms_ = high_ms;
+}
+
+/**
+ * @brief 设置为无窗口模式，在Open之前调用
+ * @param headless true时不打开窗口和声卡，帧按墙上时钟被取走
+ */
+void Player::SetHeadless(bool headless)
+{
+    headless_ = headless;
+}
+
+/**
+ * @brief 设置窗口模式的渲染方式，在Open之前调用
+ * @param enabled true时MainLoop启动单独的渲染线程上传和呈现，调用线程只处理事件；
+ *                由外部刷新循环调用Refresh时(如PlayerHost)必须为false
+ * @param texture_buffers 每种大小和格式轮流使用的纹理个数，2为双缓冲，3为三缓冲
+ */
+void Player::SetRenderThread(bool enabled, int texture_buffers)
+{
+    render_thread_ = enabled;
+    texture_buffers_ = texture_buffers;
+}
+
+/**
+ * @brief 设置按vblank显示，在Open之前调用
+ * @param enabled true时每个vblank呈现一次并选择显示哪一帧(如24p在60Hz上按3:2交替)，每次选择写入飞行记录和统计
+ * @param simulated_hz 大于0时按该刷新率模拟vblank，否则使用显示器的垂直同步和刷新率；无窗口模式总是模拟，默认60Hz
+ */
+void Player::SetVsync(bool enabled, int simulated_hz)
+{
+    vsync_ = enabled;
+    vsync_hz_ = simulated_hz;
+}
+
+/**
+ * @brief 使用共享线程池执行解复用和解码，在Play之前调用
+ * @param executor 线程池，为NULL时Play创建自己的线程池，必须比Player后释放
+ */
+void Player::SetExecutor(TaskExecutor *executor)
+{
+    executor_ = executor;
+}
+
+/**
+ * @brief 视频显示在拼接窗口的一个区域，在Open之前调用
+ * @param mosaic 拼接输出，为NULL时按SetHeadless打开自己的窗口或不显示，必须比Player后释放
+ */
+void Player::SetMosaic(MosaicOutput *mosaic)
+{
+    mosaic_ = mosaic;
+}
+
+/**
+ * @brief 缓存已解码的帧，用于逐帧步进和A/B循环，在Open之前调用
+ * @param budget_mb 内存预算，单位MB，0表示不缓存
+ */
+void Player::SetFrameCache(int budget_mb)
+{
+    frame_cache_mb_ = budget_mb > 0 ? budget_mb : 0;
+}
+
+/**
+ * @brief 倒放时已解码还没送出的帧的内存预算，在SetReverse之前调用
+ * @param budget_mb 单位MB，GOP解出的帧超过一半时分几遍解，每遍多解一次GOP开头的部分
+ */
+void Player::SetReverseBudget(int budget_mb)
+{
+    if(budget_mb > 0) {
+        reverse_budget_mb_ = budget_mb;
+    }
+}
+
+/**
+ * @brief 设置某个阶段所在线程的名字、CPU亲和性和调度类别，在Open之前调用
+ * @param stage PipelineStage，解复用和解码只在使用自己的线程池时生效(每个阶段固定在一个工作线程上)，
+ *              视频输出是调用MainLoop的线程
+ * @param options 线程属性，名字为空时保留默认名字
+ * @return 成功返回0，失败返回负值
+ */
+int Player::SetStageThreadOptions(int stage, const ThreadOptions &options)
+{
+    if(stage < 0 || stage >= STAGE_COUNT) {
+        LOG_ERROR("%s(%d) invalid stage:%d\n", __FUNCTION__, __LINE__, stage);
+        return -1;
+    }
+    std::string name = stage_options_[stage].name;
+    stage_options_[stage] = options;
+    if(options.name.empty()) {
+        stage_options_[stage].name = name;
+    }
+    return 0;
+}
+
+/**
+ * @brief 是否处于暂停状态
+ */
+bool Player::IsPaused()
+{
+    return avsync_.IsPaused();
+}
+
+bool Player::IsReverse()
+{
+    return reverse_;
+}
+
+/**
+ * @brief 当前播放速率，1.0为原速
+ */
+double Player::Rate()
+{
+    return avsync_.Rate();
+}
+
+/**
+ * @brief 获取当前播放位置
+ * @return 播放位置，单位秒，开始播放前返回0
+ */
+double Player::Position()
+{
+    if(!started_) {
+        return 0;
+    }
+    return reverse_ ? -avsync_.GetClock() : avsync_.GetClock();
+}
+
+/**
+ * @brief 获取媒体时长
+ * @return 时长，单位秒，未知时返回0
+ */
+double Player::Duration()
+{
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    if(!demux_thread_) {
+        return 0;
+    }
+    return demux_thread_->Duration() / 1000000.0;
+}
+
+/**
+ * @brief 获取媒体的起始位置，Position和Seek的时间轴从这里开始
+ * @return 起始位置，单位秒，未知时返回0
+ */
+double Player::StartTime()
+{
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    if(!demux_thread_) {
+        return 0;
+    }
+    return demux_thread_->StartTime() / 1000000.0;
+}
+
+/**
+ * @brief 获取统计快照，可以在任意线程调用
+ */
+StatsSnapshot Player::GetStats()
+{
+    return stats_.GetStats();
+}
+
+/**
+ * @brief 获取统计对象，用于StatsReporter等需要直接读取统计项的模块
+ */
+PipelineStats *Player::Stats()
+{
+    return &stats_;
+}
+
+/**
+ * @brief 本路累计占用的CPU时间，按线程CPU时间计，共享线程池时也只算本路的任务，可以在任意线程调用
+ * @return 解复用、解码、格式转换、Refresh和拼接上传之和，单位微秒；
+ *         不含声卡回调和VideoOutput自己的刷新循环，Stop之后返回停止时的值
+ */
+int64_t Player::CpuMicroseconds()
+{
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    updateCpu();
+    return stats_.cpu_us.Get();
+}
+
+/**
+ * @brief 汇总各任务和输出的CPU时间写到统计，各阶段还在时调用
+ */
+void Player::updateCpu()
+{
+    if(!demux_thread_) {
+        return;
+    }
+    int64_t cpu_us = output_cpu_us_.load(std::memory_order_relaxed) + stats_.video_render_cpu.Get();
+    Task *tasks[4] = {demux_thread_.get(), audio_decode_thread_.get(), video_decode_thread_.get(), video_convert_thread_.get()};
+    for(Task *task : tasks) {
+        if(task) {
+            cpu_us += task->CpuMicroseconds();
+        }
+    }
+    stats_.cpu_us.Set(cpu_us);
+}
+
+/**
+ * @brief 设置事件回调，在Open之前或之后都可以调用
+ */
+void Player::SetEventCallback(PlayerEventCallback callback)
+{
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    callback_ = callback;
+}
+
+/**
+ * @brief 启动解复用和解码：提交到线程池，没有设置共享线程池时先创建自己的
+ * @return 成功返回0，失败返回负值
+ */
+int Player::startStages()
+{
+    if(!executor_) {
+        own_executor_.reset(new TaskExecutor());
+        // 每个阶段一个工作线程，按阶段设置线程属性
+        // 格式转换和视频解码使用同样的调度属性
+        char convert_name[32];
+        snprintf(convert_name, sizeof(convert_name), "vconv-p%d", id_);
+        ThreadOptions convert_options = stage_options_[STAGE_VIDEO_DECODE];
+        convert_options.name = convert_name;
+        if(own_executor_->Init(4) < 0
+                || own_executor_->SetWorkerOptions(0, stage_options_[STAGE_DEMUX]) < 0
+                || own_executor_->SetWorkerOptions(1, stage_options_[STAGE_AUDIO_DECODE]) < 0
+                || own_executor_->SetWorkerOptions(2, stage_options_[STAGE_VIDEO_DECODE]) < 0
+                || own_executor_->SetWorkerOptions(3, convert_options) < 0
+                || own_executor_->Start() < 0) {
+            LOG_ERROR("%s(%d) executor init failed\n", __FUNCTION__, __LINE__);
+            own_executor_.reset();
+            return -1;
+        }
+        executor_ = own_executor_.get();
+    }
+    // 自己的线程池里每个阶段固定在自己的工作线程上，共享线程池时不固定
+    bool pinned = executor_ == own_executor_.get();
+    if(executor_->Submit(demux_thread_.get(), pinned ? 0 : -1) < 0
+            || executor_->Submit(audio_decode_thread_.get(), pinned ? 1 : -1) < 0
+            || executor_->Submit(video_decode_thread_.get(), pinned ? 2 : -1) < 0
+            || executor_->Submit(video_convert_thread_.get(), pinned ? 3 : -1) < 0) {
+        LOG_ERROR("%s(%d) executor Submit failed\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 中断解复用的阻塞IO，移除解码，它们依赖解复用提供数据，再移除解复用；返回后各阶段不会再运行
+ *
+ * 返回后interrupt_仍为true，Seek需要继续读取时自己清除
+ */
+void Player::stopStages()
+{
+    if(!executor_) {
+        return;
+    }
+    interrupt_ = true;
+    int64_t start_us = PipelineStats::NowMicroseconds();
+    Task *tasks[4] = {video_convert_thread_.get(), video_decode_thread_.get(), audio_decode_thread_.get(), demux_thread_.get()};
+    for(Task *task : tasks) {
+        if(task) {
+            executor_->Remove(task);
+        }
+    }
+    stats_.stage_cancel.Record(PipelineStats::NowMicroseconds() - start_us);
+}
+
+/**
+ * @brief 设置唤醒回调，由PlayerHost等外部刷新循环在Open之前设置，所有播放器都暂停时刷新循环不定时唤醒
+ * @param callback 在调用Play恢复或Seek的线程中调用，可以为空
+ */
+void Player::SetWakeCallback(std::function<void()> callback)
+{
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    wake_callback_ = callback;
+}
+
+void Player::wake()
+{
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    if(wake_callback_) {
+        wake_callback_();
+    }
+}
+
+/**
+ * @brief 清空各队列、解码器和输出中的数据，时钟设到新位置，各阶段已经移除
+ * @param position 新的播放位置，单位秒
+ */
+void Player::flushPipeline(double position)
+{
+    audio_packet_queue_.Flush();
+    video_packet_queue_.Flush();
+    audio_decode_thread_->Flush();
+    video_decode_thread_->Flush();
+    video_decoded_queue_.Flush();
+    video_convert_thread_->Flush();
+    if(audio_output_) {
+        audio_output_->Flush(position);
+    }
+    if(video_output_) {
+        video_output_->Flush();
+    }
+    if(headless_output_) {
+        headless_output_->Flush();
+    }
+    if(mosaic_tile_ > 0) {
+        mosaic_->FlushTile(mosaic_tile_);
+    }
+    step_pts_ = AV_NOPTS_VALUE;
+    loop_replay_ = false;
+    // 从新位置重新预缓冲，时钟停在新位置
+    holdForBuffering(true);
+    avsync_.SetClock(position);
+    buffering_controller_->Preroll();
+}
+
+/**
+ * @brief 停住或放开时钟和音频，用户暂停时音频保持暂停
+ * @param hold true停住，false放开
+ */
+void Player::holdForBuffering(bool hold)
+{
+    avsync_.Hold(hold);
+    if(audio_output_ && !avsync_.IsPaused() && !reverse_) {
+        audio_output_->SetPause(hold);
+    }
+}
+
+/**
+ * @brief BufferingController线程的回调，播放器正忙时返回false，下次检查时再试
+ */
+bool Player::onBufferingHold(bool hold)
+{
+    // Stop持锁等待缓冲控制线程退出，这里不能阻塞等锁
+    std::unique_lock<std::mutex> lock(control_mutex_, std::try_to_lock);
+    if(!lock.owns_lock() || !started_) {
+        return false;
+    }
+    holdForBuffering(hold);
+    return true;
+}
+
+/**
+ * @brief 低延时模式下丢弃播放器内的全部缓冲，从下一个视频关键帧继续，由LatencyController线程调用
+ * @param position 时钟跳到的位置，单位秒
+ * @return 成功返回true，正在seek/停止时返回false
+ */
+bool Player::dropToLive(double position)
+{
+    // Stop持锁等待控制线程退出，这里不能阻塞等锁
+    std::unique_lock<std::mutex> lock(control_mutex_, std::try_to_lock);
+    if(!lock.owns_lock() || !started_) {
+        return false;
+    }
+    stopStages();
+    interrupt_ = false;
+    flushPipeline(position);
+    demux_thread_->SkipToKeyframe();
+    return startStages() == 0;
+}
+
+/**
+ * @brief 输出端帧队列的第一帧在pts之后时返回它的新引用，调用方释放；暂停时输出端不取帧，队首一直有效
+ */
+AVFrame *Player::queuedFrame(int64_t pts)
+{
+    AVFrame *front = video_frame_queue_.Front();
+    return front && front->pts > pts ? av_frame_clone(front) : NULL;
+}
+
+/**
+ * @brief 逐帧步进时把帧交给正在使用的输出，马上显示
+ */
+void Player::showFrame(const AVFrame *frame)
+{
+    if(mosaic_tile_ > 0) {
+        mosaic_->ShowTile(mosaic_tile_, frame);
+    } else if(video_output_) {
+        video_output_->ShowFrame(frame);
+    } else if(headless_output_) {
+        headless_output_->ShowFrame(frame);
+    }
+}
+
+/**
+ * @brief A/B循环回到起点，由LoopController线程调用；整段已缓存时视频从缓存重放，只解复用和解码音频
+ * @return 成功返回true，正在seek/停止时返回false
+ */
+bool Player::loopBack(double start, double end)
+{
+    // Stop持锁等待控制线程退出，这里不能阻塞等锁
+    std::unique_lock<std::mutex> lock(control_mutex_, std::try_to_lock);
+    if(!lock.owns_lock() || !started_) {
+        return false;
+    }
+    AVRational time_base = demux_thread_->VideoStreamTimebase();
+    int64_t from_pts = av_rescale_q((int64_t)(start * 1000000), AV_TIME_BASE_Q, time_base);
+    int64_t to_pts = av_rescale_q((int64_t)(end * 1000000), AV_TIME_BASE_Q, time_base);
+    bool cached = frame_cache_ && frame_cache_->Covers(from_pts, to_pts);
+    stopStages();
+    interrupt_ = false;
+    demux_thread_->Seek((int64_t)(start * 1000000));
+    flushPipeline(start);
+    if(cached) {
+        video_decode_thread_->Replay(frame_cache_.get(), from_pts, to_pts);
+        stats_.loops_cached.Add(1);
+        loop_replay_ = true;
+    }
+    stats_.loops.Add(1);
+    LOG_INFO("player %d loop back to %0.3lf%s\n", id_, start, cached ? " from cache" : "");
+    return startStages() == 0;
+}
+
+void Player::notify(int event, const std::string &detail)
+{
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    if(callback_) {
+        callback_(event, detail);
+    }
+}
@@ -0,0 +1,154 @@
+﻿#ifndef PLAYER_H
+#define PLAYER_H
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "demuxthread.h"
+#include "decodethread.h"
+#include "convertthread.h"
+#include "audiooutput.h"
+#include "videooutput.h"
+#include "headlessoutput.h"
+#include "mosaicoutput.h"
+#include "avsync.h"
+#include "stats.h"
+#include "watchdog.h"
+#include "latencycontroller.h"
+#include "bufferingcontroller.h"
+#include "loopcontroller.h"
+#include "framecache.h"
+#include "taskexecutor.h"
+
+// Stop超过该时间时打印各步骤耗时，单位微秒
+#define PLAYER_STOP_BUDGET_US 100000
+// 超过该速率时视频解码跳过非参考帧
+#define PLAYER_SKIP_NONREF_RATE 2.0
+
+// 播放器事件，通过SetEventCallback回调
+enum PlayerEvent {
+    PLAYER_EVENT_STALL = 0,       // detail:卡顿事件的json
+    PLAYER_EVENT_END_OF_STREAM    // detail:空字符串
+};
+
+// 回调在内部线程中调用，不要在回调里调用Player的方法
+typedef std::function<void(int event, const std::string &detail)> PlayerEventCallback;
+
+/**
+ * 播放器：持有一路播放管线的全部对象(解复用、解码、队列、同步时钟、输出)，析构时按顺序停止和释放
+ *
+ * 一个Player只播放一个url，Stop之后不能再次Open；同一进程可以创建多个Player，
+ * 解复用和解码是TaskExecutor上的任务，可以通过SetExecutor交给多个Player共享的线程池，
+ * 不设置时使用自己的线程池(每个阶段一个工作线程)
+ */
+class Player
+{
+public:
+    Player();
+    ~Player();
+    int Open(const char *url);
+    int Play();
+    int Pause();
+    int Seek(double position);
+    int SeekExact(double position);
+    int SetRate(double rate);
+    int StepFrame(int direction);
+    int SetLoop(double start, double end);
+    int SetReverse(bool reverse);
+    int Stop();
+    int MainLoop();
+    int Refresh(double &remain_time);
+
+    void SetHeadless(bool headless);
+    void SetRenderThread(bool enabled, int texture_buffers);
+    void SetVsync(bool enabled, int simulated_hz);
+    void SetLowLatency(int target_ms, bool wallclock_pts);
+    void SetBufferWatermarks(int low_ms, int high_ms);
+    void SetExecutor(TaskExecutor *executor);
+    void SetMosaic(MosaicOutput *mosaic);
+    void SetFrameCache(int budget_mb);
+    void SetReverseBudget(int budget_mb);
+    int SetStageThreadOptions(int stage, const ThreadOptions &options);
+
+    bool IsPaused();
+    bool IsReverse();
+    double Rate();
+    double Position();
+    double Duration();
+    double StartTime();
+    StatsSnapshot GetStats();
+    PipelineStats *Stats();
+    int64_t CpuMicroseconds();
+    void SetEventCallback(PlayerEventCallback callback);
+    void SetWakeCallback(std::function<void()> callback);
+private:
+    int openMonitors();
+    int startStages();
+    void stopStages();
+    int seek(double position, bool exact = false);
+    void flushPipeline(double position);
+    void showFrame(const AVFrame *frame);
+    AVFrame *queuedFrame(int64_t pts);
+    bool loopBack(double start, double end);
+    void applyRate(double rate);
+    bool dropToLive(double position);
+    void holdForBuffering(bool hold);
+    bool onBufferingHold(bool hold);
+    void notify(int event, const std::string &detail);
+    void wake();
+    void updateCpu();
+
+    int id_ = 0;
+    std::string url_;
+    std::atomic<bool> started_{false};
+    std::atomic<bool> interrupt_{false};   // 中断解复用的阻塞IO，Stop不持锁也能设置
+    bool headless_ = false;
+    bool render_thread_ = true;      // MainLoop时在单独的渲染线程渲染，调用线程只处理事件
+    int texture_buffers_ = VIDEO_TEXTURE_BUFFERS;
+    bool vsync_ = false;             // 按vblank显示
+    int vsync_hz_ = 0;               // 大于0时按该刷新率模拟vblank
+    int live_target_ms_ = 0;         // 大于0时为低延时直播模式
+    bool live_wallclock_pts_ = false;
+    int frame_cache_mb_ = 0;         // 大于0时缓存已解码的帧，用于逐帧步进和A/B循环
+    int reverse_budget_mb_ = DECODE_REVERSE_BUDGET_MB;
+    std::atomic<bool> reverse_{false};   // 倒放中，时钟和视频帧的时间轴取负
+    int64_t step_pts_ = AV_NOPTS_VALUE;   // 逐帧步进显示的帧，AV_NOPTS_VALUE表示没有步进过
+    bool loop_replay_ = false;            // 上次回到起点后视频从缓存重放，循环段内的数据包没有解码
+    int buffer_low_ms_ = BUFFERING_LOW_WATERMARK_MS;
+    int buffer_high_ms_ = BUFFERING_HIGH_WATERMARK_MS;
+    TaskExecutor *executor_ = NULL;
+    std::unique_ptr<TaskExecutor> own_executor_;   // 没有设置共享线程池时使用
+    MosaicOutput *mosaic_ = NULL;   // 不为NULL时视频显示在拼接窗口的一个区域，音频不出声
+    int mosaic_tile_ = 0;
+    std::atomic<int64_t> output_cpu_us_{0};   // Refresh占用的CPU时间
+    ThreadOptions stage_options_[STAGE_COUNT];     // 下标为PipelineStage
+    std::mutex control_mutex_;   // 串行化Play/Pause/Seek/Stop
+
+    PipelineStats stats_;
+    AVPacketQueue audio_packet_queue_;
+    AVPacketQueue video_packet_queue_;
+    AVFrameQueue audio_frame_queue_;
+    AVFrameQueue video_decoded_queue_;   // 解码后、格式转换前
+    AVFrameQueue video_frame_queue_;     // 可以直接显示的帧
+    AVSync avsync_;
+
+    std::unique_ptr<DemuxThread> demux_thread_;
+    std::unique_ptr<DecodeThread> audio_decode_thread_;
+    std::unique_ptr<DecodeThread> video_decode_thread_;
+    std::unique_ptr<ConvertThread> video_convert_thread_;
+    std::unique_ptr<AudioOutput> audio_output_;
+    std::unique_ptr<VideoOutput> video_output_;
+    std::unique_ptr<HeadlessOutput> headless_output_;
+    std::unique_ptr<Watchdog> watchdog_;
+    std::unique_ptr<LatencyController> latency_controller_;
+    std::unique_ptr<BufferingController> buffering_controller_;
+    std::unique_ptr<LoopController> loop_controller_;   // 第一次SetLoop时创建
+    std::unique_ptr<FrameCache> frame_cache_;
+
+    std::mutex callback_mutex_;
+    PlayerEventCallback callback_;
+    std::function<void()> wake_callback_;   // 恢复播放或暂停中seek时唤醒外部刷新循环
+};
+
+#endif // PLAYER_H
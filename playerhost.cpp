@@ -0,0 +1,295 @@
+﻿#include "playerhost.h"
+#include "log.h"
+#include "trace.h"
+
+// 刷新循环最长等待时间，单位秒
+#define HOST_REFRESH_RATE 0.01
+
+PlayerHost::PlayerHost()
+{
+    SetOptions(ThreadOptions("host-refresh"));
+}
+
+PlayerHost::~PlayerHost()
+{
+    Stop();
+}
+
+/**
+ * @brief 初始化并启动共享线程池
+ * @param workers 工作线程数，0表示CPU核数，负数表示不共享(每个播放器自己的线程池，每个阶段一个工作线程，用于对比)
+ * @param headless true时播放器不打开窗口和声卡
+ * @return 成功返回0，失败返回负值
+ */
+int PlayerHost::Init(int workers, bool headless)
+{
+    headless_ = headless;
+    if(workers < 0) {
+        return 0;
+    }
+    executor_.reset(new TaskExecutor());
+    if(executor_->Init(workers) < 0 || executor_->Start() < 0) {
+        LOG_ERROR("%s(%d) executor init failed\n", __FUNCTION__, __LINE__);
+        executor_.reset();
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 之后添加的播放器按vblank显示，参数同Player::SetVsync
+ *
+ * 窗口模式下各播放器的窗口在同一个刷新循环里依次呈现，用显示器的垂直同步时每轮要阻塞N个vblank，
+ * 所以总是按刷新率模拟vblank，simulated_hz不大于0时取显示器的刷新率
+ */
+void PlayerHost::SetVsync(bool enabled, int simulated_hz)
+{
+    vsync_ = enabled;
+    vsync_hz_ = simulated_hz;
+}
+
+/**
+ * @brief 之后添加的播放器显示在同一个窗口的网格里，共用一个渲染器，在Init之后、AddPlayer之前调用
+ * @param width 窗口宽度
+ * @param height 窗口高度
+ * @return 成功返回0，失败返回负值
+ *
+ * 窗口和渲染器在调用线程创建，由同一线程的MainLoop上传和呈现，所以只支持窗口模式，
+ * 无窗口模式的刷新线程不能使用其他线程创建的渲染器；没有显示器时用SDL_VIDEODRIVER=dummy
+ */
+int PlayerHost::EnableMosaic(int width, int height)
+{
+    if(headless_) {
+        LOG_ERROR("%s(%d) mosaic needs a windowed host\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    mosaic_.reset(new MosaicOutput());
+    if(mosaic_->Init(width, height) < 0) {
+        LOG_ERROR("%s(%d) mosaic init failed\n", __FUNCTION__, __LINE__);
+        mosaic_.reset();
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 无窗口模式下启动刷新线程，窗口模式下由调用方在主线程调用MainLoop
+ * @return 成功返回0，失败返回负值
+ */
+int PlayerHost::Start()
+{
+    if(!headless_) {
+        return 0;
+    }
+    return Thread::Start();
+}
+
+/**
+ * @brief 停止刷新循环和所有播放器，最后停止线程池
+ * @return 成功返回0
+ */
+int PlayerHost::Stop()
+{
+    Thread::Stop();
+    std::vector<std::unique_ptr<Player>> players;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        players.swap(players_);
+    }
+    // 播放器要在线程池之前释放，Remove需要线程池还在运行；拼接输出最后释放，播放器停止时要移除自己的画面
+    players.clear();
+    if(executor_) {
+        executor_->Stop();
+    }
+    mosaic_.reset();
+    return 0;
+}
+
+/**
+ * @brief 无窗口模式的刷新线程，所有播放器都暂停时一直等到有播放器恢复、seek或增减
+ */
+void PlayerHost::Run()
+{
+    while(abort_ != 1) {
+        double remain_time = HOST_REFRESH_RATE;
+        if(refreshAll(remain_time)) {
+            if(!waitFor(-1)) {
+                break;
+            }
+            continue;
+        }
+        if(remain_time > 0 && !waitFor((int)(remain_time * 1000))) {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief 窗口模式的事件和刷新循环，必须在主线程调用，ESC或关闭任意窗口退出
+ * @param seconds 大于0时最多运行这么长时间，用于压测
+ * @return 成功返回0
+ */
+int PlayerHost::MainLoop(double seconds)
+{
+    SDL_Event event;
+    int64_t end_us = PipelineStats::NowMicroseconds() + (int64_t)(seconds * 1000000);
+    while(seconds <= 0 || PipelineStats::NowMicroseconds() < end_us) {
+        while(SDL_PollEvent(&event)) {
+            if(event.type == SDL_QUIT || (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE)) {
+                LOG_INFO("host quit\n");
+                return 0;
+            }
+        }
+        double remain_time = HOST_REFRESH_RATE;
+        refreshAll(remain_time);
+        if(remain_time > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(int64_t(remain_time * 1000000)));
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 创建播放器并开始播放
+ * @param url 媒体文件路径或URL
+ * @return 成功返回播放器指针(归PlayerHost所有)，失败返回NULL
+ */
+Player *PlayerHost::AddPlayer(const char *url)
+{
+    std::unique_ptr<Player> player(new Player());
+    player->SetHeadless(headless_);
+    // 窗口模式由宿主的刷新循环统一渲染
+    player->SetRenderThread(false, VIDEO_TEXTURE_BUFFERS);
+    player->SetVsync(vsync_, vsync_ && !headless_ ? simulatedHz() : vsync_hz_);
+    player->SetExecutor(executor_.get());
+    player->SetMosaic(mosaic_.get());
+    player->SetWakeCallback([this]() {
+        wakeUp();
+    });
+    if(player->Open(url) < 0 || player->Play() < 0) {
+        LOG_ERROR("%s(%d) add player %s failed\n", __FUNCTION__, __LINE__, url ? url : "");
+        return NULL;
+    }
+    Player *result = player.get();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        players_.push_back(std::move(player));
+    }
+    wakeUp();
+    return result;
+}
+
+/**
+ * @brief 停止并释放一个播放器，其他播放器继续播放
+ * @param player AddPlayer返回的指针，返回后不能再使用
+ * @return 成功返回0，不是本宿主的播放器返回负值
+ */
+int PlayerHost::RemovePlayer(Player *player)
+{
+    std::unique_ptr<Player> removed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for(size_t i = 0; i < players_.size(); i++) {
+            if(players_[i].get() == player) {
+                removed = std::move(players_[i]);
+                players_.erase(players_.begin() + i);
+                break;
+            }
+        }
+    }
+    if(!removed) {
+        LOG_ERROR("%s(%d) player not found\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    // 在锁外停止，不阻塞其他播放器的刷新
+    removed->Stop();
+    return 0;
+}
+
+int PlayerHost::PlayerCount()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return (int)players_.size();
+}
+
+/**
+ * @brief 共享线程池，不用线程池时返回NULL
+ */
+TaskExecutor *PlayerHost::Executor()
+{
+    return executor_.get();
+}
+
+/**
+ * @brief 拼接输出，没有开启时返回NULL
+ */
+MosaicOutput *PlayerHost::Mosaic()
+{
+    return mosaic_.get();
+}
+
+/**
+ * @brief 打印每个播放器和拼接输出累计占用的CPU时间
+ * @param seconds 统计的墙上时间，用于换算成占用的核数
+ */
+void PlayerHost::ReportCpu(double seconds)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t total_us = 0;
+    for(size_t i = 0; i < players_.size(); i++) {
+        int64_t cpu_us = players_[i]->CpuMicroseconds();
+        total_us += cpu_us;
+        LOG_INFO("cpu player %d: %.1f ms (%.2f cores, render %.1f ms)\n", (int)i, cpu_us / 1000.0,
+                 seconds > 0 ? cpu_us / (seconds * 1000000) : 0, players_[i]->Stats()->video_render_cpu.Get() / 1000.0);
+    }
+    int64_t composite_us = mosaic_ ? mosaic_->CpuMicroseconds() : 0;
+    total_us += composite_us;
+    LOG_INFO("cpu composite: %.1f ms, total: %.1f ms (%.2f cores) for %d players\n", composite_us / 1000.0,
+             total_us / 1000.0, seconds > 0 ? total_us / (seconds * 1000000) : 0, (int)players_.size());
+}
+
+/**
+ * @brief 窗口模式下各播放器模拟vblank使用的刷新率
+ */
+int PlayerHost::simulatedHz()
+{
+    if(vsync_hz_ > 0) {
+        return vsync_hz_;
+    }
+    SDL_DisplayMode mode;
+    if(SDL_GetCurrentDisplayMode(0, &mode) == 0 && mode.refresh_rate > 0) {
+        return mode.refresh_rate;
+    }
+    LOG_WARN("display refresh rate unknown, simulate %dHz\n", VSYNC_DEFAULT_REFRESH_HZ);
+    return VSYNC_DEFAULT_REFRESH_HZ;
+}
+
+/**
+ * @brief 刷新所有播放器的输出
+ * @param remain_time 返回所有播放器中最短的等待时间
+ * @return 有播放器并且全部暂停时返回true
+ */
+bool PlayerHost::refreshAll(double &remain_time)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool all_paused = !players_.empty();
+    for(std::unique_ptr<Player> &player : players_) {
+        double player_remain = HOST_REFRESH_RATE;
+        player->Refresh(player_remain);
+        if(player_remain < remain_time) {
+            remain_time = player_remain;
+        }
+        if(!player->IsPaused()) {
+            all_paused = false;
+        }
+    }
+    // 各播放器只取走音频，拼接输出一次上传所有到时间的帧再呈现
+    if(mosaic_) {
+        double mosaic_remain = HOST_REFRESH_RATE;
+        mosaic_->Refresh(mosaic_remain);
+        if(mosaic_remain < remain_time) {
+            remain_time = mosaic_remain;
+        }
+    }
+    return all_paused;
+}
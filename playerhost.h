@@ -0,0 +1,47 @@
+﻿#ifndef PLAYERHOST_H
+#define PLAYERHOST_H
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "thread.h"
+#include "player.h"
+#include "taskexecutor.h"
+#include "mosaicoutput.h"
+
+/**
+ * 多实例宿主：所有Player的解复用和解码共享一个有界线程池，按截止时间调度；
+ * 输出由一个刷新循环统一驱动(无窗口模式在自己的线程，窗口模式在MainLoop所在的主线程)
+ */
+class PlayerHost : public Thread
+{
+public:
+    PlayerHost();
+    ~PlayerHost();
+    int Init(int workers, bool headless);
+    void SetVsync(bool enabled, int simulated_hz);
+    int EnableMosaic(int width, int height);
+    virtual int Start();
+    virtual int Stop();
+    virtual void Run();
+    int MainLoop(double seconds = 0);
+
+    Player *AddPlayer(const char *url);
+    int RemovePlayer(Player *player);
+    int PlayerCount();
+    TaskExecutor *Executor();
+    MosaicOutput *Mosaic();
+    void ReportCpu(double seconds);
+private:
+    bool refreshAll(double &remain_time);
+    int simulatedHz();
+
+    bool headless_ = true;
+    bool vsync_ = false;     // 之后添加的播放器按vblank显示
+    int vsync_hz_ = 0;
+    std::unique_ptr<TaskExecutor> executor_;   // workers为负时为空，每个播放器使用自己的线程池
+    std::unique_ptr<MosaicOutput> mosaic_;     // 不为空时之后添加的播放器显示在同一个窗口
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Player>> players_;
+};
+
+#endif // PLAYERHOST_H
@@ -12,10 +12,19 @@ public:
     ~ Queue() {}
     void Abort()
     {
+        // 在锁内设置，避免等待方检查完条件、还没睡下时错过唤醒
+        std::lock_guard<std::mutex> lock(mutex_);
         abort_ = 1;
         cond_.notify_all();
     }
 
+    // 一次取走全部元素，由调用方在锁外释放，不等待
+    void Drain(std::queue<T> &out)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.swap(out);
+    }
+
     int Push(T val)
     {
         std::lock_guard<std::mutex> lock(mutex_);
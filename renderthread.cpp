@@ -0,0 +1,50 @@
+﻿#include "renderthread.h"
+#include "videooutput.h"
+#include "log.h"
+
+// 刷新循环最长等待时间，单位秒，和VideoOutput的刷新间隔一致
+#define RENDER_REFRESH_RATE 0.01
+
+/**
+ * @brief 构造函数
+ * @param video_output 视频输出，窗口已经在调用线程创建
+ */
+RenderThread::RenderThread(VideoOutput *video_output):
+    video_output_(video_output)
+{
+    SetOptions(ThreadOptions("render"));
+}
+
+RenderThread::~RenderThread()
+{
+    Stop();
+}
+
+/**
+ * @brief 唤醒刷新循环，暂停时一直等到恢复、seek或需要重画，可以在任意线程调用
+ */
+void RenderThread::Wake()
+{
+    wakeUp();
+}
+
+/**
+ * @brief 渲染线程主函数，渲染器必须在使用它的线程创建和释放
+ */
+void RenderThread::Run()
+{
+    if(video_output_->InitRenderer() < 0) {
+        LOG_ERROR("%s(%d) init renderer failed\n", __FUNCTION__, __LINE__);
+        return;
+    }
+    while(abort_ != 1) {
+        double remain_time = RENDER_REFRESH_RATE;
+        video_output_->Refresh(remain_time);
+        // 暂停中画面不变，不定时刷新
+        int timeout_ms = video_output_->Idle() ? -1 : (int)(remain_time * 1000);
+        if(!waitFor(timeout_ms)) {
+            break;
+        }
+    }
+    video_output_->DeInitRenderer();
+}
@@ -0,0 +1,22 @@
+﻿#ifndef RENDERTHREAD_H
+#define RENDERTHREAD_H
+#include "thread.h"
+
+class VideoOutput;
+
+/**
+ * 渲染线程：创建并独占VideoOutput的渲染器和纹理，按时钟上传和呈现视频帧；
+ * 窗口所在的线程(一般是主线程)只处理事件，通过Wake/RequestRedraw通知这里
+ */
+class RenderThread : public Thread
+{
+public:
+    RenderThread(VideoOutput *video_output);
+    ~RenderThread();
+    virtual void Run();
+    void Wake();
+private:
+    VideoOutput *video_output_ = NULL;
+};
+
+#endif // RENDERTHREAD_H
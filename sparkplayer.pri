@@ -0,0 +1,23 @@
+# FFmpeg和SDL2的头文件、库路径，播放器库和命令行程序共用
+
+# qmake CONFIG+=sparkplayer_coroutine 用C++20协程实现解复用和解码阶段，
+# 会改变DemuxThread/DecodeThread的布局，库和链接它的程序必须一起打开
+sparkplayer_coroutine {
+    CONFIG -= c++17
+    CONFIG += c++2a
+    DEFINES += SPARK_COROUTINE
+    *g++*: QMAKE_CXXFLAGS += -fcoroutines
+}
+
+win32 {
+
+FFMPEG_PATH = $$PWD\ffmpeg-n7.1-latest-win64-gpl-shared-7.1
+
+INCLUDEPATH += $$FFMPEG_PATH\include
+LIBS += -L$$FFMPEG_PATH\lib -lavutil -lavcodec -lswresample -lavformat -lavfilter -lswscale
+
+
+
+INCLUDEPATH += $$PWD/SDL2-2.0.10/include
+LIBS += $$PWD/SDL2-2.0.10/lib/x64/SDL2.lib
+}
@@ -0,0 +1,13 @@
+# 先编译播放器库，再编译链接它的命令行程序和压测程序
+TEMPLATE = subdirs
+
+SUBDIRS += \
+        lib \
+        app \
+        hostbench
+
+lib.file = libsparkplayer.pro
+app.file = ffmpeg7.1-player.pro
+app.depends = lib
+hostbench.file = bench/hostbench.pro
+hostbench.depends = lib
@@ -0,0 +1,397 @@
+﻿#include "stats.h"
+#include "log.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef __cplusplus
+extern "C" {
+#include "libavutil/time.h"
+}
+#endif
+
+/**
+ * @brief 把媒体时长换算成按当前速率播放需要的墙上时间，用于计算截止时间
+ * @param media_us 媒体时间，单位微秒
+ * @return 墙上时间，单位微秒
+ */
+int64_t PipelineStats::MediaToWallUs(int64_t media_us)
+{
+    int64_t rate = playback_rate.Get();
+    if(rate <= 0) {
+        return media_us;
+    }
+    return media_us * 100 / rate;
+}
+
+/**
+ * @brief 构造函数
+ * @param name 统计项名字，必须是静态字符串
+ */
+LatencyHistogram::LatencyHistogram(const char *name):
+    name_(name)
+{
+    for(int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        buckets_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief 记录一次耗时
+ * @param us 耗时，单位微秒
+ */
+void LatencyHistogram::Record(int64_t us)
+{
+    if(us < 0) {
+        us = 0;
+    }
+    buckets_[bucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(us, std::memory_order_relaxed);
+    int64_t cur = min_.load(std::memory_order_relaxed);
+    while(us < cur && !min_.compare_exchange_weak(cur, us, std::memory_order_relaxed)) {
+    }
+    cur = max_.load(std::memory_order_relaxed);
+    while(us > cur && !max_.compare_exchange_weak(cur, us, std::memory_order_relaxed)) {
+    }
+}
+
+/**
+ * @brief 获取当前的统计快照，包括分位数
+ */
+HistogramSnapshot LatencyHistogram::Snapshot()
+{
+    HistogramSnapshot snapshot;
+    snapshot.name = name_;
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total = 0;
+    for(int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        counts[i] = buckets_[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    snapshot.count = total;
+    if(total == 0) {
+        return snapshot;
+    }
+    snapshot.min = min_.load(std::memory_order_relaxed);
+    snapshot.max = max_.load(std::memory_order_relaxed);
+    snapshot.mean = (double)sum_.load(std::memory_order_relaxed) / count_.load(std::memory_order_relaxed);
+
+    const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    int64_t *outputs[] = {&snapshot.p50, &snapshot.p90, &snapshot.p99, &snapshot.p999};
+    int q = 0;
+    uint64_t seen = 0;
+    for(int i = 0; i < HISTOGRAM_BUCKETS && q < 4; i++) {
+        seen += counts[i];
+        while(q < 4 && seen >= (uint64_t)(quantiles[q] * total + 0.5) && seen > 0) {
+            int64_t value = bucketValue(i);
+            // 分位数不会超过实际记录到的最大值
+            *outputs[q] = value > snapshot.max ? snapshot.max : value;
+            q++;
+        }
+    }
+    return snapshot;
+}
+
+/**
+ * @brief 计算耗时所在的桶
+ *
+ * 小于16的值每个值一个桶，之后每个2的幂区间分16个桶
+ */
+int LatencyHistogram::bucketIndex(int64_t us)
+{
+    if(us < HISTOGRAM_SUB_BUCKETS) {
+        return (int)us;
+    }
+    int msb = 0;
+#ifdef __GNUC__
+    msb = 63 - __builtin_clzll((unsigned long long)us);
+#else
+    for(int64_t v = us; v > 1; v >>= 1) {
+        msb++;
+    }
+#endif
+    int shift = msb - 4;
+    int index = (shift + 1) * HISTOGRAM_SUB_BUCKETS + (int)((us >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+    return index < HISTOGRAM_BUCKETS ? index : HISTOGRAM_BUCKETS - 1;
+}
+
+/**
+ * @brief 桶对应的上界值，用于计算分位数
+ */
+int64_t LatencyHistogram::bucketValue(int index)
+{
+    if(index < HISTOGRAM_SUB_BUCKETS) {
+        return index;
+    }
+    int shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+    int sub = index % HISTOGRAM_SUB_BUCKETS;
+    return (((int64_t)(HISTOGRAM_SUB_BUCKETS + sub + 1)) << shift) - 1;
+}
+
+/**
+ * @brief 获取阶段名
+ */
+const char *PipelineStageName(int stage)
+{
+    static const char *names[STAGE_COUNT] = {"demux", "audio_decode", "video_decode", "audio_output", "video_output"};
+    if(stage < 0 || stage >= STAGE_COUNT) {
+        return "unknown";
+    }
+    return names[stage];
+}
+
+/**
+ * @brief 上游已产出的数据领先下游消费位置多少，用于计算任务截止时间
+ * @param produced_us 上游最近产出的时间戳，单位微秒
+ * @param consumed_us 下游最近消费的时间戳，单位微秒
+ * @return 领先的时间，单位微秒，任一方未知或已落后时返回0
+ */
+int64_t LeadUs(int64_t produced_us, int64_t consumed_us)
+{
+    if(produced_us == INT64_MIN || consumed_us == INT64_MIN || produced_us < consumed_us) {
+        return 0;
+    }
+    return produced_us - consumed_us;
+}
+
+int64_t StageHeartbeat::now()
+{
+    return PipelineStats::NowMicroseconds();
+}
+
+/**
+ * @brief 输出json格式
+ */
+std::string StatsSnapshot::ToJson()
+{
+    std::string out;
+    char buf[512];
+    snprintf(buf, sizeof(buf), "{\n  \"uptime_us\": %lld,\n  \"gauges\": {", (long long)uptime_us);
+    out += buf;
+    for(size_t i = 0; i < gauges.size(); i++) {
+        snprintf(buf, sizeof(buf), "%s\n    \"%s\": %lld", i ? "," : "",
+                 gauges[i].name.c_str(), (long long)gauges[i].value);
+        out += buf;
+    }
+    out += "\n  },\n  \"histograms\": {";
+    for(size_t i = 0; i < histograms.size(); i++) {
+        HistogramSnapshot &h = histograms[i];
+        snprintf(buf, sizeof(buf), "%s\n    \"%s\": {\"count\": %llu, \"min\": %lld, \"mean\": %.1f, "
+                 "\"p50\": %lld, \"p90\": %lld, \"p99\": %lld, \"p999\": %lld, \"max\": %lld}",
+                 i ? "," : "", h.name.c_str(), (unsigned long long)h.count, (long long)h.min, h.mean,
+                 (long long)h.p50, (long long)h.p90, (long long)h.p99, (long long)h.p999, (long long)h.max);
+        out += buf;
+    }
+    out += "\n  },\n  \"threads\": [";
+    for(size_t i = 0; i < threads.size(); i++) {
+        ThreadInfo &t = threads[i];
+        snprintf(buf, sizeof(buf), "%s\n    {\"name\": \"%s\", \"tid\": %lld, \"policy\": \"%s\", \"priority\": %d, "
+                 "\"affinity\": \"0x%llx\", \"applied\": %s}",
+                 i ? "," : "", t.name.c_str(), (long long)t.tid, ThreadPolicyName(t.policy), t.priority,
+                 (unsigned long long)t.affinity, t.applied ? "true" : "false");
+        out += buf;
+    }
+    out += "\n  ]\n}\n";
+    return out;
+}
+
+/**
+ * @brief 指标的Prometheus类型，按惯例以_total结尾的是只增不减的累计值
+ */
+static const char *prometheus_type(const std::string &name)
+{
+    const char suffix[] = "_total";
+    size_t len = sizeof(suffix) - 1;
+    bool total = name.size() > len && name.compare(name.size() - len, len, suffix) == 0;
+    return total ? "counter" : "gauge";
+}
+
+/**
+ * @brief 输出Prometheus文本格式，累计值以counter、队列深度和时钟等以gauge、直方图以summary形式输出
+ */
+std::string StatsSnapshot::ToPrometheus()
+{
+    std::string out;
+    char buf[512];
+    snprintf(buf, sizeof(buf), "# TYPE sparkplayer_uptime_us gauge\nsparkplayer_uptime_us %lld\n", (long long)uptime_us);
+    out += buf;
+    for(size_t i = 0; i < gauges.size(); i++) {
+        snprintf(buf, sizeof(buf), "# TYPE sparkplayer_%s %s\nsparkplayer_%s %lld\n",
+                 gauges[i].name.c_str(), prometheus_type(gauges[i].name), gauges[i].name.c_str(), (long long)gauges[i].value);
+        out += buf;
+    }
+    for(size_t i = 0; i < histograms.size(); i++) {
+        HistogramSnapshot &h = histograms[i];
+        const char *name = h.name.c_str();
+        snprintf(buf, sizeof(buf),
+                 "# TYPE sparkplayer_%s summary\n"
+                 "sparkplayer_%s{quantile=\"0.5\"} %lld\n"
+                 "sparkplayer_%s{quantile=\"0.9\"} %lld\n"
+                 "sparkplayer_%s{quantile=\"0.99\"} %lld\n"
+                 "sparkplayer_%s{quantile=\"0.999\"} %lld\n"
+                 "sparkplayer_%s_sum %.0f\n"
+                 "sparkplayer_%s_count %llu\n",
+                 name, name, (long long)h.p50, name, (long long)h.p90, name, (long long)h.p99,
+                 name, (long long)h.p999, name, h.mean * h.count, name, (unsigned long long)h.count);
+        out += buf;
+    }
+    // 线程属性以标签输出，值为优先级；applied为0表示设置失败(一般是没有实时调度权限)
+    if(!threads.empty()) {
+        out += "# TYPE sparkplayer_thread_priority gauge\n";
+    }
+    for(size_t i = 0; i < threads.size(); i++) {
+        ThreadInfo &t = threads[i];
+        snprintf(buf, sizeof(buf),
+                 "sparkplayer_thread_priority{name=\"%s\",tid=\"%lld\",policy=\"%s\",affinity=\"0x%llx\",applied=\"%d\"} %d\n",
+                 t.name.c_str(), (long long)t.tid, ThreadPolicyName(t.policy), (unsigned long long)t.affinity,
+                 t.applied ? 1 : 0, t.priority);
+        out += buf;
+    }
+    return out;
+}
+
+/**
+ * @brief 构造函数，记录创建时间用于计算启动耗时
+ */
+PipelineStats::PipelineStats()
+{
+    histograms_ = {&demux_read, &audio_decode, &video_decode,
+                   &audio_packet_residency, &video_packet_residency,
+                   &audio_frame_residency, &video_frame_residency,
+                   &audio_callback, &video_convert, &video_upload, &video_present,
+                   &stage_cancel, &player_stop, &glass_to_glass, &preroll, &rebuffer, &exact_seek
+                  };
+    gauges_ = {&audio_packet_depth, &video_packet_depth, &audio_frame_depth, &video_frame_depth, &video_decoded_depth,
+               &startup_us, &frames_presented, &frames_late, &frames_dropped, &video_passthrough, &video_downscaled,
+               &video_upload_bytes, &video_texture_pixels,
+               &video_direct_uploads, &video_copies, &video_copy_bytes, &video_preuploads,
+               &video_render_cpu, &cpu_us,
+               &frame_cache_bytes, &frame_cache_frames, &frame_cache_hits, &frame_cache_misses, &frame_cache_evictions,
+               &loops, &loops_cached,
+               &reverse_frames, &reverse_gops, &reverse_redecodes, &reverse_buffered_bytes, &reverse_fps,
+               &exact_seeks, &exact_seek_last_us, &exact_seek_frames, &exact_seek_distance_ms, &exact_discarded_frames,
+               &exact_misses,
+               &vsync_refresh_hz, &vsync_vblanks, &vsync_repeats, &vsync_skips, &vsync_cadence, &audio_underruns, &stalls,
+               &video_format_changes, &video_texture_creates, &audio_format_changes,
+               &playback_rate, &live_buffer_ms, &live_catchups, &live_drops,
+               &buffering, &rebuffers, &audio_buffered_ms, &video_buffered_ms
+              };
+    playback_rate.Set(100);
+    start_us_ = NowMicroseconds();
+}
+
+/**
+ * @brief 获取统计快照，可以在任意线程调用
+ */
+StatsSnapshot PipelineStats::GetStats()
+{
+    StatsSnapshot snapshot;
+    snapshot.uptime_us = NowMicroseconds() - start_us_;
+    for(Gauge *gauge : gauges_) {
+        GaugeSnapshot g;
+        g.name = gauge->Name();
+        g.value = gauge->Get();
+        snapshot.gauges.push_back(g);
+    }
+    for(LatencyHistogram *histogram : histograms_) {
+        snapshot.histograms.push_back(histogram->Snapshot());
+    }
+    snapshot.threads = ThreadInfos();
+    return snapshot;
+}
+
+/**
+ * @brief 第一帧画面显示时调用，记录启动耗时
+ */
+void PipelineStats::MarkFirstFrame()
+{
+    if(!first_frame_.exchange(true)) {
+        startup_us.Set(NowMicroseconds() - start_us_);
+    }
+}
+
+/**
+ * @brief 单调时钟，单位为微秒
+ */
+int64_t PipelineStats::NowMicroseconds()
+{
+    return av_gettime_relative();
+}
+
+/**
+ * @brief 构造函数
+ * @param stats 要输出的统计对象
+ */
+StatsReporter::StatsReporter(PipelineStats *stats):
+    stats_(stats)
+{
+    SetOptions(ThreadOptions("stats"));
+}
+
+StatsReporter::~StatsReporter()
+{
+    Stop();
+}
+
+/**
+ * @brief 初始化输出参数
+ * @param path 输出文件路径，每次整体覆盖
+ * @param format "json"或"prometheus"
+ * @param interval_ms 输出间隔，单位毫秒
+ * @return 成功返回0，失败返回负值
+ */
+int StatsReporter::Init(const char *path, const char *format, int interval_ms)
+{
+    if(!path || !stats_) {
+        LOG_ERROR("%s(%d) path or stats is null\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    path_ = path;
+    prometheus_ = format && (strcmp(format, "prometheus") == 0 || strcmp(format, "prom") == 0);
+    if(interval_ms > 0) {
+        interval_ms_ = interval_ms;
+    }
+    return 0;
+}
+
+/**
+ * @brief 输出线程主函数，按间隔输出，退出前再输出一次
+ */
+void StatsReporter::Run()
+{
+    int64_t next_us = PipelineStats::NowMicroseconds() + interval_ms_ * 1000LL;
+    while(true) {
+        int64_t wait_us = next_us - PipelineStats::NowMicroseconds();
+        if(wait_us > 0 && !waitFor((int)((wait_us + 999) / 1000))) {
+            break;
+        }
+        if(PipelineStats::NowMicroseconds() >= next_us) {
+            Dump();
+            next_us += interval_ms_ * 1000LL;
+        }
+    }
+    Dump();
+}
+
+/**
+ * @brief 写一次快照，先写临时文件再改名，读取方不会看到写了一半的文件
+ * @return 成功返回0，失败返回负值
+ */
+int StatsReporter::Dump()
+{
+    StatsSnapshot snapshot = stats_->GetStats();
+    std::string text = prometheus_ ? snapshot.ToPrometheus() : snapshot.ToJson();
+    std::string tmp_path = path_ + ".tmp";
+    FILE *fp = fopen(tmp_path.c_str(), "w");
+    if(!fp) {
+        LOG_RATELIMIT(LOG_LEVEL_ERROR, 10000, "%s(%d) open %s failed\n", __FUNCTION__, __LINE__, tmp_path.c_str());
+        return -1;
+    }
+    fwrite(text.data(), 1, text.size(), fp);
+    fclose(fp);
+    remove(path_.c_str());  // Windows下rename不能覆盖已存在的文件
+    if(rename(tmp_path.c_str(), path_.c_str()) != 0) {
+        LOG_RATELIMIT(LOG_LEVEL_ERROR, 10000, "%s(%d) rename %s failed\n", __FUNCTION__, __LINE__, path_.c_str());
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,260 @@
+﻿#ifndef STATS_H
+#define STATS_H
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "thread.h"
+#include "flightrecorder.h"
+
+// 每个2的幂区间再线性细分成16个子桶，相对误差约6%，覆盖0到2^40微秒
+#define HISTOGRAM_SUB_BUCKETS 16
+#define HISTOGRAM_BUCKETS     (41 * HISTOGRAM_SUB_BUCKETS)
+
+struct HistogramSnapshot
+{
+    std::string name;
+    uint64_t count = 0;
+    int64_t min = 0;
+    int64_t max = 0;
+    double mean = 0;
+    int64_t p50 = 0;
+    int64_t p90 = 0;
+    int64_t p99 = 0;
+    int64_t p999 = 0;
+};
+
+/**
+ * 无锁的HDR风格延迟直方图，单位为微秒，可以在音频回调中记录
+ */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram(const char *name);
+    void Record(int64_t us);
+    HistogramSnapshot Snapshot();
+    const char *Name() { return name_; }
+private:
+    static int bucketIndex(int64_t us);
+    static int64_t bucketValue(int index);
+
+    const char *name_;
+    std::atomic<uint64_t> buckets_[HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> count_{0};
+    std::atomic<int64_t> sum_{0};
+    std::atomic<int64_t> min_{INT64_MAX};
+    std::atomic<int64_t> max_{0};
+};
+
+struct GaugeSnapshot
+{
+    std::string name;
+    int64_t value = 0;
+};
+
+/**
+ * 计数器/瞬时值，如队列深度、丢帧数
+ */
+class Gauge
+{
+public:
+    Gauge(const char *name): name_(name) {}
+    void Set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+    void Add(int64_t delta) { value_.fetch_add(delta, std::memory_order_relaxed); }
+    int64_t Get() { return value_.load(std::memory_order_relaxed); }
+    const char *Name() { return name_; }
+private:
+    const char *name_;
+    std::atomic<int64_t> value_{0};
+};
+
+// 管线各阶段，用于心跳和卡顿归因
+enum PipelineStage {
+    STAGE_DEMUX = 0,
+    STAGE_AUDIO_DECODE,
+    STAGE_VIDEO_DECODE,
+    STAGE_AUDIO_OUTPUT,
+    STAGE_VIDEO_OUTPUT,
+    STAGE_COUNT
+};
+
+const char *PipelineStageName(int stage);
+int64_t LeadUs(int64_t produced_us, int64_t consumed_us);
+
+/**
+ * 阶段心跳：每轮循环Beat，完成一个单位的工作Progress，
+ * 进入可能阻塞的调用前Enter、返回后Leave，由Watchdog采样判断卡在哪里
+ */
+class StageHeartbeat
+{
+public:
+    void Beat() { beat_us_.store(now(), std::memory_order_relaxed); }
+    void Progress(int64_t pts_us = INT64_MIN)
+    {
+        progress_.fetch_add(1, std::memory_order_relaxed);
+        if(pts_us != INT64_MIN) {
+            pts_us_.store(pts_us, std::memory_order_relaxed);
+        }
+    }
+    void Enter(const char *call)
+    {
+        busy_call_.store(call, std::memory_order_relaxed);
+        busy_since_us_.store(now(), std::memory_order_release);
+    }
+    void Leave() { busy_since_us_.store(0, std::memory_order_release); }
+    void ResetPts() { pts_us_.store(INT64_MIN, std::memory_order_relaxed); }
+    void SetThrottled(bool throttled) { throttled_.store(throttled, std::memory_order_relaxed); }
+    void SetEof(bool eof) { eof_.store(eof, std::memory_order_relaxed); }
+
+    int64_t BeatUs() { return beat_us_.load(std::memory_order_relaxed); }
+    uint64_t ProgressCount() { return progress_.load(std::memory_order_relaxed); }
+    int64_t PtsUs() { return pts_us_.load(std::memory_order_relaxed); }
+    int64_t BusySinceUs() { return busy_since_us_.load(std::memory_order_acquire); }
+    const char *BusyCall() { return busy_call_.load(std::memory_order_relaxed); }
+    bool Throttled() { return throttled_.load(std::memory_order_relaxed); }
+    bool Eof() { return eof_.load(std::memory_order_relaxed); }
+private:
+    static int64_t now();
+    std::atomic<int64_t> beat_us_{0};
+    std::atomic<uint64_t> progress_{0};
+    std::atomic<int64_t> pts_us_{INT64_MIN};       // 该阶段最近处理的时间戳，单位微秒
+    std::atomic<int64_t> busy_since_us_{0};        // 0表示不在阻塞调用中
+    std::atomic<const char *> busy_call_{""};
+    std::atomic<bool> throttled_{false};           // 因下游队列满而主动等待
+    std::atomic<bool> eof_{false};
+};
+
+struct StatsSnapshot
+{
+    int64_t uptime_us = 0;
+    std::vector<GaugeSnapshot> gauges;
+    std::vector<HistogramSnapshot> histograms;
+    std::vector<ThreadInfo> threads;     // 进程内设置过属性的线程
+
+    std::string ToJson();
+    std::string ToPrometheus();
+};
+
+/**
+ * 一个播放管线的全部统计项，各模块通过SetStats拿到指针后直接记录
+ */
+class PipelineStats
+{
+public:
+    PipelineStats();
+    StatsSnapshot GetStats();
+    void MarkFirstFrame();
+
+    static int64_t NowMicroseconds();
+    int64_t MediaToWallUs(int64_t media_us);
+
+    // 各阶段耗时
+    LatencyHistogram demux_read{"demux_read_us"};
+    LatencyHistogram audio_decode{"audio_decode_us"};
+    LatencyHistogram video_decode{"video_decode_us"};
+    LatencyHistogram audio_packet_residency{"audio_packet_residency_us"};
+    LatencyHistogram video_packet_residency{"video_packet_residency_us"};
+    LatencyHistogram audio_frame_residency{"audio_frame_residency_us"};
+    LatencyHistogram video_frame_residency{"video_frame_residency_us"};
+    LatencyHistogram audio_callback{"audio_callback_us"};
+    LatencyHistogram video_convert{"video_convert_us"};   // 每帧像素格式转换，直接显示的帧不计入
+    LatencyHistogram video_upload{"video_upload_us"};
+    LatencyHistogram video_present{"video_present_us"};
+    LatencyHistogram stage_cancel{"stage_cancel_us"};   // Seek/Stop中断并移除解复用和解码任务
+    LatencyHistogram player_stop{"player_stop_us"};     // Stop从调用到全部释放
+    LatencyHistogram glass_to_glass{"glass_to_glass_us"};   // 直播发送端采集到播放的延时，需要发送端用墙上时间打时间戳
+    LatencyHistogram preroll{"preroll_us"};             // 开播和seek后缓冲到高水位的耗时
+    LatencyHistogram rebuffer{"rebuffer_us"};           // 播放中缓冲耗尽后重新缓冲的时长
+    LatencyHistogram exact_seek{"exact_seek_us"};       // 精确seek从调用到目标帧解出
+
+    // 队列深度
+    Gauge audio_packet_depth{"audio_packet_queue_depth"};
+    Gauge video_packet_depth{"video_packet_queue_depth"};
+    Gauge audio_frame_depth{"audio_frame_queue_depth"};
+    Gauge video_frame_depth{"video_frame_queue_depth"};
+    Gauge video_decoded_depth{"video_decoded_queue_depth"};   // 解码后等待格式转换的帧
+
+    // SLO相关计数
+    Gauge startup_us{"startup_us"};                 // 从创建到第一帧画面显示
+    Gauge frames_presented{"frames_presented_total"};
+    Gauge frames_late{"frames_late_total"};         // 显示时已落后于音频时钟超过一帧
+    Gauge frames_dropped{"frames_dropped_total"};   // 倍速时来不及显示而丢弃
+    Gauge video_passthrough{"video_passthrough_frames_total"};   // 纹理能直接显示、不需要转换的帧
+    Gauge video_downscaled{"video_downscaled_frames_total"};     // 窗口比视频小，缩小后上传的帧
+    Gauge video_upload_bytes{"video_upload_bytes_total"};        // 上传到纹理的字节数
+    Gauge video_texture_pixels{"video_texture_pixels"};          // 当前纹理的像素数
+    Gauge video_direct_uploads{"video_direct_uploads_total"};    // 没有本地拷贝，由SDL直接从解码缓冲上传的帧(一次或逐平面)
+    Gauge video_copies{"video_copies_total"};                    // 上传前在本地整帧拷贝的次数(格式转换、锁定纹理拷贝)
+    Gauge video_copy_bytes{"video_copy_bytes_total"};
+    Gauge video_preuploads{"video_preuploads_total"};            // 在显示时间之前提前上传到下一个纹理的帧
+    Gauge video_render_cpu{"video_render_cpu_us_total"};         // 拼接输出时本路上传占用的CPU时间，单位微秒
+    Gauge frame_cache_bytes{"frame_cache_bytes"};                // 已解码帧缓存占用的缓冲大小
+    Gauge frame_cache_frames{"frame_cache_frames"};
+    Gauge frame_cache_hits{"frame_cache_hits_total"};            // 步进和循环重放时在缓存中找到帧的次数
+    Gauge frame_cache_misses{"frame_cache_misses_total"};
+    Gauge frame_cache_evictions{"frame_cache_evictions_total"};  // 超过内存预算淘汰的帧
+    Gauge loops{"loops_total"};                                  // A/B循环回到起点的次数
+    Gauge loops_cached{"loops_cached_total"};                    // 其中整段已缓存、视频不解码直接重放的次数
+    Gauge reverse_frames{"reverse_frames_total"};                // 倒放送出的帧
+    Gauge reverse_gops{"reverse_gops_total"};                    // 倒放解码完的GOP
+    Gauge reverse_redecodes{"reverse_redecodes_total"};          // GOP超过预算，丢掉早的帧、之后再解一遍的次数
+    Gauge reverse_buffered_bytes{"reverse_buffered_bytes"};      // 倒放已解码还没送出的帧占用的缓冲大小
+    Gauge reverse_fps{"reverse_fps"};                            // 本次倒放开始以来平均每秒送出的帧
+    Gauge exact_seeks{"exact_seeks_total"};                      // 解到目标帧的精确seek
+    Gauge exact_seek_last_us{"exact_seek_last_us"};              // 最近一次精确seek的耗时
+    Gauge exact_seek_frames{"exact_seek_frames"};                // 最近一次从关键帧解到目标帧解出的帧数(GOP内的距离)
+    Gauge exact_seek_distance_ms{"exact_seek_distance_ms"};      // 最近一次关键帧到目标帧的时长
+    Gauge exact_discarded_frames{"exact_discarded_frames_total"};   // 精确seek解出后丢弃的目标之前的帧
+    Gauge exact_misses{"exact_misses_total"};                    // 解出的第一帧已在目标之后，目标不在流的第一帧之前时说明seek到的关键帧晚于目标
+    Gauge cpu_us{"cpu_us_total"};                                // 本路解复用、解码、转换和输出累计占用的CPU时间，由Player::CpuMicroseconds更新
+    Gauge vsync_refresh_hz{"vsync_refresh_hz"};     // 按vblank显示时的刷新率，0表示没有开启
+    Gauge vsync_vblanks{"vsync_vblanks_total"};     // 经过的vblank数
+    Gauge vsync_repeats{"vsync_repeats_total"};     // vblank上没有新帧，重复显示上一帧
+    Gauge vsync_skips{"vsync_skips_total"};         // 同一个vblank上有多帧到时间，只显示最后一帧
+    Gauge vsync_cadence{"vsync_cadence"};           // 最近8帧各显示了几个vblank，每帧一个十进制位，24p在60Hz上为32323232
+    Gauge video_format_changes{"video_format_changes_total"};    // 帧的大小或像素格式和上一帧不同的次数
+    Gauge video_texture_creates{"video_texture_creates_total"};  // 纹理池中没有对应(宽,高,格式)的纹理而新建
+    Gauge audio_format_changes{"audio_format_changes_total"};    // 音频帧的采样格式、采样率或声道布局变化，重建重采样器
+    Gauge playback_rate{"playback_rate_percent"};   // 当前播放速率，100为原速
+    Gauge live_buffer_ms{"live_buffer_ms"};         // 低延时模式下播放器内缓冲的时长
+    Gauge live_catchups{"live_catchups_total"};     // 低延时模式下开始加速追赶的次数
+    Gauge live_drops{"live_drops_total"};           // 低延时模式下丢到最新关键帧的次数
+    Gauge buffering{"buffering"};                   // 1表示正在缓冲，时钟和音频停住
+    Gauge rebuffers{"rebuffers_total"};             // 播放中缓冲降到低水位以下的次数
+    Gauge audio_buffered_ms{"audio_buffered_ms"};   // 音频已读到的时长减去播放时钟
+    Gauge video_buffered_ms{"video_buffered_ms"};
+    Gauge audio_underruns{"audio_underruns_total"}; // 音频回调拿不到帧只能填静音
+    Gauge stalls{"stalls_total"};                   // Watchdog检测到的卡顿次数
+
+    // 各阶段心跳，下标为PipelineStage
+    StageHeartbeat heartbeats[STAGE_COUNT];
+
+    // 常开的最近事件记录，出问题时导出
+    FlightRecorder recorder;
+
+private:
+    std::vector<LatencyHistogram *> histograms_;
+    std::vector<Gauge *> gauges_;
+    int64_t start_us_ = 0;
+    std::atomic<bool> first_frame_{false};
+};
+
+/**
+ * 定期把统计快照写到本地文件，格式为json或Prometheus文本
+ */
+class StatsReporter : public Thread
+{
+public:
+    StatsReporter(PipelineStats *stats);
+    ~StatsReporter();
+    int Init(const char *path, const char *format, int interval_ms);
+    virtual void Run();
+    int Dump();
+private:
+    PipelineStats *stats_ = NULL;
+    std::string path_;
+    bool prometheus_ = false;
+    int interval_ms_ = 1000;
+};
+
+#endif // STATS_H
@@ -0,0 +1,412 @@
+﻿#include "taskexecutor.h"
+#include "log.h"
+#include <algorithm>
+#include <stdio.h>
+
+/**
+ * @brief 唤醒挂起的任务，可以在任意线程调用(包括音频回调)，没有提交的任务忽略
+ *
+ * 队列在Push之后唤醒消费者、Pop之后唤醒生产者
+ */
+void Task::Wake()
+{
+    TaskExecutor *executor = executor_.load();
+    if(executor) {
+        executor->wake(this);
+    }
+}
+
+TaskExecutor::TaskExecutor()
+{
+}
+
+TaskExecutor::~TaskExecutor()
+{
+    Stop();
+    for(Worker *worker : workers_) {
+        delete worker;
+    }
+    workers_.clear();
+}
+
+/**
+ * @brief 初始化线程池
+ * @param workers 工作线程数，0表示使用CPU核数
+ * @return 成功返回0，失败返回负值
+ */
+int TaskExecutor::Init(int workers)
+{
+    if(running_) {
+        LOG_ERROR("%s(%d) executor is running\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    if(workers <= 0) {
+        workers = (int)std::thread::hardware_concurrency();
+        if(workers <= 0) {
+            workers = 2;
+        }
+    }
+    for(Worker *worker : workers_) {
+        delete worker;
+    }
+    workers_.clear();
+    worker_count_ = workers;
+    for(int i = 0; i < worker_count_; i++) {
+        Worker *worker = new Worker();
+        char name[32];
+        snprintf(name, sizeof(name), "worker-%d", i);
+        worker->options.name = name;
+        workers_.push_back(worker);
+    }
+    return 0;
+}
+
+/**
+ * @brief 设置工作线程的名字、CPU亲和性和调度类别，在Init之后、Start之前调用
+ * @param index 工作线程下标
+ * @param options 线程属性，名字为空时保留默认的worker-N
+ * @return 成功返回0，失败返回负值
+ */
+int TaskExecutor::SetWorkerOptions(int index, const ThreadOptions &options)
+{
+    if(running_ || index < 0 || index >= worker_count_) {
+        LOG_ERROR("%s(%d) executor is running or invalid worker:%d\n", __FUNCTION__, __LINE__, index);
+        return -1;
+    }
+    std::string name = workers_[index]->options.name;
+    workers_[index]->options = options;
+    if(options.name.empty()) {
+        workers_[index]->options.name = name;
+    }
+    return 0;
+}
+
+/**
+ * @brief 启动工作线程
+ * @return 成功返回0，失败返回负值
+ */
+int TaskExecutor::Start()
+{
+    if(worker_count_ <= 0) {
+        LOG_ERROR("%s(%d) executor not initialized\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    abort_ = 0;
+    running_ = true;
+    for(int i = 0; i < worker_count_; i++) {
+        workers_[i]->thread = new std::thread(&TaskExecutor::run, this, i);
+    }
+    LOG_INFO("task executor start, workers:%d\n", worker_count_);
+    return 0;
+}
+
+/**
+ * @brief 停止工作线程，还没结束的任务都视为已结束
+ * @return 成功返回0
+ */
+int TaskExecutor::Stop()
+{
+    if(!running_) {
+        return 0;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        abort_ = 1;
+    }
+    cond_.notify_all();
+    for(Worker *worker : workers_) {
+        if(worker->thread) {
+            worker->thread->join();
+            delete worker->thread;
+            worker->thread = nullptr;
+        }
+    }
+    running_ = false;
+    // 工作线程都已退出，就绪队列中剩下的任务直接标记结束，唤醒等在Remove里的调用方；
+    // abort_已经置位，之后的Wake不会再放入就绪队列
+    std::vector<Task *> remain;
+    for(Worker *worker : workers_) {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        for(Entry &entry : worker->heap) {
+            remain.push_back(entry.task);
+        }
+        worker->heap.clear();
+        worker->pending = 0;
+    }
+    stealable_ = 0;
+    for(Task *task : remain) {
+        finish(task);
+    }
+    LOG_INFO("task executor stop, steps:%llu, steals:%llu, wakes:%llu\n",
+             (unsigned long long)steps_.load(), (unsigned long long)steals_.load(),
+             (unsigned long long)wakes_.load());
+    return 0;
+}
+
+/**
+ * @brief 提交任务，任务会被反复调度直到Step返回TASK_DONE或被Remove
+ * @param task 任务指针，Remove返回之前不能释放
+ * @param worker 固定在该工作线程上执行(不被窃取)，用于给阶段单独设置线程属性，-1表示不固定
+ * @return 成功返回0，失败返回负值
+ */
+int TaskExecutor::Submit(Task *task, int worker)
+{
+    if(!task || !running_ || worker >= worker_count_) {
+        LOG_ERROR("%s(%d) task is null or executor not running\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    int expected = Task::STATE_FINISHED;
+    if(!task->state_.compare_exchange_strong(expected, Task::STATE_QUEUED)) {
+        LOG_ERROR("%s(%d) task already submitted\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    task->cancelled_ = false;
+    task->pinned_ = worker >= 0;
+    task->home_ = task->pinned_ ? worker : next_worker_.fetch_add(1) % worker_count_;
+    task->executor_ = this;
+    pushReady(task->home_, task);
+    return 0;
+}
+
+/**
+ * @brief 取消任务并等待它当前的Step执行完，返回后任务不会再被调用
+ * @param task 任务指针
+ * @return 成功返回0
+ */
+int TaskExecutor::Remove(Task *task)
+{
+    if(!task) {
+        return -1;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    task->cancelled_ = true;
+    // 挂起的任务直接结束；排队或正在执行的由工作线程看到cancelled_后结束
+    finished_cond_.wait(lock, [task] {
+        int expected = Task::STATE_PARKED;
+        task->state_.compare_exchange_strong(expected, Task::STATE_FINISHED);
+        return task->state_.load() == Task::STATE_FINISHED;
+    });
+    return 0;
+}
+
+int TaskExecutor::Workers()
+{
+    return worker_count_;
+}
+
+/**
+ * @brief 累计执行的Step次数
+ */
+uint64_t TaskExecutor::Steps()
+{
+    return steps_.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief 累计从其他线程窃取的任务数
+ */
+uint64_t TaskExecutor::Steals()
+{
+    return steals_.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief 累计被Wake重新放入就绪队列的次数
+ */
+uint64_t TaskExecutor::Wakes()
+{
+    return wakes_.load(std::memory_order_relaxed);
+}
+
+bool TaskExecutor::laterDeadline(const Entry &a, const Entry &b)
+{
+    return a.deadline > b.deadline;
+}
+
+/**
+ * @brief 工作线程主函数：先取自己的队列，再窃取，都没有就等待
+ */
+void TaskExecutor::run(int index)
+{
+    ApplyThreadOptions(workers_[index]->options);
+    while(abort_ != 1) {
+        Entry entry = {0, NULL, false};
+        if(popLocal(index, entry) || steal(index, entry)) {
+            execute(index, entry.task);
+            continue;
+        }
+        // 先登记再检查，和pushReady配合避免丢失唤醒；没有任务时一直等，不设超时；
+        // 其他线程上固定的任务不算，否则会空转抢占那个线程的CPU
+        Worker *worker = workers_[index];
+        std::unique_lock<std::mutex> lock(mutex_);
+        sleeping_.fetch_add(1);
+        cond_.wait(lock, [this, worker] {
+            return stealable_.load() > 0 || worker->pending.load() > 0 || abort_ == 1;
+        });
+        sleeping_.fetch_sub(1);
+    }
+    UnregisterThread(CurrentThreadId());
+}
+
+/**
+ * @brief 执行一次Step，根据返回值重新排队、挂起或结束
+ */
+void TaskExecutor::execute(int index, Task *task)
+{
+    // 从这里开始的Wake都会被记下，Step读到的是Wake之后的队列状态
+    task->state_ = Task::STATE_RUNNING;
+    if(task->cancelled_) {
+        finish(task);
+        return;
+    }
+    // 按线程CPU时间记到任务上，共享线程池时也能分摊到各个播放器
+    int64_t cpu_start_us = ThreadCpuMicroseconds();
+    int ret = task->Step();
+    task->cpu_us_.fetch_add(ThreadCpuMicroseconds() - cpu_start_us, std::memory_order_relaxed);
+    steps_.fetch_add(1, std::memory_order_relaxed);
+    if(ret == TASK_DONE || task->cancelled_) {
+        finish(task);
+        return;
+    }
+    if(ret == TASK_IDLE) {
+        // 持锁挂起，和Remove互斥：Remove返回(任务可能被释放)之前这里不会再访问任务
+        std::lock_guard<std::mutex> lock(mutex_);
+        int expected = Task::STATE_RUNNING;
+        if(task->state_.compare_exchange_strong(expected, Task::STATE_PARKED)) {
+            if(task->cancelled_) {
+                finished_cond_.notify_all();
+            }
+            return;
+        }
+        // Step期间被Wake过，马上重新排队
+    }
+    task->state_ = Task::STATE_QUEUED;
+    pushReady(task->pinned_ ? task->home_ : index, task);
+}
+
+/**
+ * @brief 把挂起的任务放回它的就绪队列，正在执行的任务记下唤醒，其他状态忽略
+ */
+void TaskExecutor::wake(Task *task)
+{
+    int state = task->state_.load();
+    while(true) {
+        if(state == Task::STATE_PARKED) {
+            if(task->state_.compare_exchange_weak(state, Task::STATE_QUEUED)) {
+                wakes_.fetch_add(1, std::memory_order_relaxed);
+                pushReady(task->home_, task);
+                return;
+            }
+        } else if(state == Task::STATE_RUNNING) {
+            if(task->state_.compare_exchange_weak(state, Task::STATE_NOTIFIED)) {
+                return;
+            }
+        } else {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief 放入指定工作线程的就绪队列，有线程在等待时唤醒；线程池已停止时直接结束任务
+ */
+void TaskExecutor::pushReady(int index, Task *task)
+{
+    Worker *worker = workers_[index];
+    Entry entry = {task->Deadline(), task, task->pinned_};
+    {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        if(abort_ != 1) {
+            worker->heap.push_back(entry);
+            std::push_heap(worker->heap.begin(), worker->heap.end(), laterDeadline);
+            entry.task = NULL;
+        }
+    }
+    if(entry.task) {
+        finish(task);
+        return;
+    }
+    worker->pending.fetch_add(1);
+    if(!entry.pinned) {
+        stealable_.fetch_add(1);
+    }
+    if(sleeping_.load() > 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // 固定的任务只能由指定线程执行，不知道哪个在等，全部唤醒
+        if(entry.pinned) {
+            cond_.notify_all();
+        } else {
+            cond_.notify_one();
+        }
+    }
+}
+
+/**
+ * @brief 取自己队列中截止时间最早的任务
+ */
+bool TaskExecutor::popLocal(int index, Entry &entry)
+{
+    Worker *worker = workers_[index];
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    if(worker->heap.empty()) {
+        return false;
+    }
+    std::pop_heap(worker->heap.begin(), worker->heap.end(), laterDeadline);
+    entry = worker->heap.back();
+    worker->heap.pop_back();
+    worker->pending.fetch_sub(1);
+    if(!entry.pinned) {
+        stealable_.fetch_sub(1);
+    }
+    return true;
+}
+
+/**
+ * @brief 从其他工作线程的队列中窃取截止时间最早的、没有固定线程的任务，对方正忙时跳过
+ */
+bool TaskExecutor::steal(int index, Entry &entry)
+{
+    for(int i = 1; i < worker_count_; i++) {
+        Worker *victim = workers_[(index + i) % worker_count_];
+        std::unique_lock<std::mutex> lock(victim->mutex, std::try_to_lock);
+        if(!lock.owns_lock() || victim->heap.empty()) {
+            continue;
+        }
+        // 堆顶没有固定时直接取，否则在堆里找，队列很短，线性查找即可
+        size_t best = victim->heap.size();
+        for(size_t j = 0; j < victim->heap.size(); j++) {
+            if(!victim->heap[j].pinned && (best == victim->heap.size() || victim->heap[j].deadline < victim->heap[best].deadline)) {
+                best = j;
+                if(j == 0) {
+                    break;
+                }
+            }
+        }
+        if(best == victim->heap.size()) {
+            continue;
+        }
+        entry = victim->heap[best];
+        if(best == 0) {
+            std::pop_heap(victim->heap.begin(), victim->heap.end(), laterDeadline);
+            victim->heap.pop_back();
+        } else {
+            victim->heap.erase(victim->heap.begin() + best);
+            std::make_heap(victim->heap.begin(), victim->heap.end(), laterDeadline);
+        }
+        victim->pending.fetch_sub(1);
+        stealable_.fetch_sub(1);
+        steals_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief 标记任务结束，唤醒等在Remove里的调用方
+ */
+void TaskExecutor::finish(Task *task)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    task->state_ = Task::STATE_FINISHED;
+    finished_cond_.notify_all();
+}
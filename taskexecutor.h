@@ -0,0 +1,114 @@
+﻿#ifndef TASKEXECUTOR_H
+#define TASKEXECUTOR_H
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include "thread.h"
+
+class TaskExecutor;
+
+// Task::Step的返回值
+enum TaskStatus {
+    TASK_PROGRESS = 0,   // 做了一个单位的工作，按新的截止时间重新排队
+    TASK_IDLE,           // 输入为空或输出已满，挂起直到Wake
+    TASK_DONE            // 结束，不再调度
+};
+
+/**
+ * 可调度的任务，Step每次只做一个单位的工作，不能阻塞等待
+ *
+ * Step返回TASK_IDLE后任务挂起，不占用CPU，直到有人调用Wake(输入队列来了数据、输出队列有了空位)；
+ * Step执行期间的Wake不会丢失，Step返回后马上重新排队
+ */
+class Task
+{
+public:
+    virtual ~Task() {}
+    virtual int Step() = 0;
+    // 截止时间，单调时钟微秒，越小越先执行
+    virtual int64_t Deadline() = 0;
+    void Wake();
+    // Step累计占用的CPU时间，单位微秒
+    int64_t CpuMicroseconds() { return cpu_us_.load(std::memory_order_relaxed); }
+private:
+    friend class TaskExecutor;
+    enum State {
+        STATE_FINISHED = 0,   // 没有提交或已经结束
+        STATE_PARKED,         // 挂起，等待Wake
+        STATE_QUEUED,         // 在某个就绪队列中
+        STATE_RUNNING,        // 正在执行Step
+        STATE_NOTIFIED        // 执行Step期间被Wake
+    };
+    std::atomic<int> state_{STATE_FINISHED};
+    std::atomic<bool> cancelled_{false};
+    std::atomic<TaskExecutor *> executor_{nullptr};
+    std::atomic<int64_t> cpu_us_{0};
+    int home_ = 0;          // 被唤醒时放入的工作线程
+    bool pinned_ = false;   // 只在home_上执行，不被其他线程窃取
+};
+
+/**
+ * 有界的工作窃取线程池，多个播放器的解复用和解码任务共享
+ *
+ * 每个工作线程有自己的就绪队列(按截止时间排序的小顶堆)，自己的队列空了从其他线程窃取截止时间最早的任务；
+ * 空闲的任务挂起，由Wake重新放回就绪队列，没有就绪任务时工作线程一直等待，不轮询
+ */
+class TaskExecutor
+{
+public:
+    TaskExecutor();
+    ~TaskExecutor();
+    int Init(int workers);
+    int SetWorkerOptions(int index, const ThreadOptions &options);
+    int Start();
+    int Stop();
+    int Submit(Task *task, int worker = -1);
+    int Remove(Task *task);
+
+    int Workers();
+    uint64_t Steps();
+    uint64_t Steals();
+    uint64_t Wakes();
+private:
+    friend class Task;
+    struct Entry {
+        int64_t deadline;
+        Task *task;
+        bool pinned;
+    };
+    struct Worker {
+        std::mutex mutex;
+        std::vector<Entry> heap;
+        std::atomic<int> pending{0};   // heap中的任务数，包括固定在该线程上的
+        std::thread *thread = nullptr;
+        ThreadOptions options;
+    };
+    static bool laterDeadline(const Entry &a, const Entry &b);
+    void run(int index);
+    void execute(int index, Task *task);
+    void wake(Task *task);
+    void pushReady(int index, Task *task);
+    bool popLocal(int index, Entry &entry);
+    bool steal(int index, Entry &entry);
+    void finish(Task *task);
+
+    int worker_count_ = 0;
+    std::vector<Worker *> workers_;
+    std::atomic<int> abort_{0};
+    std::atomic<bool> running_{false};
+    std::atomic<int> stealable_{0};    // 所有就绪队列中没有固定线程、可以被窃取的任务数
+    std::atomic<int> sleeping_{0};     // 正在等待的工作线程数
+    std::atomic<unsigned> next_worker_{0};
+    std::atomic<uint64_t> steps_{0};
+    std::atomic<uint64_t> steals_{0};
+    std::atomic<uint64_t> wakes_{0};
+
+    std::mutex mutex_;                 // 工作线程等待和Remove等待结束用
+    std::condition_variable cond_;
+    std::condition_variable finished_cond_;
+};
+
+#endif // TASKEXECUTOR_H
@@ -1,5 +1,298 @@
 ﻿#include "thread.h"
+#include "log.h"
+#include "trace.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+// 设置过属性的线程，线程退出时移除
+static std::mutex g_thread_mutex;
+static std::vector<ThreadInfo> g_threads;
+
+#ifdef _WIN32
+typedef HRESULT (WINAPI *SetThreadDescriptionFunc)(HANDLE, PCWSTR);
+
+/**
+ * @brief Windows 10 1607之后才有SetThreadDescription，动态查找，没有时不设置线程名
+ */
+static bool win_set_thread_name(const std::string &name)
+{
+    static SetThreadDescriptionFunc set_description = (SetThreadDescriptionFunc)(void *)GetProcAddress(
+                GetModuleHandleW(L"kernel32.dll"), "SetThreadDescription");
+    if(!set_description) {
+        return false;
+    }
+    wchar_t wide[64];
+    if(MultiByteToWideChar(CP_UTF8, 0, name.c_str(), -1, wide, 64) == 0) {
+        return false;
+    }
+    return SUCCEEDED(set_description(GetCurrentThread(), wide));
+}
+
+/**
+ * @brief 把nice值映射到Windows的线程优先级
+ */
+static int win_nice_priority(int nice)
+{
+    if(nice <= -10) {
+        return THREAD_PRIORITY_HIGHEST;
+    } else if(nice < 0) {
+        return THREAD_PRIORITY_ABOVE_NORMAL;
+    } else if(nice == 0) {
+        return THREAD_PRIORITY_NORMAL;
+    } else if(nice < 10) {
+        return THREAD_PRIORITY_BELOW_NORMAL;
+    }
+    return THREAD_PRIORITY_LOWEST;
+}
+#endif
+
+/**
+ * @brief 设置调用线程的名字、CPU亲和性和调度类别，并登记到线程列表，每项失败都只打印警告
+ * @param options 线程属性，名字为空时不设置名字
+ * @return 全部成功返回0，有任何一项失败返回-1
+ */
+int ApplyThreadOptions(const ThreadOptions &options)
+{
+    bool ok = true;
+    std::string failed;
+    if(!options.name.empty()) {
+        Tracer::Instance()->SetThreadName(options.name.c_str());
+#ifdef _WIN32
+        if(!win_set_thread_name(options.name)) {
+            ok = false;
+            failed += " name";
+        }
+#elif defined(__linux__)
+        // 线程名最多16字节(含结尾的0)
+        std::string name = options.name.substr(0, 15);
+        if(pthread_setname_np(pthread_self(), name.c_str()) != 0) {
+            ok = false;
+            failed += " name";
+        }
+#endif
+    }
+    if(options.affinity) {
+#ifdef _WIN32
+        if(SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)options.affinity) == 0) {
+            ok = false;
+            failed += " affinity";
+        }
+#elif defined(__linux__)
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for(int i = 0; i < 64 && i < CPU_SETSIZE; i++) {
+            if(options.affinity & (1ULL << i)) {
+                CPU_SET(i, &cpus);
+            }
+        }
+        if(pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+            ok = false;
+            failed += " affinity";
+        }
+#else
+        ok = false;
+        failed += " affinity";
+#endif
+    }
+    if(options.policy == THREAD_POLICY_FIFO) {
+#ifdef _WIN32
+        int priority = options.priority >= 50 ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST;
+        if(!SetThreadPriority(GetCurrentThread(), priority)) {
+            ok = false;
+            failed += " fifo";
+        }
+#elif defined(__linux__)
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = options.priority;
+        if(pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+            ok = false;
+            failed += " fifo";
+        }
+#else
+        ok = false;
+        failed += " fifo";
+#endif
+    } else if(options.policy == THREAD_POLICY_NICE) {
+#ifdef _WIN32
+        if(!SetThreadPriority(GetCurrentThread(), win_nice_priority(options.priority))) {
+            ok = false;
+            failed += " nice";
+        }
+#elif defined(__linux__)
+        // Linux上nice值是线程级别的
+        if(setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), options.priority) != 0) {
+            ok = false;
+            failed += " nice";
+        }
+#else
+        ok = false;
+        failed += " nice";
+#endif
+    }
+    if(!ok) {
+        LOG_WARN("thread %s set%s failed, policy:%s, priority:%d, affinity:0x%llx\n",
+                 options.name.c_str(), failed.c_str(), ThreadPolicyName(options.policy), options.priority,
+                 (unsigned long long)options.affinity);
+    }
+
+    ThreadInfo info;
+    info.tid = CurrentThreadId();
+    info.name = options.name;
+    info.affinity = options.affinity;
+    info.policy = options.policy;
+    info.priority = options.priority;
+    info.applied = ok;
+    std::lock_guard<std::mutex> lock(g_thread_mutex);
+    for(ThreadInfo &thread : g_threads) {
+        if(thread.tid == info.tid) {
+            thread = info;
+            return ok ? 0 : -1;
+        }
+    }
+    g_threads.push_back(info);
+    return ok ? 0 : -1;
+}
+
+/**
+ * @brief 线程退出时从线程列表中移除
+ * @param tid CurrentThreadId返回的线程号
+ */
+void UnregisterThread(int64_t tid)
+{
+    std::lock_guard<std::mutex> lock(g_thread_mutex);
+    for(size_t i = 0; i < g_threads.size(); i++) {
+        if(g_threads[i].tid == tid) {
+            g_threads.erase(g_threads.begin() + i);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief 调用线程在系统中的线程号，和top/perf中显示的一致
+ */
+int64_t CurrentThreadId()
+{
+#ifdef _WIN32
+    return (int64_t)GetCurrentThreadId();
+#elif defined(__linux__)
+    return (int64_t)syscall(SYS_gettid);
+#else
+    return (int64_t)std::hash<std::thread::id>()(std::this_thread::get_id());
+#endif
+}
+
+/**
+ * @brief 调用线程累计占用的CPU时间(用户态加内核态)，用于把共享线程上的开销分摊到各个播放器
+ * @return 单位微秒，不支持的平台返回0；Windows上按调度时间片计，精度约15ms，需要累计较长时间再看
+ */
+int64_t ThreadCpuMicroseconds()
+{
+#ifdef _WIN32
+    FILETIME create_time, exit_time, kernel_time, user_time;
+    if(!GetThreadTimes(GetCurrentThread(), &create_time, &exit_time, &kernel_time, &user_time)) {
+        return 0;
+    }
+    ULARGE_INTEGER kernel, user;
+    kernel.LowPart = kernel_time.dwLowDateTime;
+    kernel.HighPart = kernel_time.dwHighDateTime;
+    user.LowPart = user_time.dwLowDateTime;
+    user.HighPart = user_time.dwHighDateTime;
+    return (int64_t)((kernel.QuadPart + user.QuadPart) / 10);
+#elif defined(__linux__)
+    struct timespec ts;
+    if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0) {
+        return 0;
+    }
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief 所有设置过属性的线程，可以在任意线程调用
+ */
+std::vector<ThreadInfo> ThreadInfos()
+{
+    std::lock_guard<std::mutex> lock(g_thread_mutex);
+    return g_threads;
+}
+
+/**
+ * @brief 解析调度配置，格式为 类别[:优先级][@CPU掩码]，如 fifo:20、nice:5@0x3、@0xc，不修改名字
+ * @param spec 配置字符串
+ * @param options 解析结果写入的属性
+ * @return 成功返回0，格式错误返回-1
+ */
+int ParseThreadOptions(const char *spec, ThreadOptions &options)
+{
+    if(!spec) {
+        return -1;
+    }
+    std::string text = spec;
+    size_t at = text.find('@');
+    if(at != std::string::npos) {
+        char *end = NULL;
+        uint64_t affinity = strtoull(text.c_str() + at + 1, &end, 0);
+        if(end == text.c_str() + at + 1 || *end != '\0') {
+            return -1;
+        }
+        options.affinity = affinity;
+        text.resize(at);
+    }
+    if(text.empty()) {
+        return 0;
+    }
+    size_t colon = text.find(':');
+    std::string policy = text.substr(0, colon);
+    int priority = 0;
+    if(colon != std::string::npos) {
+        char *end = NULL;
+        priority = (int)strtol(text.c_str() + colon + 1, &end, 10);
+        if(end == text.c_str() + colon + 1 || *end != '\0') {
+            return -1;
+        }
+    }
+    if(policy == "fifo") {
+        options.policy = THREAD_POLICY_FIFO;
+        options.priority = colon == std::string::npos ? 1 : priority;
+    } else if(policy == "nice") {
+        options.policy = THREAD_POLICY_NICE;
+        options.priority = priority;
+    } else if(policy == "default") {
+        options.policy = THREAD_POLICY_DEFAULT;
+        options.priority = 0;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char *ThreadPolicyName(int policy)
+{
+    switch(policy) {
+        case THREAD_POLICY_NICE:
+            return "nice";
+        case THREAD_POLICY_FIFO:
+            return "fifo";
+        default:
+            return "default";
+    }
+}
 
 /**
  * @brief 构造函数，初始化线程基类
@@ -23,13 +316,21 @@ Thread::~Thread()
 }
 
 /**
- * @brief 启动线程
- * @return 成功返回0
- *
- * 此为基类的默认实现，派生类应重写此方法
+ * @brief 启动线程，设置线程属性后执行Run，Stop之后可以再次启动
+ * @return 成功返回0，失败返回负值
  */
 int Thread::Start()
 {
+    if(thread_) {
+        LOG_ERROR("%s(%d) thread already started\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    abort_ = 0;
+    thread_ = new std::thread(&Thread::threadMain, this);
+    if(!thread_) {
+        LOG_ERROR("%s(%d) new thread failed\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
     return 0;
 }
 
@@ -37,13 +338,17 @@ int Thread::Start()
  * @brief 停止线程
  * @return 成功返回0
  *
- * 设置终止标志并等待线程结束，释放线程资源
+ * 设置终止标志并唤醒waitFor中的线程，等待线程结束，释放线程资源
  */
 int Thread::Stop()
 {
-    printf("%s(%d)\n", __FUNCTION__, __LINE__);
-    // 设置终止标志，通知线程退出
-    abort_ = 1;
+    LOG_DEBUG("%s(%d)\n", __FUNCTION__, __LINE__);
+    // 设置终止标志，通知线程退出；持锁设置，避免waitFor检查完标志后才开始等待而错过通知
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        abort_ = 1;
+    }
+    wait_cond_.notify_all();
     
     // 如果线程存在，等待线程结束并释放资源
     if(thread_) {
@@ -53,3 +358,58 @@ int Thread::Stop()
     }
     return 0;
 }
+
+/**
+ * @brief 设置线程属性，在Start之前调用
+ * @param options 线程属性，名字为空时不设置名字，也不出现在统计的线程列表中
+ */
+void Thread::SetOptions(const ThreadOptions &options)
+{
+    options_ = options;
+}
+
+/**
+ * @brief 在Run循环中代替sleep，Stop或wakeUp时立即返回
+ * @param timeout_ms 最长等待时间，单位毫秒，负数表示一直等到Stop或wakeUp
+ * @return 超时或被wakeUp唤醒返回true，需要退出时返回false
+ */
+bool Thread::waitFor(int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    auto woken = [this] {
+        return abort_ == 1 || wake_pending_;
+    };
+    if(timeout_ms < 0) {
+        wait_cond_.wait(lock, woken);
+    } else {
+        wait_cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms), woken);
+    }
+    wake_pending_ = false;
+    return abort_ != 1;
+}
+
+/**
+ * @brief 唤醒waitFor，线程正在运行时记下，下一次waitFor立即返回
+ */
+void Thread::wakeUp()
+{
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        wake_pending_ = true;
+    }
+    wait_cond_.notify_all();
+}
+
+/**
+ * @brief 线程入口，设置属性后执行派生类的Run，退出时从线程列表中移除
+ */
+void Thread::threadMain()
+{
+    if(options_.name.empty() && options_.policy == THREAD_POLICY_DEFAULT && !options_.affinity) {
+        Run();
+        return;
+    }
+    ApplyThreadOptions(options_);
+    Run();
+    UnregisterThread(CurrentThreadId());
+}
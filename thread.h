@@ -1,8 +1,59 @@
 ﻿#ifndef THREAD_H
 #define THREAD_H
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
 #include <thread>
+#include <vector>
+#include <stdint.h>
 
+// 线程调度类别
+enum ThreadPolicy {
+    THREAD_POLICY_DEFAULT = 0,   // 不修改
+    THREAD_POLICY_NICE,          // 分时调度，priority为nice值，-20到19，越小越优先，负值一般需要权限
+    THREAD_POLICY_FIFO           // 实时调度，priority为1到99，需要权限，失败时保持原来的调度
+};
+
+/**
+ * 线程属性，在线程开始执行时由线程自己设置
+ */
+struct ThreadOptions
+{
+    ThreadOptions() {}
+    explicit ThreadOptions(const std::string &thread_name): name(thread_name) {}
+
+    std::string name;            // 线程名，Linux上最多15个字符，超出截断
+    uint64_t affinity = 0;       // CPU位掩码，第i位表示CPU i，0表示不限制
+    int policy = THREAD_POLICY_DEFAULT;
+    int priority = 0;
+};
+
+/**
+ * 已设置属性的线程，用于统计输出
+ */
+struct ThreadInfo
+{
+    int64_t tid = 0;
+    std::string name;
+    uint64_t affinity = 0;
+    int policy = THREAD_POLICY_DEFAULT;
+    int priority = 0;
+    bool applied = false;        // 属性全部设置成功
+};
+
+int ApplyThreadOptions(const ThreadOptions &options);
+void UnregisterThread(int64_t tid);
+int64_t CurrentThreadId();
+int64_t ThreadCpuMicroseconds();
+std::vector<ThreadInfo> ThreadInfos();
+int ParseThreadOptions(const char *spec, ThreadOptions &options);
+const char *ThreadPolicyName(int policy);
+
+/**
+ * 后台线程基类：Start创建线程，设置线程属性后执行Run，Stop设置退出标志、唤醒waitFor并等待线程结束
+ */
 class Thread
 {
 public:
@@ -12,9 +63,20 @@ public:
     virtual int Start();
     virtual int Stop();
     virtual void Run() = 0;
+    void SetOptions(const ThreadOptions &options);
 protected:
-    int abort_ = 0;
+    bool waitFor(int timeout_ms);
+    void wakeUp();
+
+    std::atomic<int> abort_{0};
     std::thread *thread_ = nullptr;
+private:
+    void threadMain();
+
+    ThreadOptions options_;
+    std::mutex wait_mutex_;
+    std::condition_variable wait_cond_;
+    bool wake_pending_ = false;   // wakeUp之后还没被waitFor消费
 };
 
 #endif // THREAD_H
@@ -0,0 +1,234 @@
+﻿#include "trace.h"
+#include "log.h"
+#include <stdio.h>
+#include <signal.h>
+#include <chrono>
+
+std::atomic<bool> g_trace_enabled{false};
+
+static thread_local TraceBuffer *t_trace_buffer = nullptr;
+
+#ifdef SIGUSR1
+typedef void (*SignalHandler)(int);
+static SignalHandler g_prev_handler = SIG_DFL;
+
+/**
+ * @brief SIGUSR1处理函数，只置标志，导出由后台线程完成；同时转给之前注册的处理函数
+ */
+static void trace_signal_handler(int sig)
+{
+    Tracer::Instance()->RequestDump();
+    if(g_prev_handler != SIG_DFL && g_prev_handler != SIG_IGN && g_prev_handler != SIG_ERR) {
+        g_prev_handler(sig);
+    }
+}
+#endif
+
+Tracer::Tracer()
+{
+    SetOptions(ThreadOptions("tracer"));
+}
+
+Tracer::~Tracer()
+{
+    DeInit();
+    for(TraceBuffer *buffer : buffers_) {
+        delete buffer;
+    }
+    buffers_.clear();
+}
+
+/**
+ * @brief 获取全局Tracer对象
+ */
+Tracer *Tracer::Instance()
+{
+    static Tracer tracer;
+    return &tracer;
+}
+
+/**
+ * @brief 打开埋点并启动导出线程
+ * @param path 导出的Chrome trace json文件路径，退出或收到SIGUSR1时写入
+ * @return 成功返回0，失败返回负值
+ */
+int Tracer::Init(const char *path)
+{
+    if(!path || g_trace_enabled) {
+        return -1;
+    }
+    path_ = path;
+    g_trace_enabled = true;
+    if(Start() < 0) {
+        g_trace_enabled = false;
+        return -1;
+    }
+#ifdef SIGUSR1
+    static bool installed = false;
+    if(!installed) {
+        installed = true;
+        g_prev_handler = signal(SIGUSR1, trace_signal_handler);
+    }
+#endif
+    LOG_INFO("trace enabled, output:%s\n", path_.c_str());
+    return 0;
+}
+
+/**
+ * @brief 关闭埋点，停止导出线程并写出最终的trace文件
+ * @return 成功返回0
+ */
+int Tracer::DeInit()
+{
+    if(!g_trace_enabled) {
+        return 0;
+    }
+    g_trace_enabled = false;
+    Stop();
+    return 0;
+}
+
+int Tracer::Stop()
+{
+    Thread::Stop();
+    Dump(path_.c_str());
+    return 0;
+}
+
+/**
+ * @brief 导出线程，响应信号触发的导出请求
+ */
+void Tracer::Run()
+{
+    while(waitFor(100)) {
+        if(dump_requested_.exchange(false)) {
+            Dump(path_.c_str());
+        }
+    }
+}
+
+/**
+ * @brief 设置当前线程在trace中显示的名字，只有第一次设置生效，可以在回调中反复调用
+ */
+void Tracer::SetThreadName(const char *name)
+{
+    if(!g_trace_enabled) {
+        return;
+    }
+    TraceBuffer *buffer = threadBuffer();
+    if(!buffer->name.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffer->name = name;
+}
+
+/**
+ * @brief 记录一个完整事件(Chrome trace的"X"类型)
+ * @param name 事件名
+ * @param stream 所属流
+ * @param ts_us 开始时间，单位微秒
+ * @param dur_us 持续时间，单位微秒
+ * @param pts 关联的时间戳，使用流的time_base
+ */
+void Tracer::Record(const char *name, const char *stream, int64_t ts_us, int64_t dur_us, int64_t pts)
+{
+    TraceBuffer *buffer = threadBuffer();
+    uint64_t index = buffer->count.load(std::memory_order_relaxed);
+    TraceEvent &event = buffer->events[index & (TRACE_BUFFER_CAPACITY - 1)];
+    // 序号清0表示正在写，导出线程读到0或序号不一致就丢弃该事件
+    event.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    event.name.store(name, std::memory_order_relaxed);
+    event.stream.store(stream, std::memory_order_relaxed);
+    event.ts_us.store(ts_us, std::memory_order_relaxed);
+    event.dur_us.store(dur_us, std::memory_order_relaxed);
+    event.pts.store(pts, std::memory_order_relaxed);
+    event.seq.store(index + 1, std::memory_order_release);
+    buffer->count.store(index + 1, std::memory_order_release);
+}
+
+/**
+ * @brief 请求导出，可以在信号处理函数中调用
+ */
+void Tracer::RequestDump()
+{
+    dump_requested_ = true;
+}
+
+/**
+ * @brief 把所有线程的事件按Chrome trace json格式写到文件，可用chrome://tracing或Perfetto打开
+ * @param path 文件路径
+ * @return 成功返回0，失败返回负值
+ */
+int Tracer::Dump(const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if(!fp) {
+        LOG_ERROR("%s(%d) open %s failed\n", __FUNCTION__, __LINE__, path);
+        return -1;
+    }
+    int64_t written = 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for(TraceBuffer *buffer : buffers_) {
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", buffer->tid,
+                buffer->name.empty() ? "thread" : buffer->name.c_str());
+        first = false;
+        uint64_t count = buffer->count.load(std::memory_order_acquire);
+        uint64_t begin = count > TRACE_BUFFER_CAPACITY ? count - TRACE_BUFFER_CAPACITY : 0;
+        for(uint64_t i = begin; i < count; i++) {
+            TraceEvent &event = buffer->events[i & (TRACE_BUFFER_CAPACITY - 1)];
+            if(event.seq.load(std::memory_order_acquire) != i + 1) {
+                continue;   // 已被覆盖
+            }
+            const char *name = event.name.load(std::memory_order_relaxed);
+            const char *stream = event.stream.load(std::memory_order_relaxed);
+            int64_t ts_us = event.ts_us.load(std::memory_order_relaxed);
+            int64_t dur_us = event.dur_us.load(std::memory_order_relaxed);
+            int64_t pts = event.pts.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(event.seq.load(std::memory_order_relaxed) != i + 1) {
+                continue;   // 读的过程中被覆盖
+            }
+            fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld,"
+                    "\"args\":{\"stream\":\"%s\",\"pts\":%lld}}",
+                    name, buffer->tid, (long long)ts_us, (long long)dur_us,
+                    stream ? stream : "", (long long)pts);
+            written++;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    LOG_INFO("trace dump %lld events to %s\n", (long long)written, path);
+    return 0;
+}
+
+/**
+ * @brief 单调时钟，单位为微秒
+ */
+int64_t Tracer::NowMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief 获取当前线程的事件缓冲区，第一次调用时创建并注册
+ *
+ * 线程退出后缓冲区保留，保证导出时仍能看到已退出线程的事件
+ */
+TraceBuffer *Tracer::threadBuffer()
+{
+    if(t_trace_buffer) {
+        return t_trace_buffer;
+    }
+    TraceBuffer *buffer = new TraceBuffer();
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffer->tid = ++next_tid_;
+    buffers_.push_back(buffer);
+    t_trace_buffer = buffer;
+    return buffer;
+}
@@ -0,0 +1,99 @@
+﻿#ifndef TRACE_H
+#define TRACE_H
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "thread.h"
+
+#define TRACE_BUFFER_CAPACITY 65536   // 每个线程保留最近的事件条数，必须是2的幂
+
+struct TraceEvent
+{
+    std::atomic<uint64_t> seq{0};     // 写入序号+1，0表示正在写或未写，读者据此判断事件是否完整
+    // 以下字段都是relaxed原子变量，写入线程和导出线程可能同时访问同一条
+    std::atomic<const char *> name{nullptr};     // 必须是静态字符串
+    std::atomic<const char *> stream{nullptr};   // "audio"/"video"/"demux"，必须是静态字符串
+    std::atomic<int64_t> ts_us{0};
+    std::atomic<int64_t> dur_us{0};
+    std::atomic<int64_t> pts{0};
+};
+
+/**
+ * 单个线程的事件环形缓冲区，只有所属线程写入，导出时覆盖写入的事件会被跳过
+ */
+struct TraceBuffer
+{
+    int tid = 0;
+    std::string name;
+    std::atomic<uint64_t> count{0};
+    TraceEvent events[TRACE_BUFFER_CAPACITY];
+};
+
+// 全局开关，关闭时每个埋点只有一次分支判断
+extern std::atomic<bool> g_trace_enabled;
+
+class Tracer : public Thread
+{
+public:
+    static Tracer *Instance();
+    int Init(const char *path);
+    int DeInit();
+    virtual int Stop();
+    virtual void Run();
+
+    void SetThreadName(const char *name);
+    void Record(const char *name, const char *stream, int64_t ts_us, int64_t dur_us, int64_t pts);
+    int Dump(const char *path);
+    void RequestDump();
+
+    static int64_t NowMicroseconds();
+private:
+    Tracer();
+    ~Tracer();
+    TraceBuffer *threadBuffer();
+
+    std::string path_;
+    std::atomic<bool> dump_requested_{false};
+    std::mutex mutex_;                    // 保护buffers_的注册和导出
+    std::vector<TraceBuffer *> buffers_;
+    int next_tid_ = 0;
+};
+
+/**
+ * 作用域埋点，构造时记开始时间，析构时记录一个完整事件
+ */
+class TraceScope
+{
+public:
+    TraceScope(const char *name, const char *stream, int64_t pts = 0):
+        name_(name), stream_(stream), pts_(pts), enabled_(g_trace_enabled.load(std::memory_order_relaxed))
+    {
+        if(enabled_) {
+            start_us_ = Tracer::NowMicroseconds();
+        }
+    }
+    ~TraceScope()
+    {
+        // 只看构造时读到的开关，关闭时每个作用域只有构造时一次全局读取
+        if(enabled_) {
+            Tracer::Instance()->Record(name_, stream_, start_us_, Tracer::NowMicroseconds() - start_us_, pts_);
+        }
+    }
+    // 有些pts要在操作完成后才知道(如avcodec_receive_frame)
+    void SetPts(int64_t pts) { pts_ = pts; }
+    void SetStream(const char *stream) { stream_ = stream; }
+private:
+    const char *name_;
+    const char *stream_;
+    int64_t pts_;
+    bool enabled_;
+    int64_t start_us_ = 0;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name, stream, pts) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name, stream, pts)
+
+#endif // TRACE_H
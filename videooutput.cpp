@@ -1,5 +1,83 @@
 ﻿#include "videooutput.h"
+#include "log.h"
+#include "trace.h"
+#include "convertthread.h"
+#include "frametiming.h"
+#include "renderthread.h"
 #include <thread>
+#ifdef __cplusplus
+extern "C" {
+#include "libavutil/imgutils.h"
+#include "libavutil/pixdesc.h"
+}
+#endif
+
+/**
+ * @brief 进程内唯一的唤醒事件类型，用于让阻塞在SDL_WaitEvent的刷新循环返回
+ */
+static Uint32 wake_event_type()
+{
+    static Uint32 type = SDL_RegisterEvents(1);
+    return type;
+}
+
+/**
+ * @brief 帧的像素格式对应的纹理格式，ConvertThread已经把其他格式转成YUV420P
+ */
+Uint32 VideoOutput::TextureFormat(int format)
+{
+    switch(format) {
+        case AV_PIX_FMT_NV12:
+            return SDL_PIXELFORMAT_NV12;
+        case AV_PIX_FMT_NV21:
+            return SDL_PIXELFORMAT_NV21;
+        default:
+            return SDL_PIXELFORMAT_IYUV;
+    }
+}
+
+/**
+ * @brief 帧的各平面是否在同一块缓冲里按SDL_UpdateTexture要求的布局连续存放：亮度之后紧跟色度，
+ *        YUV420P的U、V行宽为亮度的一半、V紧跟U，NV12/NV21的UV行宽和亮度相同
+ *        (DecodeThread的缓冲池和av_frame_get_buffer分配的帧都是这样)
+ * @param rows 返回亮度平面的行数，可能比画面高度多出解码器对齐的行
+ */
+bool VideoOutput::TextureLayout(const AVFrame *frame, int &rows)
+{
+    if(!frame->buf[0] || frame->buf[1] || frame->linesize[0] <= 0 || frame->data[1] <= frame->data[0]) {
+        return false;
+    }
+    ptrdiff_t luma_size = frame->data[1] - frame->data[0];
+    if(luma_size % frame->linesize[0] != 0) {
+        return false;
+    }
+    rows = (int)(luma_size / frame->linesize[0]);
+    if(rows < frame->height || (rows & 1) || (frame->linesize[0] & 1)) {
+        return false;
+    }
+    const uint8_t *end = NULL;
+    switch(frame->format) {
+        case AV_PIX_FMT_YUV420P:
+        case AV_PIX_FMT_YUVJ420P:
+            if(frame->linesize[1] != frame->linesize[0] / 2 || frame->linesize[2] != frame->linesize[1]
+                    || frame->data[2] != frame->data[1] + (ptrdiff_t)frame->linesize[1] * (rows / 2)) {
+                return false;
+            }
+            end = frame->data[2] + (ptrdiff_t)frame->linesize[2] * (rows / 2);
+            break;
+        case AV_PIX_FMT_NV12:
+        case AV_PIX_FMT_NV21:
+            if(frame->linesize[1] != frame->linesize[0]) {
+                return false;
+            }
+            end = frame->data[1] + (ptrdiff_t)frame->linesize[1] * (rows / 2);
+            break;
+        default:
+            return false;
+    }
+    // 所有平面都在buf[0]之内，SDL按行宽和行数读不会越界
+    return frame->data[0] >= frame->buf[0]->data && end <= frame->buf[0]->data + frame->buf[0]->size;
+}
 
 /**
  * @brief 构造函数，初始化视频输出对象
@@ -24,20 +102,7 @@ VideoOutput::VideoOutput(AVSync *avsync, AVFrameQueue *frame_queue,
 VideoOutput::~VideoOutput()
 {
     // 释放SDL资源
-    if (texture_) {
-        SDL_DestroyTexture(texture_);
-        texture_ = nullptr;
-    }
-    
-    if (renderer_) {
-        SDL_DestroyRenderer(renderer_);
-        renderer_ = nullptr;
-    }
-    
-    if (win_) {
-        SDL_DestroyWindow(win_);
-        win_ = nullptr;
-    }
+    DeInit();
 }
 
 /**
@@ -46,53 +111,110 @@ VideoOutput::~VideoOutput()
  */
 int VideoOutput::Init()
 {
-    // 初始化SDL视频子系统
-    if(SDL_Init(SDL_INIT_VIDEO))  {
-        printf("SDL_Init failed\n");
+    // 初始化SDL视频子系统，SDL内部有引用计数，多个实例各自初始化、各自退出
+    if(SDL_InitSubSystem(SDL_INIT_VIDEO))  {
+        LOG_ERROR("SDL_InitSubSystem failed:%s\n", SDL_GetError());
         return -1;
     }
+    sdl_inited_ = true;
     
-    // 创建窗口
+    // 创建窗口，窗口事件只在创建它的线程处理
     win_ = SDL_CreateWindow("player", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
                             video_width_, video_height_, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
     if(!win_) {
-        printf("SDL_CreateWindow failed\n");
+        LOG_ERROR("SDL_CreateWindow failed\n");
         return -1;
     }
     
-    // 创建渲染器
-    renderer_ = SDL_CreateRenderer(win_, -1, 0);
+    // 使用渲染线程时渲染器在StartRenderThread之后由渲染线程创建
+    if(render_thread_enabled_) {
+        render_thread_.reset(new RenderThread(this));
+        return 0;
+    }
+    return InitRenderer();
+}
+
+/**
+ * @brief 创建渲染器，之后渲染器和纹理只能在调用线程使用
+ * @return 成功返回0，失败返回负值
+ *
+ * 纹理在第一帧上传时按帧的大小和格式创建
+ */
+int VideoOutput::InitRenderer()
+{
+    // 使用显示器的垂直同步时呈现阻塞到vblank，不支持时退回普通渲染器，按刷新率模拟vblank
+    if(vsync_ && vsync_hz_ <= 0) {
+        renderer_ = SDL_CreateRenderer(win_, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    }
     if(!renderer_) {
-        printf("SDL_CreateRenderer failed\n");
-        return -1;
+        renderer_ = SDL_CreateRenderer(win_, -1, 0);
     }
-    
-    // 创建纹理，用于显示YUV格式的视频帧
-    texture_ = SDL_CreateTexture(renderer_, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, video_width_, video_height_);
-    if(!texture_) {
-        printf("SDL_CreateRenderer failed\n");
+    if(!renderer_) {
+        LOG_ERROR("SDL_CreateRenderer failed:%s\n", SDL_GetError());
         return -1;
     }
-    
+    if(vsync_) {
+        initVsync();
+    }
     return 0;
 }
 
 /**
- * @brief 释放视频输出资源
+ * @brief 查询显示器刷新率和渲染器是否支持垂直同步，开启按vblank显示
  */
-void VideoOutput::DeInit()
+void VideoOutput::initVsync()
 {
-    // 释放纹理
-    if(texture_) {
-        SDL_DestroyTexture(texture_);
-        texture_ = nullptr;
+    double refresh_hz = vsync_hz_;
+    bool simulated = vsync_hz_ > 0;
+    if(!simulated) {
+        SDL_DisplayMode mode;
+        int display = SDL_GetWindowDisplayIndex(win_);
+        if(display >= 0 && SDL_GetCurrentDisplayMode(display, &mode) == 0 && mode.refresh_rate > 0) {
+            refresh_hz = mode.refresh_rate;
+        } else {
+            LOG_WARN("display refresh rate unknown, use %dHz\n", VSYNC_DEFAULT_REFRESH_HZ);
+        }
+        SDL_RendererInfo info;
+        if(SDL_GetRendererInfo(renderer_, &info) < 0 || !(info.flags & SDL_RENDERER_PRESENTVSYNC)) {
+            LOG_WARN("renderer has no vsync, simulate vblank\n");
+            simulated = true;
+        }
+    }
+    pacer_.Init(refresh_hz, simulated, stats_);
+    LOG_INFO("vsync %.2fHz %s\n", pacer_.RefreshRate(), simulated ? "simulated" : "display");
+}
+
+/**
+ * @brief 释放纹理和渲染器，在创建渲染器的线程调用
+ */
+void VideoOutput::DeInitRenderer()
+{
+    // 释放纹理池中的所有纹理
+    for(TextureEntry &entry : textures_) {
+        SDL_DestroyTexture(entry.texture);
     }
+    textures_.clear();
+    texture_ = nullptr;
+    upload_texture_ = nullptr;
+    front_uploaded_ = false;
     
     // 释放渲染器
     if(renderer_) {
         SDL_DestroyRenderer(renderer_);
         renderer_ = nullptr;
     }
+}
+
+/**
+ * @brief 释放视频输出资源
+ */
+void VideoOutput::DeInit()
+{
+    // 渲染线程退出前释放它创建的渲染器
+    StopRenderThread();
+    render_thread_.reset();
+    DeInitRenderer();
+    av_frame_free(&still_frame_);
     
     // 释放窗口
     if(win_) {
@@ -100,8 +222,11 @@ void VideoOutput::DeInit()
         win_ = nullptr;
     }
     
-    // 退出SDL
-    SDL_Quit();
+    // 退出SDL视频子系统，SDL_Quit由程序在所有播放器释放后调用
+    if(sdl_inited_) {
+        SDL_QuitSubSystem(SDL_INIT_VIDEO);
+        sdl_inited_ = false;
+    }
 }
 
 /**
@@ -122,13 +247,13 @@ int VideoOutput::MainLoop()
             case SDL_KEYDOWN:
                 // ESC键退出
                 if(event.key.keysym.sym == SDLK_ESCAPE) {
-                    printf("esc key down\n");
+                    LOG_INFO("esc key down\n");
                     return 0;
                 }
                 break;
             case SDL_QUIT:
                 // 窗口关闭事件
-                printf("SDL_QUIT\n");
+                LOG_INFO("SDL_QUIT\n");
                 return 0;
                 break;
             default:
@@ -141,6 +266,10 @@ int VideoOutput::MainLoop()
 
 // 0.01秒循环一次，定义刷新率
 #define REFRESH_RATE 0.01
+// 视频落后音频超过0.5秒时导出飞行记录
+#define AV_DIFF_DUMP_THRESHOLD 0.5
+// 纹理池最多保留的纹理数，覆盖自适应码流常见的几档分辨率
+#define VIDEO_TEXTURE_POOL_SIZE 4
 
 /**
  * @brief 等待并处理事件，同时刷新视频显示
@@ -150,11 +279,26 @@ void VideoOutput::RefreshLoopWaitEvent(SDL_Event *event)
 {
     double remain_time = 0.0; // 下一帧等待时间，单位为秒
     
+    // 渲染线程在刷新，这里只等事件，窗口露出或缩放后通知渲染线程重画
+    if(render_thread_) {
+        SDL_WaitEvent(event);
+        if(event->type == SDL_WINDOWEVENT) {
+            RequestRedraw();
+        }
+        return;
+    }
+    
     // 获取所有待处理的事件
     SDL_PumpEvents();
     
     // 当没有事件时，刷新显示
     while(!SDL_PeepEvents(event, 1, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT)) {
+        // 暂停时画面不变，不再定时刷新，只等事件；恢复和seek时由Wake发事件唤醒
+        // (SDL 2.0.16之前SDL_WaitEvent内部仍按10ms检查事件，但不再访问帧队列)
+        if(paused_ && !refresh_requested_) {
+            SDL_WaitEvent(event);
+            return;
+        }
         // 如果需要等待，则延时适当时间
         if(remain_time > 0.0) {
             std::this_thread::sleep_for(std::chrono::milliseconds(int64_t(remain_time * 1000)));
@@ -168,6 +312,15 @@ void VideoOutput::RefreshLoopWaitEvent(SDL_Event *event)
     }
 }
 
+/**
+ * @brief 刷新一次，不处理事件，由外部的事件循环(如PlayerHost)调用
+ * @param remain_time 返回下一帧应该等待的时间，单位秒
+ */
+void VideoOutput::Refresh(double &remain_time)
+{
+    videoRefresh(remain_time);
+}
+
 /**
  * @brief 刷新视频帧
  * @param remain_time 引用参数，返回下一帧应该等待的时间
@@ -177,21 +330,53 @@ void VideoOutput::RefreshLoopWaitEvent(SDL_Event *event)
 void VideoOutput::videoRefresh(double &remain_time)
 {
     AVFrame *frame = NULL;
+    std::lock_guard<std::mutex> lock(refresh_mutex_);
+    if(!renderer_) {
+        return;
+    }
+    checkOutputSize();
     
+    if(stats_) {
+        stats_->heartbeats[STAGE_VIDEO_OUTPUT].Beat();
+    }
+
+    // 逐帧步进的帧马上显示，按vblank显示时也一样
+    if(still_frame_) {
+        showStill();
+        return;
+    }
+
+    // 按vblank显示时每个vblank都呈现，不需要单独重画
+    if(pacer_.Enabled()) {
+        vsyncRefresh(remain_time);
+        return;
+    }
+
+    // 窗口露出或缩放后重画正在显示的帧，暂停中也要重画
+    if(redraw_requested_.exchange(false) && texture_) {
+        present(0);
+    }
+
     // 获取队列中的第一帧但不移除
     frame = frame_queue_->Front();
     
     if(frame) {
-        // 计算视频帧的显示时间点，单位为秒
-        double pts = frame->pts * av_q2d(time_base_);
-        
-        // 计算当前帧与音频时钟的时间差
-        double diff = pts - avsync_->GetClock();
-        printf("video pts:%0.3lf, diff:%0.3f\n", pts, diff);
+        // 视频帧的显示时间点和与音频时钟的时间差，如diff = 0.005秒，表示视频比音频快了5ms
+        FrameTiming timing(frame, time_base_, avsync_->GetClock());
+        LOG_TRACE("video pts:%0.3lf, diff:%0.3f\n", timing.pts, timing.diff);
+        int action = timing.Action(avsync_->Rate());
         
         // 如果视频帧还没到显示时间，等待
-        if(diff > 0) { // 如diff = 0.005秒，表示视频比音频快了5ms
-            remain_time = diff;
+        if(action == FRAME_WAIT) {
+            // 暂停中已经显示到时钟位置，不用再刷新
+            if(paused_) {
+                refresh_requested_ = false;
+            }
+            // 等待期间先上传到下一个纹理，和正在显示的帧重叠，到时间后只需要呈现
+            if(!front_uploaded_) {
+                prepare(frame, true);
+            }
+            remain_time = timing.diff;
             
             // 限制最大等待时间为刷新率
             if(remain_time > REFRESH_RATE) {
@@ -200,31 +385,475 @@ void VideoOutput::videoRefresh(double &remain_time)
             return;
         }
         
-        // 到达或超过显示时间，渲染当前帧
-        
-        // 准备渲染区域
-        SDL_Rect rect;
-        rect.x = 0;
-        rect.y = 0;
-        rect.w = video_width_;
-        rect.h = video_height_;
-        
-        // 更新纹理数据
-        SDL_UpdateYUVTexture(texture_, &rect, frame->data[0], frame->linesize[0],
-                             frame->data[1], frame->linesize[1],
-                             frame->data[2], frame->linesize[2]);
-        
-        // 清空渲染器
-        SDL_RenderClear(renderer_);
+        if(action == FRAME_DROP) {
+            RecordFrameDropped(stats_, frame, timing);
+            frame = frame_queue_->Pop(0);
+            av_frame_free(&frame);
+            // 提前上传过也没有显示，下一帧继续用这个纹理
+            front_uploaded_ = false;
+            remain_time = 0;
+            return;
+        }
+
+        // 到达或超过显示时间，渲染当前帧；落后太多时导出飞行记录
+        if(stats_ && timing.diff < -AV_DIFF_DUMP_THRESHOLD) {
+            stats_->recorder.Trigger("av_diff");
+        }
+
+        // 没有提前上传(落后或刚seek)时现在上传
+        if(!front_uploaded_) {
+            prepare(frame, false);
+        }
         
-        // 将纹理复制到渲染器
-        SDL_RenderCopy(renderer_, texture_, NULL, &rect);
+        // 上传好的纹理成为正在显示的纹理，下一帧上传到轮换的下一个纹理
+        texture_ = upload_texture_;
+        texture_src_ = upload_src_;
+        upload_slot_ = (upload_slot_ + 1) % texture_buffers_;
         
-        // 将渲染器的内容呈现到窗口
-        SDL_RenderPresent(renderer_);
+        int64_t present_start_us = stats_ ? PipelineStats::NowMicroseconds() : 0;
+        present(frame->pts);
+        if(stats_) {
+            stats_->video_present.Record(PipelineStats::NowMicroseconds() - present_start_us);
+        }
+        RecordFrameShown(stats_, frame, timing);
         
         // 显示完成后，从队列中取出并释放该帧
-        frame = frame_queue_->Pop(1);
+        {
+            TRACE_SCOPE("frame_queue_pop", "video", frame->pts);
+            frame = frame_queue_->Pop(1);
+        }
         av_frame_free(&frame);
+        front_uploaded_ = false;
+        // 下一帧马上判断，还没到时间也先上传
+        remain_time = 0;
+    }
+}
+
+/**
+ * @brief 按vblank刷新：每个vblank呈现一次，由VsyncPacer决定换新帧还是重复上一帧，
+ *        24p在60Hz上各帧交替显示3个和2个vblank
+ * @param remain_time 返回到下一次模拟vblank的时间，使用显示器的垂直同步时为0(呈现本身阻塞到vblank)
+ */
+void VideoOutput::vsyncRefresh(double &remain_time)
+{
+    int64_t now_us = PipelineStats::NowMicroseconds();
+    double wait = pacer_.UntilVblank(now_us);
+    if(wait > 0) {
+        remain_time = wait;
+        return;
+    }
+    redraw_requested_ = false;
+    double rate = avsync_->Rate();
+    double vblank_clock = pacer_.VblankClock(avsync_->GetClock(), rate, now_us);
+    AVFrame *frame = pacer_.Select(frame_queue_, time_base_, vblank_clock, rate);
+    if(frame) {
+        if(stats_ && frame->pts * av_q2d(time_base_) - vblank_clock < -AV_DIFF_DUMP_THRESHOLD) {
+            stats_->recorder.Trigger("av_diff");
+        }
+        prepare(frame, false);
+        front_uploaded_ = false;
+        texture_ = upload_texture_;
+        texture_src_ = upload_src_;
+        upload_slot_ = (upload_slot_ + 1) % texture_buffers_;
+    } else if(paused_) {
+        // 暂停中已经显示到时钟位置，不用再刷新
+        refresh_requested_ = false;
+    }
+
+    int64_t present_start_us = stats_ ? PipelineStats::NowMicroseconds() : 0;
+    present(frame ? frame->pts : 0);
+    int64_t present_end_us = PipelineStats::NowMicroseconds();
+    pacer_.OnVblank(present_end_us);
+    if(frame) {
+        if(stats_) {
+            stats_->video_present.Record(present_end_us - present_start_us);
+        }
+        RecordFrameShown(stats_, frame, FrameTiming(frame, time_base_, vblank_clock));
+        av_frame_free(&frame);
+    }
+    remain_time = pacer_.UntilVblank(present_end_us);
+}
+
+/**
+ * @brief 上传队首帧并统计上传耗时，失败时显示时保留上一帧的画面
+ * @param frame 队首帧，出队之前一直有效
+ * @param ahead true表示在显示时间之前提前上传
+ */
+void VideoOutput::prepare(AVFrame *frame, bool ahead)
+{
+    int64_t upload_start_us = stats_ ? PipelineStats::NowMicroseconds() : 0;
+    if(upload(frame) < 0) {
+        upload_texture_ = texture_;
+        upload_src_ = texture_src_;
+    }
+    front_uploaded_ = true;
+    if(stats_) {
+        stats_->video_upload.Record(PipelineStats::NowMicroseconds() - upload_start_us);
+        if(ahead) {
+            stats_->video_preuploads.Add(1);
+        }
+    }
+}
+
+/**
+ * @brief 把正在显示的纹理按宽高比画到窗口中间并呈现
+ * @param pts 用于埋点的时间戳
+ *
+ * 按帧的宽高比(码流中途可能切换分辨率)计算渲染区域，
+ * 纹理可能已经缩小，缩小保持宽高比，由渲染器拉伸到该区域
+ */
+void VideoOutput::present(int64_t pts)
+{
+    SDL_Rect rect;
+    ConvertThread::FitSize(texture_src_.w, texture_src_.h, output_width_, output_height_, rect.w, rect.h);
+    rect.x = (output_width_ - rect.w) / 2;
+    rect.y = (output_height_ - rect.h) / 2;
+
+    // 清空渲染器
+    SDL_RenderClear(renderer_);
+    
+    // 将纹理复制到渲染器
+    if(texture_) {
+        SDL_RenderCopy(renderer_, texture_, &texture_src_, &rect);
+    }
+    
+    // 将渲染器的内容呈现到窗口
+    TRACE_SCOPE("SDL_RenderPresent", "video", pts);
+    SDL_RenderPresent(renderer_);
+}
+
+/**
+ * @brief 上传并呈现逐帧步进的帧，和正常显示一样轮换纹理
+ */
+void VideoOutput::showStill()
+{
+    prepare(still_frame_, false);
+    texture_ = upload_texture_;
+    texture_src_ = upload_src_;
+    upload_slot_ = (upload_slot_ + 1) % texture_buffers_;
+    present(still_frame_->pts);
+    if(stats_) {
+        stats_->heartbeats[STAGE_VIDEO_OUTPUT].Progress((int64_t)(still_frame_->pts * av_q2d(time_base_) * 1000000));
+    }
+    av_frame_free(&still_frame_);
+    // prepare标记的是步进的帧，队首帧还没有上传
+    front_uploaded_ = false;
+    refresh_requested_ = false;
+}
+
+/**
+ * @brief 渲染区域大小变化时通知格式转换，窗口缩小后之后的帧按新的大小缩小
+ */
+void VideoOutput::checkOutputSize()
+{
+    int width = 0;
+    int height = 0;
+    // 像素大小，高DPI屏幕上和窗口大小不同
+    if(SDL_GetRendererOutputSize(renderer_, &width, &height) < 0) {
+        return;
+    }
+    if(width == output_width_ && height == output_height_) {
+        return;
+    }
+    output_width_ = width;
+    output_height_ = height;
+    LOG_INFO("video output %dx%d\n", width, height);
+    if(resize_callback_) {
+        resize_callback_(width, height);
+    }
+}
+
+/**
+ * @brief 从纹理池取(宽,高,格式,序号)相同的纹理，没有时新建，池满时先销毁最久没用的
+ * @param format SDL像素格式
+ * @param width 纹理宽度
+ * @param height 纹理高度
+ * @param slot 同一大小和格式轮流使用的第几个纹理
+ * @return 纹理指针，失败返回NULL
+ */
+SDL_Texture *VideoOutput::acquireTexture(Uint32 format, int width, int height, int slot)
+{
+    texture_uses_++;
+    for(TextureEntry &entry : textures_) {
+        if(entry.format == format && entry.width == width && entry.height == height && entry.slot == slot) {
+            entry.last_used = texture_uses_;
+            return entry.texture;
+        }
+    }
+    // 正在显示的纹理刚用过，不会被淘汰
+    if(textures_.size() >= (size_t)(VIDEO_TEXTURE_POOL_SIZE * texture_buffers_)) {
+        size_t oldest = 0;
+        for(size_t i = 1; i < textures_.size(); i++) {
+            if(textures_[i].last_used < textures_[oldest].last_used) {
+                oldest = i;
+            }
+        }
+        SDL_DestroyTexture(textures_[oldest].texture);
+        textures_.erase(textures_.begin() + oldest);
+    }
+    SDL_Texture *texture = SDL_CreateTexture(renderer_, format, SDL_TEXTUREACCESS_STREAMING, width, height);
+    if(!texture) {
+        LOG_ERROR("SDL_CreateTexture failed:%s\n", SDL_GetError());
+        return NULL;
+    }
+    textures_.push_back({texture, format, width, height, slot, texture_uses_});
+    if(stats_) {
+        stats_->video_texture_creates.Add(1);
+    }
+    LOG_INFO("video texture %dx%d %s slot %d, pool %d\n", width, height, SDL_GetPixelFormatName(format), slot,
+             (int)textures_.size());
+    return texture;
+}
+
+/**
+ * @brief 把帧上传到轮换的下一个纹理，帧的格式或大小变化时从纹理池切换纹理，不重建整条流水线
+ * @return 成功返回0，失败返回负值
+ *
+ * 上传的纹理和正在显示的纹理不同，驱动不用等上一帧画完才能改写纹理
+ *
+ * 各平面已经按纹理布局连续存放时一次SDL_UpdateTexture直接上传；否则YUV420P逐平面上传，
+ * 这两种都是SDL从解码缓冲拷进纹理，记为直接上传；NV12/NV21锁定纹理后本地拷贝，记为一次拷贝
+ */
+int VideoOutput::upload(AVFrame *frame)
+{
+    Uint32 format = TextureFormat(frame->format);
+    int rows = frame->height;
+    bool direct = TextureLayout(frame, rows);
+    if(frame->width != frame_width_ || frame->height != frame_height_ || frame->format != frame_format_) {
+        if(frame_format_ >= 0) {
+            LOG_INFO("video frame changed %dx%d %s -> %dx%d %s\n", frame_width_, frame_height_,
+                     av_get_pix_fmt_name((enum AVPixelFormat)frame_format_),
+                     frame->width, frame->height, av_get_pix_fmt_name((enum AVPixelFormat)frame->format));
+            if(stats_) {
+                stats_->video_format_changes.Add(1);
+            }
+        }
+        frame_width_ = frame->width;
+        frame_height_ = frame->height;
+        frame_format_ = frame->format;
+    }
+    // 每帧都按(宽,高,格式)取轮换的纹理，大小不变时在几个纹理之间轮流使用
+    SDL_Texture *texture = acquireTexture(format, frame->width, rows, upload_slot_);
+    if(!texture) {
+        return -1;
+    }
+    upload_texture_ = texture;
+    upload_src_ = {0, 0, frame->width, frame->height};
+    if(stats_) {
+        stats_->video_texture_pixels.Set((int64_t)frame->width * frame->height);
+    }
+    return UpdateTexture(texture, frame, direct, stats_);
+}
+
+/**
+ * @brief 把帧写入大小和格式匹配的纹理，VideoOutput和MosaicOutput共用
+ * @param texture 按TextureFormat和TextureLayout给出的格式和行数创建的纹理
+ * @param frame 视频帧
+ * @param direct TextureLayout的返回值，true时一次SDL_UpdateTexture上传
+ * @param stats 统计对象，可以为NULL
+ * @return 成功返回0，失败返回负值
+ */
+int VideoOutput::UpdateTexture(SDL_Texture *texture, const AVFrame *frame, bool direct, PipelineStats *stats)
+{
+    int bytes = av_image_get_buffer_size((enum AVPixelFormat)frame->format, frame->width, frame->height, 1);
+    if(stats) {
+        stats->video_upload_bytes.Add(bytes);
+    }
+    if(direct) {
+        TRACE_SCOPE("SDL_UpdateTexture", "video", frame->pts);
+        if(stats) {
+            stats->video_direct_uploads.Add(1);
+        }
+        return SDL_UpdateTexture(texture, NULL, frame->data[0], frame->linesize[0]);
+    }
+    if(TextureFormat(frame->format) == SDL_PIXELFORMAT_IYUV) {
+        // 和一次SDL_UpdateTexture一样由SDL直接从解码缓冲拷进纹理，只是分三次调用
+        TRACE_SCOPE("SDL_UpdateYUVTexture", "video", frame->pts);
+        if(stats) {
+            stats->video_direct_uploads.Add(1);
+        }
+        return SDL_UpdateYUVTexture(texture, NULL, frame->data[0], frame->linesize[0],
+                                    frame->data[1], frame->linesize[1],
+                                    frame->data[2], frame->linesize[2]);
+    }
+    // SDL 2.0.10没有SDL_UpdateNVTexture，锁定纹理后逐平面拷贝，UV平面紧跟在Y平面之后
+    TRACE_SCOPE("SDL_LockTexture", "video", frame->pts);
+    void *pixels = NULL;
+    int pitch = 0;
+    if(SDL_LockTexture(texture, NULL, &pixels, &pitch) < 0) {
+        LOG_ERROR("SDL_LockTexture failed:%s\n", SDL_GetError());
+        return -1;
+    }
+    int uv_pitch = (pitch + 1) & ~1;
+    av_image_copy_plane((uint8_t *)pixels, pitch, frame->data[0], frame->linesize[0],
+                        frame->width, frame->height);
+    av_image_copy_plane((uint8_t *)pixels + pitch * frame->height, uv_pitch, frame->data[1], frame->linesize[1],
+                        (frame->width + 1) / 2 * 2, (frame->height + 1) / 2);
+    SDL_UnlockTexture(texture);
+    if(stats) {
+        stats->video_copies.Add(1);
+        stats->video_copy_bytes.Add(bytes);
+    }
+    return 0;
+}
+
+/**
+ * @brief 丢弃帧队列中的所有帧，用于seek，可以在任意线程调用
+ */
+void VideoOutput::Flush()
+{
+    std::lock_guard<std::mutex> lock(refresh_mutex_);
+    frame_queue_->Flush();
+    front_uploaded_ = false;
+    av_frame_free(&still_frame_);
+    pacer_.Reset();
+}
+
+/**
+ * @brief 暂停中逐帧步进：不看时钟马上显示指定的帧，队列里不晚于它的帧丢弃，解码继续往后填充，可以在任意线程调用
+ * @param frame 要显示的帧，增加一个引用
+ */
+void VideoOutput::ShowFrame(const AVFrame *frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(refresh_mutex_);
+        av_frame_free(&still_frame_);
+        still_frame_ = av_frame_clone(frame);
+        AVFrame *front = NULL;
+        while((front = frame_queue_->Front()) && front->pts <= frame->pts) {
+            front = frame_queue_->Pop(0);
+            av_frame_free(&front);
+            front_uploaded_ = false;
+        }
     }
+    RequestRefresh();
+}
+
+/**
+ * @brief 暂停或恢复刷新，可以在任意线程调用
+ * @param paused true时刷新循环只等事件，false时唤醒刷新循环
+ */
+void VideoOutput::SetPaused(bool paused)
+{
+    paused_ = paused;
+    if(!paused) {
+        Wake();
+    }
+}
+
+/**
+ * @brief 暂停中seek后调用，刷新循环继续刷新，直到显示到时钟位置的画面再回到只等事件
+ */
+void VideoOutput::RequestRefresh()
+{
+    refresh_requested_ = true;
+    Wake();
+}
+
+/**
+ * @brief 窗口露出或缩放后重画正在显示的帧，暂停中也会重画，可以在任意线程调用
+ */
+void VideoOutput::RequestRedraw()
+{
+    redraw_requested_ = true;
+    Wake();
+}
+
+/**
+ * @brief 暂停中并且没有要刷新或重画的画面，刷新循环可以一直等到被唤醒
+ */
+bool VideoOutput::Idle()
+{
+    return paused_ && !refresh_requested_ && !redraw_requested_;
+}
+
+/**
+ * @brief 让刷新循环返回：唤醒渲染线程，或者让阻塞在SDL_WaitEvent的事件循环返回，可以在任意线程调用
+ */
+void VideoOutput::Wake()
+{
+    if(render_thread_) {
+        render_thread_->Wake();
+        return;
+    }
+    SDL_Event event;
+    memset(&event, 0, sizeof(event));
+    event.type = wake_event_type();
+    SDL_PushEvent(&event);
+}
+
+/**
+ * @brief 设置渲染区域大小变化的回调，在Init之前调用，回调在刷新循环中调用
+ * @param callback 参数为渲染区域的像素大小
+ */
+void VideoOutput::SetResizeCallback(std::function<void(int width, int height)> callback)
+{
+    resize_callback_ = callback;
+}
+
+/**
+ * @brief 设置渲染方式，在Init之前调用
+ * @param enabled true时渲染器由单独的渲染线程创建和使用，窗口所在的线程只处理事件；
+ *                false时由调用Refresh或RefreshLoopWaitEvent的线程渲染(如PlayerHost的刷新循环)
+ * @param texture_buffers 每种大小和格式轮流使用的纹理个数，1到3
+ */
+void VideoOutput::SetRenderThread(bool enabled, int texture_buffers)
+{
+    render_thread_enabled_ = enabled;
+    texture_buffers_ = av_clip(texture_buffers, 1, 3);
+}
+
+/**
+ * @brief 设置按vblank显示，在Init之前调用
+ * @param enabled true时每个vblank呈现一次，并按vblank选择显示哪一帧
+ * @param simulated_hz 大于0时不使用显示器的垂直同步，按该刷新率模拟vblank
+ */
+void VideoOutput::SetVsync(bool enabled, double simulated_hz)
+{
+    vsync_ = enabled;
+    vsync_hz_ = simulated_hz;
+}
+
+/**
+ * @brief 启动渲染线程，在Init之后、创建窗口的线程中调用
+ * @param options 渲染线程的属性
+ * @return 成功返回0，没有设置渲染线程时返回负值
+ */
+int VideoOutput::StartRenderThread(const ThreadOptions &options)
+{
+    if(!render_thread_) {
+        LOG_ERROR("%s(%d) render thread not enabled\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    if(render_started_) {
+        return 0;
+    }
+    render_thread_->SetOptions(options);
+    if(render_thread_->Start() < 0) {
+        LOG_ERROR("%s(%d) render thread start failed\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    render_started_ = true;
+    return 0;
+}
+
+/**
+ * @brief 停止渲染线程，渲染线程退出前释放渲染器和纹理，在创建窗口的线程中调用
+ */
+void VideoOutput::StopRenderThread()
+{
+    if(!render_started_) {
+        return;
+    }
+    render_thread_->Stop();
+    render_started_ = false;
+}
+
+/**
+ * @brief 设置统计对象，在MainLoop之前调用
+ * @param stats 统计对象指针，可以为NULL
+ */
+void VideoOutput::SetStats(PipelineStats *stats)
+{
+    stats_ = stats;
 }
@@ -1,14 +1,27 @@
 ﻿#ifndef VIDEOOUTPUT_H
 #define VIDEOOUTPUT_H
 
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include "avframequeue.h"
 #include "avsync.h"
+#include "thread.h"
+#include "vsyncpacer.h"
 #ifdef __cplusplus  ///
 extern "C"
 {
 #include "SDL.h"
 }
 #endif
+
+// 每种(宽,高,格式)轮流使用的纹理个数，2为双缓冲，3为三缓冲
+#define VIDEO_TEXTURE_BUFFERS 3
+
+class RenderThread;
+
 class VideoOutput
 {
 public:
@@ -18,17 +31,83 @@ public:
     void DeInit();
     int MainLoop();
     void RefreshLoopWaitEvent(SDL_Event *event);
+    void Refresh(double &remain_time);
+    void Flush();
+    void ShowFrame(const AVFrame *frame);
+    void SetStats(PipelineStats *stats);
+    void SetPaused(bool paused);
+    void RequestRefresh();
+    void Wake();
+    void SetResizeCallback(std::function<void(int width, int height)> callback);
+    void SetRenderThread(bool enabled, int texture_buffers);
+    void SetVsync(bool enabled, double simulated_hz);
+    int StartRenderThread(const ThreadOptions &options);
+    void StopRenderThread();
+    int InitRenderer();
+    void DeInitRenderer();
+    void RequestRedraw();
+    bool Idle();
+
+    static Uint32 TextureFormat(int format);
+    static bool TextureLayout(const AVFrame *frame, int &rows);
+    static int UpdateTexture(SDL_Texture *texture, const AVFrame *frame, bool direct, PipelineStats *stats);
 private:
     void videoRefresh(double &remain_time);
+    void vsyncRefresh(double &remain_time);
+    void initVsync();
+    void prepare(AVFrame *frame, bool ahead);
+    int upload(AVFrame *frame);
+    void present(int64_t pts);
+    void showStill();
+    SDL_Texture *acquireTexture(Uint32 format, int width, int height, int slot);
+    void checkOutputSize();
+
+    // 纹理池中的一项，按(宽,高,格式)查找，满了淘汰最久没用的
+    struct TextureEntry {
+        SDL_Texture *texture;
+        Uint32 format;
+        int width;
+        int height;       // 直接上传时包含解码器对齐多出的行
+        int slot;         // 同一大小和格式轮流使用的第几个纹理
+        uint64_t last_used;
+    };
+
     AVFrameQueue *frame_queue_ = NULL;
     SDL_Window *win_  = NULL;
     SDL_Renderer *renderer_  = NULL;
-    SDL_Texture *texture_  = NULL;
+    SDL_Texture *texture_  = NULL;   // 正在显示的帧所在的纹理，指向纹理池中的一项
+    SDL_Rect texture_src_;       // 纹理中有效的画面，渲染时裁掉对齐多出的行
+    SDL_Texture *upload_texture_ = NULL;   // 队首帧已经上传到的纹理，到显示时间后成为texture_
+    SDL_Rect upload_src_;
+    bool front_uploaded_ = false;   // 队首帧已经提前上传，出队或Flush后清除
+    AVFrame *still_frame_ = NULL;   // 逐帧步进时要显示的帧，不看时钟，显示后释放
+    int upload_slot_ = 0;           // 下一帧上传到的纹理序号，和正在显示的纹理不同
+    int texture_buffers_ = VIDEO_TEXTURE_BUFFERS;
+    std::vector<TextureEntry> textures_;   // 码流中途切换分辨率或格式时，切回来直接复用
+    uint64_t texture_uses_ = 0;  // 纹理池的使用序号，用于淘汰
+    int frame_width_ = 0;        // 上一帧的大小和格式，用于统计格式变化
+    int frame_height_ = 0;
+    int frame_format_ = -1;
+    int output_width_ = 0;    // 渲染区域的像素大小，窗口缩放时变化
+    int output_height_ = 0;
+    std::function<void(int, int)> resize_callback_;   // 渲染区域变化时通知格式转换缩小到该大小
 
     int video_width_ = 0;
     int video_height_ = 0;
     AVRational time_base_ ;
     AVSync *avsync_ = NULL;
+    PipelineStats *stats_ = NULL;
+    bool sdl_inited_ = false;
+    std::atomic<bool> paused_{false};              // 暂停时刷新循环只等事件
+    std::atomic<bool> refresh_requested_{false};   // 暂停中seek后要刷新到新位置的画面
+    std::atomic<bool> redraw_requested_{false};    // 窗口露出或缩放后重画正在显示的帧
+    bool render_thread_enabled_ = false;           // 在Init之前设置，渲染器由渲染线程创建和使用
+    std::unique_ptr<RenderThread> render_thread_;
+    bool vsync_ = false;          // 在Init之前设置，每个vblank呈现一次并选择显示哪一帧
+    double vsync_hz_ = 0;         // 大于0时按该刷新率模拟vblank，否则使用渲染器的垂直同步和显示器的刷新率
+    VsyncPacer pacer_;
+    bool render_started_ = false;                  // 只在窗口所在的线程访问
+    std::mutex refresh_mutex_;   // videoRefresh持有队首帧的指针，Flush要和它互斥
 };
 
 #endif // VIDEOOUTPUT_H
@@ -0,0 +1,197 @@
+﻿#include "vsyncpacer.h"
+#include "log.h"
+#include <math.h>
+
+/**
+ * @brief 开启按vblank显示
+ * @param refresh_hz 刷新率，不大于0时使用VSYNC_DEFAULT_REFRESH_HZ
+ * @param simulated true时按刷新率模拟vblank，由UntilVblank给出等待时间；
+ *                  false时vblank来自渲染器，每次呈现返回后调用OnVblank
+ * @param stats 统计对象，可以为NULL
+ */
+void VsyncPacer::Init(double refresh_hz, bool simulated, PipelineStats *stats)
+{
+    refresh_hz_ = refresh_hz > 0 ? refresh_hz : VSYNC_DEFAULT_REFRESH_HZ;
+    simulated_ = simulated;
+    period_us_ = (int64_t)(1000000 / refresh_hz_);
+    stats_ = stats;
+    cadence_ = 0;
+    Reset();
+    if(stats_) {
+        stats_->vsync_refresh_hz.Set((int64_t)(refresh_hz_ + 0.5));
+    }
+}
+
+bool VsyncPacer::Enabled()
+{
+    return refresh_hz_ > 0;
+}
+
+bool VsyncPacer::Simulated()
+{
+    return simulated_;
+}
+
+double VsyncPacer::RefreshRate()
+{
+    return refresh_hz_;
+}
+
+/**
+ * @brief 模拟的vblank还要等多久，真实vsync由呈现阻塞，总是返回0
+ * @param now_us 当前时间，PipelineStats::NowMicroseconds
+ * @return 单位秒，0表示已经到了
+ */
+double VsyncPacer::UntilVblank(int64_t now_us)
+{
+    if(!simulated_ || next_vblank_us_ == 0 || now_us >= next_vblank_us_) {
+        return 0;
+    }
+    return (next_vblank_us_ - now_us) / 1000000.0;
+}
+
+/**
+ * @brief 这次决定的画面出现时的媒体时钟
+ *
+ * 真实vsync在上一次呈现返回后决定，画面在下一次vblank出现，时钟要往后推；
+ * 模拟的vblank在到点时决定，画面立即出现
+ * @param clock 当前播放时钟，单位秒
+ * @param rate 播放速率
+ * @param now_us 当前时间
+ */
+double VsyncPacer::VblankClock(double clock, double rate, int64_t now_us)
+{
+    if(next_vblank_us_ > now_us) {
+        clock += (next_vblank_us_ - now_us) / 1000000.0 * rate;
+    }
+    return clock;
+}
+
+/**
+ * @brief 选择这个vblank显示的帧
+ * @param queue 帧队列，换帧时新帧和跳过的帧出队
+ * @param time_base 帧的时间基准
+ * @param vblank_clock VblankClock的返回值
+ * @param rate 播放速率，倍速时一个vblank周期对应的媒体时长更长
+ * @return 要显示的新帧(由调用方释放)，NULL表示重复上一帧
+ */
+AVFrame *VsyncPacer::Select(AVFrameQueue *queue, AVRational time_base, double vblank_clock, double rate)
+{
+    AVFrame *front = queue->Front();
+    if(!front) {
+        record(NULL, 0);
+        return NULL;
+    }
+    // 一个vblank周期对应的媒体时长，倍速时更长
+    double vblank_media = rate / refresh_hz_;
+    double next_pts = front->pts * av_q2d(time_base);
+    double span = 0;
+    bool due = false;
+    if(frame_vblanks_ == 0) {
+        // 第一帧(或seek后)在离它的时间戳最近的vblank显示
+        due = next_pts <= vblank_clock + vblank_media / 2;
+    } else {
+        // 当前帧应该显示的vblank数，加上一帧的余数，24p在60Hz上为2.5、2.0交替取整成3、2
+        span = (next_pts - shown_pts_) / vblank_media + carry_;
+        due = frame_vblanks_ >= (int)floor(span + 0.5 + 1e-3);
+        double drift = (vblank_clock - next_pts) / vblank_media;
+        if(drift > VSYNC_MAX_DRIFT_VBLANKS && !due) {
+            due = true;          // 时钟走得比帧快，提前换帧
+            corrected_ = true;
+        } else if(drift < -VSYNC_MAX_DRIFT_VBLANKS && due) {
+            due = false;         // 时钟走得比帧慢，多重复一次
+            corrected_ = true;
+        }
+    }
+    if(!due) {
+        record(NULL, 0);
+        return NULL;
+    }
+    if(frame_vblanks_ == 0 || corrected_) {
+        carry_ = 0;
+    } else {
+        carry_ = av_clipd(span - frame_vblanks_, -1, 1);
+    }
+    corrected_ = false;
+    AVFrame *frame = queue->Pop(0);
+    // 后面的帧也已经落后时钟超过修正范围，跳过前面的帧只显示最后一帧
+    int skipped = 0;
+    while(true) {
+        front = queue->Front();
+        if(!front || (vblank_clock - front->pts * av_q2d(time_base)) / vblank_media <= VSYNC_MAX_DRIFT_VBLANKS) {
+            break;
+        }
+        if(stats_) {
+            stats_->recorder.Record(FLIGHT_FRAME_DROPPED, FLIGHT_STREAM_VIDEO, frame->pts,
+                                    frame->pts * av_q2d(time_base) - vblank_clock);
+        }
+        av_frame_free(&frame);
+        frame = queue->Pop(0);
+        skipped++;
+        carry_ = 0;
+    }
+    shown_pts_ = frame->pts * av_q2d(time_base);
+    record(frame, skipped);
+    return frame;
+}
+
+/**
+ * @brief 经过了一次vblank：真实vsync在呈现返回时调用，模拟的vblank在到点处理完后调用
+ * @param now_us 当前时间
+ */
+void VsyncPacer::OnVblank(int64_t now_us)
+{
+    // 第一次、真实vsync、或者停顿过(暂停、卡顿)超过一个周期时从现在重新对齐
+    if(!simulated_ || next_vblank_us_ == 0 || now_us - next_vblank_us_ >= period_us_) {
+        next_vblank_us_ = now_us + period_us_;
+        return;
+    }
+    // 模拟的vblank按固定网格走，不随调度延迟漂移
+    next_vblank_us_ += period_us_;
+}
+
+/**
+ * @brief seek后重新开始计数，节奏统计不跨越seek
+ */
+void VsyncPacer::Reset()
+{
+    next_vblank_us_ = 0;
+    frame_vblanks_ = 0;
+    carry_ = 0;
+    corrected_ = false;
+}
+
+/**
+ * @brief 记录一次vblank上的决定
+ * @param frame 新显示的帧，NULL表示重复
+ * @param skipped 跳过的帧数
+ */
+void VsyncPacer::record(AVFrame *frame, int skipped)
+{
+    if(frame) {
+        // 上一帧显示完，把它显示的vblank数追加到节奏里
+        if(frame_vblanks_ > 0) {
+            int digit = frame_vblanks_ < 9 ? frame_vblanks_ : 9;
+            int64_t modulo = 1;
+            for(int i = 0; i < VSYNC_CADENCE_FRAMES; i++) {
+                modulo *= 10;
+            }
+            cadence_ = (cadence_ * 10 + digit) % modulo;
+        }
+        frame_vblanks_ = 1;
+    } else if(frame_vblanks_ > 0) {
+        frame_vblanks_++;
+    }
+    if(!stats_) {
+        return;
+    }
+    stats_->vsync_vblanks.Add(1);
+    if(frame) {
+        stats_->vsync_skips.Add(skipped);
+        stats_->vsync_cadence.Set(cadence_);
+    } else if(frame_vblanks_ > 0) {
+        stats_->vsync_repeats.Add(1);
+    }
+    stats_->recorder.Record(FLIGHT_VBLANK, FLIGHT_STREAM_VIDEO, frame ? frame->pts : AV_NOPTS_VALUE,
+                            frame ? 1 : 0, skipped);
+}
@@ -0,0 +1,50 @@
+﻿#ifndef VSYNCPACER_H
+#define VSYNCPACER_H
+#include "avframequeue.h"
+#include "stats.h"
+
+// 查询不到显示器刷新率时使用
+#define VSYNC_DEFAULT_REFRESH_HZ 60
+// 下一帧偏离播放时钟超过这么多个vblank时不再按时长分配，提前换帧或继续重复，用于跟上时钟漂移
+#define VSYNC_MAX_DRIFT_VBLANKS 1.0
+// vsync_cadence保留的帧数，每帧一个十进制位
+#define VSYNC_CADENCE_FRAMES 8
+
+/**
+ * 按vblank选择显示的帧：每个vblank只做一次决定，换新帧或重复上一帧，每次决定写入飞行记录(FLIGHT_VBLANK)和统计。
+ *
+ * 每帧显示的vblank数按和下一帧的时间戳差分配，取整的余数带到下一帧(误差扩散)，
+ * 24p在60Hz上为3、2交替，不受时钟抖动影响；下一帧偏离时钟超过VSYNC_MAX_DRIFT_VBLANKS时才按时钟修正，
+ * 落后太多的帧跳过
+ *
+ * vblank来自渲染器的垂直同步(SDL_RenderPresent阻塞到vblank)，或者按刷新率模拟的时间网格；
+ * 模拟的vblank用于无窗口模式和不支持垂直同步的渲染器。只在刷新线程使用，Reset由调用方和刷新互斥
+ */
+class VsyncPacer
+{
+public:
+    void Init(double refresh_hz, bool simulated, PipelineStats *stats);
+    bool Enabled();
+    bool Simulated();
+    double RefreshRate();
+    double UntilVblank(int64_t now_us);
+    double VblankClock(double clock, double rate, int64_t now_us);
+    AVFrame *Select(AVFrameQueue *queue, AVRational time_base, double vblank_clock, double rate);
+    void OnVblank(int64_t now_us);
+    void Reset();
+private:
+    void record(AVFrame *frame, int skipped);
+
+    double refresh_hz_ = 0;        // 0表示没有开启
+    bool simulated_ = false;
+    int64_t period_us_ = 0;
+    int64_t next_vblank_us_ = 0;   // 预计的下一次vblank，0表示还没有经过vblank
+    int frame_vblanks_ = 0;        // 正在显示的帧已经显示了几个vblank，0表示还没有显示过帧
+    double shown_pts_ = 0;         // 正在显示的帧的时间戳，单位秒
+    double carry_ = 0;             // 上一帧分配的vblank数取整后的余数
+    bool corrected_ = false;       // 正在显示的帧按时钟修正过，换帧时不带余数
+    int64_t cadence_ = 0;
+    PipelineStats *stats_ = NULL;
+};
+
+#endif // VSYNCPACER_H
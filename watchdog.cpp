@@ -0,0 +1,250 @@
+﻿#include "watchdog.h"
+#include "log.h"
+#include <stdio.h>
+
+/**
+ * @brief 获取卡顿原因的名字
+ */
+const char *StallCauseName(int cause)
+{
+    switch(cause) {
+        case STALL_DEMUX_IO:
+            return "demux_io";
+        case STALL_DEMUX_STARVED:
+            return "demux_starved";
+        case STALL_DECODE:
+            return "decode";
+        case STALL_QUEUE_STARVATION:
+            return "queue_starvation";
+        case STALL_OUTPUT:
+            return "output";
+        default:
+            return "none";
+    }
+}
+
+/**
+ * @brief 输出单行json，便于日志采集
+ */
+std::string StallEvent::ToJson() const
+{
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             "{\"event\":\"stall\",\"cause\":\"%s\",\"stage\":\"%s\",\"busy_call\":\"%s\","
+             "\"stalled_ms\":%lld,\"busy_ms\":%lld,\"position_ms\":%lld,"
+             "\"audio_packets\":%lld,\"video_packets\":%lld,\"audio_frames\":%lld,\"video_frames\":%lld}",
+             StallCauseName(cause), PipelineStageName(stage), busy_call ? busy_call : "",
+             (long long)(stalled_us / 1000), (long long)(busy_us / 1000),
+             (long long)(position_us == INT64_MIN ? -1 : position_us / 1000),
+             (long long)audio_packets, (long long)video_packets,
+             (long long)audio_frames, (long long)video_frames);
+    return buf;
+}
+
+/**
+ * @brief 构造函数
+ * @param stats 管线统计对象，心跳和队列深度从这里读取
+ */
+Watchdog::Watchdog(PipelineStats *stats):
+    stats_(stats)
+{
+    SetOptions(ThreadOptions("watchdog"));
+}
+
+Watchdog::~Watchdog()
+{
+    Stop();
+}
+
+/**
+ * @brief 初始化
+ * @param stall_threshold_ms 播放位置超过该时间不前进视为卡顿
+ * @return 成功返回0，失败返回负值
+ */
+int Watchdog::Init(int stall_threshold_ms)
+{
+    if(!stats_) {
+        LOG_ERROR("%s(%d) stats is null\n", __FUNCTION__, __LINE__);
+        return -1;
+    }
+    if(stall_threshold_ms > 0) {
+        threshold_us_ = stall_threshold_ms * 1000LL;
+    }
+    return 0;
+}
+
+int Watchdog::Start()
+{
+    last_advance_us_ = PipelineStats::NowMicroseconds();
+    return Thread::Start();
+}
+
+/**
+ * @brief 设置卡顿回调，在Watchdog线程中调用
+ */
+void Watchdog::SetStallCallback(std::function<void(const StallEvent &)> callback)
+{
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    callback_ = callback;
+}
+
+/**
+ * @brief 设置播放结束回调，读到文件结尾且队列都取空后调用一次，seek后重新布防，在Watchdog线程中调用
+ */
+void Watchdog::SetEndCallback(std::function<void()> callback)
+{
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    end_callback_ = callback;
+}
+
+/**
+ * @brief 暂停期间播放位置本来就不前进，不做卡顿检测，采样线程一直等到恢复
+ */
+void Watchdog::SetPaused(bool paused)
+{
+    paused_ = paused;
+    if(!paused) {
+        wakeUp();
+    }
+}
+
+/**
+ * @brief 采样线程主函数，每100ms检查一次，暂停时不定时唤醒
+ */
+void Watchdog::Run()
+{
+    while(true) {
+        if(paused_) {
+            if(!waitFor(-1)) {
+                break;
+            }
+            // 暂停期间位置不前进，从恢复时重新计时
+            last_advance_us_ = PipelineStats::NowMicroseconds();
+            continue;
+        }
+        if(!waitFor(100)) {
+            break;
+        }
+        check();
+    }
+}
+
+/**
+ * @brief 检查播放位置是否前进，卡住超过阈值时上报一次
+ */
+void Watchdog::check()
+{
+    int64_t now = PipelineStats::NowMicroseconds();
+    if(paused_) {
+        last_advance_us_ = now;
+        return;
+    }
+    int64_t audio_pts = stats_->heartbeats[STAGE_AUDIO_OUTPUT].PtsUs();
+    int64_t video_pts = stats_->heartbeats[STAGE_VIDEO_OUTPUT].PtsUs();
+    int64_t position = audio_pts > video_pts ? audio_pts : video_pts;
+    if(!stats_->heartbeats[STAGE_DEMUX].Eof()) {
+        ended_ = false;
+    }
+    if(position != last_position_us_) {
+        if(reported_) {
+            LOG_INFO("stall recovered after %lld ms\n", (long long)((now - last_advance_us_) / 1000));
+        }
+        last_position_us_ = position;
+        last_advance_us_ = now;
+        reported_ = false;
+        return;
+    }
+    // 读到文件结尾并且队列都已取空，是正常播放结束
+    if(stats_->heartbeats[STAGE_DEMUX].Eof()
+            && stats_->audio_packet_depth.Get() == 0 && stats_->video_packet_depth.Get() == 0
+            && stats_->audio_frame_depth.Get() == 0 && stats_->video_frame_depth.Get() == 0) {
+        last_advance_us_ = now;
+        if(!ended_) {
+            ended_ = true;
+            LOG_INFO("end of stream\n");
+            std::lock_guard<std::mutex> lock(callback_mutex_);
+            if(end_callback_) {
+                end_callback_();
+            }
+        }
+        return;
+    }
+    int64_t stalled_us = now - last_advance_us_;
+    if(reported_ || stalled_us < threshold_us_) {
+        return;
+    }
+    reported_ = true;
+    StallEvent event = Diagnose(stalled_us);
+    stats_->stalls.Add(1);
+    LOG_WARN("%s\n", event.ToJson().c_str());
+    stats_->recorder.Record(FLIGHT_STALL, FLIGHT_STREAM_NONE, event.position_us, event.cause, event.stage);
+    stats_->recorder.Trigger("stall");
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    if(callback_) {
+        callback_(event);
+    }
+}
+
+/**
+ * @brief 根据心跳和队列深度判断卡在哪个阶段
+ * @param stalled_us 播放位置已经多久没有前进
+ * @return 卡顿事件
+ *
+ * 先看是否有阶段卡在阻塞调用里(I/O或解码)，再沿音频(主时钟)、视频两条链从输出往上游找第一个空的队列
+ */
+StallEvent Watchdog::Diagnose(int64_t stalled_us)
+{
+    StallEvent event;
+    int64_t now = PipelineStats::NowMicroseconds();
+    event.time_us = now;
+    event.stalled_us = stalled_us;
+    event.position_us = last_position_us_;
+    event.audio_packets = stats_->audio_packet_depth.Get();
+    event.video_packets = stats_->video_packet_depth.Get();
+    event.audio_frames = stats_->audio_frame_depth.Get();
+    event.video_frames = stats_->video_frame_depth.Get();
+
+    // 1. 阻塞在某个调用里超过阈值的一半
+    const int busy_stages[] = {STAGE_DEMUX, STAGE_AUDIO_DECODE, STAGE_VIDEO_DECODE};
+    for(int stage : busy_stages) {
+        StageHeartbeat &hb = stats_->heartbeats[stage];
+        int64_t busy_since = hb.BusySinceUs();
+        if(busy_since > 0 && now - busy_since > threshold_us_ / 2) {
+            event.cause = stage == STAGE_DEMUX ? STALL_DEMUX_IO : STALL_DECODE;
+            event.stage = stage;
+            event.busy_call = hb.BusyCall();
+            event.busy_us = now - busy_since;
+            return event;
+        }
+    }
+
+    // 2. 沿音频、视频链找第一个空队列
+    const int64_t frames[2] = {event.audio_frames, event.video_frames};
+    const int64_t packets[2] = {event.audio_packets, event.video_packets};
+    const int decode_stages[2] = {STAGE_AUDIO_DECODE, STAGE_VIDEO_DECODE};
+    for(int i = 0; i < 2; i++) {
+        if(frames[i] > 0) {
+            continue;
+        }
+        if(packets[i] > 0) {
+            event.cause = STALL_DECODE;
+            event.stage = decode_stages[i];
+        } else if(stats_->heartbeats[STAGE_DEMUX].Throttled()) {
+            event.cause = STALL_QUEUE_STARVATION;
+            event.stage = STAGE_DEMUX;
+        } else {
+            event.cause = STALL_DEMUX_STARVED;
+            event.stage = STAGE_DEMUX;
+        }
+        return event;
+    }
+
+    // 3. 帧都在队列里，输出端没有消费；音频回调长时间没来说明音频设备停了
+    event.cause = STALL_OUTPUT;
+    if(now - stats_->heartbeats[STAGE_AUDIO_OUTPUT].BeatUs() > threshold_us_ / 2) {
+        event.stage = STAGE_AUDIO_OUTPUT;
+    } else {
+        event.stage = STAGE_VIDEO_OUTPUT;
+    }
+    return event;
+}
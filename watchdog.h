@@ -0,0 +1,72 @@
+﻿#ifndef WATCHDOG_H
+#define WATCHDOG_H
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include "thread.h"
+#include "stats.h"
+
+// 卡顿原因
+enum StallCause {
+    STALL_NONE = 0,
+    STALL_DEMUX_IO,          // av_read_frame长时间不返回，一般是网络/NFS等I/O问题
+    STALL_DEMUX_STARVED,     // 解复用线程在跑但读不到数据
+    STALL_DECODE,            // 有数据包但解码器不出帧，一般是解码卡死或CPU不足
+    STALL_QUEUE_STARVATION,  // 某个流的队列空了，而解复用因另一个流的队列满在等待
+    STALL_OUTPUT             // 帧队列有数据但输出端不消费
+};
+
+const char *StallCauseName(int cause);
+
+struct StallEvent
+{
+    int64_t time_us = 0;
+    int cause = STALL_NONE;
+    int stage = STAGE_COUNT;           // 归因到的阶段
+    const char *busy_call = "";        // 该阶段正在执行的阻塞调用
+    int64_t stalled_us = 0;            // 播放位置已经多久没前进
+    int64_t position_us = 0;           // 卡住时的播放位置
+    int64_t busy_us = 0;               // 阻塞调用已经持续的时间
+    int64_t audio_packets = 0;
+    int64_t video_packets = 0;
+    int64_t audio_frames = 0;
+    int64_t video_frames = 0;
+
+    std::string ToJson() const;
+};
+
+/**
+ * 管线卡顿检测线程
+ *
+ * 定期采样各阶段心跳和队列深度，播放位置超过阈值没有前进时归因并上报一次，
+ * 恢复前进后重新布防
+ */
+class Watchdog : public Thread
+{
+public:
+    Watchdog(PipelineStats *stats);
+    ~Watchdog();
+    int Init(int stall_threshold_ms);
+    virtual int Start();
+    virtual void Run();
+    void SetStallCallback(std::function<void(const StallEvent &)> callback);
+    void SetEndCallback(std::function<void()> callback);
+    void SetPaused(bool paused);
+
+    StallEvent Diagnose(int64_t stalled_us);
+private:
+    void check();
+
+    PipelineStats *stats_ = NULL;
+    int64_t threshold_us_ = 1000000;
+    int64_t last_position_us_ = INT64_MIN;
+    int64_t last_advance_us_ = 0;
+    bool reported_ = false;
+    bool ended_ = false;
+    std::atomic<bool> paused_{false};
+    std::mutex callback_mutex_;
+    std::function<void(const StallEvent &)> callback_;
+    std::function<void()> end_callback_;
+};
+
+#endif // WATCHDOG_H